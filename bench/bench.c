@@ -0,0 +1,1120 @@
+/**
+ * @file bench.c
+ *
+ * The benchmark suite, built as the @c ckone_bench executable. It runs a
+ * corpus of CPU-bound TTK-91 programs several times and reports the
+ * number of instructions executed, the wall time of a run and its
+ * standard deviation, and the speed in millions of instructions per
+ * second (MIPS) of each program on each engine.
+ *
+ * The programs are assembled into the memory of the machine when the
+ * benchmark starts, so no files are read. The sample programs fiborek,
+ * hanoi, binrek, taulu and lista are scaled up: fiborek and hanoi get a
+ * larger input, and binrek, taulu and lista loop over many values instead
+ * of one or a few. The synthetic kernels exercise the ALU, the addressing
+ * modes and the calls one at a time. The input of KBD is given from memory.
+ * The output of CRT in the warm-up run is compared with the output the
+ * program should print, and in the measured runs it is written to
+ * @c /dev/null.
+ *
+ * The engines are the two ways the emulator runs a program: @c step calls
+ * cpu_step() until the machine halts, like the serve mode does, and @c run
+ * goes through ckone_run() with its per-instruction checks.
+ *
+ * Each program is run once to warm up before the measured runs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <argp.h>
+#include <math.h>
+#include "common.h"
+#include "cpu.h"
+#include "ext.h"
+#include "instr.h"
+#include "args.h"
+#include "config.h"
+#include "stats.h"
+
+
+extern bool ckone_init (s_ckone* kone);
+extern int ckone_run (s_ckone* kone);
+extern void ckone_free (s_ckone* kone);
+
+
+/**
+ * @internal
+ * The memory size of the machines, in words.
+ */
+#define BENCH_MEMORY_SIZE 65536
+
+/**
+ * @internal
+ * The address where the data of the programs starts. The code
+ * of each program fits below it.
+ */
+#define DATA 1024
+
+/**
+ * @internal
+ * The largest array used by the memory kernel.
+ */
+#define MAX_ARRAY 8192
+
+
+/**
+ * @internal
+ * A program in the corpus.
+ */
+typedef struct {
+    const char* name;               ///< The name of the program.
+    void (*build) (s_ckone*);       ///< Assembles the program into memory.
+    void (*input) (FILE*);          ///< Writes the input for KBD.
+    void (*output) (FILE*);         ///< Writes the expected output of CRT.
+} s_program;
+
+/**
+ * @internal
+ * An engine which runs a program until it halts.
+ */
+typedef struct {
+    const char* name;               ///< The name of the engine.
+    bool (*run) (s_ckone*);         ///< Runs the program; false on a fault.
+} s_engine;
+
+
+/**
+ * @internal
+ * The memory of the program being assembled.
+ */
+static int32_t* code;
+
+/**
+ * @internal
+ * The address of the next instruction to assemble.
+ */
+static int32_t here;
+
+
+/**
+ * @internal
+ * Assemble an instruction at the next address.
+ *
+ * @return The address of the instruction, for patch().
+ */
+static int32_t
+emit (
+        e_opcode opcode,            ///< The opcode.
+        e_register first_operand,   ///< The first operand.
+        e_addr_mode addr_mode,      ///< The addressing mode.
+        e_register index_reg,       ///< The index register, or R0.
+        int32_t addr                ///< The address or constant part.
+        )
+{
+    code[here] = make_instr (opcode, first_operand, addr_mode, index_reg, 0)
+               | (addr & 0xffff);
+    return here++;
+}
+
+
+/**
+ * @internal
+ * Make the instruction at the given address, a jump or a call
+ * assembled before its target, refer to the next address.
+ */
+static void
+patch (
+        int32_t at          ///< The address of the instruction.
+        )
+{
+    code[at] = (code[at] & ~0xffff) | (here & 0xffff);
+}
+
+
+/// @cond skip
+// the operand forms of the assembly language: =c, r, c(r) and @c(r);
+// STORE and the jumps take the address itself as their operand
+#define IMM(op, r, c)       emit (op, r, IMMEDIATE, R0, c)
+#define REG(op, r, i)       emit (op, r, IMMEDIATE, i, 0)
+#define MEM(op, r, c, i)    emit (op, r, DIRECT, i, c)
+#define IND(op, r, c, i)    emit (op, r, INDIRECT, i, c)
+#define ADDR(op, r, c, i)   emit (op, r, IMMEDIATE, i, c)
+#define JUMP_TO(op, r, c)   emit (op, r, IMMEDIATE, R0, c)
+#define HALT()              IMM (SVC, SP, 11)
+#define KBD 1
+#define CRT 0
+/// @endcond
+
+
+/**
+ * @internal
+ * Start assembling a program into the given machine.
+ */
+static void
+begin (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    code = kone->mem;
+    here = 0;
+}
+
+
+/**
+ * @internal
+ * Finish assembling a program, setting FP and SP to the end of the
+ * code and of the data like ckone_load() does.
+ */
+static void
+end (
+        s_ckone* kone,      ///< The machine.
+        int32_t data_size   ///< The number of words of data at ::DATA.
+        )
+{
+    kone->r[FP] = here - 1;
+    kone->r[SP] = DATA + data_size - 1;
+    kone->pc = 0;
+}
+
+
+/**
+ * @internal
+ * fiborek: compute a Fibonacci number with a recursive function.
+ */
+static void
+build_fiborek (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    const int32_t m = DATA;
+    begin (kone);
+    IMM (IN, R1, KBD);
+    ADDR (STORE, R1, m, R0);
+    IMM (PUSH, SP, 0);
+    MEM (PUSH, SP, m, R0);
+    int32_t call = JUMP_TO (CALL, SP, 0);
+    REG (POP, SP, R1);
+    IMM (OUT, R1, CRT);
+    HALT ();
+
+    int32_t f2 = here;
+    patch (call);
+    MEM (PUSHR, SP, 0, R0);
+    MEM (LOAD, R2, -2, FP);
+    IMM (COMP, R2, 1);
+    int32_t to_zero = JUMP_TO (JEQU, R0, 0);
+    IMM (COMP, R2, 2);
+    int32_t to_one = JUMP_TO (JEQU, R0, 0);
+    IMM (PUSH, SP, 0);
+    IMM (SUB, R2, 1);
+    REG (PUSH, SP, R2);
+    JUMP_TO (CALL, SP, f2);
+    REG (POP, SP, R3);
+    IMM (SUB, R2, 1);
+    IMM (PUSH, SP, 0);
+    REG (PUSH, SP, R2);
+    JUMP_TO (CALL, SP, f2);
+    REG (POP, SP, R4);
+    REG (ADD, R3, R4);
+    int32_t to_end1 = JUMP_TO (JUMP, R0, 0);
+    patch (to_zero);
+    IMM (LOAD, R3, 0);
+    int32_t to_end2 = JUMP_TO (JUMP, R0, 0);
+    patch (to_one);
+    IMM (LOAD, R3, 1);
+    patch (to_end1);
+    patch (to_end2);
+    ADDR (STORE, R3, -3, FP);
+    MEM (POPR, SP, 0, R0);
+    IMM (EXIT, SP, 1);
+    end (kone, 1);
+}
+
+
+/**
+ * @internal
+ * The input of fiborek.
+ */
+static void
+input_fiborek (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "22\n");
+}
+
+
+/**
+ * @internal
+ * The output of fiborek: the 22nd Fibonacci number, counting
+ * from 0.
+ */
+static void
+output_fiborek (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    int32_t a = 0, b = 1;
+    for (int i = 2; i < 22; i++) {
+        int32_t next = a + b;
+        a = b;
+        b = next;
+    }
+    fprintf (f, "%d\n", b);
+}
+
+
+/**
+ * @internal
+ * hanoi: print the moves which solve the towers of Hanoi.
+ */
+static void
+build_hanoi (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    const int32_t m = DATA;
+    const int32_t c = -2, b = -3, a = -4, n = -5;
+    begin (kone);
+    IMM (IN, R1, KBD);
+    ADDR (STORE, R1, m, R0);
+    REG (PUSH, SP, R1);
+    IMM (PUSH, SP, 1);
+    IMM (PUSH, SP, 2);
+    IMM (PUSH, SP, 3);
+    int32_t call = JUMP_TO (CALL, SP, 0);
+    HALT ();
+
+    int32_t siirra = here;
+    patch (call);
+    MEM (LOAD, R1, n, FP);
+    IMM (COMP, R1, 1);
+    int32_t to_more = JUMP_TO (JNEQU, R0, 0);
+    MEM (LOAD, R2, a, FP);
+    MEM (LOAD, R3, b, FP);
+    IMM (OUT, R2, CRT);
+    IMM (OUT, R3, CRT);
+    IMM (EXIT, SP, 4);
+    patch (to_more);
+    MEM (LOAD, R1, n, FP);
+    IMM (SUB, R1, 1);
+    REG (PUSH, SP, R1);
+    MEM (PUSH, SP, a, FP);
+    MEM (PUSH, SP, c, FP);
+    MEM (PUSH, SP, b, FP);
+    JUMP_TO (CALL, SP, siirra);
+    MEM (LOAD, R2, a, FP);
+    MEM (LOAD, R3, b, FP);
+    IMM (OUT, R2, CRT);
+    IMM (OUT, R3, CRT);
+    MEM (LOAD, R1, n, FP);
+    IMM (SUB, R1, 1);
+    REG (PUSH, SP, R1);
+    MEM (PUSH, SP, c, FP);
+    MEM (PUSH, SP, b, FP);
+    MEM (PUSH, SP, a, FP);
+    JUMP_TO (CALL, SP, siirra);
+    IMM (EXIT, SP, 4);
+    end (kone, 1);
+}
+
+
+/**
+ * @internal
+ * The input of hanoi.
+ */
+static void
+input_hanoi (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "14\n");
+}
+
+
+/**
+ * @internal
+ * Write the moves of @p n discs from @p a to @p b through @p c.
+ */
+static void
+moves_hanoi (
+        FILE* f,            ///< Where to write the moves.
+        int n,              ///< The number of discs.
+        int a,              ///< The peg to move from.
+        int b,              ///< The peg to move to.
+        int c               ///< The third peg.
+        )
+{
+    if (n > 1)
+        moves_hanoi (f, n - 1, a, c, b);
+    fprintf (f, "%d\n%d\n", a, b);
+    if (n > 1)
+        moves_hanoi (f, n - 1, c, b, a);
+}
+
+
+/**
+ * @internal
+ * The output of hanoi: the pegs of each move.
+ */
+static void
+output_hanoi (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    moves_hanoi (f, 14, 1, 2, 3);
+}
+
+
+/**
+ * @internal
+ * binrek: print the numbers from 1 to N in binary with a
+ * recursive function.
+ */
+static void
+build_binrek (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    begin (kone);
+    IMM (IN, R5, KBD);
+    IMM (LOAD, R4, 1);
+    int32_t loop = here;
+    REG (COMP, R4, R5);
+    int32_t to_done = JUMP_TO (JGRE, R0, 0);
+    REG (PUSH, SP, R4);
+    int32_t call = JUMP_TO (CALL, SP, 0);
+    IMM (ADD, R4, 1);
+    JUMP_TO (JUMP, R0, loop);
+    patch (to_done);
+    HALT ();
+
+    int32_t bin = here;
+    patch (call);
+    MEM (PUSHR, SP, 0, R0);
+    MEM (LOAD, R1, -2, FP);
+    int32_t to_pura = JUMP_TO (JZER, R1, 0);
+    REG (LOAD, R2, R1);
+    IMM (DIV, R2, 2);
+    REG (PUSH, SP, R2);
+    JUMP_TO (CALL, SP, bin);
+    IMM (MOD, R1, 2);
+    IMM (OUT, R1, CRT);
+    patch (to_pura);
+    MEM (POPR, SP, 0, R0);
+    IMM (EXIT, SP, 1);
+    end (kone, 0);
+}
+
+
+/**
+ * @internal
+ * The input of binrek.
+ */
+static void
+input_binrek (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "6000\n");
+}
+
+
+/**
+ * @internal
+ * The output of binrek: the binary digits of each number,
+ * the most significant first.
+ */
+static void
+output_binrek (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    for (int i = 1; i <= 6000; i++) {
+        int bit = 1;
+        while (bit * 2 <= i)
+            bit *= 2;
+        for (; bit; bit /= 2)
+            fprintf (f, "%d\n", !!(i & bit));
+    }
+}
+
+
+/**
+ * @internal
+ * taulu: read N numbers into an array, and sum the array
+ * a given number of times.
+ */
+static void
+build_taulu (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    const int32_t a = DATA;
+    begin (kone);
+    IMM (LOAD, R2, 0);
+    IMM (IN, R3, KBD);
+    int32_t read = here;
+    REG (COMP, R2, R3);
+    int32_t to_sum = JUMP_TO (JNLES, R0, 0);
+    IMM (IN, R1, KBD);
+    ADDR (STORE, R1, a, R2);
+    IMM (ADD, R2, 1);
+    JUMP_TO (JUMP, R0, read);
+    patch (to_sum);
+    IMM (IN, R5, KBD);
+    int32_t round = here;
+    IMM (LOAD, R1, 0);
+    IMM (LOAD, R2, 0);
+    int32_t loop = here;
+    REG (COMP, R1, R3);
+    int32_t to_print = JUMP_TO (JNLES, R0, 0);
+    MEM (ADD, R2, a, R1);
+    IMM (ADD, R1, 1);
+    JUMP_TO (JUMP, R0, loop);
+    patch (to_print);
+    IMM (OUT, R2, CRT);
+    IMM (SUB, R5, 1);
+    JUMP_TO (JPOS, R5, round);
+    HALT ();
+    end (kone, MAX_ARRAY);
+}
+
+
+/**
+ * @internal
+ * The input of taulu: the size of the array, the values and
+ * the number of rounds.
+ */
+static void
+input_taulu (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "5000\n");
+    for (int i = 0; i < 5000; i++)
+        fprintf (f, "%d\n", (i * 37) % 1001 - 500);
+    fprintf (f, "60\n");
+}
+
+
+/**
+ * @internal
+ * The output of taulu: the sum of the array on each round.
+ */
+static void
+output_taulu (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    int32_t sum = 0;
+    for (int i = 0; i < 5000; i++)
+        sum += (i * 37) % 1001 - 500;
+    for (int i = 0; i < 60; i++)
+        fprintf (f, "%d\n", sum);
+}
+
+
+/**
+ * @internal
+ * lista: build a linked list of N nodes, and sum the values in
+ * it a given number of times.
+ */
+static void
+build_lista (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    begin (kone);
+    IMM (IN, R3, KBD);
+    IMM (LOAD, R1, DATA);
+    IMM (LOAD, R2, 0);
+    int32_t build = here;
+    IMM (ADD, R2, 1);
+    ADDR (STORE, R2, 0, R1);
+    REG (LOAD, R4, R1);
+    IMM (ADD, R4, 2);
+    ADDR (STORE, R4, 1, R1);
+    REG (LOAD, R1, R4);
+    REG (COMP, R2, R3);
+    JUMP_TO (JLES, R0, build);
+    IMM (LOAD, R4, -1);
+    ADDR (STORE, R4, -1, R1);
+    IMM (IN, R5, KBD);
+    int32_t round = here;
+    IMM (LOAD, R1, DATA);
+    IMM (LOAD, R2, 0);
+    int32_t loop = here;
+    MEM (ADD, R2, 0, R1);
+    IMM (ADD, R1, 1);
+    MEM (LOAD, R1, 0, R1);
+    JUMP_TO (JNNEG, R1, loop);
+    IMM (OUT, R2, CRT);
+    IMM (SUB, R5, 1);
+    JUMP_TO (JPOS, R5, round);
+    HALT ();
+    end (kone, 2 * MAX_ARRAY);
+}
+
+
+/**
+ * @internal
+ * The input of lista: the number of nodes and of rounds.
+ */
+static void
+input_lista (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "5000\n60\n");
+}
+
+
+/**
+ * @internal
+ * The output of lista: the sum of the values 1 to N on each round.
+ */
+static void
+output_lista (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    for (int i = 0; i < 60; i++)
+        fprintf (f, "%d\n", 5000 * 5001 / 2);
+}
+
+
+/**
+ * @internal
+ * alu: a loop of arithmetic and logic operations on registers.
+ */
+static void
+build_alu (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    begin (kone);
+    IMM (IN, R5, KBD);
+    IMM (LOAD, R1, 1);
+    IMM (LOAD, R2, 0);
+    int32_t loop = here;
+    IMM (MUL, R1, 75);
+    IMM (ADD, R1, 74);
+    IMM (AND, R1, 32767);
+    REG (XOR, R2, R1);
+    IMM (SHL, R2, 3);
+    IMM (OR, R2, 1);
+    IMM (SHRA, R2, 2);
+    IMM (NOT, R2, 0);
+    IMM (AND, R2, 32767);
+    REG (LOAD, R3, R2);
+    IMM (DIV, R3, 7);
+    REG (SUB, R2, R3);
+    IMM (SUB, R5, 1);
+    JUMP_TO (JPOS, R5, loop);
+    IMM (OUT, R2, CRT);
+    HALT ();
+    end (kone, 0);
+}
+
+
+/**
+ * @internal
+ * The input of alu: the number of iterations.
+ */
+static void
+input_alu (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "100000\n");
+}
+
+
+/**
+ * @internal
+ * The output of alu: the last value of R2.
+ */
+static void
+output_alu (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    int32_t r1 = 1, r2 = 0;
+    for (int i = 0; i < 100000; i++) {
+        r1 = (r1 * 75 + 74) & 32767;
+        r2 ^= r1;
+        r2 = (r2 << 3 | 1) >> 2;
+        r2 = ~r2 & 32767;
+        r2 -= r2 / 7;
+    }
+    fprintf (f, "%d\n", r2);
+}
+
+
+/**
+ * @internal
+ * memory: copy an array through a table of pointers, using the
+ * indexed, direct and indirect addressing modes.
+ */
+static void
+build_memory (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    const int32_t a = DATA, p = DATA + MAX_ARRAY, b = DATA + 2 * MAX_ARRAY;
+    begin (kone);
+    IMM (IN, R3, KBD);
+    IMM (IN, R5, KBD);
+    IMM (LOAD, R1, 0);
+    int32_t fill = here;
+    ADDR (STORE, R1, a, R1);
+    REG (LOAD, R2, R3);
+    REG (SUB, R2, R1);
+    IMM (ADD, R2, a - 1);
+    ADDR (STORE, R2, p, R1);
+    IMM (ADD, R1, 1);
+    REG (COMP, R1, R3);
+    JUMP_TO (JLES, R0, fill);
+    int32_t round = here;
+    IMM (LOAD, R1, 0);
+    IMM (LOAD, R4, 0);
+    int32_t copy = here;
+    IND (LOAD, R2, p, R1);
+    ADDR (STORE, R2, b, R1);
+    MEM (ADD, R4, b, R1);
+    IMM (ADD, R1, 1);
+    REG (COMP, R1, R3);
+    JUMP_TO (JLES, R0, copy);
+    IMM (SUB, R5, 1);
+    JUMP_TO (JPOS, R5, round);
+    IMM (OUT, R4, CRT);
+    HALT ();
+    end (kone, 3 * MAX_ARRAY);
+}
+
+
+/**
+ * @internal
+ * The input of memory: the size of the array and the number of rounds.
+ */
+static void
+input_memory (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "4096\n60\n");
+}
+
+
+/**
+ * @internal
+ * The output of memory: the sum of the copied array.
+ */
+static void
+output_memory (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    fprintf (f, "%d\n", 4095 * 4096 / 2);
+}
+
+
+/**
+ * @internal
+ * calls: call a small function which saves and restores
+ * the registers.
+ */
+static void
+build_calls (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    begin (kone);
+    IMM (IN, R5, KBD);
+    IMM (LOAD, R1, 0);
+    int32_t loop = here;
+    IMM (PUSH, SP, 0);
+    REG (PUSH, SP, R1);
+    int32_t call = JUMP_TO (CALL, SP, 0);
+    REG (POP, SP, R1);
+    IMM (SUB, R5, 1);
+    JUMP_TO (JPOS, R5, loop);
+    IMM (OUT, R1, CRT);
+    HALT ();
+
+    patch (call);
+    MEM (PUSHR, SP, 0, R0);
+    MEM (LOAD, R2, -2, FP);
+    IMM (ADD, R2, 1);
+    IMM (AND, R2, 32767);
+    ADDR (STORE, R2, -3, FP);
+    MEM (POPR, SP, 0, R0);
+    IMM (EXIT, SP, 1);
+    end (kone, 0);
+}
+
+
+/**
+ * @internal
+ * The input of calls: the number of calls.
+ */
+static void
+input_calls (
+        FILE* f             ///< Where to write the input.
+        )
+{
+    fprintf (f, "70000\n");
+}
+
+
+/**
+ * @internal
+ * The output of calls: the counter, which wraps at 32768.
+ */
+static void
+output_calls (
+        FILE* f             ///< Where to write the output.
+        )
+{
+    fprintf (f, "%d\n", 70000 % 32768);
+}
+
+
+/**
+ * @internal
+ * The programs in the corpus.
+ */
+static const s_program programs[] = {
+    { "fiborek",    build_fiborek,  input_fiborek,  output_fiborek },
+    { "hanoi",      build_hanoi,    input_hanoi,    output_hanoi },
+    { "binrek",     build_binrek,   input_binrek,   output_binrek },
+    { "taulu",      build_taulu,    input_taulu,    output_taulu },
+    { "lista",      build_lista,    input_lista,    output_lista },
+    { "alu",        build_alu,      input_alu,      output_alu },
+    { "memory",     build_memory,   input_memory,   output_memory },
+    { "calls",      build_calls,    input_calls,    output_calls },
+};
+
+
+/**
+ * @internal
+ * Run a program with cpu_step() until it halts.
+ *
+ * @return False if the program stopped on a fault.
+ */
+static bool
+engine_step (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    while (!kone->halted)
+        if (!cpu_step (kone))
+            return false;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Run a program with ckone_run().
+ *
+ * @return False if the program stopped on a fault.
+ */
+static bool
+engine_run (
+        s_ckone* kone       ///< The machine.
+        )
+{
+    return ckone_run (kone) == EXIT_SUCCESS;
+}
+
+
+/**
+ * @internal
+ * The engines.
+ */
+static const s_engine engines[] = {
+    { "step",   engine_step },
+    { "run",    engine_run },
+};
+
+
+/**
+ * @internal
+ * The command line options of the benchmark.
+ */
+static struct {
+    int runs;               ///< The number of measured runs.
+    char** names;           ///< The programs to run, or NULL for all.
+    int name_count;         ///< The number of entries in names.
+    const char* engine;     ///< The engine to use, or NULL for all.
+} options;
+
+
+/// @cond skip
+const char* argp_program_version = "ckone_bench " VERSION;
+
+static char doc[] =
+"ckone_bench -- the ckone benchmark suite\v"
+"Runs the programs given, or all of them: fiborek, hanoi, binrek, taulu, lista,\n"
+"alu, memory and calls. The times are the mean and the standard deviation of\n"
+"the measured runs, and MIPS is computed from the mean.\n";
+
+static char args_doc[] = "[PROGRAM...]";
+
+static struct argp_option argp_options[] = {
+    { "runs",           'n',    "N",        0,
+        "Measure N runs of each program (default: 5)", 0 },
+
+    { "engine",         'e',    "ENGINE",   0,
+        "Only use ENGINE (step or run)", 0 },
+
+    { 0, 0, 0, 0, 0, 0 }    // end of table
+};
+/// @endcond
+
+
+/**
+ * @internal
+ * Parse one command line option. See the argp documentation.
+ *
+ * @return 0 on success, ARGP_ERR_UNKNOWN if the option is unknown.
+ */
+static error_t
+parse_opt (
+        int key,                    ///< The option key.
+        char* arg,                  ///< The option argument.
+        struct argp_state* state    ///< The parser state.
+        )
+{
+    switch (key) {
+        case 'n':
+            options.runs = atoi (arg);
+            if (options.runs < 1)
+                argp_error (state, "the number of runs must be positive");
+            break;
+        case 'e':
+            options.engine = arg;
+            for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+                if (!strcmp (arg, engines[e].name))
+                    return 0;
+            argp_error (state, "unknown engine %s", arg);
+            break;
+        case ARGP_KEY_ARGS:
+            options.names = state->argv + state->next;
+            options.name_count = state->argc - state->next;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/// @cond skip
+static struct argp argp = { argp_options, parse_opt, args_doc, doc, 0, 0, 0 };
+/// @endcond
+
+
+/**
+ * @internal
+ * Check whether a name was selected on the command line.
+ *
+ * @return True if the name was given, or if no names were given.
+ */
+static bool
+selected (
+        const char* name    ///< The program name.
+        )
+{
+    if (!options.names)
+        return true;
+    for (int i = 0; i < options.name_count; i++)
+        if (!strcmp (options.names[i], name))
+            return true;
+    return false;
+}
+
+
+/**
+ * @internal
+ * Run a program once on an engine.
+ *
+ * @return The wall time of the run in seconds, or a negative
+ *         value if the program stopped on a fault.
+ */
+static double
+run_once (
+        const s_ckone* image,   ///< The machine with the program loaded.
+        s_ckone* kone,          ///< The machine to run, with its own memory.
+        const s_engine* engine, ///< The engine.
+        char* input,            ///< The input for KBD.
+        size_t input_size,      ///< The size of the input.
+        FILE* crt               ///< The file for CRT.
+        )
+{
+    int32_t* mem = kone->mem;
+    *kone = *image;
+    kone->mem = mem;
+    memcpy (mem, image->mem, image->mem_size * sizeof(int32_t));
+
+    FILE* kbd = fmemopen (input, input_size, "r");
+    if (!kbd)
+        return -1;
+    ext_init_devices ();
+    ext_attach_console (kbd, crt);
+
+    double start = stats_now ();
+    bool ok = engine->run (kone);
+    double time = stats_now () - start;
+
+    ext_close_devices ();
+    fclose (kbd);
+    return ok? time : -1;
+}
+
+
+/**
+ * @internal
+ * Benchmark a program on each selected engine and print the results.
+ *
+ * @return False if the program could not be run.
+ */
+static bool
+bench_program (
+        const s_program* program,   ///< The program.
+        FILE* crt,                  ///< The file for CRT.
+        double* log_mips,           ///< The sums of the logarithms of the
+                                    ///< MIPS of each engine.
+        int* counts                 ///< The numbers of programs added to
+                                    ///< log_mips.
+        )
+{
+    s_ckone image, kone;
+    if (!ckone_init (&image) || !ckone_init (&kone))
+        return false;
+    program->build (&image);
+
+    char* input = NULL;
+    size_t input_size = 0;
+    FILE* f = open_memstream (&input, &input_size);
+    if (!f)
+        return false;
+    program->input (f);
+    fclose (f);
+
+    char* expected = NULL;
+    size_t expected_size = 0;
+    f = open_memstream (&expected, &expected_size);
+    if (!f) {
+        free (input);
+        return false;
+    }
+    program->output (f);
+    fclose (f);
+
+    bool ok = true;
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]) && ok; e++) {
+        const s_engine* engine = &engines[e];
+        if (options.engine && strcmp (options.engine, engine->name))
+            continue;
+
+        s_stats time;
+        stats_init (&time);
+        for (int run = -1; run < options.runs && ok; run++) {
+            // the output of the warm-up run is checked
+            char* output = NULL;
+            size_t output_size = 0;
+            FILE* out = run < 0? open_memstream (&output, &output_size) : crt;
+            double t = out? run_once (&image, &kone, engine, input, input_size, out) : -1;
+            if (out && run < 0)
+                fclose (out);
+
+            if (t < 0) {
+                ELOG ("%s stopped on a fault with %s\n", program->name, engine->name);
+                ok = false;
+            } else if (run < 0 && (output_size != expected_size
+                        || memcmp (output, expected, expected_size))) {
+                ELOG ("%s printed the wrong output with %s\n", program->name, engine->name);
+                ok = false;
+            } else if (run >= 0)
+                stats_add (&time, t);
+            free (output);
+        }
+        if (!ok)
+            break;
+
+        double mips = kone.instr_count / time.mean / 1e6;
+        printf ("%-10s %-6s %12llu %10.2f %9.2f %6.1f%% %9.2f\n",
+                program->name, engine->name, (unsigned long long) kone.instr_count,
+                time.mean * 1e3, stats_stddev (&time) * 1e3,
+                100 * stats_stddev (&time) / time.mean, mips);
+        fflush (stdout);
+        log_mips[e] += log (mips);
+        counts[e]++;
+    }
+
+    free (expected);
+    free (input);
+    ckone_free (&kone);
+    ckone_free (&image);
+    return ok;
+}
+
+
+/**
+ * The entry point of the benchmark.
+ *
+ * @return EXIT_SUCCESS if every program ran to the end.
+ */
+int
+main (
+        int argc,       ///< The number of command line arguments.
+        char** argv     ///< The command line arguments.
+        )
+{
+    options.runs = 5;
+    argp_parse (&argp, argc, argv, 0, 0, 0);
+
+    args.mem_size = BENCH_MEMORY_SIZE;
+    args.mmu_base = 0;
+    args.mmu_limit = BENCH_MEMORY_SIZE;
+    args.zero = true;
+    args.no_dump = true;
+    args.stdin_file = "/dev/null";
+    args.stdout_file = "/dev/null";
+
+    for (int i = 0; i < options.name_count; i++) {
+        size_t p = 0;
+        while (p < sizeof(programs) / sizeof(programs[0]) && strcmp (programs[p].name, options.names[i]))
+            p++;
+        if (p == sizeof(programs) / sizeof(programs[0])) {
+            ELOG ("Unknown program %s\n", options.names[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE* crt = fopen ("/dev/null", "w");
+    if (!crt) {
+        ELOG ("Cannot open /dev/null for writing\n", 0);
+        return EXIT_FAILURE;
+    }
+
+    printf ("%-10s %-6s %12s %10s %9s %7s %9s\n",
+            "program", "engine", "instructions", "mean ms", "stddev ms", "cv", "MIPS");
+
+    double log_mips[sizeof(engines) / sizeof(engines[0])] = { 0 };
+    int counts[sizeof(engines) / sizeof(engines[0])] = { 0 };
+    int retval = EXIT_SUCCESS;
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++)
+        if (selected (programs[p].name) && !bench_program (&programs[p], crt, log_mips, counts))
+            retval = EXIT_FAILURE;
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+        if (counts[e])
+            printf ("%-10s %-6s %12s %10s %9s %7s %9.2f\n", "geomean", engines[e].name,
+                    "", "", "", "", exp (log_mips[e] / counts[e]));
+
+    fclose (crt);
+    return retval;
+}
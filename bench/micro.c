@@ -0,0 +1,696 @@
+/**
+ * @file micro.c
+ *
+ * The component microbenchmarks, built as the @c ckone_micro executable.
+ * Each benchmark calls one emulator function in a loop on a prepared
+ * machine: the instruction decoding functions, the ALU operations and
+ * their overflow and division by zero paths, the MMU reads and writes
+ * inside and outside of the memory limits, the second operand
+ * calculation in each addressing mode, and KBD and CRT through
+ * ext_in() and ext_out(), which read from memory and write to
+ * @c /dev/null.
+ *
+ * The number of calls in a batch is doubled until a batch takes the
+ * minimum time, and then the batch is timed the given number of times.
+ * The mean, the standard deviation and the minimum of the time per
+ * call are reported. The @c empty benchmark measures the loop itself.
+ *
+ * The results can be saved to a file and later compared against: each
+ * benchmark whose mean is slower than the saved one by more than the
+ * threshold, and by more than twice the standard error of the difference
+ * so that noise is not reported, is marked as a regression, and the exit
+ * status is then failure.
+ *
+ * The messages logged on the error paths are written to @c /dev/null
+ * while measuring, so their cost is included.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <argp.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include "common.h"
+#include "alu.h"
+#include "cpu.h"
+#include "ext.h"
+#include "instr.h"
+#include "mmu.h"
+#include "args.h"
+#include "config.h"
+#include "stats.h"
+
+
+/**
+ * @internal
+ * The memory size of the machine, in words.
+ */
+#define MICRO_MEMORY_SIZE 1024
+
+/**
+ * @internal
+ * The maximum number of benchmarks in a baseline file.
+ */
+#define MAX_BASELINE 128
+
+
+/**
+ * @internal
+ * A microbenchmark.
+ */
+typedef struct {
+    const char* name;               ///< The name of the benchmark.
+    void (*setup) (long calls);     ///< Prepares a batch of calls, or NULL.
+    void (*op) (void);              ///< The operation to measure.
+} s_micro;
+
+/**
+ * @internal
+ * A result read from a baseline file.
+ */
+typedef struct {
+    char name[64];                  ///< The name of the benchmark.
+    double mean;                    ///< The mean time per call in ns.
+    double stddev;                  ///< The standard deviation in ns.
+    int count;                      ///< The number of batches timed.
+} s_baseline;
+
+
+/**
+ * @internal
+ * The machine the benchmarks operate on.
+ */
+static s_ckone kone;
+
+/**
+ * @internal
+ * The memory of the machine.
+ */
+static int32_t mem[MICRO_MEMORY_SIZE];
+
+/**
+ * @internal
+ * Where the results of the decoding functions are accumulated,
+ * so that the calls are not optimized away.
+ */
+static volatile int32_t sink;
+
+/**
+ * @internal
+ * The instruction decoded by the decoding benchmarks.
+ */
+static int32_t instr;
+
+/**
+ * @internal
+ * The input of KBD, and its size.
+ */
+static char* kbd_data;
+/// @copydoc kbd_data
+static size_t kbd_size;
+
+/**
+ * @internal
+ * The files of KBD and CRT.
+ */
+static FILE* kbd;
+/// @copydoc kbd
+static FILE* crt;
+
+
+/**
+ * @internal
+ * Reset the machine, keeping its memory.
+ */
+static void
+reset (
+        void
+        )
+{
+    memset (&kone, 0, sizeof(kone));
+    kone.mem = mem;
+    kone.mem_size = MICRO_MEMORY_SIZE;
+    kone.mmu_limit = MICRO_MEMORY_SIZE;
+}
+
+
+/// @cond skip
+// the benchmarked operations are one-liners
+#define OP(name, body) static void name (void) { body; }
+
+OP (op_empty,               )
+OP (op_instr_opcode,        sink += instr_opcode (instr))
+OP (op_instr_first_operand, sink += instr_first_operand (instr))
+OP (op_instr_addr_mode,     sink += instr_addr_mode (instr))
+OP (op_instr_index_reg,     sink += instr_index_reg (instr))
+OP (op_instr_addr,          sink += instr_addr (instr))
+OP (op_make_instr,          sink += make_instr (LOAD, R1, DIRECT, R2, 100))
+OP (op_instr_string,        char buf[64]; instr_string (instr, buf, sizeof(buf)); sink += buf[0])
+
+OP (op_alu_add,             alu_add (&kone))
+OP (op_alu_sub,             alu_sub (&kone))
+OP (op_alu_mul,             alu_mul (&kone))
+OP (op_alu_div,             alu_div (&kone))
+OP (op_alu_mod,             alu_mod (&kone))
+OP (op_alu_and,             alu_and (&kone))
+OP (op_alu_or,              alu_or (&kone))
+OP (op_alu_xor,             alu_xor (&kone))
+OP (op_alu_not,             alu_not (&kone))
+OP (op_alu_shl,             alu_shl (&kone))
+OP (op_alu_shr,             alu_shr (&kone))
+OP (op_alu_shra,            alu_shra (&kone))
+
+OP (op_mmu_read,            kone.mar = 100; mmu_read (&kone))
+OP (op_mmu_write,           kone.mar = 100; kone.mbr = 5; mmu_write (&kone))
+OP (op_mmu_read_fault,      kone.mar = MICRO_MEMORY_SIZE; mmu_read (&kone))
+OP (op_mmu_write_fault,     kone.mar = MICRO_MEMORY_SIZE; mmu_write (&kone))
+
+OP (op_operand,             cpu_calculate_second_operand (&kone))
+
+OP (op_ext_in,              kone.tr = 1; ext_in (&kone))
+OP (op_ext_out,             kone.tr = 0; ext_out (&kone))
+/// @endcond
+
+
+/**
+ * @internal
+ * Set the ALU operands to values which do not overflow.
+ */
+static void
+setup_alu (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+    kone.alu_in1 = 1000;
+    kone.alu_in2 = 7;
+}
+
+
+/**
+ * @internal
+ * Set the ALU operands to values which overflow in an
+ * addition and a multiplication.
+ */
+static void
+setup_alu_overflow (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+    kone.alu_in1 = INT32_MAX;
+    kone.alu_in2 = INT32_MAX;
+}
+
+
+/**
+ * @internal
+ * Set the ALU operands to values which overflow in a subtraction.
+ */
+static void
+setup_alu_overflow_sub (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+    kone.alu_in1 = INT32_MIN;
+    kone.alu_in2 = 1;
+}
+
+
+/**
+ * @internal
+ * Set the ALU operands to a division by zero.
+ */
+static void
+setup_alu_zero (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+    kone.alu_in1 = 1000;
+    kone.alu_in2 = 0;
+}
+
+
+/**
+ * @internal
+ * Reset the machine for the MMU benchmarks.
+ */
+static void
+setup_mmu (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+}
+
+
+/**
+ * @internal
+ * Prepare the operand benchmarks for an instruction.
+ */
+static void
+setup_operand (
+        e_addr_mode mode,   ///< The addressing mode.
+        e_register index    ///< The index register, or R0.
+        )
+{
+    reset ();
+    mem[100] = 200;
+    mem[200] = 300;
+    kone.r[R2] = 0;
+    kone.ir = make_instr (LOAD, R1, mode, index, 100);
+}
+
+
+/// @cond skip
+// one setup function for each addressing mode
+#define SETUP_OPERAND(name, mode, index) \
+    static void name (long calls) { (void) calls; setup_operand (mode, index); }
+
+SETUP_OPERAND (setup_immediate, IMMEDIATE, R0)
+SETUP_OPERAND (setup_direct, DIRECT, R0)
+SETUP_OPERAND (setup_indirect, INDIRECT, R0)
+SETUP_OPERAND (setup_indexed, DIRECT, R2)
+/// @endcond
+
+
+/**
+ * @internal
+ * Prepare the input of KBD for a batch of calls.
+ */
+static void
+setup_kbd (
+        long calls          ///< The number of values to read.
+        )
+{
+    reset ();
+    kone.ir = make_instr (IN, R1, IMMEDIATE, R0, 1);
+
+    if (kbd)
+        fclose (kbd);
+    free (kbd_data);
+
+    FILE* f = open_memstream (&kbd_data, &kbd_size);
+    for (long i = 0; i < calls; i++)
+        fprintf (f, "%ld\n", 1000 + i % 9000);
+    fclose (f);
+
+    kbd = fmemopen (kbd_data, kbd_size, "r");
+    ext_attach_console (kbd, crt);
+}
+
+
+/**
+ * @internal
+ * Prepare the output to CRT.
+ */
+static void
+setup_crt (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    reset ();
+    kone.ir = make_instr (OUT, R1, IMMEDIATE, R0, 0);
+    kone.r[R1] = 12345;
+    ext_attach_console (kbd, crt);
+}
+
+
+/**
+ * @internal
+ * Prepare the decoding benchmarks.
+ */
+static void
+setup_instr (
+        long calls          ///< Not used.
+        )
+{
+    (void) calls;
+    instr = make_instr (ADD, R3, INDIRECT, R5, -20);
+}
+
+
+/**
+ * @internal
+ * The benchmarks.
+ */
+static const s_micro micros[] = {
+    { "empty",                  NULL,                   op_empty },
+
+    { "instr_opcode",           setup_instr,            op_instr_opcode },
+    { "instr_first_operand",    setup_instr,            op_instr_first_operand },
+    { "instr_addr_mode",        setup_instr,            op_instr_addr_mode },
+    { "instr_index_reg",        setup_instr,            op_instr_index_reg },
+    { "instr_addr",             setup_instr,            op_instr_addr },
+    { "instr_make",             setup_instr,            op_make_instr },
+    { "instr_string",           setup_instr,            op_instr_string },
+
+    { "alu_add",                setup_alu,              op_alu_add },
+    { "alu_sub",                setup_alu,              op_alu_sub },
+    { "alu_mul",                setup_alu,              op_alu_mul },
+    { "alu_div",                setup_alu,              op_alu_div },
+    { "alu_mod",                setup_alu,              op_alu_mod },
+    { "alu_and",                setup_alu,              op_alu_and },
+    { "alu_or",                 setup_alu,              op_alu_or },
+    { "alu_xor",                setup_alu,              op_alu_xor },
+    { "alu_not",                setup_alu,              op_alu_not },
+    { "alu_shl",                setup_alu,              op_alu_shl },
+    { "alu_shr",                setup_alu,              op_alu_shr },
+    { "alu_shra",               setup_alu,              op_alu_shra },
+    { "alu_add_overflow",       setup_alu_overflow,     op_alu_add },
+    { "alu_sub_overflow",       setup_alu_overflow_sub, op_alu_sub },
+    { "alu_mul_overflow",       setup_alu_overflow,     op_alu_mul },
+    { "alu_div_zero",           setup_alu_zero,         op_alu_div },
+    { "alu_mod_zero",           setup_alu_zero,         op_alu_mod },
+
+    { "mmu_read",               setup_mmu,              op_mmu_read },
+    { "mmu_write",              setup_mmu,              op_mmu_write },
+    { "mmu_read_fault",         setup_mmu,              op_mmu_read_fault },
+    { "mmu_write_fault",        setup_mmu,              op_mmu_write_fault },
+
+    { "operand_immediate",      setup_immediate,        op_operand },
+    { "operand_direct",         setup_direct,           op_operand },
+    { "operand_indirect",       setup_indirect,         op_operand },
+    { "operand_indexed",        setup_indexed,          op_operand },
+
+    { "ext_in_kbd",             setup_kbd,              op_ext_in },
+    { "ext_out_crt",            setup_crt,              op_ext_out },
+};
+
+
+/**
+ * @internal
+ * The command line options of the microbenchmarks.
+ */
+static struct {
+    int repeat;             ///< The number of timed batches.
+    double min_time;        ///< The minimum time of a batch in seconds.
+    const char* save;       ///< The file to save the results to, or NULL.
+    const char* baseline;   ///< The file to compare against, or NULL.
+    double threshold;       ///< The slowdown in percent which is a regression.
+    char** names;           ///< The name prefixes to run, or NULL for all.
+    int name_count;         ///< The number of entries in names.
+} options;
+
+
+/// @cond skip
+const char* argp_program_version = "ckone_micro " VERSION;
+
+static char doc[] =
+"ckone_micro -- the ckone component microbenchmarks\v"
+"Runs the benchmarks whose names start with one of the NAMEs given, or all of\n"
+"them. The times are nanoseconds per call.\n";
+
+static char args_doc[] = "[NAME...]";
+
+static struct argp_option argp_options[] = {
+    { "repeat",         'r',    "N",        0,
+        "Time N batches of each benchmark (default: 20)", 0 },
+
+    { "min-time",       't',    "MS",       0,
+        "Make a batch take at least MS milliseconds (default: 5)", 0 },
+
+    { "save",           's',    "FILE",     0,
+        "Save the results to FILE to be used as a baseline", 0 },
+
+    { "baseline",       'b',    "FILE",     0,
+        "Compare the results with the baseline FILE", 0 },
+
+    { "threshold",      'T',    "PERCENT",  0,
+        "Report a slowdown of more than PERCENT as a regression (default: 5)", 0 },
+
+    { 0, 0, 0, 0, 0, 0 }    // end of table
+};
+/// @endcond
+
+
+/**
+ * @internal
+ * Parse one command line option. See the argp documentation.
+ *
+ * @return 0 on success, ARGP_ERR_UNKNOWN if the option is unknown.
+ */
+static error_t
+parse_opt (
+        int key,                    ///< The option key.
+        char* arg,                  ///< The option argument.
+        struct argp_state* state    ///< The parser state.
+        )
+{
+    switch (key) {
+        case 'r':
+            options.repeat = atoi (arg);
+            if (options.repeat < 1)
+                argp_error (state, "the number of batches must be positive");
+            break;
+        case 't':
+            options.min_time = atof (arg) / 1e3;
+            if (options.min_time <= 0)
+                argp_error (state, "the batch time must be positive");
+            break;
+        case 's':
+            options.save = arg;
+            break;
+        case 'b':
+            options.baseline = arg;
+            break;
+        case 'T':
+            options.threshold = atof (arg);
+            break;
+        case ARGP_KEY_ARGS:
+            options.names = state->argv + state->next;
+            options.name_count = state->argc - state->next;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/// @cond skip
+static struct argp argp = { argp_options, parse_opt, args_doc, doc, 0, 0, 0 };
+/// @endcond
+
+
+/**
+ * @internal
+ * Check whether a benchmark was selected on the command line.
+ *
+ * @return True if a prefix of the name was given, or if no names were given.
+ */
+static bool
+selected (
+        const char* name    ///< The benchmark name.
+        )
+{
+    if (!options.names)
+        return true;
+    for (int i = 0; i < options.name_count; i++)
+        if (!strncmp (options.names[i], name, strlen (options.names[i])))
+            return true;
+    return false;
+}
+
+
+/**
+ * @internal
+ * Time a batch of calls.
+ *
+ * @return The time of the batch in seconds.
+ */
+static double
+time_batch (
+        const s_micro* micro,   ///< The benchmark.
+        long calls              ///< The number of calls.
+        )
+{
+    if (micro->setup)
+        micro->setup (calls);
+
+    void (*op) (void) = micro->op;
+    double start = stats_now ();
+    for (long i = 0; i < calls; i++)
+        op ();
+    return stats_now () - start;
+}
+
+
+/**
+ * @internal
+ * Run a benchmark.
+ *
+ * @return The statistics of the time per call in nanoseconds.
+ */
+static s_stats
+run_micro (
+        const s_micro* micro,   ///< The benchmark.
+        long* calls             ///< Where to store the calls in a batch.
+        )
+{
+    long n = 1000;
+    while (time_batch (micro, n) < options.min_time && n < (1L << 30))
+        n *= 2;
+
+    s_stats s;
+    stats_init (&s);
+    for (int i = 0; i < options.repeat; i++)
+        stats_add (&s, time_batch (micro, n) * 1e9 / n);
+    *calls = n;
+    return s;
+}
+
+
+/**
+ * @internal
+ * Read a baseline file written with the save option.
+ *
+ * @return The number of results read, or -1 if the file could
+ *         not be read.
+ */
+static int
+read_baseline (
+        const char* path,       ///< The file.
+        s_baseline* baseline    ///< Where to store the results.
+        )
+{
+    FILE* f = fopen (path, "r");
+    if (!f) {
+        ELOG ("Cannot open %s for reading\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    char line[256];
+    while (count < MAX_BASELINE && fgets (line, sizeof(line), f)) {
+        s_baseline* b = &baseline[count];
+        if (sscanf (line, "%63s %lf %lf %d", b->name, &b->mean, &b->stddev, &b->count) == 4
+                && b->count > 0)
+            count++;
+    }
+
+    fclose (f);
+    return count;
+}
+
+
+/**
+ * @internal
+ * Find a benchmark in the baseline.
+ *
+ * @return The baseline result, or NULL if the benchmark is not in it.
+ */
+static const s_baseline*
+find_baseline (
+        const s_baseline* baseline,     ///< The results.
+        int count,                      ///< The number of results.
+        const char* name                ///< The benchmark name.
+        )
+{
+    for (int i = 0; i < count; i++)
+        if (!strcmp (baseline[i].name, name))
+            return &baseline[i];
+    return NULL;
+}
+
+
+/**
+ * The entry point of the microbenchmarks.
+ *
+ * @return EXIT_SUCCESS if nothing regressed compared to the baseline.
+ */
+int
+main (
+        int argc,       ///< The number of command line arguments.
+        char** argv     ///< The command line arguments.
+        )
+{
+    options.repeat = 20;
+    options.min_time = 5e-3;
+    options.threshold = 5;
+    argp_parse (&argp, argc, argv, 0, 0, 0);
+
+    static s_baseline baseline[MAX_BASELINE];
+    int baseline_count = 0;
+    if (options.baseline && (baseline_count = read_baseline (options.baseline, baseline)) < 0)
+        return EXIT_FAILURE;
+
+    FILE* save = NULL;
+    if (options.save && !(save = fopen (options.save, "w"))) {
+        ELOG ("Cannot open %s for writing\n", options.save);
+        return EXIT_FAILURE;
+    }
+
+    crt = fopen ("/dev/null", "w");
+    int null_fd = open ("/dev/null", O_WRONLY);
+    int stderr_fd = dup (STDERR_FILENO);
+    if (!crt || null_fd < 0 || stderr_fd < 0) {
+        ELOG ("Cannot open /dev/null for writing\n", 0);
+        return EXIT_FAILURE;
+    }
+
+    args.mem_size = MICRO_MEMORY_SIZE;
+    args.stdin_file = "/dev/null";
+    args.stdout_file = "/dev/null";
+    ext_init_devices ();
+
+    printf ("%-20s %10s %9s %9s %9s", "benchmark", "calls", "mean ns", "stddev", "min ns");
+    if (options.baseline)
+        printf (" %9s %8s", "base ns", "change");
+    printf ("\n");
+
+    int regressions = 0;
+    for (size_t m = 0; m < sizeof(micros) / sizeof(micros[0]); m++) {
+        const s_micro* micro = &micros[m];
+        if (!selected (micro->name))
+            continue;
+
+        // the error paths log every call
+        fflush (stderr);
+        dup2 (null_fd, STDERR_FILENO);
+        long calls;
+        s_stats s = run_micro (micro, &calls);
+        fflush (stderr);
+        dup2 (stderr_fd, STDERR_FILENO);
+
+        printf ("%-20s %10ld %9.2f %9.2f %9.2f", micro->name, calls,
+                s.mean, stats_stddev (&s), s.min);
+        const s_baseline* base = find_baseline (baseline, baseline_count, micro->name);
+        if (base) {
+            double change = 100 * (s.mean - base->mean) / base->mean;
+            double error = sqrt (stats_variance (&s) / s.count
+                    + base->stddev * base->stddev / base->count);
+            bool regressed = change > options.threshold && s.mean - base->mean > 2 * error;
+            printf (" %9.2f %+7.1f%%%s", base->mean, change, regressed? " REGRESSION" : "");
+            regressions += regressed;
+        }
+        printf ("\n");
+        fflush (stdout);
+
+        if (save)
+            fprintf (save, "%s %.4f %.4f %d\n", micro->name, s.mean, stats_stddev (&s), s.count);
+    }
+
+    if (options.baseline)
+        printf ("%d regression%s over %.1f%%\n", regressions, regressions == 1? "" : "s",
+                options.threshold);
+
+    ext_close_devices ();
+    if (kbd)
+        fclose (kbd);
+    free (kbd_data);
+    fclose (crt);
+    close (null_fd);
+    close (stderr_fd);
+    if (save)
+        fclose (save);
+    return regressions? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file stats.c
+ *
+ * The running statistics of the repeated measurements in the benchmarks,
+ * and the clock they are measured with. The mean and the variance are
+ * updated with Welford's method, so the measurements need not be kept.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <time.h>
+#include "stats.h"
+
+
+/**
+ * Start a new series of measurements.
+ */
+void
+stats_init (
+        s_stats* s          ///< The statistics.
+        )
+{
+    s->count = 0;
+    s->mean = 0;
+    s->m2 = 0;
+    s->min = HUGE_VAL;
+    s->max = -HUGE_VAL;
+}
+
+
+/**
+ * Add a measurement to the statistics.
+ */
+void
+stats_add (
+        s_stats* s,         ///< The statistics.
+        double value        ///< The measurement.
+        )
+{
+    s->count++;
+    double delta = value - s->mean;
+    s->mean += delta / s->count;
+    s->m2 += delta * (value - s->mean);
+
+    if (value < s->min)
+        s->min = value;
+    if (value > s->max)
+        s->max = value;
+}
+
+
+/**
+ * Get the sample variance of the measurements.
+ *
+ * @return The variance, or 0 for less than two measurements.
+ */
+double
+stats_variance (
+        const s_stats* s    ///< The statistics.
+        )
+{
+    return s->count > 1? s->m2 / (s->count - 1) : 0;
+}
+
+
+/**
+ * Get the sample standard deviation of the measurements.
+ *
+ * @return The standard deviation, or 0 for less than two measurements.
+ */
+double
+stats_stddev (
+        const s_stats* s    ///< The statistics.
+        )
+{
+    return sqrt (stats_variance (s));
+}
+
+
+/**
+ * Read the monotonic clock.
+ *
+ * @return The time in seconds from an unspecified starting point.
+ */
+double
+stats_now (
+        void
+        )
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
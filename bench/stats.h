@@ -0,0 +1,31 @@
+/**
+ * @file stats.h
+ *
+ * The running statistics of the repeated measurements in the benchmarks.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+
+/**
+ * The statistics of a series of measurements, updated one
+ * measurement at a time.
+ */
+typedef struct {
+    int count;          ///< The number of measurements.
+    double mean;        ///< The mean of the measurements.
+    double m2;          ///< The sum of the squared differences from the mean.
+    double min;         ///< The smallest measurement.
+    double max;         ///< The largest measurement.
+} s_stats;
+
+
+extern void stats_init (s_stats* s);
+extern void stats_add (s_stats* s, double value);
+extern double stats_variance (const s_stats* s);
+extern double stats_stddev (const s_stats* s);
+extern double stats_now (void);
+
+
+#endif
@@ -35,16 +35,18 @@ do_and_check (
     int32_t a = kone->alu_in1;
     int32_t b = kone->alu_in2;
 
-    int32_t result = 0;
     int64_t real_result = 0;
 
+    // computed in 64 bits, since an overflowing 32-bit operation is
+    // undefined and the compiler may assume it never happens
     switch (op) {
-        case ADD: result = a + b; real_result = (int64_t)a + (int64_t)b; break;
-        case SUB: result = a - b; real_result = (int64_t)a - (int64_t)b; break;
-        case MUL: result = a * b; real_result = (int64_t)a * (int64_t)b; break;
+        case ADD: real_result = (int64_t)a + (int64_t)b; break;
+        case SUB: real_result = (int64_t)a - (int64_t)b; break;
+        case MUL: real_result = (int64_t)a * (int64_t)b; break;
     }
+    int32_t result = (int32_t)real_result;
 
-    if ((int64_t)result != real_result) {
+    if (real_result < INT32_MIN || real_result > INT32_MAX) {
         kone->sr |= SR_O;   // overflow
         char* opstr = " + ";
         if (op == SUB)
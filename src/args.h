@@ -9,6 +9,19 @@
 #define ARGS_H
 
 
+/// The maximum number of --plugin options.
+#define MAX_PLUGINS 8
+
+/// The maximum number of --break options.
+#define MAX_BREAKPOINTS 32
+
+/// The maximum number of --watch options.
+#define MAX_WATCHPOINTS 32
+
+/// The maximum number of --report options.
+#define MAX_REPORTS 32
+
+
 /**
  * A structure containing all the variables which can be set
  * by command line arguments.
@@ -54,6 +67,157 @@ typedef struct {
 
     /// If true, the symbol table is printed in every dump.
     bool include_symtable;  
+
+    /// The shared objects to load SVC handlers from (see plugin.h).
+    char* plugins[MAX_PLUGINS];
+
+    /// The number of entries used in plugins.
+    int plugin_count;
+
+    /// If true, executions and memory accesses are counted per 
+    /// instruction and a profile is printed at the end (see prof.c).
+    bool profile;
+
+    /// The file where the profile is written. If NULL, stdout is used.
+    char* profile_file;
+
+    /// If not NULL, a shadow call stack is kept and the call paths are
+    /// written to this file in the folded stack format (see callgraph.c).
+    char* callgraph_file;
+
+    /// If not NULL, a binary trace of the execution is written
+    /// to this file (see trace.c).
+    char* trace_file;
+
+    /// If true, the trace is gzip-compressed.
+    bool trace_compress;
+
+    /// If not NULL, this trace file is printed instead of running a program.
+    char* decode_trace;
+
+    /// If not NULL, the input values and times given to the program
+    /// are written to this file (see replay.c).
+    char* record_file;
+
+    /// If not NULL, the input values and times given to the program
+    /// are read from this file instead of the devices and the clock.
+    char* replay_file;
+
+    /// The size of the undo log in entries. If 0, the undo log is off
+    /// (see undo.c).
+    int undo_size;
+
+    /// The breakpoint addresses or symbols (see debug.c).
+    char* breaks[MAX_BREAKPOINTS];
+
+    /// The number of entries used in breaks.
+    int break_count;
+
+    /// The watchpoint addresses or symbols (see debug.c).
+    char* watches[MAX_WATCHPOINTS];
+
+    /// The number of entries used in watches.
+    int watch_count;
+
+    /// If not NULL, the emulation is controlled by a debugger through
+    /// the GDB remote protocol on this TCP port or Unix socket (see gdb.c).
+    char* gdb_socket;
+
+    /// If not NULL, the machine is restored from this snapshot instead
+    /// of loading a program (see snapshot.c).
+    char* restore_file;
+
+    /// The file where snapshots are saved.
+    char* snapshot_file;
+
+    /// If not 0, a snapshot is saved every this many instructions.
+    uint64_t snapshot_interval;
+
+    /// If not NULL, the control file of the fork-server mode
+    /// (see forksrv.c), or "-" for the standard input.
+    char* fork_server;
+
+    /// If not NULL, the Unix socket on which jobs are served (see serve.c).
+    char* serve_socket;
+
+    /// If true, memory dumps after the first one only show the rows 
+    /// written since the previous dump.
+    bool dump_changes;
+
+    /// If true, runs of equal memory rows are collapsed in memory dumps.
+    bool dump_sparse;
+
+    /// If not NULL, memory dumps are written to this file as raw
+    /// little-endian words instead of as text.
+    char* dump_binary;
+
+    /// The comma-separated lists of items to report at the end of
+    /// the run (see report.c).
+    char* reports[MAX_REPORTS];
+
+    /// The number of entries used in reports.
+    int report_count;
+
+    /// If true, the report is written in the binary layout instead of JSON.
+    bool binary_report;
+
+    /// The file where the report is written, or NULL for the standard output.
+    char* report_file;
+
+    /// If true, the state is not dumped at the end of the run.
+    bool no_dump;
+
+    /// If true, the log messages are written by a background thread
+    /// (see log.c).
+    bool async_log;
+
+    /// If true, the host performance counters are read around the
+    /// run and reported at the end (see perf.c).
+    bool perf_counters;
+
+    /// If true, the instruction mix is counted and written at the
+    /// end (see mix.c).
+    bool mix;
+
+    /// The file where the instruction mix is written. If NULL, stdout
+    /// is used.
+    char* mix_file;
+
+    /// If true, the guest PC and call stack are sampled by a CPU time
+    /// timer and a profile is printed at the end (see sample.c).
+    bool sample;
+
+    /// The file where the sampling profile is written. If NULL, stdout
+    /// is used.
+    char* sample_file;
+
+    /// The sampling interval in microseconds.
+    uint32_t sample_interval;
+
+    /// If true, the progress of the run is published in shared memory
+    /// for ckone-top (see live.c).
+    bool live;
+
+    /// If true, the memory accesses go through the cache simulator and
+    /// a report is printed at the end (see cache.c).
+    bool cache;
+
+    /// The file where the cache report is written. If NULL, stdout is used.
+    char* cache_file;
+
+    /// The cache configuration, or NULL for the defaults (see cache.c).
+    char* cache_config;
+
+    /// If true, the jumps and returns go through the branch predictor
+    /// simulator and a report is printed at the end (see branch.c).
+    bool branch;
+
+    /// The file where the branch report is written. If NULL, stdout is used.
+    char* branch_file;
+
+    /// The branch predictor configuration, or NULL for the default
+    /// (see branch.c).
+    char* branch_config;
 } s_arguments;
 
 
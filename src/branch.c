@@ -0,0 +1,522 @@
+/**
+ * @file branch.c
+ *
+ * A branch predictor simulator. With the branch option (see ::args),
+ * each jump instruction is predicted before it is executed, as the fetch
+ * stage of a pipelined processor would have to, and the prediction is
+ * compared with what the jump really did. The returns of EXIT are
+ * predicted with a return address stack which follows CALL and the
+ * interrupts.
+ *
+ * The predictors are:
+ *  - @c static: backward jumps are taken and forward jumps are not.
+ *  - @c bimodal: a table of two-bit saturating counters indexed by the
+ *    address of the jump.
+ *  - @c gshare: the counters are indexed by the address of the jump
+ *    XORed with the outcomes of the latest conditional jumps.
+ *
+ * JUMP is unconditional and always predicted correctly; it is counted,
+ * but it does not update the predictors.
+ *
+ * The predictor is chosen with a configuration of the form
+ * <tt>NAME[:BITS[:PENALTY]]</tt>: the predictor, the base 2 logarithm of
+ * the number of counters (and the length of the gshare history), and the
+ * cycles lost on each mispredicted jump or return. Recording a jump is
+ * an update of the counters of its address, so the simulator can be used
+ * on long runs. At the end the accuracy, the estimated cycles lost, and
+ * the jumps with the most mispredictions are reported.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include "common.h"
+#include "instr.h"
+#include "counters.h"
+#include "branch.h"
+
+
+/// @cond skip
+// How many of the worst jumps are listed in the report.
+#define BRANCH_TOP 20
+
+// The number of entries in the return address stack.
+#define BRANCH_RAS_SIZE 16
+
+// The largest number of index bits.
+#define BRANCH_MAX_BITS 24
+
+// The default number of index bits and misprediction penalty.
+#define BRANCH_BITS 12
+#define BRANCH_PENALTY 10
+/// @endcond
+
+
+/**
+ * @internal
+ * A branch predictor.
+ */
+typedef struct {
+    const char* name;       ///< The name of the predictor.
+
+    /// Predict a conditional jump.
+    /// @return True if the jump is predicted to be taken.
+    bool (*predict) (int32_t pc, int32_t target);
+
+    /// Update the predictor with the outcome of a conditional jump.
+    void (*update) (int32_t pc, bool taken);
+} s_predictor;
+
+
+/**
+ * @internal
+ * The counters of one jump or EXIT instruction.
+ */
+typedef struct {
+    uint64_t execs;         ///< The executions.
+    uint64_t taken;         ///< The times the jump was taken.
+    uint64_t mispredicts;   ///< The wrong predictions.
+} s_branch_counts;
+
+
+/**
+ * @internal
+ * The counters, indexed by logical address (see counters_alloc()).
+ */
+static s_branch_counts* counts = NULL;
+
+/**
+ * @internal
+ * The number of addresses in ::counts.
+ */
+static int32_t size = 0;
+
+/**
+ * @internal
+ * The predictor in use.
+ */
+static const s_predictor* predictor = NULL;
+
+/**
+ * @internal
+ * The two-bit counters of the bimodal and gshare predictors. 0 and 1
+ * predict not taken, 2 and 3 taken.
+ */
+static uint8_t* table = NULL;
+
+/**
+ * @internal
+ * The number of index bits of ::table.
+ */
+static int bits = BRANCH_BITS;
+
+/**
+ * @internal
+ * The outcomes of the latest conditional jumps, the latest in bit 0.
+ */
+static uint32_t history = 0;
+
+/**
+ * @internal
+ * The cycles lost on a misprediction.
+ */
+static uint32_t penalty = BRANCH_PENALTY;
+
+/**
+ * @internal
+ * The return address stack. It wraps around when full.
+ */
+static int32_t ras[BRANCH_RAS_SIZE];
+
+/**
+ * @internal
+ * The number of pushes minus pops of ::ras, not below 0.
+ */
+static uint32_t ras_top = 0;
+
+/**
+ * @internal
+ * The totals: conditional jumps, their mispredictions, unconditional
+ * jumps, returns and their mispredictions.
+ */
+static uint64_t cond_jumps, cond_mispredicts, uncond_jumps, returns, ret_mispredicts;
+
+
+/**
+ * @internal
+ * Predict backward jumps as taken and forward jumps as not taken.
+ *
+ * @return True if the jump is predicted to be taken.
+ */
+static bool
+static_predict (
+        int32_t pc,         ///< The address of the jump.
+        int32_t target      ///< The target of the jump.
+        )
+{
+    return target <= pc;
+}
+
+
+/**
+ * @internal
+ * The static predictor learns nothing.
+ */
+static void
+static_update (
+        int32_t pc,         ///< The address of the jump.
+        bool taken          ///< True if the jump was taken.
+        )
+{
+    (void) pc;
+    (void) taken;
+}
+
+
+/**
+ * @internal
+ * The index of the counter of a jump in the bimodal predictor.
+ *
+ * @return The index.
+ */
+static uint32_t
+bimodal_index (
+        int32_t pc          ///< The address of the jump.
+        )
+{
+    return (uint32_t) pc & ((1u << bits) - 1);
+}
+
+
+/**
+ * @internal
+ * The index of the counter of a jump in the gshare predictor.
+ *
+ * @return The index.
+ */
+static uint32_t
+gshare_index (
+        int32_t pc          ///< The address of the jump.
+        )
+{
+    return ((uint32_t) pc ^ history) & ((1u << bits) - 1);
+}
+
+
+/**
+ * @internal
+ * Update a two-bit counter.
+ */
+static void
+update_counter (
+        uint8_t* counter,   ///< The counter.
+        bool taken          ///< True if the jump was taken.
+        )
+{
+    if (taken && *counter < 3)
+        (*counter)++;
+    else if (!taken && *counter > 0)
+        (*counter)--;
+}
+
+
+/**
+ * @internal
+ * Predict a jump with the counter of its address.
+ *
+ * @return True if the jump is predicted to be taken.
+ */
+static bool
+bimodal_predict (
+        int32_t pc,         ///< The address of the jump.
+        int32_t target      ///< The target of the jump.
+        )
+{
+    (void) target;
+    return table[bimodal_index (pc)] >= 2;
+}
+
+
+/**
+ * @internal
+ * Update the counter of a jump.
+ */
+static void
+bimodal_update (
+        int32_t pc,         ///< The address of the jump.
+        bool taken          ///< True if the jump was taken.
+        )
+{
+    update_counter (&table[bimodal_index (pc)], taken);
+}
+
+
+/**
+ * @internal
+ * Predict a jump with the counter of its address and the history.
+ *
+ * @return True if the jump is predicted to be taken.
+ */
+static bool
+gshare_predict (
+        int32_t pc,         ///< The address of the jump.
+        int32_t target      ///< The target of the jump.
+        )
+{
+    (void) target;
+    return table[gshare_index (pc)] >= 2;
+}
+
+
+/**
+ * @internal
+ * Update the counter of a jump and the history.
+ */
+static void
+gshare_update (
+        int32_t pc,         ///< The address of the jump.
+        bool taken          ///< True if the jump was taken.
+        )
+{
+    update_counter (&table[gshare_index (pc)], taken);
+    history = ((history << 1) | taken) & ((1u << bits) - 1);
+}
+
+
+/**
+ * @internal
+ * The available predictors.
+ */
+static const s_predictor predictors[] = {
+    { "static",     static_predict,     static_update },
+    { "bimodal",    bimodal_predict,    bimodal_update },
+    { "gshare",     gshare_predict,     gshare_update },
+};
+
+
+/**
+ * @internal
+ * Parse the configuration. The numbers not given take the defaults.
+ *
+ * @return False if it is invalid.
+ */
+static bool
+parse_config (
+        const char* config  ///< The configuration.
+        )
+{
+    char name[16];
+    size_t len = strcspn (config, ":");
+    if (len >= sizeof(name))
+        return false;
+    memcpy (name, config, len);
+    name[len] = '\0';
+
+    predictor = NULL;
+    for (size_t i = 0; i < sizeof(predictors) / sizeof(predictors[0]); i++)
+        if (!strcmp (name, predictors[i].name))
+            predictor = &predictors[i];
+    if (!predictor)
+        return false;
+
+    unsigned long b = BRANCH_BITS, p = BRANCH_PENALTY;
+    const char* s = config + len;
+    char* end = (char*) s;
+    if (*s == ':') {
+        s++;
+        if (!isdigit ((unsigned char) *s))
+            return false;
+        b = strtoul (s, &end, 10);
+        if (b < 1 || b > BRANCH_MAX_BITS)
+            return false;
+    }
+    if (*end == ':') {
+        s = end + 1;
+        if (!isdigit ((unsigned char) *s))
+            return false;
+        errno = 0;
+        p = strtoul (s, &end, 10);
+        if (errno == ERANGE || p > UINT32_MAX)
+            return false;
+    }
+    if (*end)
+        return false;
+
+    bits = b;
+    penalty = p;
+    return true;
+}
+
+
+/**
+ * Choose the predictor and allocate the counters. The program must have
+ * been loaded. See also branch_free().
+ *
+ * @return False if the configuration is invalid or the allocation failed.
+ */
+bool
+branch_init (
+        s_ckone* kone,      ///< The state structure.
+        const char* config  ///< The configuration, or NULL for gshare.
+        )
+{
+    if (!parse_config (config? config : "gshare")) {
+        ELOG ("Invalid branch predictor: %s\n", config);
+        return false;
+    }
+
+    counts = counters_alloc (kone, sizeof(s_branch_counts), &size);
+    table = malloc (1u << bits);
+    if (!counts || !table) {
+        ELOG ("Could not allocate memory for the branch predictor\n", 0);
+        return false;
+    }
+
+    // weakly not taken
+    memset (table, 1, 1u << bits);
+    history = 0;
+    ras_top = 0;
+    cond_jumps = cond_mispredicts = uncond_jumps = returns = ret_mispredicts = 0;
+    DLOG ("Branch predictor %s with %u counters\n", predictor->name, 1u << bits);
+    return true;
+}
+
+
+/**
+ * Free the counters allocated by branch_init().
+ */
+void
+branch_free (
+        void
+        )
+{
+    free (counts);
+    free (table);
+    counts = NULL;
+    table = NULL;
+    size = 0;
+}
+
+
+/**
+ * Predict and record the jump in IR. Called before PC is changed.
+ */
+void
+branch_jump (
+        s_ckone* kone,      ///< The state structure.
+        bool taken          ///< True if the jump is taken.
+        )
+{
+    int32_t pc = kone->pc - 1;
+    s_branch_counts* c = &counts[COUNTERS_INDEX (pc, size)];
+    c->execs++;
+    c->taken += taken;
+
+    if (instr_opcode (kone->ir) == JUMP) {
+        uncond_jumps++;
+        return;
+    }
+
+    cond_jumps++;
+    if (predictor->predict (pc, kone->tr) != taken) {
+        c->mispredicts++;
+        cond_mispredicts++;
+    }
+    predictor->update (pc, taken);
+}
+
+
+/**
+ * Push a return address onto the return address stack. Called on CALL
+ * and interrupts.
+ */
+void
+branch_call (
+        int32_t ret         ///< The return address.
+        )
+{
+    ras[ras_top++ % BRANCH_RAS_SIZE] = ret;
+}
+
+
+/**
+ * Predict and record a return.
+ */
+void
+branch_exit (
+        int32_t site,       ///< The address of the EXIT instruction.
+        int32_t target      ///< The address returned to.
+        )
+{
+    s_branch_counts* c = &counts[COUNTERS_INDEX (site, size)];
+    c->execs++;
+    c->taken++;
+    returns++;
+
+    bool hit = false;
+    if (ras_top) {
+        ras_top--;
+        hit = ras[ras_top % BRANCH_RAS_SIZE] == target;
+    }
+    if (!hit) {
+        c->mispredicts++;
+        ret_mispredicts++;
+    }
+}
+
+
+/**
+ * Print the accuracy of the predictions, the cycles lost, and the jumps
+ * and returns with the most mispredictions. Must be called before
+ * symtable_clear().
+ */
+void
+branch_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The file to print the report to.
+        )
+{
+    if (!counts)
+        return;
+
+    int32_t n = 0;
+    int32_t* addrs = counters_top (counts, sizeof(s_branch_counts),
+            offsetof (s_branch_counts, mispredicts), size, &n);
+    if (!addrs) {
+        ELOG ("Could not allocate memory for the branch report\n", 0);
+        return;
+    }
+
+    uint64_t mispredicts = cond_mispredicts + ret_mispredicts;
+    fprintf (out, "Branch prediction: %s", predictor->name);
+    if (predictor->update != static_update)
+        fprintf (out, " with %u counters", 1u << bits);
+    fprintf (out, ", %d-entry return address stack\n", BRANCH_RAS_SIZE);
+    fprintf (out, "  Conditional jumps   %14llu  %6.2f%% predicted\n",
+            (unsigned long long) cond_jumps,
+            100.0 - counters_percent (cond_mispredicts, cond_jumps));
+    fprintf (out, "  Returns             %14llu  %6.2f%% predicted\n",
+            (unsigned long long) returns, 100.0 - counters_percent (ret_mispredicts, returns));
+    fprintf (out, "  Unconditional jumps %14llu\n", (unsigned long long) uncond_jumps);
+    fprintf (out, "  Cycles lost         %14llu  (%u per misprediction",
+            (unsigned long long) mispredicts * penalty, penalty);
+    if (kone->instr_count)
+        fprintf (out, ", %.3f per instruction", (double) mispredicts * penalty / kone->instr_count);
+    fprintf (out, ")\n\n");
+
+    fprintf (out, "Mispredictions:\n");
+    fprintf (out, "%12s %12s %7s %9s  %-20s %s\n",
+            "Mispredicts", "Executions", "Taken", "Accuracy", "Address", "Instruction");
+    for (int32_t i = 0; i < n && i < BRANCH_TOP; i++) {
+        int32_t a = addrs[i];
+        char sym[64], instr[256];
+        counters_describe (kone, a, sym, sizeof(sym), instr, sizeof(instr));
+        fprintf (out, "%12llu %12llu %6.2f%% %8.2f%%  %-20s %s\n",
+                (unsigned long long) counts[a].mispredicts,
+                (unsigned long long) counts[a].execs,
+                counters_percent (counts[a].taken, counts[a].execs),
+                100.0 - counters_percent (counts[a].mispredicts, counts[a].execs), sym, instr);
+    }
+    fprintf (out, "\n");
+
+    free (addrs);
+}
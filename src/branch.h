@@ -0,0 +1,21 @@
+/**
+ * @file branch.h
+ *
+ * The public functions of the branch predictor simulator.
+ */
+
+#ifndef BRANCH_H
+#define BRANCH_H
+
+
+extern bool branch_init (s_ckone* kone, const char* config);
+extern void branch_free ();
+
+extern void branch_jump (s_ckone* kone, bool taken);
+extern void branch_call (int32_t ret);
+extern void branch_exit (int32_t site, int32_t target);
+
+extern void branch_report (s_ckone* kone, FILE* out);
+
+
+#endif
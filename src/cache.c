@@ -0,0 +1,556 @@
+/**
+ * @file cache.c
+ *
+ * A cache simulator. With the cache option (see ::args), every memory
+ * access made by the program goes through a model of a cache hierarchy:
+ * separate level 1 caches for the instruction fetches (L1I) and the data
+ * (L1D), and an optional unified level 2 cache (L2) behind them. The model
+ * only keeps the tags, so it does not change what the program does.
+ *
+ * Each cache has a size, an associativity, a line size and a replacement
+ * policy (least recently used, first in first out, or random). The caches
+ * allocate a line on a write as well as on a read, and the write-backs of
+ * the lines are not modeled. An access costs the latency of each level it
+ * reaches, so a miss in both caches costs the L1, L2 and memory latencies.
+ * Addresses are in bytes, four per word, from the physical word address.
+ *
+ * The caches are configured with a comma-separated list of
+ * <tt>NAME=SIZE:WAYS:LINE[:POLICY[:LATENCY]]</tt> entries, where NAME is
+ * @c l1i, @c l1d or @c l2, SIZE and LINE are in bytes (with an optional
+ * @c k suffix), and POLICY is @c lru, @c fifo or @c random. A SIZE of 0
+ * leaves out the L2 cache. The entry <tt>mem=LATENCY</tt> sets the memory
+ * latency. The levels not given keep the defaults of ::CACHE_DEFAULT.
+ *
+ * The accesses, misses and cycles are also counted per logical address
+ * (see counters.c), and the report at the end sums them by the nearest
+ * preceding label, so that for example an array shows how well its
+ * traversal order suits the cache.
+ */
+
+#include <errno.h>
+#include "common.h"
+#include "counters.h"
+#include "cache.h"
+
+
+/// The default configuration of the caches.
+#define CACHE_DEFAULT "l1i=1k:2:16:lru:1,l1d=1k:2:16:lru:1,l2=16k:4:32:lru:10,mem=100"
+
+/// @cond skip
+// The maximum number of entries in a configuration.
+#define CACHE_ENTRIES 16
+/// @endcond
+
+
+/**
+ * @internal
+ * The replacement policies.
+ */
+typedef enum {
+    POLICY_LRU,             ///< Replace the least recently used line.
+    POLICY_FIFO,            ///< Replace the line filled first.
+    POLICY_RANDOM           ///< Replace a random line.
+} e_policy;
+
+
+/**
+ * @internal
+ * One cache.
+ */
+typedef struct {
+    const char* name;       ///< The name of the cache in the report.
+    uint32_t size;          ///< The size in bytes, or 0 if the cache is left out.
+    uint32_t ways;          ///< The associativity.
+    uint32_t line;          ///< The line size in bytes.
+    e_policy policy;        ///< The replacement policy.
+    uint32_t latency;       ///< The cycles of an access.
+    uint32_t sets;          ///< The number of sets.
+    int line_shift;         ///< The base 2 logarithm of the line size.
+    uint32_t* tags;         ///< The line number + 1 of each way of each set, 0 if empty.
+    uint64_t* stamps;       ///< The time of the last use (LRU) or the fill (FIFO).
+    uint64_t hits;          ///< The number of hits.
+    uint64_t misses;        ///< The number of misses.
+} s_cache;
+
+
+/**
+ * @internal
+ * The counters of one logical address.
+ */
+typedef struct {
+    uint64_t fetches;       ///< The instruction fetches.
+    uint64_t data;          ///< The data reads and writes.
+    uint64_t l1_misses;     ///< The misses in L1I or L1D.
+    uint64_t l2_misses;     ///< The misses in L2, or the misses to memory.
+    uint64_t cycles;        ///< The estimated cycles.
+} s_cache_counts;
+
+
+/**
+ * @internal
+ * The level 1 instruction cache.
+ */
+static s_cache l1i = { "L1I", 0, 0, 0, POLICY_LRU, 0, 0, 0, NULL, NULL, 0, 0 };
+
+/**
+ * @internal
+ * The level 1 data cache.
+ */
+static s_cache l1d = { "L1D", 0, 0, 0, POLICY_LRU, 0, 0, 0, NULL, NULL, 0, 0 };
+
+/**
+ * @internal
+ * The level 2 cache, shared by the instructions and the data.
+ */
+static s_cache l2 = { "L2", 0, 0, 0, POLICY_LRU, 0, 0, 0, NULL, NULL, 0, 0 };
+
+/**
+ * @internal
+ * The latency of the memory in cycles.
+ */
+static uint32_t mem_latency = 0;
+
+/**
+ * @internal
+ * The counters, indexed by logical address (see counters_alloc()).
+ */
+static s_cache_counts* counts = NULL;
+
+/**
+ * @internal
+ * The number of addresses in ::counts.
+ */
+static int32_t size = 0;
+
+/**
+ * @internal
+ * The access clock for the replacement policies.
+ */
+static uint64_t clock_now = 0;
+
+/**
+ * @internal
+ * The state of the random number generator of the random policy.
+ */
+static uint32_t random_state = 2463534242u;
+
+
+/**
+ * @internal
+ * Parse a size in bytes with an optional @c k suffix.
+ *
+ * @return False if the size is not a number or does not fit in 32 bits.
+ */
+static bool
+parse_size (
+        const char* str,    ///< The size.
+        uint32_t* value     ///< Where to store the size.
+        )
+{
+    char* end;
+    errno = 0;
+    unsigned long n = strtoul (str, &end, 10);
+    if (end == str || *str == '-' || errno == ERANGE || n > UINT32_MAX)
+        return false;
+    if (*end == 'k' || *end == 'K') {
+        if (n > UINT32_MAX / 1024)
+            return false;
+        n *= 1024;
+        end++;
+    }
+    *value = n;
+    return *end == '\0';
+}
+
+
+/**
+ * @internal
+ * Parse one entry of the configuration into its cache.
+ *
+ * @return False if the entry is invalid.
+ */
+static bool
+parse_entry (
+        char* entry         ///< The entry; modified.
+        )
+{
+    char* eq = strchr (entry, '=');
+    if (!eq)
+        return false;
+    *eq = '\0';
+    char* fields[5] = { NULL, NULL, NULL, NULL, NULL };
+    int n = 0;
+    char* s = strtok (eq + 1, ":");
+    for (; s && n < 5; s = strtok (NULL, ":"))
+        fields[n++] = s;
+    if (s)
+        return false;
+
+    if (!strcmp (entry, "mem")) {
+        uint32_t latency;
+        if (n != 1 || !parse_size (fields[0], &latency))
+            return false;
+        mem_latency = latency;
+        return true;
+    }
+
+    s_cache* c = !strcmp (entry, "l1i")? &l1i : !strcmp (entry, "l1d")? &l1d
+            : !strcmp (entry, "l2")? &l2 : NULL;
+    if (!c || n < 1 || !parse_size (fields[0], &c->size))
+        return false;
+    if (c->size == 0)
+        return c == &l2 && n == 1;
+    if (n < 3 || !parse_size (fields[1], &c->ways) || !parse_size (fields[2], &c->line))
+        return false;
+
+    if (n >= 4) {
+        if (!strcmp (fields[3], "lru"))
+            c->policy = POLICY_LRU;
+        else if (!strcmp (fields[3], "fifo"))
+            c->policy = POLICY_FIFO;
+        else if (!strcmp (fields[3], "random"))
+            c->policy = POLICY_RANDOM;
+        else
+            return false;
+    }
+    if (n >= 5 && !parse_size (fields[4], &c->latency))
+        return false;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Parse a configuration.
+ *
+ * @return False if it is invalid.
+ */
+static bool
+parse_config (
+        const char* config  ///< The configuration.
+        )
+{
+    char list[1024];
+    if (snprintf (list, sizeof(list), "%s", config) >= (int) sizeof(list)) {
+        ELOG ("The cache configuration is too long\n", 0);
+        return false;
+    }
+
+    // strtok is also used for the fields
+    char* entries[CACHE_ENTRIES];
+    int n = 0;
+    char* s = strtok (list, ",");
+    for (; s && n < CACHE_ENTRIES; s = strtok (NULL, ","))
+        entries[n++] = s;
+    if (s) {
+        ELOG ("The cache configuration has more than %d entries\n", CACHE_ENTRIES);
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!parse_entry (entries[i])) {
+            ELOG ("Invalid cache configuration for %s\n", entries[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @internal
+ * Check the geometry of a cache and allocate its tags.
+ *
+ * @return False if the geometry is invalid or the allocation failed.
+ */
+static bool
+setup_cache (
+        s_cache* c          ///< The cache.
+        )
+{
+    c->hits = c->misses = 0;
+    if (!c->size)
+        return true;
+
+    bool power_of_2 = c->line && !(c->line & (c->line - 1));
+    if (!power_of_2 || c->line < sizeof(int32_t) || !c->ways
+            || c->line > c->size || c->ways > c->size / c->line
+            || c->size % (c->ways * c->line)) {
+        ELOG ("Invalid %s cache: %u bytes, %u ways, %u-byte lines\n",
+                c->name, c->size, c->ways, c->line);
+        return false;
+    }
+
+    c->sets = c->size / (c->ways * c->line);
+    c->line_shift = 0;
+    while ((1u << c->line_shift) < c->line)
+        c->line_shift++;
+
+    c->tags = calloc (c->sets * c->ways, sizeof(uint32_t));
+    c->stamps = calloc (c->sets * c->ways, sizeof(uint64_t));
+    if (!c->tags || !c->stamps) {
+        ELOG ("Could not allocate memory for the %s cache\n", c->name);
+        return false;
+    }
+
+    DLOG ("%s cache: %u bytes, %u sets of %u ways, %u-byte lines, latency %u\n",
+            c->name, c->size, c->sets, c->ways, c->line, c->latency);
+    return true;
+}
+
+
+/**
+ * Configure the caches and allocate the counters. The program must have
+ * been loaded. See also cache_free().
+ *
+ * @return False if the configuration is invalid or the allocation failed.
+ */
+bool
+cache_init (
+        s_ckone* kone,      ///< The state structure.
+        const char* config  ///< The configuration, or NULL for the defaults.
+        )
+{
+    if (!parse_config (CACHE_DEFAULT) || (config && !parse_config (config)))
+        return false;
+    if (!l1i.size || !l1d.size) {
+        ELOG ("The L1 caches cannot be left out\n", 0);
+        return false;
+    }
+    if (!setup_cache (&l1i) || !setup_cache (&l1d) || !setup_cache (&l2))
+        return false;
+
+    counts = counters_alloc (kone, sizeof(s_cache_counts), &size);
+    if (!counts) {
+        ELOG ("Could not allocate memory for the cache counters\n", 0);
+        return false;
+    }
+    clock_now = 0;
+    return true;
+}
+
+
+/**
+ * Free the caches and the counters allocated by cache_init().
+ */
+void
+cache_free (
+        void
+        )
+{
+    s_cache* caches[] = { &l1i, &l1d, &l2 };
+    for (int i = 0; i < 3; i++) {
+        free (caches[i]->tags);
+        free (caches[i]->stamps);
+        caches[i]->tags = NULL;
+        caches[i]->stamps = NULL;
+    }
+    free (counts);
+    counts = NULL;
+    size = 0;
+}
+
+
+/**
+ * @internal
+ * Look up a byte address in a cache, and fill its line on a miss.
+ *
+ * @return True on a hit.
+ */
+static bool
+lookup (
+        s_cache* c,         ///< The cache.
+        uint32_t addr       ///< The byte address.
+        )
+{
+    uint32_t block = addr >> c->line_shift;
+    uint32_t* tags = &c->tags[(block % c->sets) * c->ways];
+    uint64_t* stamps = &c->stamps[(block % c->sets) * c->ways];
+    clock_now++;
+
+    for (uint32_t w = 0; w < c->ways; w++) {
+        if (tags[w] == block + 1) {
+            if (c->policy == POLICY_LRU)
+                stamps[w] = clock_now;
+            c->hits++;
+            return true;
+        }
+    }
+
+    // replace an empty way, or the oldest or a random one
+    uint32_t victim = 0;
+    if (c->policy == POLICY_RANDOM) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        victim = random_state % c->ways;
+    }
+    for (uint32_t w = 0; w < c->ways; w++) {
+        if (!tags[w]) {
+            victim = w;
+            break;
+        }
+        if (c->policy != POLICY_RANDOM && stamps[w] < stamps[victim])
+            victim = w;
+    }
+
+    tags[victim] = block + 1;
+    stamps[victim] = clock_now;
+    c->misses++;
+    return false;
+}
+
+
+/**
+ * Simulate a memory access. Called by the MMU after a successful access.
+ */
+void
+cache_access (
+        int32_t laddr,          ///< The logical address.
+        int32_t paddr,          ///< The physical address.
+        e_cache_access kind     ///< The kind of the access.
+        )
+{
+    uint32_t addr = (uint32_t) paddr * sizeof(int32_t);
+    s_cache* l1 = kind == CACHE_FETCH? &l1i : &l1d;
+    s_cache_counts* count = &counts[laddr];
+
+    if (kind == CACHE_FETCH)
+        count->fetches++;
+    else
+        count->data++;
+
+    count->cycles += l1->latency;
+    if (lookup (l1, addr))
+        return;
+    count->l1_misses++;
+
+    if (l2.size) {
+        count->cycles += l2.latency;
+        if (lookup (&l2, addr))
+            return;
+    }
+    count->l2_misses++;
+    count->cycles += mem_latency;
+}
+
+
+/**
+ * @internal
+ * Calculate a hit rate.
+ *
+ * @return 100 * (accesses - misses) / accesses, or 100 if there were
+ *         no accesses.
+ */
+static double
+hit_rate (
+        uint64_t accesses,  ///< The accesses.
+        uint64_t misses     ///< The misses.
+        )
+{
+    return accesses? 100.0 * (accesses - misses) / accesses : 100.0;
+}
+
+
+/**
+ * @internal
+ * Sum up the counters of the accessed addresses by routine.
+ *
+ * @return The sums, indexed by routine, which must be freed, or NULL if
+ *         the allocation failed.
+ */
+static s_cache_counts*
+sum_routines (
+        s_routines* routines    ///< Where to store the routines.
+        )
+{
+    if (!counters_routines (size, routines))
+        return NULL;
+    s_cache_counts* sums = calloc (routines->count, sizeof(s_cache_counts));
+    if (!sums)
+        return NULL;
+
+    for (int32_t a = 0; a < size; a++) {
+        s_cache_counts* r = &sums[routines->of[a]];
+        r->fetches += counts[a].fetches;
+        r->data += counts[a].data;
+        r->l1_misses += counts[a].l1_misses;
+        r->l2_misses += counts[a].l2_misses;
+        r->cycles += counts[a].cycles;
+    }
+    return sums;
+}
+
+
+/**
+ * Print the hits and misses of each cache, the estimated cycles, and
+ * the accesses, hit rates and cycles of each routine. Must be called
+ * before symtable_clear().
+ */
+void
+cache_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The file to print the report to.
+        )
+{
+    if (!counts)
+        return;
+
+    s_routines routines = { NULL, NULL, 0 };
+    int32_t n = 0;
+    s_cache_counts* sums = sum_routines (&routines);
+    int32_t* order = sums? counters_top (sums, sizeof(s_cache_counts),
+            offsetof (s_cache_counts, cycles), routines.count, &n) : NULL;
+    if (!order) {
+        ELOG ("Could not allocate memory for the cache report\n", 0);
+        free (sums);
+        counters_free_routines (&routines);
+        return;
+    }
+
+    fprintf (out, "Caches:\n");
+    fprintf (out, "%-4s %8s %5s %6s %8s %7s %14s %14s %8s\n", "", "Size", "Ways", "Line",
+            "Policy", "Latency", "Hits", "Misses", "Hit rate");
+    static const char* policies[] = { "lru", "fifo", "random" };
+    s_cache* caches[] = { &l1i, &l1d, &l2 };
+    for (int i = 0; i < 3; i++) {
+        s_cache* c = caches[i];
+        if (!c->size)
+            continue;
+        fprintf (out, "%-4s %8u %5u %6u %8s %7u %14llu %14llu %7.2f%%\n", c->name, c->size,
+                c->ways, c->line, policies[c->policy], c->latency,
+                (unsigned long long) c->hits, (unsigned long long) c->misses,
+                hit_rate (c->hits + c->misses, c->misses));
+    }
+    fprintf (out, "Memory latency: %u\n\n", mem_latency);
+
+    uint64_t cycles = 0;
+    for (int32_t r = 0; r < routines.count; r++)
+        cycles += sums[r].cycles;
+    fprintf (out, "Estimated memory cycles: %llu", (unsigned long long) cycles);
+    if (kone->instr_count)
+        fprintf (out, " (%.2f per instruction)", (double) cycles / kone->instr_count);
+    fprintf (out, "\n\n");
+
+    fprintf (out, "Symbols:\n");
+    fprintf (out, "%14s %14s %8s %8s %14s %7s  %s\n", "Fetches", "Data", "L1 hits",
+            l2.size? "L2 hits" : "", "Cycles", "%", "Symbol");
+    for (int32_t i = 0; i < n; i++) {
+        s_cache_counts* c = &sums[order[i]];
+        const char* name = routines.names[order[i]];
+        uint64_t accesses = c->fetches + c->data;
+        fprintf (out, "%14llu %14llu %7.2f%% ", (unsigned long long) c->fetches,
+                (unsigned long long) c->data, hit_rate (accesses, c->l1_misses));
+        if (l2.size)
+            fprintf (out, "%7.2f%% ", hit_rate (c->l1_misses, c->l2_misses));
+        else
+            fprintf (out, "%8s ", "");
+        fprintf (out, "%14llu %6.2f%%  %s\n", (unsigned long long) c->cycles,
+                counters_percent (c->cycles, cycles), name? name : "(unknown)");
+    }
+    fprintf (out, "\n");
+
+    free (order);
+    free (sums);
+    counters_free_routines (&routines);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file cache.h
+ *
+ * The public functions of the cache simulator.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+
+/**
+ * The kinds of memory accesses.
+ */
+typedef enum {
+    CACHE_FETCH,            ///< An instruction fetch.
+    CACHE_READ,             ///< A data read.
+    CACHE_WRITE             ///< A data write.
+} e_cache_access;
+
+
+extern bool cache_init (s_ckone* kone, const char* config);
+extern void cache_free ();
+
+extern void cache_access (int32_t laddr, int32_t paddr, e_cache_access kind);
+
+extern void cache_report (s_ckone* kone, FILE* out);
+
+
+#endif
@@ -0,0 +1,466 @@
+/**
+ * @file callgraph.c
+ *
+ * A call graph profiler. Keeps a shadow call stack which follows the
+ * CALL and EXIT instructions (and interrupts), and counts the instructions
+ * executed in each distinct call path. SVCs appear as leaf calls which
+ * execute one instruction, the SVC itself.
+ *
+ * The call paths form a tree of ::s_cg_node nodes. A node is always
+ * created after its parent, so the tree can be summed up bottom-up by
+ * walking the node array backwards, without recursion. The result can be
+ * written in the folded stack format used by flame graph tools, and as a
+ * summary of the inclusive and exclusive counts of each routine.
+ *
+ * The hooks are called from cpu.c when a call graph file (see ::args)
+ * has been given.
+ */
+
+#include "common.h"
+#include "symtable.h"
+#include "plugin.h"
+
+
+/**
+ * @internal
+ * One call path, i.e. a routine together with the path it was called through.
+ */
+typedef struct {
+    int32_t func;           ///< The routine address, or -1 - n for SVC n.
+    int32_t parent;         ///< The index of the caller node. -1 for the root.
+    int32_t first_child;    ///< The index of the first callee node, or -1.
+    int32_t next_sibling;   ///< The index of the next node with the same parent, or -1.
+    int32_t depth;          ///< The call depth. 0 for the root.
+    bool recursive;         ///< True if the routine is also one of the callers.
+    uint64_t calls;         ///< The number of times the path was entered.
+    uint64_t self;          ///< The number of instructions executed in this routine.
+} s_cg_node;
+
+
+/**
+ * @internal
+ * The call path nodes. The root is at index 0.
+ */
+static s_cg_node* nodes = NULL;
+
+/**
+ * @internal
+ * The number of entries used in ::nodes.
+ */
+static int32_t node_count = 0;
+
+/**
+ * @internal
+ * The number of entries allocated for ::nodes.
+ */
+static int32_t node_cap = 0;
+
+/**
+ * @internal
+ * The node of the routine currently executing.
+ */
+static int32_t current = 0;
+
+/**
+ * @internal
+ * For each address, the number of frames of the routine at that
+ * address currently on the shadow stack.
+ */
+static int32_t* active = NULL;
+
+/**
+ * @internal
+ * For each address, the maximum value ::active has had.
+ */
+static int32_t* max_active = NULL;
+
+/**
+ * @internal
+ * The number of entries in ::active and ::max_active.
+ */
+static int32_t size = 0;
+
+/**
+ * @internal
+ * The maximum call depth seen.
+ */
+static int32_t max_depth = 0;
+
+
+/**
+ * @internal
+ * Add a node to the tree.
+ *
+ * @return The index of the new node, or -1 if out of memory.
+ */
+static int32_t
+add_node (
+        int32_t func,       ///< The routine.
+        int32_t parent      ///< The caller node, or -1 for the root.
+        )
+{
+    if (node_count == node_cap) {
+        int32_t cap = node_cap? 2 * node_cap : 256;
+        s_cg_node* new_nodes = realloc (nodes, cap * sizeof(s_cg_node));
+        if (!new_nodes) {
+            ELOG ("Could not allocate memory for the call graph\n", 0);
+            return -1;
+        }
+        nodes = new_nodes;
+        node_cap = cap;
+    }
+
+    s_cg_node* n = &nodes[node_count];
+    n->func = func;
+    n->parent = parent;
+    n->first_child = -1;
+    n->next_sibling = -1;
+    n->depth = 0;
+    n->recursive = false;
+    n->calls = 0;
+    n->self = 0;
+
+    if (parent >= 0) {
+        n->depth = nodes[parent].depth + 1;
+        n->recursive = func >= 0 && func < size && active[func] > 0;
+        n->next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = node_count;
+    }
+
+    return node_count++;
+}
+
+
+/**
+ * @internal
+ * Find the callee node of the current node for a routine,
+ * creating it if necessary.
+ *
+ * @return The index of the node, or -1 if out of memory.
+ */
+static int32_t
+find_child (
+        int32_t func        ///< The routine.
+        )
+{
+    for (int32_t c = nodes[current].first_child; c >= 0; c = nodes[c].next_sibling)
+        if (nodes[c].func == func)
+            return c;
+    return add_node (func, current);
+}
+
+
+/**
+ * Allocate the call graph. The root node will be the routine at the
+ * current PC. See also callgraph_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+callgraph_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    size = kone->mmu_limit;
+    active = calloc (size, sizeof(int32_t));
+    max_active = calloc (size, sizeof(int32_t));
+    if (!active || !max_active) {
+        ELOG ("Could not allocate memory for the call graph\n", 0);
+        return false;
+    }
+
+    current = add_node (kone->pc, -1);
+    if (current < 0)
+        return false;
+    nodes[current].calls = 1;
+    if (kone->pc >= 0 && kone->pc < size)
+        active[kone->pc] = max_active[kone->pc] = 1;
+    return true;
+}
+
+
+/**
+ * Free the memory allocated by callgraph_init().
+ */
+void
+callgraph_free (
+        void
+        )
+{
+    free (nodes);
+    free (active);
+    free (max_active);
+    nodes = NULL;
+    active = max_active = NULL;
+    node_count = node_cap = size = 0;
+    current = 0;
+    max_depth = 0;
+}
+
+
+/**
+ * Count an instruction for the current routine.
+ */
+void
+callgraph_instr (
+        void
+        )
+{
+    nodes[current].self++;
+}
+
+
+/**
+ * Push a routine onto the shadow stack. Called after a CALL
+ * instruction or an interrupt.
+ */
+void
+callgraph_call (
+        int32_t addr        ///< The address of the called routine.
+        )
+{
+    int32_t c = find_child (addr);
+    if (c < 0)
+        return;
+
+    current = c;
+    nodes[c].calls++;
+    if (nodes[c].depth > max_depth)
+        max_depth = nodes[c].depth;
+
+    if (addr >= 0 && addr < size && ++active[addr] > max_active[addr])
+        max_active[addr] = active[addr];
+}
+
+
+/**
+ * Record an SVC. The SVC instruction itself is moved from the
+ * caller to the SVC node.
+ */
+void
+callgraph_svc (
+        int32_t num         ///< The SVC number.
+        )
+{
+    int32_t c = find_child (-1 - num);
+    if (c < 0)
+        return;
+
+    nodes[c].calls++;
+    nodes[c].self++;
+    nodes[current].self--;
+}
+
+
+/**
+ * Pop a routine off the shadow stack. Called after an EXIT
+ * instruction. An EXIT at the root is ignored.
+ */
+void
+callgraph_exit (
+        void
+        )
+{
+    if (nodes[current].parent < 0)
+        return;
+
+    int32_t func = nodes[current].func;
+    if (func >= 0 && func < size)
+        active[func]--;
+    current = nodes[current].parent;
+}
+
+
+/**
+ * @internal
+ * Write the name of a routine to a buffer: its label, or the SVC name.
+ */
+static void
+func_name (
+        int32_t func,       ///< The routine.
+        char* buffer,       ///< The buffer to write the name to.
+        size_t buf_size     ///< The size of the buffer.
+        )
+{
+    if (func >= 0) {
+        symtable_addr_string (func, buffer, buf_size);
+        return;
+    }
+
+    int32_t num = -1 - func;
+    const char* name = NULL;
+    switch (num) {
+        case 11: name = "HALT"; break;
+        case 12: name = "READ"; break;
+        case 13: name = "WRITE"; break;
+        case 14: name = "TIME"; break;
+        case 15: name = "DATE"; break;
+        case 16: name = "WAIT"; break;
+        default:
+            if (plugin_find_svc (num))
+                name = plugin_find_svc (num)->name;
+            break;
+    }
+
+    if (name)
+        snprintf (buffer, buf_size, "SVC:%s", name);
+    else
+        snprintf (buffer, buf_size, "SVC:%d", num);
+}
+
+
+/**
+ * Write the call paths in the folded stack format: one line per
+ * path, with the routine names separated by semicolons, followed by
+ * the number of instructions executed in the last routine. This is the
+ * input format of flamegraph.pl and similar tools. Must be called
+ * before symtable_clear().
+ */
+void
+callgraph_write_folded (
+        FILE* out           ///< The file to write to.
+        )
+{
+    if (!nodes)
+        return;
+
+    // name every node once
+    char (*names)[64] = malloc (node_count * sizeof(*names));
+    int32_t* path = malloc ((max_depth + 1) * sizeof(int32_t));
+    if (!names || !path) {
+        ELOG ("Could not allocate memory for the call graph output\n", 0);
+        free (names);
+        free (path);
+        return;
+    }
+
+    for (int32_t i = 0; i < node_count; i++)
+        func_name (nodes[i].func, names[i], sizeof(names[i]));
+
+    for (int32_t i = 0; i < node_count; i++) {
+        if (!nodes[i].self)
+            continue;
+
+        int32_t len = 0;
+        for (int32_t n = i; n >= 0; n = nodes[n].parent)
+            path[len++] = n;
+
+        for (int32_t p = len - 1; p >= 0; p--)
+            fprintf (out, "%s%c", names[path[p]], p? ';' : ' ');
+        fprintf (out, "%llu\n", (unsigned long long) nodes[i].self);
+    }
+
+    free (path);
+    free (names);
+}
+
+
+/**
+ * @internal
+ * The totals of one routine in the summary.
+ */
+typedef struct {
+    int32_t func;           ///< The routine.
+    uint64_t inclusive;     ///< The instructions executed in it and its callees.
+    uint64_t exclusive;     ///< The instructions executed in it.
+    uint64_t calls;         ///< The number of calls.
+    int32_t max_recursion;  ///< The maximum number of its frames on the stack.
+} s_cg_func;
+
+
+/**
+ * @internal
+ * Compare two routines by their inclusive counts, highest first.
+ * Used with qsort().
+ *
+ * @return See qsort().
+ */
+static int
+compare_inclusive (
+        const void* a,      ///< The first routine.
+        const void* b       ///< The second routine.
+        )
+{
+    uint64_t ia = ((const s_cg_func*) a)->inclusive;
+    uint64_t ib = ((const s_cg_func*) b)->inclusive;
+    return (ia < ib) - (ia > ib);
+}
+
+
+/**
+ * Print the inclusive and exclusive instruction counts, the number of
+ * calls and the maximum recursion depth of each routine, and statistics
+ * of the call depth. Recursive calls are only counted once towards the
+ * inclusive counts. Must be called before symtable_clear().
+ */
+void
+callgraph_report (
+        FILE* out           ///< The file to print the report to.
+        )
+{
+    if (!nodes)
+        return;
+
+    uint64_t* totals = malloc (node_count * sizeof(uint64_t));
+    s_cg_func* funcs = malloc (node_count * sizeof(s_cg_func));
+    if (!totals || !funcs) {
+        ELOG ("Could not allocate memory for the call graph report\n", 0);
+        free (totals);
+        free (funcs);
+        return;
+    }
+
+    // sum the subtrees; children always come after their parents
+    for (int32_t i = 0; i < node_count; i++)
+        totals[i] = nodes[i].self;
+    for (int32_t i = node_count - 1; i > 0; i--)
+        totals[nodes[i].parent] += totals[i];
+
+    uint64_t weighted_depth = 0;
+    int32_t nf = 0;
+    for (int32_t i = 0; i < node_count; i++) {
+        s_cg_node* n = &nodes[i];
+        weighted_depth += n->self * n->depth;
+
+        int32_t f = 0;
+        while (f < nf && funcs[f].func != n->func)
+            f++;
+        if (f == nf) {
+            funcs[nf].func = n->func;
+            funcs[nf].inclusive = funcs[nf].exclusive = funcs[nf].calls = 0;
+            funcs[nf].max_recursion =
+                (n->func >= 0 && n->func < size)? max_active[n->func] : 1;
+            nf++;
+        }
+
+        funcs[f].exclusive += n->self;
+        funcs[f].calls += n->calls;
+        if (!n->recursive)
+            funcs[f].inclusive += totals[i];
+    }
+    qsort (funcs, nf, sizeof(s_cg_func), compare_inclusive);
+
+    uint64_t total = totals[0];
+    fprintf (out, "Call graph: %llu instructions, %d call paths, maximum call depth %d, "
+            "average call depth %.2f\n\n",
+            (unsigned long long) total, node_count, max_depth,
+            total? (double) weighted_depth / total : 0.0);
+
+    fprintf (out, "%14s %7s %14s %7s %12s %10s  %s\n",
+            "Inclusive", "%", "Exclusive", "%", "Calls", "Recursion", "Routine");
+    for (int32_t f = 0; f < nf; f++) {
+        char name[64];
+        func_name (funcs[f].func, name, sizeof(name));
+        fprintf (out, "%14llu %6.2f%% %14llu %6.2f%% %12llu %10d  %s\n",
+                (unsigned long long) funcs[f].inclusive,
+                total? 100.0 * funcs[f].inclusive / total : 0.0,
+                (unsigned long long) funcs[f].exclusive,
+                total? 100.0 * funcs[f].exclusive / total : 0.0,
+                (unsigned long long) funcs[f].calls,
+                funcs[f].max_recursion, name);
+    }
+    fprintf (out, "\n");
+
+    free (funcs);
+    free (totals);
+}
@@ -0,0 +1,23 @@
+/**
+ * @file callgraph.h
+ *
+ * The public functions of the call graph profiler.
+ */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+
+extern bool callgraph_init (s_ckone* kone);
+extern void callgraph_free ();
+
+extern void callgraph_instr ();
+extern void callgraph_call (int32_t addr);
+extern void callgraph_svc (int32_t num);
+extern void callgraph_exit ();
+
+extern void callgraph_write_folded (FILE* out);
+extern void callgraph_report (FILE* out);
+
+
+#endif
@@ -6,17 +6,46 @@
  * create/destroy the symbol table and symtable_dump() to print the
  * contents of it. To get a textual representation of an instruction,
  * instr_string() is used. The most important, however, is the use of
- * cpu_step() to advance the emulator.
+ * cpu_step() to advance the emulator. When paused, undo_step() and
+ * undo_to_write() are used to go back, and debug_stop() tells when
+ * to pause for a breakpoint or a watchpoint.
  */
 
 #include "common.h"
 #include "instr.h"
 #include "cpu.h"
 #include "symtable.h"
+#include "undo.h"
+#include "debug.h"
+#include "snapshot.h"
+#include "image.h"
+#include "dirty.h"
 #include "args.h"
 #include "config.h"
 
 
+/**
+ * @internal
+ * True if the emulation pauses after every instruction. Set from 
+ * ::args, and changed by the user at a pause.
+ */
+static bool stepping = false;
+
+/**
+ * @internal
+ * True if the emulation can pause (stepping mode, the undo log, 
+ * breakpoints or watchpoints), so the dumps show the next instruction.
+ */
+static bool interactive = false;
+
+/**
+ * @internal
+ * The dirty page epoch of the last memory dump, or 0 before the first 
+ * dump. Only used with the dump-changes option (see ::args).
+ */
+static uint32_t dump_epoch = 0;
+
+
 /**
  * Initializes the ckone. Allocates memory and resets the CPU.
  * If the zero flag (see ::args) is set, it will also zero all 
@@ -50,12 +79,17 @@ ckone_init (
     }
 
     kone->mem_size = args.mem_size;
+    kone->mem_mapped = false;
     kone->mmu_base = args.mmu_base;
     kone->mmu_limit = args.mmu_limit;
 
     kone->pc = 0;
     kone->sr = 0;
     kone->halted = false;
+    kone->instr_count = 0;
+    kone->ivec = 0;
+    kone->timer_period = 0;
+    kone->timer_left = 0;
 
     return true;
 }
@@ -208,7 +242,8 @@ ckone_load (
 
 
 /**
- * Frees all memory allocated by ckone_init() and ckone_load().
+ * Frees all memory allocated by ckone_init() and ckone_load(), or
+ * the mapping made by image_map().
  */
 void 
 ckone_free (
@@ -216,21 +251,155 @@ ckone_free (
         ) 
 {
     symtable_clear ();
+    image_unmap (kone);
 
-    if (kone->mem)
-        free (kone->mem);
-
-    kone->mem = NULL;
     kone->mem_size = 0;
     kone->mmu_limit = 0;
 }
 
 
+/**
+ * @internal
+ * The size of the memory dump output buffer.
+ */
+#define DUMP_BUFFER_SIZE 65536
+
+/**
+ * @internal
+ * The memory dump output buffer. The rows are formatted here and
+ * written out in large blocks instead of with printf() for each word.
+ */
+static struct {
+    char data[DUMP_BUFFER_SIZE];    ///< The formatted text.
+    size_t len;                     ///< The number of bytes used.
+} out;
+
+
+/**
+ * @internal
+ * Write out the memory dump output buffer.
+ */
+static void
+out_flush (
+        void
+        )
+{
+    fwrite (out.data, 1, out.len, stdout);
+    out.len = 0;
+}
+
+
+/**
+ * @internal
+ * Append a string to the memory dump output buffer.
+ */
+static void
+out_string (
+        const char* str     ///< The string.
+        )
+{
+    for (; *str; str++) {
+        if (out.len == DUMP_BUFFER_SIZE)
+            out_flush ();
+        out.data[out.len++] = *str;
+    }
+}
+
+
+/**
+ * @internal
+ * Append a decimal number, right-aligned in a field, to the memory
+ * dump output buffer. The same as printf() with "%*lld".
+ */
+static void
+out_dec (
+        int64_t value,      ///< The number.
+        int width           ///< The width of the field.
+        )
+{
+    char digits[24];
+    int n = 0;
+    uint64_t abs = value < 0? -(uint64_t) value : (uint64_t) value;
+    do {
+        digits[n++] = '0' + abs % 10;
+        abs /= 10;
+    } while (abs);
+    if (value < 0)
+        digits[n++] = '-';
+
+    if (out.len + width + n > DUMP_BUFFER_SIZE)
+        out_flush ();
+    for (int i = n; i < width; i++)
+        out.data[out.len++] = ' ';
+    while (n > 0)
+        out.data[out.len++] = digits[--n];
+}
+
+
+/**
+ * @internal
+ * Append a number as "0x" and eight hexadecimal digits to the memory
+ * dump output buffer. The same as printf() with "0x%08x".
+ */
+static void
+out_hex (
+        uint32_t value      ///< The number.
+        )
+{
+    static const char hex[] = "0123456789abcdef";
+    if (out.len + 10 > DUMP_BUFFER_SIZE)
+        out_flush ();
+    out.data[out.len++] = '0';
+    out.data[out.len++] = 'x';
+    for (int shift = 28; shift >= 0; shift -= 4)
+        out.data[out.len++] = hex[(value >> shift) & 0xf];
+}
+
+
+/**
+ * @internal
+ * Write the memory as little-endian words to the file given with the
+ * dump-binary option.
+ */
+static void
+dump_binary (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    FILE* f = fopen (args.dump_binary, "wb");
+    if (!f) {
+        ELOG ("Cannot open %s for writing\n", args.dump_binary);
+        return;
+    }
+
+    unsigned char buf[4096];
+    size_t len = 0;
+    for (int32_t i = 0; i < kone->mem_size; i++) {
+        uint32_t word = kone->mem[i];
+        for (int b = 0; b < 4; b++)
+            buf[len++] = word >> (8 * b);
+        if (len == sizeof(buf)) {
+            fwrite (buf, 1, len, f);
+            len = 0;
+        }
+    }
+    fwrite (buf, 1, len, f);
+
+    if (fclose (f))
+        ELOG ("Could not write %s\n", args.dump_binary);
+}
+
+
 /**
  * @internal
  * Print the contents of the emulator memory. The number of columns
  * and the number base is determined by command line arguments and
- * a compile-time option (DEFAULT_MEMDUMP_BASE).
+ * a compile-time option (DEFAULT_MEMDUMP_BASE). With the dump-changes
+ * option, the rows which have not been written since the previous dump
+ * are left out (see dirty.c). With the dump-sparse option, a run of rows
+ * equal to the row before them is shown as a single "*" row, like
+ * hexdump does. With the dump-binary option, the memory is written to
+ * a file instead.
  */
 static void 
 ckone_dump_memory (
@@ -245,6 +414,12 @@ ckone_dump_memory (
             kone->mmu_base, kone->mmu_base + kone->mmu_limit - 1,
             kone->mmu_base, kone->mmu_base + kone->mmu_limit - 1);
 
+    if (args.dump_binary) {
+        dump_binary (kone);
+        printf ("Memory written to %s\n", args.dump_binary);
+        return;
+    }
+
 
     // choose the number base based on both a compile-time option
     // and a command line argument
@@ -270,23 +445,57 @@ ckone_dump_memory (
     printf ("\n");
 
     // table contents
-    for (int32_t i = 0; i < kone->mem_size; i++) {
-        if (i % cols == 0) {        // the location of the first row entry
-            if (base == 10)
-                printf ("%10u |", i);
-            else
-                printf ("0x%08x |", i);
+    bool changes = args.dump_changes && dump_epoch;
+    int32_t unchanged = 0;
+    bool prev_shown = false, starred = false;
+    for (int32_t row = 0; row < kone->mem_size; row += cols) {
+        int32_t end = row + cols;
+        if (end > kone->mem_size)
+            end = kone->mem_size;
+
+        if (changes && !dirty_range (row, cols, dump_epoch)) {
+            unchanged++;
+            prev_shown = false;
+            continue;
         }
 
-        if (base == 10)
-            printf (" %11d", kone->mem[i]);
-        else
-            printf ("  0x%08x", kone->mem[i]);
+        // the last row is always shown, so the end of the memory is seen
+        if (args.dump_sparse && prev_shown && end == row + cols && end < kone->mem_size
+                && !memcmp (kone->mem + row, kone->mem + row - cols, cols * sizeof(int32_t))) {
+            if (!starred)
+                out_string ("*\n");
+            starred = true;
+            continue;
+        }
+        starred = false;
+        prev_shown = true;
+
+        // the location of the first row entry
+        if (base == 10) {
+            out_dec (row, 10);
+            out_string (" |");
+        } else {
+            out_hex (row);
+            out_string (" |");
+        }
 
-        // newline after the last entry in the row
-        if ((i % cols == cols - 1) || (i == kone->mem_size - 1))
-            printf ("\n");
+        for (int32_t i = row; i < end; i++) {
+            if (base == 10) {
+                out_string (" ");
+                out_dec (kone->mem[i], 11);
+            } else {
+                out_string ("  ");
+                out_hex (kone->mem[i]);
+            }
+        }
+        out_string ("\n");
     }
+    out_flush ();
+
+    if (unchanged)
+        printf ("(%d unchanged rows not shown)\n", unchanged);
+    if (args.dump_changes)
+        dump_epoch = dirty_clear ();
 }
 
 
@@ -358,7 +567,7 @@ ckone_dump_registers (
 /**
  * @internal
  * Print the current state. Prints the registers, the
- * next instruction (if in stepping mode), the symbol
+ * next instruction (if the emulation can pause), the symbol
  * table (if enabled by a command line argument), and
  * the memory contents.
  */
@@ -371,7 +580,7 @@ ckone_dump (
     ckone_dump_registers (kone);
 
     // In stepping mode, print also the next instruction (not the current)
-    if (args.step) {
+    if (interactive) {
         char buf[1024];
         if (!kone->halted && kone->pc >= 0 && kone->pc < kone->mmu_limit)
             instr_string (kone->mem[kone->mmu_base + kone->pc], buf, sizeof(buf));
@@ -393,19 +602,54 @@ ckone_dump (
 
 /**
  * @internal
- * Pause execution after an instruction. The user can either continue
- * to the next instruction, show the symbol table, or quit.
+ * Go back to the last write to an address given by the user, as a
+ * number or a symbol.
+ */
+static void 
+reverse_to_write (
+        s_ckone* kone,          ///< The state structure.
+        char* arg               ///< The address.
+        ) 
+{
+    int32_t addr;
+    arg[strcspn (arg, "\n")] = '\0';
+    if (!debug_parse_addr (arg, &addr)) {
+        printf ("\nUnknown address: %s\n", arg);
+        return;
+    }
+
+    uint64_t count = kone->instr_count;
+    if (undo_to_write (kone, addr))
+        printf ("\nWent back %llu instructions; the next instruction writes to %d.\n",
+                (unsigned long long) (count - kone->instr_count), addr);
+    else
+        printf ("\nNo write to %d in the undo log; went back %llu instructions.\n", 
+                addr, (unsigned long long) (count - kone->instr_count));
+    ckone_dump (kone);
+}
+
+
+/**
+ * @internal
+ * Pause execution after an instruction. The user can either execute
+ * the next instruction, continue until the next breakpoint, show the 
+ * symbol table, save a snapshot, or quit. If the undo log is on, the 
+ * user can also step back, or go back to the last write to an address.
  *
  * @return True if the simulation should continue.
  */
 static bool 
 pause (
-        void
+        s_ckone* kone           ///< The state structure.
         ) 
 {
+    log_flush ();
     while (true) {
-        printf ("Type enter to execute the next instruction, \"s\" to show\n"
-                "the symbol table, or \"q\" to quit: ");
+        printf ("Type enter to execute the next instruction, \"c\" to continue,\n");
+        if (args.undo_size)
+            printf ("\"b\" to step back, \"w ADDR\" to go back to the last write to ADDR,\n");
+        printf ("\"save FILE\" to save a snapshot, \"s\" to show the symbol table,\n"
+                "or \"q\" to quit: ");
 
         char buf[1024];
         if (!fgets (buf, sizeof (buf), stdin)) {
@@ -413,8 +657,15 @@ pause (
             return false;
         }
 
-        if (!strcmp (buf, "\n"))
+        if (!strcmp (buf, "\n")) {
+            stepping = true;
             return true;
+        }
+
+        if (!strcmp (buf, "c\n")) {
+            stepping = false;
+            return true;
+        }
 
         if (!strcmp (buf, "s\n")) {
             printf ("\n");
@@ -422,6 +673,22 @@ pause (
             printf ("\n");
         }
 
+        if (args.undo_size && !strcmp (buf, "b\n")) {
+            if (undo_step (kone))
+                ckone_dump (kone);
+            else
+                printf ("\nThe undo log is empty.\n\n");
+        }
+
+        if (args.undo_size && !strncmp (buf, "w ", 2))
+            reverse_to_write (kone, buf + 2);
+
+        if (!strncmp (buf, "save ", 5)) {
+            buf[strcspn (buf, "\n")] = '\0';
+            if (snapshot_save (kone, buf + 5))
+                printf ("\nSaved a snapshot to %s.\n\n", buf + 5);
+        }
+
         if (!strcmp (buf, "q\n"))
             return false;
     }
@@ -429,43 +696,88 @@ pause (
 
 
 /**
- * Start emulation. The emulation will run until an error occurs
- * or the CPU halts. If stepping mode is on, the emulation will pause
- * between every instruction. In this case the user can also choose
- * to quit at any time the emulation has paused.
+ * @internal
+ * Run until an error occurs or the CPU halts, pausing between 
+ * instructions in stepping mode and at breakpoints and watchpoints,
+ * and saving the periodic snapshots.
  *
  * @return EXIT_FAILURE if something went wrong, EXIT_SUCCESS otherwise.
  */
-int 
-ckone_run (
+static int 
+run (
         s_ckone* kone       ///< The state structure.
         ) 
 {
-    ILOG ("Running program...\n", 0);
-    if (args.step) {
-        ckone_dump (kone);
-        if (!pause ())
-            return EXIT_FAILURE;
-    }
+    bool debugging = args.break_count || args.watch_count;
+    bool dumped = false;
 
     while (!kone->halted) {
         if (!cpu_step (kone)) {
             ILOG ("Execution stopped.\n", 0);
-            ckone_dump (kone);
+            if (!args.no_dump)
+                ckone_dump (kone);
             return EXIT_FAILURE;
         }
-        if (args.step) {
+
+        if (args.snapshot_interval && kone->instr_count % args.snapshot_interval == 0)
+            snapshot_checkpoint (kone, args.snapshot_file);
+
+        bool stop = debugging && debug_stop (kone);
+        dumped = stepping || stop;
+        if (dumped) {
             ckone_dump (kone);
             if (!kone->halted)
-                if (!pause ())
+                if (!pause (kone))
                     return EXIT_FAILURE;
         }
     }
 
-    // in stepping mode, this was already done
-    if (!args.step)
+    // if paused after the last instruction, this was already done
+    if (!dumped && !args.no_dump)
         ckone_dump (kone);
 
     return EXIT_SUCCESS;
 }
 
+
+/**
+ * Start emulation. The emulation will run until an error occurs
+ * or the CPU halts. If stepping mode is on, the emulation will pause
+ * between every instruction. In this case the user can also choose
+ * to quit at any time the emulation has paused. The emulation also
+ * pauses at breakpoints and watchpoints. If the undo log is
+ * on, the emulation also pauses when it stops, so that the user can
+ * go back and continue from an earlier point.
+ *
+ * @return EXIT_FAILURE if something went wrong, EXIT_SUCCESS otherwise.
+ */
+int 
+ckone_run (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    ILOG ("Running program...\n", 0);
+    stepping = args.step;
+    interactive = args.step || args.undo_size || args.break_count || args.watch_count;
+
+    // run() only checks after each instruction, so check the first one here
+    bool stop = (args.break_count || args.watch_count) && debug_stop (kone);
+    if (args.step || stop) {
+        ckone_dump (kone);
+        if (!pause (kone))
+            return EXIT_FAILURE;
+    }
+
+    while (true) {
+        int retval = run (kone);
+        if (!args.undo_size || !undo_count ())
+            return retval;
+
+        // stop unless the user went back
+        uint64_t count = kone->instr_count;
+        printf ("The program %s after %llu instructions.\n", 
+                kone->halted? "halted" : "stopped", (unsigned long long) count);
+        if (!pause (kone) || kone->instr_count == count)
+            return retval;
+    }
+}
@@ -63,9 +63,33 @@ typedef struct {
     /// The memory array.
     int32_t* mem;               
 
+    /// True if the memory array is a private mapping of a shared
+    /// image (see image.c) instead of being allocated with malloc().
+    bool mem_mapped;
+
 
     /// True if the machine has halted.
     bool halted;                
+
+    /// The number of instructions executed.
+    uint64_t instr_count;
+
+
+    /// The interrupt vector. An interrupt calls the routine at this 
+    /// address. Set through the IVEC device.
+    int32_t ivec;
+
+    /// The timer period in instructions. Zero if the timer is stopped.
+    /// Set through the TIMER device.
+    int32_t timer_period;
+
+    /// The number of instructions left until the timer expires.
+    int32_t timer_left;
+
+
+    /// The instruction mix counters (see mix.c), or NULL if the mix
+    /// is not collected.
+    struct mix_counts* mix;
 } s_ckone;
 
 
@@ -106,7 +130,8 @@ enum e_status_bits {
     SR_M = 1 << 25,         
                             
 
-    /// Device interrupt (unused)
+    /// Device interrupt. Set when the timer expires and cleared
+    /// when the interrupt is taken.
     SR_I = 1 << 24,         
 
     /// Supervisor call (unused)
@@ -115,10 +140,15 @@ enum e_status_bits {
     /// Priviledged mode (unused)
     SR_P = 1 << 22,         
 
-    /// Interrupts disabled (unused)
+    /// Interrupts disabled. Set when an interrupt is taken; the
+    /// handler enables interrupts again through the PIC device.
     SR_D = 1 << 21,         
 };
 
 
+/// The status register bits which stop the execution.
+#define SR_FAULTS (SR_O | SR_Z | SR_U | SR_M)
+
+
 #endif
 
@@ -0,0 +1,228 @@
+/**
+ * @file counters.c
+ *
+ * The per-address counters shared by the profilers (prof.c, sample.c) and
+ * the simulators (cache.c, branch.c). Each of them keeps its counters in
+ * a flat array indexed by the logical address, so counting is cheap, with
+ * an extra last entry for the accesses made when the address is out of
+ * bounds (see COUNTERS_INDEX()).
+ *
+ * For the reports, the addresses are divided into routines by the labels
+ * of the symbol table, the addresses or routines with the highest counts
+ * are sorted first, and the addresses are named and disassembled. The
+ * names come from the symbol table, so the reports must be made before
+ * symtable_clear().
+ */
+
+#include "common.h"
+#include "instr.h"
+#include "symtable.h"
+#include "counters.h"
+
+
+/**
+ * @internal
+ * The sort key of one entry.
+ */
+typedef struct {
+    uint64_t key;           ///< The count to sort by.
+    int32_t index;          ///< The index of the entry.
+} s_counters_key;
+
+
+/**
+ * Allocate the counters of the addresses from 0 to MMU_LIMIT and the extra
+ * entry for the addresses out of bounds. The program must have been loaded.
+ *
+ * @return The zeroed counters, which must be freed, or NULL if the
+ *         allocation failed.
+ */
+void*
+counters_alloc (
+        s_ckone* kone,      ///< The state structure.
+        size_t elem_size,   ///< The size of the counters of one address.
+        int32_t* size       ///< Where to store the number of addresses,
+                            ///< not including the extra entry.
+        )
+{
+    DLOG ("Allocating counters for %d addresses...\n", kone->mmu_limit);
+    *size = kone->mmu_limit;
+    return calloc (*size + 1, elem_size);
+}
+
+
+/**
+ * Divide the addresses into routines by the labels of the symbol table,
+ * so that the routine of an address can be found without looking at the
+ * symbols. Walks down from the top of the memory, looking up the label
+ * of the address just below the previous label, and numbers the routines
+ * in the order of their addresses. See also counters_free_routines().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+counters_routines (
+        int32_t size,           ///< The number of addresses.
+        s_routines* routines    ///< Where to store the routines.
+        )
+{
+    int32_t cap = 16;
+    routines->of = malloc ((size + 1) * sizeof(int32_t));
+    routines->names = malloc (cap * sizeof(const char*));
+    routines->count = 1;
+    if (!routines->of || !routines->names)
+        return false;
+    routines->names[0] = NULL;
+    routines->of[size] = 0;
+
+    int32_t end = size;
+    while (end > 0) {
+        char* name = NULL;
+        int32_t offset = 0;
+        int32_t id = 0;
+        if (symtable_lookup_addr (end - 1, &name, &offset)) {
+            if (routines->count == cap) {
+                cap *= 2;
+                const char** names = realloc (routines->names, cap * sizeof(const char*));
+                if (!names)
+                    return false;
+                routines->names = names;
+            }
+            id = routines->count++;
+            routines->names[id] = name;
+        } else
+            offset = end - 1;
+
+        int32_t start = end - 1 - offset;
+        for (int32_t a = start; a < end; a++)
+            routines->of[a] = id;
+        end = start;
+    }
+
+    // number the routines in the order of their addresses
+    int32_t last = routines->count;
+    for (int32_t a = 0; a < size; a++)
+        if (routines->of[a])
+            routines->of[a] = last - routines->of[a];
+    for (int32_t i = 1, j = last - 1; i < j; i++, j--) {
+        const char* name = routines->names[i];
+        routines->names[i] = routines->names[j];
+        routines->names[j] = name;
+    }
+    return true;
+}
+
+
+/**
+ * Free the routines found by counters_routines().
+ */
+void
+counters_free_routines (
+        s_routines* routines    ///< The routines.
+        )
+{
+    free (routines->of);
+    free (routines->names);
+    routines->of = NULL;
+    routines->names = NULL;
+    routines->count = 0;
+}
+
+
+/**
+ * @internal
+ * Compare two keys, highest first and then by the index. Used with qsort().
+ *
+ * @return See qsort().
+ */
+static int
+compare_keys (
+        const void* a,      ///< The first key.
+        const void* b       ///< The second key.
+        )
+{
+    const s_counters_key* ka = a;
+    const s_counters_key* kb = b;
+    if (ka->key != kb->key)
+        return ka->key < kb->key? 1 : -1;
+    return ka->index - kb->index;
+}
+
+
+/**
+ * Sort the entries of an array of counters by one of the counters,
+ * highest first. The entries whose counter is 0 are left out.
+ *
+ * @return The indices of the entries, which must be freed, or NULL if
+ *         the allocation failed.
+ */
+int32_t*
+counters_top (
+        const void* counts, ///< The counters.
+        size_t elem_size,   ///< The size of one entry.
+        size_t key_offset,  ///< The offset of the @c uint64_t counter to sort by.
+        int32_t size,       ///< The number of entries.
+        int32_t* found      ///< Where to store the number of indices returned.
+        )
+{
+    s_counters_key* keys = malloc ((size + 1) * sizeof(s_counters_key));
+    int32_t* order = malloc ((size + 1) * sizeof(int32_t));
+    if (!keys || !order) {
+        free (keys);
+        free (order);
+        return NULL;
+    }
+
+    int32_t n = 0;
+    for (int32_t i = 0; i < size; i++) {
+        uint64_t key;
+        memcpy (&key, (const char*) counts + i * elem_size + key_offset, sizeof(key));
+        if (key) {
+            keys[n].key = key;
+            keys[n].index = i;
+            n++;
+        }
+    }
+    qsort (keys, n, sizeof(s_counters_key), compare_keys);
+
+    for (int32_t i = 0; i < n; i++)
+        order[i] = keys[i].index;
+    free (keys);
+    *found = n;
+    return order;
+}
+
+
+/**
+ * Calculate a percentage.
+ *
+ * @return 100 * part / total, or 0 if total is 0.
+ */
+double
+counters_percent (
+        uint64_t part,      ///< The part.
+        uint64_t total      ///< The total.
+        )
+{
+    return total? 100.0 * part / total : 0.0;
+}
+
+
+/**
+ * Name an address after the nearest preceding label (see
+ * symtable_addr_string()) and disassemble the instruction in it
+ * from the current memory contents.
+ */
+void
+counters_describe (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr,       ///< The logical address.
+        char* sym,          ///< The buffer for the name.
+        size_t sym_size,    ///< The size of @p sym.
+        char* instr,        ///< The buffer for the instruction.
+        size_t instr_size   ///< The size of @p instr.
+        )
+{
+    symtable_addr_string (addr, sym, sym_size);
+    instr_string (kone->mem[kone->mmu_base + addr], instr, instr_size);
+}
@@ -0,0 +1,44 @@
+/**
+ * @file counters.h
+ *
+ * The public functions of the per-address counters shared by the
+ * profilers and the simulators.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+
+/**
+ * The index of an address in an array allocated by counters_alloc():
+ * the address itself, or the extra last entry if it is out of bounds.
+ */
+#define COUNTERS_INDEX(addr, size) ((uint32_t) (addr) < (uint32_t) (size)? (addr) : (size))
+
+
+/**
+ * The routines of a program. Each address belongs to the routine named
+ * by the nearest label at or before it.
+ */
+typedef struct {
+    int32_t* of;            ///< The routine of each address, as an index to
+                            ///< s_routines::names; the extra last entry is 0.
+    const char** names;     ///< The names of the routines. The first one is NULL
+                            ///< and stands for the addresses before the first label.
+    int32_t count;          ///< The number of routines.
+} s_routines;
+
+
+extern void* counters_alloc (s_ckone* kone, size_t elem_size, int32_t* size);
+
+extern bool counters_routines (int32_t size, s_routines* routines);
+extern void counters_free_routines (s_routines* routines);
+
+extern int32_t* counters_top (const void* counts, size_t elem_size, size_t key_offset,
+        int32_t size, int32_t* found);
+extern double counters_percent (uint64_t part, uint64_t total);
+extern void counters_describe (s_ckone* kone, int32_t addr, char* sym, size_t sym_size,
+        char* instr, size_t instr_size);
+
+
+#endif
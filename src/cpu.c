@@ -11,10 +11,18 @@
  */
 
 #include "common.h"
+#include "cpu.h"
 #include "instr.h"
 #include "alu.h"
 #include "mmu.h"
 #include "ext.h"
+#include "prof.h"
+#include "mix.h"
+#include "live.h"
+#include "branch.h"
+#include "callgraph.h"
+#include "trace.h"
+#include "undo.h"
 #include "args.h"
 
 
@@ -33,13 +41,12 @@ cpu_fetch_instr (
 {
     DLOG ("Fetching instruction...\n", 0);
     kone->mar = kone->pc++;
-    mmu_read (kone);
+    mmu_fetch (kone);
     kone->ir = kone->mbr;
 }
 
 
 /**
- * @internal
  * Calculates the second operand for the current instruction 
  * and stores it to the TR register.
  *
@@ -47,7 +54,7 @@ cpu_fetch_instr (
  *
  * Affected status bits: ::SR_O, ::SR_M, ::SR_U
  */
-static void 
+void 
 cpu_calculate_second_operand (
         s_ckone* kone       ///< The state structure.
         ) 
@@ -241,8 +248,13 @@ cpu_exec_jump (
         default: ELOG ("We should never get here", 0); break;
     }
 
-    if (jump)
+    if (args.branch)
+        branch_jump (kone, jump);
+    if (jump) {
         kone->pc = kone->tr;
+        if (kone->mix)
+            mix_taken (kone);
+    }
 }
 
 
@@ -310,7 +322,12 @@ cpu_exec_call (
         ) 
 {
     push_pc_fp (kone, instr_first_operand (kone->ir));
+    if (args.branch)
+        branch_call (kone->pc);
     kone->pc = kone->tr;
+
+    if (args.callgraph_file)
+        callgraph_call (kone->pc);
 }
 
 
@@ -328,8 +345,14 @@ cpu_exec_exit (
         ) 
 {
     e_register sp = instr_first_operand (kone->ir);
+    int32_t site = kone->pc - 1;
     pop_fp_pc (kone, sp);
     kone->r[sp] -= kone->tr;    // remove parameters from stack
+
+    if (args.callgraph_file)
+        callgraph_exit ();
+    if (args.branch)
+        branch_exit (site, kone->pc);
 }
 
 
@@ -458,6 +481,11 @@ cpu_exec_svc (
     push_pc_fp (kone, sp);
     DLOG ("FP is now 0x%x\n", kone->r[FP]);
 
+    if (args.callgraph_file)
+        callgraph_svc (kone->tr);
+    if (kone->mix)
+        mix_svc (kone, kone->tr);
+
     uint32_t params = ext_svc (kone);
 
     if (!kone->halted) {
@@ -467,6 +495,35 @@ cpu_exec_svc (
 }
 
 
+/**
+ * @internal
+ * Take an interrupt. This works like a CALL through SP to the
+ * interrupt vector, except that interrupts are also disabled. The
+ * handler should enable them again (see the PIC device in ext.c)
+ * before returning with EXIT.
+ *
+ * Affects: MAR, MBR, SP, FP, PC
+ *
+ * Affected status bits: ::SR_I, ::SR_D, ::SR_M
+ */
+static void 
+cpu_interrupt (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    DLOG ("Interrupt; calling handler at 0x%x\n", kone->ivec);
+    kone->sr &= ~SR_I;
+    kone->sr |= SR_D;
+    push_pc_fp (kone, SP);
+    if (args.branch)
+        branch_call (kone->pc);
+    kone->pc = kone->ivec;
+
+    if (args.callgraph_file)
+        callgraph_call (kone->pc);
+}
+
+
 /**
  * @internal
  * Execute the current instruction. Assumes that the instruction has been
@@ -512,32 +569,55 @@ cpu_execute_instruction (
 
 
 /**
+ * @internal
  * Perform one execution cycle. Fetch the next instruction, 
- * calculate its second operand, and execute it.
+ * calculate its second operand, and execute it. If the timer is
+ * running, advance it and take an interrupt if one is due.
  *
  * @return True if everything succeeded.
  */
-bool 
-cpu_step (
+static bool 
+cpu_cycle (
         s_ckone* kone       ///< The state structure.
         ) 
 {
+    if (args.profile)
+        prof_fetch (kone);
+    if (args.live && !(kone->instr_count & LIVE_MASK))
+        live_update (kone);
+
     cpu_fetch_instr (kone);
     if (kone->sr & SR_M)
         return false;
 
-    char buf[1024];
-    instr_string (kone->ir, buf, sizeof(buf));
-    ILOG ("Executing %s\n", buf);
+    kone->instr_count++;
+    if (args.profile)
+        prof_instr (kone);
+    if (kone->mix)
+        mix_instr (kone);
+    if (args.callgraph_file)
+        callgraph_instr ();
+
+    if (args.verbosity >= 1) {
+        char buf[1024];
+        instr_string (kone->ir, buf, sizeof(buf));
+        ILOG ("Executing %s\n", buf);
+    }
 
     cpu_calculate_second_operand (kone);
     if (kone->sr & (SR_O | SR_M | SR_U))
         return false;
     
     cpu_execute_instruction (kone);
-    if (kone->sr & ~(SR_L | SR_E | SR_G))
+    if (kone->sr & SR_FAULTS)
         return false;
 
+    if (kone->timer_period && !kone->halted && ext_timer_tick (kone)) {
+        cpu_interrupt (kone);
+        if (kone->sr & SR_M)
+            return false;
+    }
+
     if (args.step)
         ILOG ("Instruction finished.\n", 0);
     else
@@ -546,3 +626,37 @@ cpu_step (
     return true;
 }
 
+
+
+/**
+ * Perform one execution cycle (see cpu_cycle()). If a trace
+ * is being recorded, the cycle is also written to the trace, and 
+ * if the undo log is on, the changes made are recorded in it.
+ *
+ * @return True if everything succeeded.
+ */
+bool 
+cpu_step (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    if (!args.trace_file && !args.undo_size && !kone->mix && !args.live)
+        return cpu_cycle (kone);
+
+    if (args.trace_file)
+        trace_begin (kone);
+    if (args.undo_size)
+        undo_begin (kone);
+
+    bool ok = cpu_cycle (kone);
+    if (!ok && kone->mix)
+        mix_fault (kone);
+    if (!ok && args.live)
+        live_fault (kone);
+
+    if (args.undo_size)
+        undo_end (kone);
+    if (args.trace_file)
+        trace_end (kone);
+    return ok;
+}
@@ -9,6 +9,7 @@
 
 
 extern bool cpu_step (s_ckone* kone);
+extern void cpu_calculate_second_operand (s_ckone* kone);
 
 
 #endif
@@ -0,0 +1,337 @@
+/**
+ * @file debug.c
+ *
+ * Breakpoints and watchpoints. A breakpoint stops the emulation before
+ * the instruction at its address is executed, and a watchpoint stops it
+ * after an instruction has written to its address. The emulation runs
+ * at full speed until then: the breakpoints are a bitmap indexed by the
+ * PC, and a write only has to look for a watchpoint if it goes to a
+ * page of ::WATCH_PAGE_SIZE words which contains one.
+ *
+ * The addresses are given with the @c --break and @c --watch options
+ * (see ::args) as numbers or symbols, and resolved through symtable.c
+ * by debug_init() once the program has been loaded. More can be set
+ * and cleared later by the GDB stub (gdb.c). debug_write() is called 
+ * from mmu.c, and debug_stop() from the main loop in ckone.c.
+ */
+
+#include <ctype.h>
+#include "common.h"
+#include "debug.h"
+#include "symtable.h"
+#include "args.h"
+
+
+/**
+ * @internal
+ * The watchpoint page size in words is 1 << WATCH_PAGE_BITS.
+ */
+#define WATCH_PAGE_BITS 8
+
+/**
+ * @internal
+ * The watchpoint page size in words.
+ */
+#define WATCH_PAGE_SIZE (1 << WATCH_PAGE_BITS)
+
+
+/**
+ * @internal
+ * One bit per logical address. A set bit means there is a breakpoint.
+ */
+static uint8_t* breaks = NULL;
+
+/**
+ * @internal
+ * The number of bits in ::breaks.
+ */
+static int32_t break_size = 0;
+
+/**
+ * @internal
+ * One counter per page of physical memory: the number of watchpoints 
+ * in the page.
+ */
+static uint8_t* watch_pages = NULL;
+
+/**
+ * @internal
+ * The physical addresses of the watchpoints.
+ */
+static int32_t watches[MAX_WATCHPOINTS];
+
+/**
+ * @internal
+ * The number of entries used in ::watches.
+ */
+static int watch_count = 0;
+
+/**
+ * @internal
+ * The number of pages in ::watch_pages.
+ */
+static int32_t page_count = 0;
+
+/**
+ * @internal
+ * The last watchpoint hit, which has not been reported yet.
+ */
+static struct {
+    bool hit;               ///< True if a watchpoint has been hit.
+    int32_t addr;           ///< The logical address written.
+    int32_t old_value;      ///< The value before the write.
+    int32_t new_value;      ///< The value written.
+} watch_hit;
+
+
+/**
+ * Parse an address given by the user. It can be a number or
+ * the name of a symbol in the symbol table.
+ *
+ * @return False if the address is not a number or a known symbol.
+ */
+bool
+debug_parse_addr (
+        const char* str,    ///< The address.
+        int32_t* addr       ///< Where to store the address.
+        )
+{
+    char* end;
+    long value = strtol (str, &end, 0);
+    if (end != str && *end == '\0') {
+        *addr = (int32_t) value;
+        return true;
+    }
+
+    // the symbols are stored in lower case
+    char name[1024];
+    size_t len = strlen (str);
+    if (len == 0 || len >= sizeof(name))
+        return false;
+    for (size_t i = 0; i <= len; i++)
+        name[i] = tolower ((unsigned char) str[i]);
+
+    int value_int;
+    if (!symtable_lookup (name, &value_int))
+        return false;
+    *addr = value_int;
+    return true;
+}
+
+
+/**
+ * Allocate the breakpoint and watchpoint tables and resolve the
+ * addresses given in ::args. Must be called after the program has
+ * been loaded. See also debug_free().
+ *
+ * @return False if an address is invalid or the allocation failed.
+ */
+bool
+debug_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    break_size = kone->mmu_limit;
+    page_count = (kone->mem_size >> WATCH_PAGE_BITS) + 1;
+    breaks = calloc ((break_size + 7) / 8, 1);
+    watch_pages = calloc (page_count, 1);
+    if (!breaks || !watch_pages) {
+        ELOG ("Could not allocate memory for the breakpoints\n", 0);
+        return false;
+    }
+
+    for (int i = 0; i < args.break_count; i++) {
+        int32_t addr;
+        if (!debug_parse_addr (args.breaks[i], &addr)) {
+            ELOG ("Unknown breakpoint address: %s\n", args.breaks[i]);
+            return false;
+        }
+        if (!debug_set_break (addr, true)) {
+            ELOG ("The breakpoint %s is outside the program memory\n", args.breaks[i]);
+            return false;
+        }
+        ILOG ("Breakpoint at %d\n", addr);
+    }
+
+    watch_count = 0;
+    for (int i = 0; i < args.watch_count; i++) {
+        int32_t addr;
+        if (!debug_parse_addr (args.watches[i], &addr)) {
+            ELOG ("Unknown watchpoint address: %s\n", args.watches[i]);
+            return false;
+        }
+        if (!debug_set_watch (kone, addr, true)) {
+            ELOG ("The watchpoint %s is outside the program memory\n", args.watches[i]);
+            return false;
+        }
+        ILOG ("Watchpoint at %d\n", addr);
+    }
+
+    watch_hit.hit = false;
+    return true;
+}
+
+
+/**
+ * Free the memory allocated by debug_init().
+ */
+void
+debug_free (
+        void
+        )
+{
+    free (breaks);
+    free (watch_pages);
+    breaks = watch_pages = NULL;
+    break_size = 0;
+    watch_count = 0;
+    page_count = 0;
+}
+
+
+/**
+ * Set or clear a breakpoint.
+ *
+ * @return False if the address is outside the program memory.
+ */
+bool
+debug_set_break (
+        int32_t addr,       ///< The logical address.
+        bool on             ///< True to set, false to clear.
+        )
+{
+    if (addr < 0 || addr >= break_size)
+        return false;
+
+    if (on)
+        breaks[addr / 8] |= 1 << (addr % 8);
+    else
+        breaks[addr / 8] &= ~(1 << (addr % 8));
+    return true;
+}
+
+
+/**
+ * Set or clear a watchpoint.
+ *
+ * @return False if the address is outside the program memory, or
+ *         there are already ::MAX_WATCHPOINTS watchpoints.
+ */
+bool
+debug_set_watch (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr,       ///< The logical address.
+        bool on             ///< True to set, false to clear.
+        )
+{
+    if (addr < 0 || addr >= kone->mmu_limit)
+        return false;
+
+    int32_t paddr = kone->mmu_base + addr;
+    if (on) {
+        if (watch_count == MAX_WATCHPOINTS)
+            return false;
+        watches[watch_count++] = paddr;
+        watch_pages[paddr >> WATCH_PAGE_BITS]++;
+        return true;
+    }
+
+    for (int i = 0; i < watch_count; i++) {
+        if (watches[i] == paddr) {
+            watches[i] = watches[--watch_count];
+            watch_pages[paddr >> WATCH_PAGE_BITS]--;
+            break;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Check a memory write for watchpoints. Called before the word is
+ * written.
+ */
+void
+debug_write (
+        s_ckone* kone,      ///< The state structure.
+        int32_t paddr,      ///< The physical address.
+        int32_t old_value,  ///< The value before the write.
+        int32_t new_value   ///< The value to be written.
+        )
+{
+    if (!watch_pages || !watch_pages[paddr >> WATCH_PAGE_BITS])
+        return;
+
+    for (int i = 0; i < watch_count; i++) {
+        if (watches[i] == paddr) {
+            watch_hit.hit = true;
+            watch_hit.addr = paddr - kone->mmu_base;
+            watch_hit.old_value = old_value;
+            watch_hit.new_value = new_value;
+            return;
+        }
+    }
+}
+
+
+/**
+ * Check whether the emulation should stop after an instruction: either
+ * a watchpoint was hit, or there is a breakpoint at the next instruction.
+ *
+ * @return The reason to stop, or ::DEBUG_NONE.
+ */
+e_debug_event
+debug_check (
+        s_ckone* kone,      ///< The state structure.
+        int32_t* addr       ///< Where to store the address of the watchpoint
+                            ///< or the breakpoint hit.
+        )
+{
+    if (watch_hit.hit) {
+        watch_hit.hit = false;
+        *addr = watch_hit.addr;
+        return DEBUG_WATCH;
+    }
+
+    int32_t pc = kone->pc;
+    if (!kone->halted && pc >= 0 && pc < break_size && (breaks[pc / 8] & (1 << (pc % 8)))) {
+        *addr = pc;
+        return DEBUG_BREAK;
+    }
+
+    return DEBUG_NONE;
+}
+
+
+/**
+ * Check whether the emulation should stop after an instruction
+ * (see debug_check()), and print the reason.
+ *
+ * @return True if the emulation should stop.
+ */
+bool
+debug_stop (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    char name[64];
+    int32_t addr;
+
+    switch (debug_check (kone, &addr)) {
+        case DEBUG_WATCH:
+            symtable_addr_string (addr, name, sizeof(name));
+            printf ("\nWatchpoint: %s (%d) changed from %d to %d after %llu instructions\n",
+                    name, addr, watch_hit.old_value, watch_hit.new_value,
+                    (unsigned long long) kone->instr_count);
+            return true;
+
+        case DEBUG_BREAK:
+            symtable_addr_string (addr, name, sizeof(name));
+            printf ("\nBreakpoint: %s (%d) after %llu instructions\n",
+                    name, addr, (unsigned long long) kone->instr_count);
+            return true;
+
+        default:
+            return false;
+    }
+}
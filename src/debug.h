@@ -0,0 +1,34 @@
+/**
+ * @file debug.h
+ *
+ * The public functions of the breakpoints and watchpoints.
+ */
+
+#ifndef DEBUG_H
+#define DEBUG_H
+
+
+/**
+ * The reasons for the emulation to stop, see debug_check().
+ */
+typedef enum {
+    DEBUG_NONE = 0,     ///< No breakpoint or watchpoint was hit.
+    DEBUG_BREAK,        ///< The next instruction has a breakpoint.
+    DEBUG_WATCH         ///< A watched address was written to.
+} e_debug_event;
+
+
+extern bool debug_parse_addr (const char* str, int32_t* addr);
+
+extern bool debug_init (s_ckone* kone);
+extern void debug_free ();
+
+extern bool debug_set_break (int32_t addr, bool on);
+extern bool debug_set_watch (s_ckone* kone, int32_t addr, bool on);
+
+extern void debug_write (s_ckone* kone, int32_t paddr, int32_t old_value, int32_t new_value);
+extern e_debug_event debug_check (s_ckone* kone, int32_t* addr);
+extern bool debug_stop (s_ckone* kone);
+
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * @file dirty.c
+ *
+ * Dirty page tracking. The physical memory is divided into pages of
+ * ::DIRTY_PAGE_WORDS words, and every write through the MMU marks its
+ * page dirty. Users of the map clear it with dirty_clear() and later
+ * ask which pages have been written since.
+ *
+ * There are two users, the memory dumps of ckone.c which only show the
+ * rows changed since the previous dump, and the incremental snapshots of
+ * snapshot.c which only save the pages changed since the last full
+ * snapshot. So that they can clear the map independently, a page does
+ * not have a dirty bit but the number of the epoch in which it was last
+ * written: dirty_clear() starts a new epoch and returns its number, and
+ * a page is dirty since an epoch if it was written in it or later. A
+ * write is still a single store.
+ *
+ * dirty_write() is called from mmu.c, and from undo.c and gdb.c which
+ * change the memory directly, when ::args enables a user.
+ */
+
+#include "common.h"
+#include "dirty.h"
+
+
+/**
+ * @internal
+ * The epoch in which each page was last written, or 0 if never.
+ */
+static uint32_t* epochs = NULL;
+
+/**
+ * @internal
+ * The number of pages in ::epochs.
+ */
+static int32_t page_count = 0;
+
+/**
+ * @internal
+ * The current epoch.
+ */
+static uint32_t epoch = 1;
+
+
+/**
+ * Allocate the dirty page map. No page is dirty at first. See also
+ * dirty_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+dirty_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    page_count = (kone->mem_size >> DIRTY_PAGE_BITS) + 1;
+    epochs = calloc (page_count, sizeof(uint32_t));
+    if (!epochs) {
+        ELOG ("Could not allocate memory for the dirty page map\n", 0);
+        return false;
+    }
+
+    epoch = 1;
+    return true;
+}
+
+
+/**
+ * Free the memory allocated by dirty_init().
+ */
+void
+dirty_free (
+        void
+        )
+{
+    free (epochs);
+    epochs = NULL;
+    page_count = 0;
+}
+
+
+/**
+ * Mark the page of a memory word dirty. Called when the word is written.
+ */
+void
+dirty_write (
+        int32_t paddr       ///< The physical address.
+        )
+{
+    if (epochs)
+        epochs[paddr >> DIRTY_PAGE_BITS] = epoch;
+}
+
+
+/**
+ * Start a new epoch. Pages written from now on are dirty since the
+ * returned epoch; the pages written before are not.
+ *
+ * @return The new epoch.
+ */
+uint32_t
+dirty_clear (
+        void
+        )
+{
+    return ++epoch;
+}
+
+
+/**
+ * Check whether a page has been written since an epoch.
+ *
+ * @return True if the page is dirty.
+ */
+bool
+dirty_page (
+        int32_t page,       ///< The page number, the physical address 
+                            ///< divided by ::DIRTY_PAGE_WORDS.
+        uint32_t since      ///< An epoch returned by dirty_clear().
+        )
+{
+    return epochs && page >= 0 && page < page_count && epochs[page] >= since;
+}
+
+
+/**
+ * Check whether any word in a range of memory has been written since
+ * an epoch. The check is done a page at a time, so a word next to a
+ * written one also counts.
+ *
+ * @return True if a page in the range is dirty.
+ */
+bool
+dirty_range (
+        int32_t paddr,      ///< The first physical address.
+        int32_t count,      ///< The number of words.
+        uint32_t since      ///< An epoch returned by dirty_clear().
+        )
+{
+    int32_t last = (paddr + count - 1) >> DIRTY_PAGE_BITS;
+    for (int32_t page = paddr >> DIRTY_PAGE_BITS; page <= last; page++)
+        if (dirty_page (page, since))
+            return true;
+    return false;
+}
+
+
+/**
+ * Count the pages written since an epoch. With epoch 0, this is the
+ * number of pages.
+ *
+ * @return The number of dirty pages.
+ */
+int32_t
+dirty_count (
+        uint32_t since      ///< An epoch returned by dirty_clear().
+        )
+{
+    int32_t count = 0;
+    for (int32_t page = 0; page < page_count; page++)
+        if (epochs[page] >= since)
+            count++;
+    return count;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file dirty.h
+ *
+ * The public functions of the dirty page tracking.
+ */
+
+#ifndef DIRTY_H
+#define DIRTY_H
+
+
+/// The dirty page size in words is 1 << DIRTY_PAGE_BITS; 16 words
+/// are one 64-byte cache line.
+#define DIRTY_PAGE_BITS 4
+
+/// The dirty page size in words.
+#define DIRTY_PAGE_WORDS (1 << DIRTY_PAGE_BITS)
+
+
+extern bool dirty_init (s_ckone* kone);
+extern void dirty_free ();
+
+extern void dirty_write (int32_t paddr);
+extern uint32_t dirty_clear ();
+extern bool dirty_page (int32_t page, uint32_t since);
+extern bool dirty_range (int32_t paddr, int32_t count, uint32_t since);
+extern int32_t dirty_count (uint32_t since);
+
+
+#endif
@@ -2,17 +2,27 @@
  * @file ext.c
  *
  * Implements operations involving the external world.
- * These operations are IN, OUT and SVC.
+ * These operations are IN, OUT and SVC. Also contains the interval
+ * timer and the interrupt controller devices.
  *
  * Calls functions from mmu.c to read and write memory, and
- * from instr.c to decode instructions.
+ * from instr.c to decode instructions. The input values and the
+ * times given to the program go through replay.c when recording 
+ * or replaying.
  */
 
+// for ftruncate ()
+#define _POSIX_C_SOURCE 200809L
+
 #include <time.h>
+#include <unistd.h>
 #include "common.h"
 #include "instr.h"
 #include "mmu.h"
 #include "args.h"
+#include "plugin.h"
+#include "replay.h"
+#include "live.h"
 
 
 /**
@@ -38,9 +48,17 @@ enum e_device_number {
     STDIN = 6,      ///< The STDIN device. The file for this can be defined
                     ///< in the program file and overridden with a command
                     ///< line argument.
-    STDOUT = 7      ///< The STDOUT device. The file for this can be defined
+    STDOUT = 7,     ///< The STDOUT device. The file for this can be defined
                     ///< in the program file and overridden with a command
                     ///< line argument.
+    TIMER = 8,      ///< The interval timer. Writing sets the period in 
+                    ///< instructions (0 stops the timer), reading gives 
+                    ///< the number of instructions left.
+    PIC = 9,        ///< The interrupt controller. Writing a nonzero value
+                    ///< enables interrupts, zero disables them. Reading
+                    ///< gives 1 if an interrupt is pending.
+    IVEC = 10       ///< The interrupt vector. Writing sets the address of
+                    ///< the interrupt handler.
 };
 
 
@@ -58,6 +76,14 @@ static s_device devices[] = {
 };
 
 
+/**
+ * @internal
+ * The positions in the STDIN and STDOUT files to continue from,
+ * or -1 to start from the beginning. See ext_resume_devices ().
+ */
+static long resume_pos[2] = { -1, -1 };
+
+
 /**
  * Initialize the external devices. CRT is will be stdout and
  * KBD will be stdin. The values in the ::args structure define
@@ -84,16 +110,98 @@ ext_init_devices (
     if (!devices[2].file)
         WLOG ("Cannot open %s for reading; trying to read from STDIN will not work\n",
                 args.stdin_file);
+    else if (resume_pos[0] > 0)
+        fseek (devices[2].file, resume_pos[0], SEEK_SET);
     
     ILOG ("Opening STDOUT file: %s\n", args.stdout_file);
 
-    devices[3].file = fopen (args.stdout_file, "w");
+    // when resuming, keep what was written before and drop the rest
+    devices[3].file = NULL;
+    if (resume_pos[1] >= 0 && (devices[3].file = fopen (args.stdout_file, "r+"))) {
+        if (ftruncate (fileno (devices[3].file), resume_pos[1]))
+            WLOG ("Cannot truncate %s\n", args.stdout_file);
+        fseek (devices[3].file, resume_pos[1], SEEK_SET);
+    }
+    if (!devices[3].file)
+        devices[3].file = fopen (args.stdout_file, "w");
     if (!devices[3].file)
         WLOG ("Cannot open %s for writing; trying to write to STDOUT will not work\n",
                 args.stdout_file);
 }
 
 
+/**
+ * Initialize the external devices like ext_init_devices (), but use
+ * the given files for STDIN and STDOUT instead of opening the files
+ * named in the ::args structure or in the program. The job daemon uses
+ * this, so that a job cannot reach the files of the host. The files
+ * are closed by ext_close_devices ().
+ */
+void 
+ext_init_files (
+        FILE* in,           ///< The file to read STDIN from, or NULL.
+        FILE* out           ///< The file to write STDOUT to, or NULL.
+        ) 
+{
+    ILOG ("Initializing external devices...\n", 0);
+    devices[0].file = stdout;
+    devices[1].file = stdin;
+    devices[2].file = in;
+    devices[3].file = out;
+}
+
+
+/**
+ * Use the given files for KBD and CRT instead of stdin and stdout.
+ * Must be called after ext_init_devices (), which attaches stdin and
+ * stdout again. The files are not closed by ext_close_devices ().
+ */
+void 
+ext_attach_console (
+        FILE* kbd,          ///< The file to read KBD from.
+        FILE* crt           ///< The file to write CRT to.
+        ) 
+{
+    devices[0].file = crt;
+    devices[1].file = kbd;
+}
+
+
+/**
+ * Get the current positions in the STDIN and STDOUT files. The
+ * STDOUT file is flushed first, so everything before the position
+ * has been written. A position is -1 if the device has no file.
+ */
+void 
+ext_device_positions (
+        long* stdin_pos,    ///< Where to store the STDIN position.
+        long* stdout_pos    ///< Where to store the STDOUT position.
+        ) 
+{
+    *stdin_pos = devices[2].file? ftell (devices[2].file) : -1;
+    if (devices[3].file)
+        fflush (devices[3].file);
+    *stdout_pos = devices[3].file? ftell (devices[3].file) : -1;
+}
+
+
+/**
+ * Make ext_init_devices () continue from the given positions in
+ * the STDIN and STDOUT files instead of starting from the beginning,
+ * and keep the contents of the STDOUT file up to the position.
+ * See ext_device_positions ().
+ */
+void 
+ext_resume_devices (
+        long stdin_pos,     ///< The STDIN position, or -1.
+        long stdout_pos     ///< The STDOUT position, or -1.
+        ) 
+{
+    resume_pos[0] = stdin_pos;
+    resume_pos[1] = stdout_pos;
+}
+
+
 /**
  * Close the files for the external devices. See ext_init_devices ().
  */
@@ -236,6 +344,57 @@ get_device_file (
 }
 
 
+/**
+ * @internal
+ * Read an integer from an input device. When replaying, the value is
+ * taken from the replay log and the device is not touched. When 
+ * recording, the value is also written to the log.
+ *
+ * @return False if no value could be read.
+ */
+static bool 
+device_input (
+        uint32_t dev_num,   ///< The device number.
+        int32_t* value      ///< Where to store the value.
+        ) 
+{
+    if (args.replay_file)
+        return replay_input (dev_num, value);
+
+    FILE* f = get_device_file (dev_num, true);
+    if (!f)
+        return false;
+
+    *value = read_input (f);
+    if (args.record_file)
+        replay_record_input (dev_num, *value);
+    return true;
+}
+
+
+/**
+ * @internal
+ * Get the local time, from the replay log when replaying. When 
+ * recording, the time is also written to the log.
+ *
+ * @return False if the time could not be read from the replay log.
+ */
+static bool 
+local_time (
+        struct tm* t        ///< Where to store the time.
+        ) 
+{
+    if (args.replay_file)
+        return replay_time (t);
+
+    time_t now = time (NULL);
+    *t = *localtime (&now);
+    if (args.record_file)
+        replay_record_time (t);
+    return true;
+}
+
+
 /**
  * Read an integer from the device denoted in TR and store the
  * result in the first operand register.
@@ -251,14 +410,21 @@ ext_in (
 {
     DLOG ("Reading input from device %d...\n", kone->tr);
 
-    FILE* f = get_device_file (kone->tr, true);
-    if (!f) {
+    e_register r = instr_first_operand (kone->ir);
+    switch (kone->tr) {
+        case TIMER: kone->r[r] = kone->timer_left; return;
+        case PIC: kone->r[r] = (kone->sr & SR_I)? 1 : 0; return;
+    }
+
+    if (args.live)
+        live_io (kone);
+
+    int32_t value;
+    if (!device_input (kone->tr, &value)) {
         kone->sr |= SR_M;
         return;
     }
-
-    int32_t value = read_input (f);
-    kone->r[instr_first_operand (kone->ir)] = value;
+    kone->r[r] = value;
 
     DLOG ("Read %d from %s\n", value, get_device_name (kone->tr));
 }
@@ -268,7 +434,9 @@ ext_in (
  * Writes the value in the current instruction's first operand
  * register to the device denoted in TR.
  *
- * Affected status bits: ::SR_M
+ * Affects: IVEC, TIMER_PERIOD, TIMER_LEFT (the timer devices)
+ *
+ * Affected status bits: ::SR_M, ::SR_D (PIC)
  */
 void 
 ext_out (
@@ -277,13 +445,35 @@ ext_out (
 {
     DLOG ("Writing output to device %d...\n", kone->tr);
 
+    int32_t value = kone->r[instr_first_operand (kone->ir)];
+    switch (kone->tr) {
+        case TIMER:
+            DLOG ("Timer period set to %d\n", value);
+            kone->timer_period = value > 0? value : 0;
+            kone->timer_left = kone->timer_period;
+            return;
+        case PIC:
+            DLOG ("Interrupts %s\n", value? "enabled" : "disabled");
+            if (value)
+                kone->sr &= ~SR_D;
+            else
+                kone->sr |= SR_D;
+            return;
+        case IVEC:
+            DLOG ("Interrupt vector set to 0x%x\n", value);
+            kone->ivec = value;
+            return;
+    }
+
+    if (args.live)
+        live_io (kone);
+
     FILE* f = get_device_file (kone->tr, false);
     if (!f) {
         kone->sr |= SR_M;
         return;
     }
 
-    int32_t value = kone->r[instr_first_operand (kone->ir)];
     write_output (f, value);
 
     DLOG ("Wrote %d to %s\n", value, get_device_name (kone->tr));
@@ -332,19 +522,20 @@ svc_read (
         ) 
 {
     DLOG ("SVC READ\n", 0);
-    FILE* f = get_device_file (KBD, true);
-    if (!f) {
-        ELOG ("WTF?", 0);
-        return 0;
-    }
-
     uint32_t ofs = args.emulate_bugs? 1 : 0;
+    if (args.live)
+        live_io (kone);
 
     kone->mar = kone->r[FP] - (2 + ofs);
     mmu_read (kone);    // read the address of the destination variable
     DLOG ("Destination: 0x%x\n", kone->mbr);
     kone->mar = kone->mbr;
-    kone->mbr = read_input (f);     // read the value from keyboard
+    int32_t value;
+    if (!device_input (KBD, &value)) {  // read the value from keyboard
+        kone->sr |= SR_M;
+        return 1 + ofs;
+    }
+    kone->mbr = value;
     DLOG ("Read %d from KBD\n", kone->mbr);
     mmu_write (kone);               // write it to the destination variable
 
@@ -368,6 +559,9 @@ svc_write (
         ) 
 {
     DLOG ("SVC WRITE\n", 0);
+    if (args.live)
+        live_io (kone);
+
     FILE* f = get_device_file (CRT, false);
     if (!f) {
         ELOG ("WTF?", 0);
@@ -398,8 +592,12 @@ svc_time (
         ) 
 {
     DLOG ("SVC TIME\n", 0);
-    time_t now = time (NULL);
-    struct tm* t = localtime (&now);
+    struct tm tm;
+    if (!local_time (&tm)) {
+        kone->sr |= SR_M;
+        return 3;
+    }
+    struct tm* t = &tm;
 
     DLOG ("Now is: %s\n", asctime (t));
 
@@ -444,8 +642,12 @@ svc_date (
         ) 
 {
     DLOG ("SVC DATE\n", 0);
-    time_t now = time (NULL);
-    struct tm* t = localtime (&now);
+    struct tm tm;
+    if (!local_time (&tm)) {
+        kone->sr |= SR_M;
+        return 3;
+    }
+    struct tm* t = &tm;
 
     DLOG ("Now is: %s\n", asctime (t));
 
@@ -472,13 +674,70 @@ svc_date (
 
 
 /**
- * Execute an svc command.
+ * @internal
+ * Sleep until the next interrupt. Instead of executing instructions
+ * until the timer expires, the timer is made to expire right after 
+ * this SVC, so neither the emulated nor the host CPU spins.
+ *
+ * @return The number of arguments for this SVC, which is 0.
+ *
+ * Affects: TIMER_LEFT
+ *
+ * Affected status bits: ::SR_M (if no interrupt can ever come)
+ */
+static int32_t 
+svc_wait (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    DLOG ("SVC WAIT\n", 0);
+    if (!kone->timer_period || (kone->sr & SR_D)) {
+        ELOG ("WAIT with the timer stopped or interrupts disabled would never return\n", 0);
+        kone->sr |= SR_M;
+        return 0;
+    }
+
+    kone->timer_left = 1;
+    return 0;
+}
+
+
+/**
+ * Advance the interval timer by one instruction. When the timer 
+ * expires, an interrupt is requested and the timer is restarted.
+ * This should only be called when the timer is running.
+ *
+ * @return True if an interrupt should be taken now.
+ *
+ * Affects: TIMER_LEFT
+ *
+ * Affected status bits: ::SR_I
+ */
+bool 
+ext_timer_tick (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    if (--kone->timer_left <= 0) {
+        DLOG ("Timer expired\n", 0);
+        kone->sr |= SR_I;
+        kone->timer_left = kone->timer_period;
+    }
+
+    return (kone->sr & (SR_I | SR_D)) == SR_I;
+}
+
+
+/**
+ * Execute an svc command. SVC numbers not implemented here are
+ * looked up from the loaded plugins (see plugin.h).
  *
  * @return The number of arguments for the SVC.
  *
  * Affects:
  *  - halted (HALT)
  *  - MAR, MBR (the rest)
+ *  - Anything (plugin SVCs)
  *
  * Affected status bits: ::SR_M (not HALT)
  */
@@ -493,9 +752,14 @@ ext_svc (
         case 13: return svc_write (kone);
         case 14: return svc_time (kone);
         case 15: return svc_date (kone);
-        default:
-                 ELOG ("Invalid SVC: %d\n", kone->tr);
-                 return 0;
+        case 16: return svc_wait (kone);
     }
+
+    const s_plugin_svc* svc = plugin_find_svc (kone->tr);
+    if (svc)
+        return plugin_call_svc (kone, svc);
+
+    ELOG ("Invalid SVC: %d\n", kone->tr);
+    return 0;
 }
 
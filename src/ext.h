@@ -10,10 +10,15 @@
 
 extern void ext_init_devices ();
 extern void ext_close_devices ();
+extern void ext_init_files (FILE* in, FILE* out);
+extern void ext_attach_console (FILE* kbd, FILE* crt);
+extern void ext_device_positions (long* stdin_pos, long* stdout_pos);
+extern void ext_resume_devices (long stdin_pos, long stdout_pos);
 
 extern void ext_in (s_ckone* kone);
 extern void ext_out (s_ckone* kone);
 extern int32_t ext_svc (s_ckone* kone);
+extern bool ext_timer_tick (s_ckone* kone);
 
 
 #endif
@@ -0,0 +1,166 @@
+/**
+ * @file forksrv.c
+ *
+ * The fork-server mode for running the same program many times with
+ * different inputs. The program is loaded and checked once, after which
+ * the server reads requests from a control file, usually a pipe (see
+ * ::args). For each request a child is forked, which gets a copy-on-write
+ * copy of the loaded machine, attaches the files of the request to the
+ * devices and runs. The server waits for the child and reports how it
+ * ended before reading the next request.
+ *
+ * A request is one line with up to four file names separated by spaces:
+ *
+ *     KBD CRT [STDIN [STDOUT]]
+ *
+ * KBD and CRT become the standard input and output of the child, and
+ * STDIN and STDOUT the files of the devices with the same names. A name
+ * of @c - keeps the file of the server. When the requests are read from
+ * the standard input, KBD must be given, since the child would otherwise
+ * read the requests meant for the server. For each request the server
+ * writes one line to its standard output: the process id of the child
+ * followed by <tt>exit CODE</tt> or <tt>signal NUMBER</tt>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "common.h"
+#include "args.h"
+#include "forksrv.h"
+
+
+/**
+ * @internal
+ * The maximum length of a request line.
+ */
+#define FORKSRV_LINE_SIZE 4096
+
+
+/**
+ * @internal
+ * The last request. The file names given to a child point here.
+ */
+static char request[FORKSRV_LINE_SIZE];
+
+
+/**
+ * @internal
+ * Attach the files of a request in a child. A child which cannot
+ * open its files exits with a failure status.
+ */
+static void
+attach_files (
+        char** names,       ///< The file names, see the request format.
+        int count,          ///< The number of file names.
+        bool control_stdin  ///< True if the requests come from the standard input.
+        )
+{
+    if (control_stdin && !strcmp (names[0], "-")) {
+        ELOG ("KBD cannot be - when the requests are read from the standard input\n", 0);
+        _exit (EXIT_FAILURE);
+    }
+    if (count > 0 && strcmp (names[0], "-") && !freopen (names[0], "r", stdin)) {
+        ELOG ("Cannot open %s for reading\n", names[0]);
+        _exit (EXIT_FAILURE);
+    }
+    if (count > 1 && strcmp (names[1], "-") && !freopen (names[1], "w", stdout)) {
+        ELOG ("Cannot open %s for writing\n", names[1]);
+        _exit (EXIT_FAILURE);
+    }
+    if (count > 2 && strcmp (names[2], "-"))
+        args.stdin_file = names[2];
+    if (count > 3 && strcmp (names[3], "-"))
+        args.stdout_file = names[3];
+}
+
+
+/**
+ * @internal
+ * Wait for a child and report how it ended.
+ *
+ * @return The exit status of the child.
+ */
+static int
+report_child (
+        pid_t pid           ///< The process id of the child.
+        )
+{
+    int status;
+    if (waitpid (pid, &status, 0) < 0) {
+        ELOG ("Could not wait for the child %ld\n", (long) pid);
+        return EXIT_FAILURE;
+    }
+
+    if (WIFSIGNALED (status)) {
+        printf ("%ld signal %d\n", (long) pid, WTERMSIG (status));
+        fflush (stdout);
+        return EXIT_FAILURE;
+    }
+
+    printf ("%ld exit %d\n", (long) pid, WEXITSTATUS (status));
+    fflush (stdout);
+    return WEXITSTATUS (status);
+}
+
+
+/**
+ * Serve requests from the control file given in ::args until it ends.
+ * Must be called after the program has been loaded, and before the
+ * devices are initialized. Returns in each child with its files
+ * attached, so that the caller continues by running the program.
+ *
+ * @return True in a child, false in the server once the control
+ *         file has ended.
+ */
+bool
+forksrv_run (
+        int* retval         ///< Where to store the exit status of the server:
+                            ///< failure if the last child failed.
+        )
+{
+    FILE* control = stdin;
+    if (strcmp (args.fork_server, "-"))
+        control = fopen (args.fork_server, "r");
+    if (!control) {
+        ELOG ("Cannot open %s for reading\n", args.fork_server);
+        *retval = EXIT_FAILURE;
+        return false;
+    }
+
+    ILOG ("Waiting for requests from %s\n", args.fork_server);
+    *retval = EXIT_SUCCESS;
+    while (fgets (request, sizeof(request), control)) {
+        char* names[4];
+        int count = 0;
+        for (char* s = strtok (request, " \t\n"); s && count < 4; s = strtok (NULL, " \t\n"))
+            names[count++] = s;
+        if (!count)
+            continue;
+
+        // don't let the child write out the buffers of the server again
+        fflush (stdout);
+        fflush (stderr);
+
+        pid_t pid = fork ();
+        if (pid < 0) {
+            ELOG ("Could not fork a child\n", 0);
+            *retval = EXIT_FAILURE;
+            break;
+        }
+        if (pid == 0) {
+            if (control != stdin)
+                fclose (control);
+            attach_files (names, count, control == stdin);
+            return true;
+        }
+
+        *retval = report_child (pid);
+    }
+
+    if (control != stdin)
+        fclose (control);
+    return false;
+}
@@ -0,0 +1,14 @@
+/**
+ * @file forksrv.h
+ *
+ * The public functions of the fork-server mode.
+ */
+
+#ifndef FORKSRV_H
+#define FORKSRV_H
+
+
+extern bool forksrv_run (int* retval);
+
+
+#endif
@@ -0,0 +1,732 @@
+/**
+ * @file gdb.c
+ *
+ * A stub for the GDB remote serial protocol. The emulator listens on a
+ * localhost TCP port or a Unix domain socket (see ::args), accepts one
+ * debugger and then runs only as the debugger tells it to. Between stops
+ * the program runs at full speed.
+ *
+ * The supported packets are: @c ? (the reason for the last stop), @c g and
+ * @c G (all registers), @c p and @c P (one register), @c m and @c M (memory,
+ * within the MMU limits), @c Z0/@c z0 and @c Z1/@c z1 (breakpoints), @c Z2/@c z2
+ * (write watchpoints), @c s (step), @c c (continue), @c D (detach, after
+ * which the program runs to the end) and @c k (kill). A Ctrl-C from the
+ * debugger interrupts a continue.
+ *
+ * The registers are numbered R0 to R7 (0 - 7), PC (8) and SR (9). The
+ * addresses used by the debugger are byte addresses, so memory word n
+ * is at address 4n. Registers and words are sent in little-endian byte
+ * order.
+ *
+ * The breakpoints and watchpoints are kept by debug.c.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include "common.h"
+#include "cpu.h"
+#include "debug.h"
+#include "dirty.h"
+#include "args.h"
+#include "gdb.h"
+
+
+extern int ckone_run (s_ckone* kone);
+
+
+/**
+ * @internal
+ * The maximum packet size.
+ */
+#define GDB_PACKET_SIZE 4096
+
+/**
+ * @internal
+ * The number of registers: R0 to R7, PC and SR.
+ */
+#define GDB_REGS 10
+
+/**
+ * @internal
+ * How many instructions are executed between checks for a Ctrl-C.
+ */
+#define GDB_POLL_INTERVAL 65536
+
+
+/**
+ * @internal
+ * How a debugging session ended.
+ */
+typedef enum {
+    GDB_DETACHED,       ///< The debugger detached. The program runs to the end.
+    GDB_ENDED,          ///< The program halted, or the connection was closed.
+    GDB_KILLED          ///< The debugger killed the program.
+} e_gdb_end;
+
+
+/**
+ * @internal
+ * The connection to the debugger.
+ */
+static int conn = -1;
+
+/**
+ * @internal
+ * The buffer for data received from the debugger.
+ */
+static struct {
+    char data[GDB_PACKET_SIZE];     ///< The data.
+    size_t len;                     ///< The number of bytes in data.
+    size_t pos;                     ///< The next byte to return.
+} in;
+
+/**
+ * @internal
+ * The last stop reply, sent again for the @c ? packet.
+ */
+static char last_stop[32] = "S05";
+
+
+/**
+ * @internal
+ * Open a listening socket. The address is a TCP port on localhost if
+ * it is a number, and the path of a Unix domain socket otherwise.
+ *
+ * @return The socket, or -1 on error.
+ */
+static int
+listen_on (
+        const char* addr    ///< The port or the path.
+        )
+{
+    int fd;
+    bool ok;
+    if (addr[0] && strspn (addr, "0123456789") == strlen (addr)) {
+        unsigned long port = strtoul (addr, NULL, 10);
+        if (!port || port > 65535) {
+            ELOG ("The port %s is not between 1 and 65535\n", addr);
+            return -1;
+        }
+
+        struct sockaddr_in sin;
+        memset (&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons (port);
+        sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+        int one = 1;
+        fd = socket (AF_INET, SOCK_STREAM, 0);
+        ok = fd >= 0 && !setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+            && !bind (fd, (struct sockaddr*) &sin, sizeof(sin));
+    } else {
+        struct sockaddr_un sun;
+        memset (&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen (addr) >= sizeof(sun.sun_path)) {
+            ELOG ("The socket path %s is too long\n", addr);
+            return -1;
+        }
+        strcpy (sun.sun_path, addr);
+
+        // only replace a socket left behind, never another file
+        struct stat st;
+        if (!lstat (addr, &st)) {
+            if (!S_ISSOCK (st.st_mode)) {
+                ELOG ("The path %s is in use and not a socket\n", addr);
+                return -1;
+            }
+            unlink (addr);
+        }
+
+        fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        ok = fd >= 0 && !bind (fd, (struct sockaddr*) &sun, sizeof(sun));
+    }
+
+    if (!ok || listen (fd, 1)) {
+        ELOG ("Cannot listen on %s\n", addr);
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * @internal
+ * Get the next byte from the debugger.
+ *
+ * @return The byte, or -1 if the connection was closed.
+ */
+static int
+get_byte (
+        void
+        )
+{
+    if (in.pos == in.len) {
+        ssize_t n = recv (conn, in.data, sizeof(in.data), 0);
+        if (n <= 0)
+            return -1;
+        in.len = n;
+        in.pos = 0;
+    }
+    return (unsigned char) in.data[in.pos++];
+}
+
+
+/**
+ * @internal
+ * Check whether the debugger has sent a Ctrl-C, without waiting.
+ *
+ * @return True if the debugger wants to interrupt the program.
+ */
+static bool
+interrupted (
+        void
+        )
+{
+    if (in.pos == in.len) {
+        struct pollfd p = { conn, POLLIN, 0 };
+        if (poll (&p, 1, 0) <= 0)
+            return false;
+    }
+
+    if (in.pos < in.len && in.data[in.pos] != 0x03)
+        return false;
+    return get_byte () == 0x03;
+}
+
+
+/**
+ * @internal
+ * Send bytes to the debugger.
+ */
+static void
+send_bytes (
+        const char* data,   ///< The bytes.
+        size_t len          ///< The number of bytes.
+        )
+{
+    while (len > 0) {
+        ssize_t n = send (conn, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+
+/**
+ * @internal
+ * Send a packet to the debugger and wait for the acknowledgement.
+ */
+static void
+send_packet (
+        const char* data    ///< The packet contents.
+        )
+{
+    static const char hex[] = "0123456789abcdef";
+    char buf[GDB_PACKET_SIZE + 4];
+
+    size_t len = strlen (data);
+    uint8_t sum = 0;
+    buf[0] = '$';
+    for (size_t i = 0; i < len; i++)
+        sum += (uint8_t) (buf[i + 1] = data[i]);
+    buf[len + 1] = '#';
+    buf[len + 2] = hex[sum >> 4];
+    buf[len + 3] = hex[sum & 0xf];
+
+    int c;
+    do {
+        send_bytes (buf, len + 4);
+        c = get_byte ();
+    } while (c == '-');
+}
+
+
+/**
+ * @internal
+ * Get the value of a hexadecimal digit.
+ *
+ * @return The value, or -1 if the character is not a hexadecimal digit.
+ */
+static int
+hex_value (
+        int c               ///< The character.
+        )
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+/**
+ * @internal
+ * Receive a packet from the debugger. Bad packets are rejected and
+ * resent by the debugger. Bytes outside packets (such as a Ctrl-C
+ * when the program is already stopped) are ignored.
+ *
+ * @return False if the connection was closed.
+ */
+static bool
+get_packet (
+        char* buf           ///< A buffer of ::GDB_PACKET_SIZE bytes.
+        )
+{
+    while (true) {
+        int c;
+        while ((c = get_byte ()) != '$')
+            if (c < 0)
+                return false;
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        while ((c = get_byte ()) != '#') {
+            if (c < 0)
+                return false;
+            if (len < GDB_PACKET_SIZE - 1)
+                buf[len++] = c;
+            sum += c;
+        }
+        buf[len] = '\0';
+
+        int hi = hex_value (get_byte ());
+        int lo = hex_value (get_byte ());
+        if (hi >= 0 && lo >= 0 && (hi << 4 | lo) == sum) {
+            send_bytes ("+", 1);
+            return true;
+        }
+        send_bytes ("-", 1);
+    }
+}
+
+
+/**
+ * @internal
+ * Write a word as 8 hexadecimal digits in little-endian byte order.
+ *
+ * @return A pointer to the end of the digits.
+ */
+static char*
+put_word (
+        char* out,          ///< Where to write.
+        int32_t value       ///< The word.
+        )
+{
+    for (int i = 0; i < 4; i++)
+        out += sprintf (out, "%02x", ((uint32_t) value >> (8 * i)) & 0xff);
+    return out;
+}
+
+
+/**
+ * @internal
+ * Read a word written by put_word().
+ *
+ * @return False if there are not 8 hexadecimal digits.
+ */
+static bool
+get_word (
+        const char** in,    ///< The digits. Moved past the word.
+        int32_t* value      ///< Where to store the word.
+        )
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int hi = hex_value ((*in)[0]);
+        int lo = hex_value (hi >= 0? (*in)[1] : 0);
+        if (hi < 0 || lo < 0)
+            return false;
+        v |= (uint32_t) (hi << 4 | lo) << (8 * i);
+        *in += 2;
+    }
+    *value = (int32_t) v;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Get a pointer to a register.
+ *
+ * @return The register, or NULL if the number is invalid.
+ */
+static int32_t*
+reg (
+        s_ckone* kone,      ///< The state structure.
+        unsigned long num   ///< The register number.
+        )
+{
+    if (num < 8)
+        return &kone->r[num];
+    if (num == 8)
+        return &kone->pc;
+    if (num == 9)
+        return &kone->sr;
+    return NULL;
+}
+
+
+/**
+ * @internal
+ * Read or write a memory word for the debugger. The address is checked
+ * against MMU_LIMIT and translated with MMU_BASE as in mmu.c, but the 
+ * access does not change MAR, MBR or SR, and it is not seen by the 
+ * profiler, the trace, the undo log or the watchpoints.
+ *
+ * @return False if the address is invalid.
+ */
+static bool
+access_word (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr,       ///< The logical address.
+        int32_t* value,     ///< The value to write, or where to store the value read.
+        bool write          ///< True to write, false to read.
+        )
+{
+    if (addr < 0 || addr >= kone->mmu_limit)
+        return false;
+
+    if (write) {
+        kone->mem[kone->mmu_base + addr] = *value;
+        dirty_write (kone->mmu_base + addr);
+    } else
+        *value = kone->mem[kone->mmu_base + addr];
+    return true;
+}
+
+
+/**
+ * @internal
+ * Handle the @c m and @c M packets. Any byte range can be accessed;
+ * partially written words are read, modified and written back.
+ */
+static void
+handle_memory (
+        s_ckone* kone,      ///< The state structure.
+        const char* packet, ///< The packet.
+        char* reply         ///< A buffer of ::GDB_PACKET_SIZE bytes for the reply.
+        )
+{
+    bool write = packet[0] == 'M';
+    char* end;
+    unsigned long addr = strtoul (packet + 1, &end, 16);
+    if (*end != ',') {
+        strcpy (reply, "E01");
+        return;
+    }
+    unsigned long len = strtoul (end + 1, &end, 16);
+    if ((write && *end != ':') || (!write && len > (GDB_PACKET_SIZE - 1) / 2)) {
+        strcpy (reply, "E01");
+        return;
+    }
+
+    const char* data = end + 1;
+    char* out = reply;
+    for (unsigned long i = 0; i < len; i++) {
+        int32_t word;
+        unsigned long byte = addr + i;
+        if (!access_word (kone, byte / 4, &word, false)) {
+            strcpy (reply, "E02");
+            return;
+        }
+
+        int shift = 8 * (byte % 4);
+        if (write) {
+            int hi = hex_value (data[0]);
+            int lo = hex_value (hi >= 0? data[1] : 0);
+            if (hi < 0 || lo < 0) {
+                strcpy (reply, "E01");
+                return;
+            }
+            data += 2;
+            word = (int32_t) (((uint32_t) word & ~(0xffu << shift))
+                    | (uint32_t) (hi << 4 | lo) << shift);
+            access_word (kone, byte / 4, &word, true);
+        } else
+            out += sprintf (out, "%02x", ((uint32_t) word >> shift) & 0xff);
+    }
+
+    if (write)
+        strcpy (reply, "OK");
+    else
+        *out = '\0';
+}
+
+
+/**
+ * @internal
+ * Handle the @c Z and @c z packets.
+ */
+static void
+handle_point (
+        s_ckone* kone,      ///< The state structure.
+        const char* packet, ///< The packet.
+        char* reply         ///< A buffer for the reply.
+        )
+{
+    bool on = packet[0] == 'Z';
+    char type = packet[1];
+    unsigned long addr = strtoul (packet + 3, NULL, 16);
+    bool ok;
+
+    switch (type) {
+        case '0':   // software and hardware breakpoints are the same
+        case '1':
+            ok = debug_set_break (addr / 4, on);
+            break;
+        case '2':
+            ok = debug_set_watch (kone, addr / 4, on);
+            break;
+        default:
+            reply[0] = '\0';    // not supported
+            return;
+    }
+
+    strcpy (reply, ok? "OK" : "E01");
+}
+
+
+/**
+ * @internal
+ * Make the stop reply for the faults set in SR, reporting each fault
+ * as the closest signal.
+ */
+static void
+fault_reply (
+        s_ckone* kone,      ///< The state structure.
+        char* reply         ///< A buffer for the stop reply.
+        )
+{
+    int sig = 11;                   // SIGSEGV
+    if (kone->sr & SR_U)
+        sig = 4;                    // SIGILL
+    else if (kone->sr & (SR_Z | SR_O))
+        sig = 8;                    // SIGFPE
+    sprintf (reply, "S%02x", sig);
+}
+
+
+/**
+ * @internal
+ * Execute instructions and make the stop reply. Stepping executes one
+ * instruction. Continuing runs until a breakpoint or a watchpoint is
+ * hit, the program stops, or the debugger sends a Ctrl-C. While the
+ * fault bits of SR are set, nothing is executed and the fault is
+ * reported again, so the debugger has to clear them first.
+ *
+ * @return False if the program halted, which ends the session.
+ */
+static bool
+resume (
+        s_ckone* kone,      ///< The state structure.
+        bool step,          ///< True to step, false to continue.
+        char* reply         ///< A buffer for the stop reply.
+        )
+{
+    if (kone->sr & SR_FAULTS) {
+        fault_reply (kone, reply);
+        return true;
+    }
+
+    for (uint32_t n = 1; ; n++) {
+        if (!cpu_step (kone)) {
+            fault_reply (kone, reply);
+            return true;
+        }
+
+        if (kone->halted) {
+            strcpy (reply, "W00");
+            return false;
+        }
+
+        int32_t addr;
+        switch (debug_check (kone, &addr)) {
+            case DEBUG_WATCH:
+                sprintf (reply, "T05watch:%x;", (unsigned) addr * 4);
+                return true;
+            case DEBUG_BREAK:
+                strcpy (reply, "S05");
+                return true;
+            default:
+                break;
+        }
+
+        if (step) {
+            strcpy (reply, "S05");
+            return true;
+        }
+
+        if (n % GDB_POLL_INTERVAL == 0 && interrupted ()) {
+            strcpy (reply, "S02");          // SIGINT
+            return true;
+        }
+    }
+}
+
+
+/**
+ * @internal
+ * Serve the debugger until it detaches, kills the program, or the
+ * program halts.
+ *
+ * @return How the session ended.
+ */
+static e_gdb_end
+serve (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    char packet[GDB_PACKET_SIZE];
+    char reply[GDB_PACKET_SIZE];
+
+    while (get_packet (packet)) {
+        DLOG ("GDB: %s\n", packet);
+        char* end;
+        reply[0] = '\0';
+
+        switch (packet[0]) {
+            case '?':
+                strcpy (reply, last_stop);
+                break;
+
+            case 'g': {
+                char* out = reply;
+                for (int r = 0; r < GDB_REGS; r++)
+                    out = put_word (out, *reg (kone, r));
+                break;
+            }
+
+            case 'G': {
+                const char* p = packet + 1;
+                int32_t values[GDB_REGS];
+                bool ok = true;
+                for (int r = 0; r < GDB_REGS && ok; r++)
+                    ok = get_word (&p, &values[r]);
+                if (ok)
+                    for (int r = 0; r < GDB_REGS; r++)
+                        *reg (kone, r) = values[r];
+                strcpy (reply, ok? "OK" : "E01");
+                break;
+            }
+
+            case 'p': {
+                int32_t* r = reg (kone, strtoul (packet + 1, NULL, 16));
+                if (r)
+                    put_word (reply, *r);
+                else
+                    strcpy (reply, "E01");
+                break;
+            }
+
+            case 'P': {
+                int32_t* r = reg (kone, strtoul (packet + 1, &end, 16));
+                const char* p = end + 1;
+                if (r && *end == '=' && get_word (&p, r))
+                    strcpy (reply, "OK");
+                else
+                    strcpy (reply, "E01");
+                break;
+            }
+
+            case 'm':
+            case 'M':
+                handle_memory (kone, packet, reply);
+                break;
+
+            case 'Z':
+            case 'z':
+                handle_point (kone, packet, reply);
+                break;
+
+            case 's':
+            case 'c': {
+                if (packet[1])
+                    kone->pc = strtoul (packet + 1, NULL, 16) / 4;
+                bool running = resume (kone, packet[0] == 's', reply);
+                strcpy (last_stop, reply);
+                send_packet (reply);
+                if (!running)
+                    return GDB_ENDED;
+                continue;
+            }
+
+            case 'D':
+                send_packet ("OK");
+                return GDB_DETACHED;
+
+            case 'k':
+                return GDB_KILLED;
+
+            case 'H':
+                strcpy (reply, "OK");
+                break;
+
+            case 'q':
+                if (!strncmp (packet, "qSupported", 10))
+                    sprintf (reply, "PacketSize=%x", GDB_PACKET_SIZE);
+                else if (!strcmp (packet, "qAttached"))
+                    strcpy (reply, "1");
+                break;
+        }
+
+        send_packet (reply);
+    }
+
+    WLOG ("The debugger closed the connection\n", 0);
+    return GDB_ENDED;
+}
+
+
+/**
+ * Wait for a debugger to connect to the address given in ::args and
+ * let it control the emulation. If the debugger detaches, the program
+ * runs to the end as with ckone_run().
+ *
+ * @return EXIT_FAILURE if something went wrong or the debugger killed
+ *         the program, EXIT_SUCCESS otherwise.
+ */
+int
+gdb_run (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    int fd = listen_on (args.gdb_socket);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    ILOG ("Waiting for a debugger to connect to %s...\n", args.gdb_socket);
+    conn = accept (fd, NULL, NULL);
+    close (fd);
+    if (conn < 0) {
+        ELOG ("Could not accept a connection on %s\n", args.gdb_socket);
+        return EXIT_FAILURE;
+    }
+    ILOG ("Debugger connected\n", 0);
+
+    in.len = in.pos = 0;
+    e_gdb_end end = serve (kone);
+    close (conn);
+    conn = -1;
+
+    if (end == GDB_DETACHED)
+        return ckone_run (kone);
+    if (end == GDB_KILLED)
+        return EXIT_FAILURE;
+    return (kone->sr & SR_FAULTS)? EXIT_FAILURE : EXIT_SUCCESS;
+}
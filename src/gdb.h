@@ -0,0 +1,14 @@
+/**
+ * @file gdb.h
+ *
+ * The public functions of the GDB remote serial protocol stub.
+ */
+
+#ifndef GDB_H
+#define GDB_H
+
+
+extern int gdb_run (s_ckone* kone);
+
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file image.c
+ *
+ * Shared program images. When many machines run the same program, the
+ * memory of a machine with the program loaded can be turned into an
+ * image with image_create(), and each machine then maps the image
+ * privately with image_map(). The pages of a mapping are shared with
+ * the image until the machine writes to them, so a machine only costs
+ * the pages it actually writes, typically the stack and a few
+ * variables. The image itself only holds the pages which are not all
+ * zero.
+ *
+ * The image is a memfd where available, and an unlinked temporary file
+ * otherwise. A mapped memory must be released with image_unmap() instead
+ * of free(); see s_ckone::mem_mapped.
+ */
+
+// for memfd_create ()
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "common.h"
+#include "config.h"
+#include "image.h"
+
+
+/**
+ * @internal
+ * Open an empty anonymous file.
+ *
+ * @return The file descriptor, or -1 on error.
+ */
+static int
+open_image (
+        void
+        )
+{
+#ifdef HAVE_MEMFD_CREATE
+    int fd = memfd_create ("ckone-image", 0);
+    if (fd >= 0)
+        return fd;
+#endif
+
+    FILE* f = tmpfile ();
+    if (!f)
+        return -1;
+    int fd2 = dup (fileno (f));
+    fclose (f);
+    return fd2;
+}
+
+
+/**
+ * Create an image of the memory of a machine. The machine itself is
+ * not changed.
+ *
+ * @return The file descriptor of the image, or -1 on error. The caller
+ *         closes it once no more machines will be mapped from it.
+ */
+int
+image_create (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    int fd = open_image ();
+    size_t size = kone->mem_size * sizeof(int32_t);
+    if (fd < 0 || ftruncate (fd, size)) {
+        ELOG ("Could not create an image of %d bytes\n", (int) size);
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+
+    // leave the zero pages as holes
+    size_t page = sysconf (_SC_PAGESIZE) / sizeof(int32_t);
+    for (size_t start = 0; start < (size_t) kone->mem_size; start += page) {
+        size_t len = (size_t) kone->mem_size - start;
+        if (len > page)
+            len = page;
+
+        size_t i = 0;
+        while (i < len && !kone->mem[start + i])
+            i++;
+        if (i == len)
+            continue;
+
+        off_t offset = start * sizeof(int32_t);
+        if (pwrite (fd, kone->mem + start, len * sizeof(int32_t), offset)
+                != (ssize_t) (len * sizeof(int32_t))) {
+            ELOG ("Could not write the image\n", 0);
+            close (fd);
+            return -1;
+        }
+    }
+
+    DLOG ("Created an image of %d words\n", kone->mem_size);
+    return fd;
+}
+
+
+/**
+ * Replace the memory of a machine with a private copy-on-write mapping
+ * of an image. The memory is freed first. The image must have been
+ * created from a machine with the same memory size.
+ *
+ * @return False if the image could not be mapped; the machine then
+ *         has no memory.
+ */
+bool
+image_map (
+        s_ckone* kone,      ///< The state structure.
+        int image           ///< The image from image_create().
+        )
+{
+    image_unmap (kone);
+
+    size_t size = kone->mem_size * sizeof(int32_t);
+    void* mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image, 0);
+    if (mem == MAP_FAILED) {
+        ELOG ("Could not map an image of %d bytes\n", (int) size);
+        return false;
+    }
+
+    kone->mem = mem;
+    kone->mem_mapped = true;
+    return true;
+}
+
+
+/**
+ * Release the memory of a machine, whether it was mapped with
+ * image_map() or allocated by ckone_init().
+ */
+void
+image_unmap (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (kone->mem_mapped)
+        munmap (kone->mem, kone->mem_size * sizeof(int32_t));
+    else
+        free (kone->mem);
+
+    kone->mem = NULL;
+    kone->mem_mapped = false;
+}
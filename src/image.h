@@ -0,0 +1,16 @@
+/**
+ * @file image.h
+ *
+ * The public functions of the shared program images.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+
+extern int image_create (s_ckone* kone);
+extern bool image_map (s_ckone* kone, int image);
+extern void image_unmap (s_ckone* kone);
+
+
+#endif
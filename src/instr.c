@@ -42,13 +42,12 @@ static s_op_name op_names[] = {
 
 
 /**
- * @internal
  * Return the name of the given operation.
  *
  * @return The name of the operation.
  */
-static const char* 
-op_name (
+const char* 
+instr_op_name (
         e_opcode opcode     ///< The operation code.
         ) 
 {
@@ -193,7 +192,7 @@ instr_string (
 {
     snprintf (buffer, buf_size, "%s, first opr: %s, indirections: %u, "
             "index: %s, constant: 0x%04x (%d)",
-            op_name (instr_opcode (instr)), reg_name (instr_first_operand (instr)),
+            instr_op_name (instr_opcode (instr)), reg_name (instr_first_operand (instr)),
             instr_addr_mode (instr), reg_name (instr_index_reg (instr)),
             instr_addr (instr), instr_addr (instr));
 }
@@ -50,6 +50,7 @@ extern int32_t make_instr (
         e_register index_reg,
         int16_t addr);
 
+extern const char* instr_op_name (e_opcode opcode);
 extern void instr_string (uint32_t instr, char* buffer, size_t buf_size);
 
 
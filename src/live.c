@@ -0,0 +1,271 @@
+/**
+ * @file live.c
+ *
+ * Live metrics. With the live option (see ::args), the emulator publishes
+ * its progress in a small POSIX shared memory object named after its
+ * process ID (see ::s_live_metrics): the instructions executed, the program
+ * counter and its symbol, the I/O operations, the faults and the speed
+ * over the last second. The ckone-top tool (top.c) reads the objects of
+ * all running emulators, so a program stuck in a loop can be found
+ * without stopping it.
+ *
+ * The metrics are published every LIVE_MASK + 1 instructions and when
+ * the state changes, so the cost per instruction is a test of the
+ * instruction count. The object is removed by live_close().
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "symtable.h"
+#include "args.h"
+#include "live.h"
+
+
+/**
+ * @internal
+ * The mapped segment, or NULL.
+ */
+static s_live_metrics* live = NULL;
+
+/**
+ * @internal
+ * The name of the shared memory object.
+ */
+static char live_name[64];
+
+/**
+ * @internal
+ * The start of the current speed window, in seconds.
+ */
+static double window_start = 0;
+
+/**
+ * @internal
+ * The instruction count at the start of the current speed window.
+ */
+static uint64_t window_count = 0;
+
+
+/**
+ * @internal
+ * The time of CLOCK_MONOTONIC, which is the same for all processes.
+ *
+ * @return The time in seconds.
+ */
+static double
+now (
+        void
+        )
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * @internal
+ * Start updating the segment.
+ */
+static void
+begin_write (
+        void
+        )
+{
+    __atomic_store_n (&live->seq, live->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+
+/**
+ * @internal
+ * Finish updating the segment.
+ */
+static void
+end_write (
+        void
+        )
+{
+    __atomic_store_n (&live->seq, live->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Create the shared memory object of this process and publish the
+ * first metrics. Must be called in the process which runs the emulation,
+ * after any fork. See also live_close().
+ *
+ * @return False if the object could not be created.
+ */
+bool
+live_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    snprintf (live_name, sizeof(live_name), "/%s%d", LIVE_PREFIX, (int) getpid ());
+    int fd = shm_open (live_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        WLOG ("Could not create the live metrics %s: %s\n", live_name, strerror (errno));
+        return false;
+    }
+
+    void* mem = MAP_FAILED;
+    if (!ftruncate (fd, sizeof(s_live_metrics)))
+        mem = mmap (NULL, sizeof(s_live_metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close (fd);
+    if (mem == MAP_FAILED) {
+        WLOG ("Could not map the live metrics %s: %s\n", live_name, strerror (error));
+        shm_unlink (live_name);
+        return false;
+    }
+
+    live = mem;
+    live->pid = getpid ();
+    live->state = LIVE_RUNNING;
+    live->started = now ();
+    snprintf (live->program, sizeof(live->program), "%s",
+            args.program? args.program : args.restore_file);
+    window_start = live->started;
+    window_count = kone->instr_count;
+    live_update (kone);
+
+    // the readers check the magic number last
+    live->version = LIVE_VERSION;
+    __atomic_store_n (&live->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+    DLOG ("Publishing live metrics in %s\n", live_name);
+    return true;
+}
+
+
+/**
+ * Publish the final state and remove the shared memory object.
+ */
+void
+live_close (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (!live)
+        return;
+
+    live_update (kone);
+    begin_write ();
+    live->state = (kone->halted && !(kone->sr & SR_FAULTS))? LIVE_HALTED : LIVE_FAULT;
+    end_write ();
+
+    munmap (live, sizeof(s_live_metrics));
+    shm_unlink (live_name);
+    live = NULL;
+}
+
+
+/**
+ * Publish the instruction count, the program counter and the speed.
+ * Called every LIVE_MASK + 1 instructions.
+ */
+void
+live_update (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (!live)
+        return;
+
+    double t = now ();
+    begin_write ();
+    live->instructions = kone->instr_count;
+    live->pc = kone->pc;
+    live->updated = t;
+    symtable_addr_string (kone->pc, live->symbol, sizeof(live->symbol));
+    if (t - window_start >= 1.0) {
+        live->mips = (kone->instr_count - window_count) / (t - window_start) / 1e6;
+        window_start = t;
+        window_count = kone->instr_count;
+    }
+    end_write ();
+}
+
+
+/**
+ * Count an I/O operation.
+ */
+void
+live_io (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (!live)
+        return;
+
+    begin_write ();
+    live->io++;
+    live->io_instructions = kone->instr_count;
+    end_write ();
+}
+
+
+/**
+ * Count a fault. Called when an execution cycle fails.
+ */
+void
+live_fault (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (!live)
+        return;
+
+    begin_write ();
+    live->faults++;
+    end_write ();
+    live_update (kone);
+}
+
+
+/**
+ * Read the metrics of a machine from its shared memory object. The
+ * segment is copied under the sequence lock, so the copy is never torn
+ * by a concurrent update. Used by ckone-top.
+ *
+ * @return False if the object is not a valid segment, or if it was
+ *         being updated on every try.
+ */
+bool
+live_read (
+        const char* name,           ///< The name of the object, without the slash.
+        s_live_metrics* metrics     ///< Where to store the metrics.
+        )
+{
+    char path[300];
+    snprintf (path, sizeof(path), "/%s", name);
+    int fd = shm_open (path, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    void* mem = mmap (NULL, sizeof(s_live_metrics), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    const s_live_metrics* segment = mem;
+    bool ok = false;
+    if (__atomic_load_n (&segment->magic, __ATOMIC_ACQUIRE) == LIVE_MAGIC
+            && segment->version == LIVE_VERSION) {
+        for (int tries = 0; tries < 100 && !ok; tries++) {
+            uint32_t seq = __atomic_load_n (&segment->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1)
+                continue;
+            memcpy (metrics, segment, sizeof(s_live_metrics));
+            __atomic_thread_fence (__ATOMIC_ACQUIRE);
+            ok = __atomic_load_n (&segment->seq, __ATOMIC_RELAXED) == seq;
+        }
+    }
+    munmap (mem, sizeof(s_live_metrics));
+    return ok;
+}
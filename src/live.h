@@ -0,0 +1,70 @@
+/**
+ * @file live.h
+ *
+ * The layout of the live metrics segment, shared by the emulator and
+ * ckone-top, and the public functions of the emulator side.
+ */
+
+#ifndef LIVE_H
+#define LIVE_H
+
+
+/// The prefix of the shared memory object names. The process ID follows.
+#define LIVE_PREFIX "ckone-live."
+
+/// The magic number at the start of a segment.
+#define LIVE_MAGIC 0x6576696c
+
+/// The version of the segment layout.
+#define LIVE_VERSION 1
+
+/// The metrics are published when the instruction count & LIVE_MASK is 0.
+#define LIVE_MASK 0x3fff
+
+
+/**
+ * The state of a machine in the live metrics.
+ */
+typedef enum {
+    LIVE_RUNNING = 0,       ///< The program is running.
+    LIVE_HALTED = 1,        ///< The program halted.
+    LIVE_FAULT = 2          ///< The program stopped on a fault.
+} e_live_state;
+
+
+/**
+ * The live metrics segment of one emulator process. It is written
+ * under a sequence lock: ::seq is odd while the writer is updating the
+ * fields, so a reader copies the segment and retries until ::seq was
+ * the same even number before and after the copy.
+ */
+typedef struct {
+    uint32_t magic;         ///< ::LIVE_MAGIC.
+    uint32_t version;       ///< ::LIVE_VERSION.
+    uint32_t seq;           ///< The sequence count of the lock.
+    int32_t pid;            ///< The process ID.
+    int32_t state;          ///< See ::e_live_state.
+    int32_t pc;             ///< The program counter.
+    uint64_t instructions;  ///< The instructions executed.
+    uint64_t io;            ///< The I/O operations (IN, OUT, READ and WRITE).
+    uint64_t io_instructions;   ///< The instructions executed at the last I/O operation.
+    uint64_t faults;        ///< The faults.
+    double mips;            ///< The speed over the last second, in MIPS.
+    double started;         ///< The start time, in CLOCK_MONOTONIC seconds.
+    double updated;         ///< The time of the last update, in CLOCK_MONOTONIC seconds.
+    char program[128];      ///< The program file.
+    char symbol[64];        ///< The symbolic name of the program counter.
+} s_live_metrics;
+
+
+extern bool live_init (s_ckone* kone);
+extern void live_close (s_ckone* kone);
+
+extern void live_update (s_ckone* kone);
+extern void live_io (s_ckone* kone);
+extern void live_fault (s_ckone* kone);
+
+extern bool live_read (const char* name, s_live_metrics* metrics);
+
+
+#endif
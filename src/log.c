@@ -2,31 +2,549 @@
  * @file log.c
  *
  * A simple logger.
+ *
+ * By default the messages are written to stderr as they are logged. With
+ * the async-log option (see ::args), wlog() only stores the level, the
+ * format string and the arguments of a message as a fixed-size record in
+ * a ring buffer, and a background thread formats and writes the records.
+ * The format string, which is a literal at each call site, identifies the
+ * message, so the only text copied is the strings given for @c %s.
+ *
+ * The ring has a single producer, the emulator, and a single consumer,
+ * the writer thread, so it needs no locks: the producer only advances the
+ * head and the consumer the tail. When the ring is full, the message is
+ * dropped and counted, and the writer reports the number of dropped
+ * messages in the place where they were lost.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include "common.h"
 #include "args.h"
 
 
+/**
+ * @internal
+ * The number of records in the ring. Must be a power of two.
+ */
+#define LOG_RING_SIZE 4096
+
+/**
+ * @internal
+ * The maximum number of arguments in a message stored as a record.
+ */
+#define LOG_MAX_ARGS 8
+
+/**
+ * @internal
+ * The space for the strings of a record. Longer strings are truncated.
+ */
+#define LOG_TEXT_SIZE 128
+
+
+/**
+ * @internal
+ * An argument of a message. The integers are widened to long long
+ * when they are stored.
+ */
+typedef union {
+    long long i;            ///< An integer or a character.
+    unsigned long long u;   ///< An unsigned integer.
+    double d;               ///< A floating point number.
+    const void* p;          ///< A pointer for @c %p.
+    size_t s;               ///< The offset of a string in s_log_record::text.
+} u_log_arg;
+
+/**
+ * @internal
+ * A message in the ring.
+ */
+typedef struct {
+    e_loglevel lvl;                 ///< The type of the message.
+    const char* fmt;                ///< The format string, or NULL if the
+                                    ///< message was formatted into text.
+    int argc;                       ///< The number of arguments.
+    u_log_arg argv[LOG_MAX_ARGS];   ///< The arguments.
+    char text[LOG_TEXT_SIZE];       ///< The strings of the arguments.
+} s_log_record;
+
+/**
+ * @internal
+ * A conversion specification in a format string.
+ */
+typedef struct {
+    const char* start;      ///< The '%' character.
+    const char* end;        ///< The character after the conversion.
+    int flags_len;          ///< The length of the flags, width and precision.
+    char size;              ///< The length modifier: 'H' for hh, 'h', 'l',
+                            ///< 'q' for ll, 'j', 'z', 't', 'L' or 0.
+    char conv;              ///< The conversion character.
+} s_log_spec;
+
+
+/**
+ * @internal
+ * The ring of records, allocated by log_init().
+ */
+static s_log_record* ring;
+
+/**
+ * @internal
+ * The number of records written to the ring. Only changed by the emulator.
+ */
+static uint32_t ring_head;
+
+/**
+ * @internal
+ * The number of records consumed from the ring. Only changed by the writer.
+ */
+static uint32_t ring_tail;
+
+/**
+ * @internal
+ * The number of messages dropped because the ring was full.
+ */
+static unsigned long long dropped;
+
+/**
+ * @internal
+ * True if the messages should be written by the writer thread.
+ */
+static bool async;
+
+/**
+ * @internal
+ * True while the writer thread runs. Cleared in a forked child, which
+ * starts its own writer when it first logs a message.
+ */
+static bool writer_running;
+
+/**
+ * @internal
+ * Set to make the writer thread stop once the ring is empty.
+ */
+static bool writer_stop;
+
+/**
+ * @internal
+ * The writer thread.
+ */
+static pthread_t writer;
+
+
+/**
+ * @internal
+ * Find the next conversion specification in a format string.
+ *
+ * @return True if a specification was found, false at the end
+ *         of the string or for a specification not supported
+ *         in records (@c * for the width or the precision, @c %n).
+ */
+static bool
+next_spec (
+        const char* p,          ///< Where to start looking.
+        s_log_spec* spec        ///< The specification found.
+        )
+{
+    p = strchr (p, '%');
+    if (!p)
+        return false;
+
+    spec->start = p++;
+    p += strspn (p, "-+ #0");
+    p += strspn (p, "0123456789");
+    if (*p == '.') {
+        p++;
+        p += strspn (p, "0123456789");
+    }
+    spec->flags_len = p - spec->start - 1;
+
+    spec->size = 0;
+    if (p[0] == 'h' && p[1] == 'h') {
+        spec->size = 'H';
+        p += 2;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        spec->size = 'q';
+        p += 2;
+    } else if (*p && strchr ("hljztL", *p)) {
+        spec->size = *p++;
+    }
+
+    spec->conv = *p;
+    spec->end = p + 1;
+    return *p && strchr ("diouxXcsfFeEgGaAp%", *p);
+}
+
+
+/**
+ * @internal
+ * Store the arguments of a message in a record, following the
+ * format string.
+ *
+ * @return False if the format string cannot be stored as a record.
+ */
+static bool
+store_args (
+        s_log_record* rec,      ///< The record.
+        const char* fmt,        ///< The format string.
+        va_list ap              ///< The arguments.
+        )
+{
+    size_t text_used = 0;
+    s_log_spec spec;
+
+    rec->argc = 0;
+    for (const char* p = fmt; *p; p = spec.end) {
+        if (!next_spec (p, &spec))
+            return !strchr (p, '%');
+        if (spec.conv == '%')
+            continue;
+        if (rec->argc == LOG_MAX_ARGS)
+            return false;
+
+        u_log_arg* arg = &rec->argv[rec->argc++];
+        switch (spec.conv) {
+            case 'd':
+            case 'i':
+                switch (spec.size) {
+                    case 'q': arg->i = va_arg (ap, long long); break;
+                    case 'l': arg->i = va_arg (ap, long); break;
+                    case 'j': arg->i = va_arg (ap, intmax_t); break;
+                    case 'z':
+                    case 't': arg->i = va_arg (ap, ptrdiff_t); break;
+                    case 'h': arg->i = (short) va_arg (ap, int); break;
+                    case 'H': arg->i = (signed char) va_arg (ap, int); break;
+                    default:  arg->i = va_arg (ap, int); break;
+                }
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                switch (spec.size) {
+                    case 'q': arg->u = va_arg (ap, unsigned long long); break;
+                    case 'l': arg->u = va_arg (ap, unsigned long); break;
+                    case 'j': arg->u = va_arg (ap, uintmax_t); break;
+                    case 'z': arg->u = va_arg (ap, size_t); break;
+                    case 't': arg->u = va_arg (ap, ptrdiff_t); break;
+                    case 'h': arg->u = (unsigned short) va_arg (ap, unsigned); break;
+                    case 'H': arg->u = (unsigned char) va_arg (ap, unsigned); break;
+                    default:  arg->u = va_arg (ap, unsigned); break;
+                }
+                break;
+            case 'c':
+                arg->i = va_arg (ap, int);
+                break;
+            case 'p':
+                arg->p = va_arg (ap, void*);
+                break;
+            case 's': {
+                const char* s = va_arg (ap, const char*);
+                if (!s)
+                    s = "(null)";
+                if (text_used >= LOG_TEXT_SIZE) {
+                    // no space left: the terminator of the previous string
+                    arg->s = LOG_TEXT_SIZE - 1;
+                    break;
+                }
+                size_t len = strlen (s);
+                if (len > LOG_TEXT_SIZE - 1 - text_used)
+                    len = LOG_TEXT_SIZE - 1 - text_used;
+                memcpy (rec->text + text_used, s, len);
+                rec->text[text_used + len] = '\0';
+                arg->s = text_used;
+                text_used += len + 1;
+                break;
+            }
+            default:
+                if (spec.size == 'L')
+                    arg->d = va_arg (ap, long double);
+                else
+                    arg->d = va_arg (ap, double);
+                break;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @internal
+ * Format a record and write it to stderr.
+ */
+static void
+write_record (
+        const s_log_record* rec     ///< The record.
+        )
+{
+    if (!rec->fmt) {
+        fputs (rec->text, stderr);
+        return;
+    }
+
+    s_log_spec spec;
+    int argi = 0;
+    for (const char* p = rec->fmt; *p; p = spec.end) {
+        if (!next_spec (p, &spec)) {
+            fputs (p, stderr);
+            break;
+        }
+        fwrite (p, 1, spec.start - p, stderr);
+        if (spec.conv == '%') {
+            fputc ('%', stderr);
+            continue;
+        }
+
+        // rebuild the specification for the stored type of the argument
+        char f[32];
+        int n = snprintf (f, sizeof(f), "%%%.*s", spec.flags_len, spec.start + 1);
+        const u_log_arg* arg = &rec->argv[argi++];
+        switch (spec.conv) {
+            case 'd':
+            case 'i':
+                snprintf (f + n, sizeof(f) - n, "ll%c", spec.conv);
+                fprintf (stderr, f, arg->i);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                snprintf (f + n, sizeof(f) - n, "ll%c", spec.conv);
+                fprintf (stderr, f, arg->u);
+                break;
+            case 'c':
+                snprintf (f + n, sizeof(f) - n, "c");
+                fprintf (stderr, f, (int) arg->i);
+                break;
+            case 'p':
+                snprintf (f + n, sizeof(f) - n, "p");
+                fprintf (stderr, f, arg->p);
+                break;
+            case 's':
+                snprintf (f + n, sizeof(f) - n, "s");
+                fprintf (stderr, f, rec->text + arg->s);
+                break;
+            default:
+                snprintf (f + n, sizeof(f) - n, "%c", spec.conv);
+                fprintf (stderr, f, arg->d);
+                break;
+        }
+    }
+}
+
+
+/**
+ * @internal
+ * Sleep for the given number of microseconds.
+ */
+static void
+nap (
+        long usec       ///< The time to sleep.
+        )
+{
+    struct timespec t = { 0, usec * 1000 };
+    nanosleep (&t, NULL);
+}
+
+
+/**
+ * @internal
+ * The writer thread: write the records in the ring until told to stop.
+ *
+ * @return NULL.
+ */
+static void*
+writer_main (
+        void* unused    ///< Not used.
+        )
+{
+    (void) unused;
+    unsigned long long reported = 0;
+
+    while (true) {
+        uint32_t head = __atomic_load_n (&ring_head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring_tail;
+        unsigned long long lost = __atomic_load_n (&dropped, __ATOMIC_RELAXED);
+
+        if (lost != reported) {
+            fprintf (stderr, "Warning: %llu log messages dropped\n", lost - reported);
+            reported = lost;
+        }
+
+        if (tail == head) {
+            fflush (stderr);
+            if (__atomic_load_n (&writer_stop, __ATOMIC_ACQUIRE))
+                break;
+            nap (200);
+            continue;
+        }
+
+        for (; tail != head; tail++)
+            write_record (&ring[tail & (LOG_RING_SIZE - 1)]);
+        __atomic_store_n (&ring_tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+/**
+ * @internal
+ * Start the writer thread. If it cannot be started, the messages are
+ * written synchronously from then on.
+ */
+static void
+start_writer (
+        void
+        )
+{
+    // the signals, such as the SIGPROF of the sampling profiler,
+    // must be handled by the emulator thread
+    sigset_t all, old;
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+
+    writer_stop = false;
+    int error = pthread_create (&writer, NULL, writer_main, NULL);
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+    if (error) {
+        async = false;
+        WLOG ("Cannot start the log writer, logging synchronously\n", 0);
+        return;
+    }
+    writer_running = true;
+}
+
+
+/**
+ * @internal
+ * Called in a forked child, where the writer thread of the parent does
+ * not exist. The child starts a new writer when it logs a message.
+ */
+static void
+forget_writer (
+        void
+        )
+{
+    writer_running = false;
+}
+
+
 /**
  * Write the given data to stderr, if the message is important
  * enough compared to the current verbosity level.
  */
-void 
+void
 wlog (
         e_loglevel lvl,         ///< The type of the message.
         const char* fmt,        ///< The format string and data (fed to vfprintf).
         ...
-        ) 
-{
-    if ((lvl >= LOG_WARN) ||
-        (lvl >= LOG_INFO && args.verbosity >= 1) ||
-        (args.verbosity >= 2))
-    {
-        va_list ap;
-        va_start (ap, fmt);
+        )
+{
+    if ((lvl < LOG_WARN) &&
+        (lvl < LOG_INFO || args.verbosity < 1) &&
+        (args.verbosity < 2))
+        return;
+
+    if (async && !writer_running)
+        start_writer ();
+
+    va_list ap;
+    va_start (ap, fmt);
+    if (!async) {
         vfprintf (stderr, fmt, ap);
+        va_end (ap);
+        return;
+    }
+
+    uint32_t head = ring_head;
+    if (head - __atomic_load_n (&ring_tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_add_fetch (&dropped, 1, __ATOMIC_RELAXED);
+        va_end (ap);
+        return;
+    }
+
+    s_log_record* rec = &ring[head & (LOG_RING_SIZE - 1)];
+    rec->lvl = lvl;
+    rec->fmt = fmt;
+
+    va_list copy;
+    va_copy (copy, ap);
+    if (!store_args (rec, fmt, copy)) {
+        rec->fmt = NULL;
+        vsnprintf (rec->text, sizeof(rec->text), fmt, ap);
+    }
+    va_end (copy);
+    va_end (ap);
+
+    __atomic_store_n (&ring_head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Wait until the writer thread has written every message logged so far.
+ * Does nothing if the messages are written synchronously.
+ */
+void
+log_flush (
+        void
+        )
+{
+    if (!writer_running) {
+        fflush (stderr);
+        return;
+    }
+
+    while (__atomic_load_n (&ring_tail, __ATOMIC_ACQUIRE) != ring_head)
+        nap (100);
+    fflush (stderr);
+}
+
+
+/**
+ * Write the messages logged so far, and stop the writer thread. The
+ * messages logged after this are written synchronously.
+ */
+void
+log_close (
+        void
+        )
+{
+    if (writer_running) {
+        __atomic_store_n (&writer_stop, true, __ATOMIC_RELEASE);
+        pthread_join (writer, NULL);
+        writer_running = false;
     }
+    async = false;
+    free (ring);
+    ring = NULL;
 }
 
+
+/**
+ * Start writing the messages from a background thread. The thread
+ * is stopped with log_close(), which is also called at exit.
+ *
+ * @return True if the ring buffer could be allocated.
+ */
+bool
+log_init (
+        void
+        )
+{
+    ring = malloc (LOG_RING_SIZE * sizeof(s_log_record));
+    if (!ring) {
+        ELOG ("Could not allocate the log buffer\n", 0);
+        return false;
+    }
+
+    ring_head = ring_tail = 0;
+    dropped = 0;
+    async = true;
+    atexit (log_close);
+    pthread_atfork (log_flush, NULL, forget_writer);
+    return true;
+}
@@ -21,6 +21,9 @@ typedef enum {
 
 
 extern void wlog (e_loglevel lvl, const char* fmt, ...);
+extern bool log_init (void);
+extern void log_flush (void);
+extern void log_close (void);
 
 
 /// Print a debug message, with the current file and line included.
@@ -81,14 +81,27 @@
  * lots of output which is only useful for debugging. More details about what the 
  * other options mean can be found in the following section.
  *
+ * For post-mortems of long runs the text output is far too slow and large. The 
+ * @c --trace option writes a compact binary record of every instruction instead: 
+ * its address, the instruction word, the registers it changed and the memory 
+ * words it wrote, all delta-encoded (see trace.c). With @c --trace-compress the 
+ * trace is also gzip-compressed while it is written. A trace is printed with 
+ * <tt>ckone --decode-trace FILE</tt>, which needs no program file.
+ *
+ * The only nondeterministic inputs of a program are the values it reads from 
+ * KBD and STDIN and the times SVC TIME and SVC DATE give it. @c --record FILE 
+ * saves them to a log, and @c --replay FILE feeds them back from the log 
+ * without prompting or looking at the clock, so the run is repeated exactly.
+ *
  *
  * @section structure The structure of the program
  * 
  * The @c ckone executable consists of two parts: the emulator and the interface. 
- * The emulator is built from the files alu.c, cpu.c, ext.c, instr.c, and mmu.c.
- * The interface is built from ckone.c, symtable.c, and main.c. The files 
- * args.c and log.c are linked in the emulator library since they are also used 
- * by the test module.
+ * The emulator is built from the files alu.c, branch.c, cache.c, callgraph.c, counters.c, cpu.c, debug.c, dirty.c, 
+ * ext.c, image.c, instr.c, live.c, mix.c, mmu.c, perf.c, plugin.c, prof.c, replay.c, report.c, 
+ * sample.c, snapshot.c, trace.c, and undo.c. The interface 
+ * is built from ckone.c, forksrv.c, gdb.c, main.c and serve.c. The files args.c, log.c and symtable.c are linked in the emulator library since they are also used 
+ * by the test module and the profiler.
  *
  * The most important data structure is ::s_ckone. It holds the values of all
  * registers and contains a pointer to the emulator memory. Any operation which
@@ -100,7 +113,8 @@
  * The symbol table is a linked list of ::s_symtable nodes. It is used to 
  * figure out the @c STDIN and @c STDOUT device files defined in the program file.
  * The contents of the table can also be included in memory dumps to facilitate
- * following the execution of the emulator.
+ * following the execution of the emulator, and the reports of the profiler use
+ * it to name code addresses after their labels.
  *
  * One more data structure is the ::s_arguments struct, which is used to store
  * the command-line-modifiable options. First, the structure is initialized
@@ -159,7 +173,62 @@
  * locations on one row. The length of a row (the number of columns) can be adjusted 
  * by using the @c --columns option and the number base can be changed with the 
  * @c --base option. If the @c --show-symtable flag was set, each dump will also 
- * contain the contents of the symbol table.
+ * contain the contents of the symbol table. With @c --dump-changes, each dump 
+ * after the first one only shows the memory rows written since the previous 
+ * one, which keeps stepping through a large memory readable. @c --dump-sparse 
+ * collapses runs of equal rows into a single @c * row like hexdump, and 
+ * @c --dump-binary writes the memory to a file as raw little-endian words for 
+ * other tools instead.
+ *
+ * Test harnesses which only check a few values can skip the dump with 
+ * @c --no-dump and ask for just those values with @c --report: registers, the 
+ * words at symbols or addresses, and address ranges (report.c). The report is 
+ * written as JSON, or with <tt>--report-format binary</tt> as little-endian 
+ * integers in the order the items were given, to the standard output or to 
+ * the file given with @c --report-file.
+ *
+ * With @c --undo-log, the old values of the registers and memory words changed 
+ * by each instruction are kept in a fixed-size ring buffer (undo.c). The emulator 
+ * then also pauses when the program stops, and at every pause the user can step 
+ * back one instruction (@c b) or go back to the last instruction which wrote to 
+ * an address or a symbol (<tt>w ADDR</tt>), and continue from there. Device input 
+ * and output are not undone.
+ *
+ * Long runs are debugged with @c --break and @c --watch instead of @c --step. 
+ * Both take an address or a symbol and can be repeated. The program runs at full 
+ * speed until it is about to execute an instruction with a breakpoint, or an 
+ * instruction has written to a watched address (debug.c). The emulator then dumps 
+ * the state and pauses; at a pause, enter executes one instruction and @c c 
+ * continues at full speed.
+ *
+ * Other front ends can drive the emulator with @c --gdb, which takes a TCP port 
+ * on localhost or the path of a Unix socket. The emulator waits for a debugger 
+ * to connect and then speaks the GDB remote serial protocol (gdb.c): the 
+ * registers R0 to R7, PC and SR and the memory can be read and written, and 
+ * the program can be stepped or continued at full speed until a breakpoint or 
+ * a watchpoint is hit. There is no ttk-91 architecture in GDB itself, so the 
+ * client must know the register layout described in gdb.c.
+ *
+ * The complete state of the machine can be saved in a snapshot (snapshot.c): 
+ * the registers, the memory, the positions in the @c STDIN and @c STDOUT files 
+ * and the symbol table. @c --snapshot names the file, and @c --snapshot-every 
+ * saves it periodically, replacing the previous one only once the new one is 
+ * complete; at a pause, <tt>save FILE</tt> saves one. @c --restore continues 
+ * from a snapshot instead of loading a program, also on another host. The 
+ * periodic snapshots are incremental: after the first full snapshot, only the 
+ * pages written since then are saved to a delta file next to it (dirty.c).
+ *
+ * To run the same program many times with different inputs, @c --fork-server 
+ * loads it once and then reads requests from a control pipe (forksrv.c). Each 
+ * request names the files to use as the @c KBD, @c CRT, @c STDIN and @c STDOUT 
+ * devices; a child process with a copy-on-write copy of the loaded machine is 
+ * forked to run it, and the server replies with how the child exited.
+ *
+ * With @c --serve, the emulator becomes a daemon which runs jobs sent to a Unix 
+ * socket (serve.c). A job carries a program, or the id of a program sent before 
+ * and kept in the image cache, the data for @c KBD and @c STDIN and optional 
+ * limits. The output of @c CRT and @c STDOUT is streamed back as it is written, 
+ * followed by the final registers and the reason the program stopped.
  *
  * Each instruction is executed in the following steps:
  *  -# The MMU is told to fetch the next instruction from the memory address 
@@ -194,10 +263,87 @@
  * I/O will set the ::SR_M bit of @c SR if an I/O error occurs. The SVC @c HALT 
  * routine is the only way to stop a program without signaling an error.
  *
+ * The timer and interrupt devices are also in ext.c. Writing a period to the 
+ * @c TIMER device (8) starts an interval timer which counts executed instructions. 
+ * When it expires, the ::SR_I bit is set, and unless interrupts are disabled 
+ * (::SR_D), the routine whose address was written to the @c IVEC device (10) is 
+ * called through @c SP like with @c CALL. Taking an interrupt disables further 
+ * interrupts; the handler enables them again by writing a nonzero value to the 
+ * @c PIC device (9) before it returns with @c EXIT. A program which has nothing 
+ * to do until the next interrupt can call SVC @c WAIT (16), which makes the timer 
+ * expire immediately instead of spinning. When the timer is stopped, the only 
+ * cost is one test per instruction in cpu_step().
+ *
+ * More SVC routines can be added with the @c --plugin option, which loads native 
+ * handlers from a shared object. SVC numbers which are not built-in are looked up 
+ * from the loaded plugins. See plugin.h for how to write a plugin.
+ *
  * The rest of the operations (@c STORE, @c LOAD, @c COMP, and the jump and stack 
  * operations) are all defined in cpu.c.
  * 
  *
+ * @section profiling Profiling
+ *
+ * The @c --profile option makes the emulator count how many times each 
+ * instruction is executed, how many times each opcode is executed, and how many 
+ * memory reads and writes each instruction makes. The counters are kept in flat 
+ * arrays indexed by the address (see prof.c). At the end a report is printed 
+ * with the hottest instructions, the totals of each routine and the opcode counts. 
+ * Addresses are named after the nearest preceding label in the symbol table, 
+ * e.g. @c fact+3.
+ *
+ * The @c --sample option is a cheaper alternative for long runs: a @c SIGPROF 
+ * timer interrupts the emulator every @c --sample-interval microseconds of CPU 
+ * time, and the handler records the program counter and the return addresses 
+ * along the frame pointer chain (see sample.c). Nothing is done between the 
+ * samples. The report lists the addresses with the most samples and, for each 
+ * routine, the samples in it and the samples in which it was on the stack.
+ *
+ * The @c --callgraph option keeps a shadow call stack which follows the @c CALL 
+ * and @c EXIT instructions (see callgraph.c). The instructions executed in each 
+ * call path are written to the given file in the folded stack format, which 
+ * flame graph tools such as @c flamegraph.pl read directly. A summary of the 
+ * inclusive and exclusive instruction counts, the number of calls and the 
+ * maximum recursion depth of each routine is printed at the end.
+ *
+ * The @c --perf-counters option measures the host rather than the program: the 
+ * CPU cycles, instructions, branch misses, L1 data cache misses and instruction 
+ * TLB misses of the emulator while it runs (see perf.c). They are printed at the 
+ * end also per emulated instruction. If the kernel does not permit the counters, 
+ * a warning is printed and the program runs without them.
+ *
+ * The @c --mix option counts the instruction mix of the run: the executions of 
+ * each opcode and addressing mode, how often each conditional jump is taken, 
+ * the memory reads and writes, the SVCs by number and the faults by status bit 
+ * (see mix.c). It is written at the end as JSON, to the given file or the 
+ * standard output, and read during the run with mix_get().
+ *
+ * The @c --cache option passes the memory accesses of the program through a 
+ * simulated cache hierarchy (see cache.c): level 1 instruction and data caches 
+ * and a unified level 2 cache, whose size, associativity, line size, 
+ * replacement policy and latency are set with @c --cache-config. The report 
+ * shows the hit rate of each cache and, for each symbol, the accesses, hit rates 
+ * and estimated cycles, so that for example the effect of the traversal order of 
+ * an array can be seen.
+ *
+ * The @c --branch option predicts each jump before it is executed, with the 
+ * static, bimodal or gshare predictor chosen with @c --branch-predictor, and 
+ * each @c EXIT with a return address stack (see branch.c). The report shows the 
+ * accuracy, the cycles a pipeline would lose on the mispredictions, and the 
+ * jumps which were mispredicted most often.
+ *
+ *
+ * @section live Live metrics
+ *
+ * With the @c --live option the emulator publishes its progress in a POSIX 
+ * shared memory object named after its process ID (see live.c): the number of 
+ * instructions, the program counter and its symbol, the I/O operations, the 
+ * faults and the speed over the last second. They are updated every few thousand 
+ * instructions. The @c ckone-top executable (see top.c) shows all running 
+ * emulators, fastest first, with the number of instructions since their last I/O 
+ * operation, so that a program in an infinite loop stands out.
+ *
+ *
  * @section log Logging
  *
  * The file log.c contains a very simple logger and some helper macros are in 
@@ -205,6 +351,12 @@
  * only if the message is important enough given the current verbosity level of 
  * the program.
  *
+ * With the @c --async-log option the emulator does not wait for the messages 
+ * to be written. It stores the format string and the arguments of each message 
+ * in a ring buffer, and a background thread formats and writes them. If the 
+ * ring is full, the message is dropped and the number of dropped messages is 
+ * written in its place.
+ *
  *
  * @section tests Testing
  *
@@ -214,6 +366,17 @@
  * messages, but they can be ignored if the last line says that all tests were 
  * passed. This should be the case.
  *
+ * The third executable, @c ckone_bench, is built from the files in the @c bench 
+ * directory (see bench.c). It runs scaled-up versions of some sample programs 
+ * and a few synthetic kernels several times, and reports the instructions, the 
+ * mean wall time and its deviation, and the MIPS of each. It is meant to be run 
+ * before and after a change to the emulator to see how the speed changed.
+ *
+ * The fourth executable, @c ckone_micro (see micro.c), times single emulator 
+ * functions such as the ALU operations, the MMU accesses and the operand 
+ * calculation. Its results can be saved with @c --save and compared with 
+ * @c --baseline, which reports the functions that became slower.
+ *
  * The @c samples subdirectory contains example programs, most of which are from 
  * http://www.cs.helsinki.fi/group/nodes/kurssit/tito/esimerkit/ and 
  * http://www.cs.helsinki.fi/group/nodes/kurssit/tito/esim_vanhat/ . The sources 
@@ -226,8 +389,30 @@
  */
 
 #include <argp.h>
+#include <ctype.h>
+#include <errno.h>
 #include "common.h"
 #include "ext.h"
+#include "plugin.h"
+#include "prof.h"
+#include "callgraph.h"
+#include "trace.h"
+#include "replay.h"
+#include "undo.h"
+#include "debug.h"
+#include "gdb.h"
+#include "snapshot.h"
+#include "forksrv.h"
+#include "serve.h"
+#include "dirty.h"
+#include "report.h"
+#include "perf.h"
+#include "mix.h"
+#include "sample.h"
+#include "live.h"
+#include "cache.h"
+#include "branch.h"
+#include "symtable.h"
 #include "args.h"
 #include "config.h"
 
@@ -244,6 +429,7 @@ const char* argp_program_version = "ckone " VERSION;
 static char doc[] = 
 "ckone -- a ttk-91 emulator\v"
 "If the program file is -, the program is read from the standard input\n"
+"With --decode-trace, --restore or --serve, no program file is needed.\n"
 "The stdin and stdout options override settings defined in the program file.\n";
 
 static char args_doc[] = "PROGRAM_FILE";
@@ -298,6 +484,129 @@ static struct argp_option options[] = {
 
     { "show-symtable",  'y',    0,          0, 
         "Include the symbol table in dumps", 0 },
+
+    { "plugin",         'p',    "FILE",     0, 
+        "Load SVC handlers from the shared object FILE (can be repeated)", 0 },
+
+    { "profile",        401,    "FILE",     OPTION_ARG_OPTIONAL, 
+        "Count the executions of each instruction and print a profile "
+        "to FILE (default: standard output) at the end", 0 },
+
+    { "callgraph",      402,    "FILE",     0, 
+        "Follow the calls and write the call paths to FILE in the folded "
+        "stack format; a summary is printed at the end", 0 },
+
+    { "trace",          403,    "FILE",     0, 
+        "Write a binary trace of the execution to FILE", 0 },
+
+    { "trace-compress", 404,    0,          0, 
+        "Compress the trace with gzip", 0 },
+
+    { "decode-trace",   405,    "FILE",     0, 
+        "Print the trace FILE and exit", 0 },
+
+    { "record",         406,    "FILE",     0, 
+        "Record the input values and times read by the program to FILE", 0 },
+
+    { "replay",         407,    "FILE",     0, 
+        "Read the input values and times from FILE, recorded with --record", 0 },
+
+    { "undo-log",       408,    "ENTRIES",  OPTION_ARG_OPTIONAL, 
+        "Record the changes made by each instruction in a log of ENTRIES "
+        "entries (default: " STR(DEFAULT_UNDO_SIZE) ") so they can be undone when paused", 0 },
+
+    { "break",          409,    "ADDR",     0, 
+        "Pause before executing the instruction at ADDR, a number or a symbol "
+        "(can be repeated)", 0 },
+
+    { "watch",          410,    "ADDR",     0, 
+        "Pause after an instruction writes to ADDR, a number or a symbol "
+        "(can be repeated)", 0 },
+
+    { "gdb",            411,    "PORT|PATH", 0, 
+        "Let a debugger control the emulation through the GDB remote protocol "
+        "on the localhost TCP port PORT or the Unix socket PATH", 0 },
+
+    { "restore",        412,    "FILE",     0, 
+        "Continue from the snapshot FILE instead of loading a program", 0 },
+
+    { "snapshot",       413,    "FILE",     0, 
+        "Save snapshots to FILE (with --snapshot-every or the save command when paused)", 0 },
+
+    { "snapshot-every", 414,    "N",        0, 
+        "Save a snapshot every N instructions", 0 },
+
+    { "fork-server",    415,    "CONTROL",  0, 
+        "Load the program once, then run a copy of it for each request read "
+        "from CONTROL (a pipe, or - for the standard input)", 0 },
+
+    { "serve",          416,    "SOCKET",   0, 
+        "Run as a daemon which runs the jobs sent to the Unix socket SOCKET", 0 },
+
+    { "dump-changes",   417,    0,          0, 
+        "After the first memory dump, only show the rows changed since the previous one", 0 },
+
+    { "dump-sparse",    418,    0,          0, 
+        "Show a run of memory rows equal to the row before them as a single * row", 0 },
+
+    { "dump-binary",    419,    "FILE",     0, 
+        "Write the memory in dumps to FILE as raw little-endian words instead of as text", 0 },
+
+    { "report",         420,    "ITEMS",    0, 
+        "At the end, report the comma-separated ITEMS: registers (r0-r7, sp, fp, pc, ir, "
+        "tr, sr, mar, mbr), the words at symbols or addresses, and ranges START..END "
+        "(can be repeated)", 0 },
+
+    { "report-format",  421,    "FORMAT",   0, 
+        "Write the report as json (the default) or binary", 0 },
+
+    { "report-file",    422,    "FILE",     0, 
+        "Write the report to FILE instead of the standard output", 0 },
+
+    { "no-dump",        423,    0,          0, 
+        "Do not dump the state at the end of the run", 0 },
+
+    { "async-log",      424,    0,          0, 
+        "Write the log messages from a background thread; messages are dropped "
+        "if it falls behind", 0 },
+
+    { "perf-counters",  425,    0,          0, 
+        "Count the host cycles, instructions, branch misses, L1 data cache misses "
+        "and iTLB misses while running, and report them per emulated instruction", 0 },
+
+    { "mix",            426,    "FILE",     OPTION_ARG_OPTIONAL, 
+        "Count the instruction mix (opcodes, addressing modes, jumps, memory accesses, "
+        "SVCs and faults) and write it as JSON to FILE or the standard output", 0 },
+
+    { "sample",         427,    "FILE",     OPTION_ARG_OPTIONAL, 
+        "Sample the program counter and the call stack on a CPU time timer and print "
+        "a profile to FILE or the standard output", 0 },
+
+    { "sample-interval", 428,   "USEC",     0, 
+        "Take a sample every USEC microseconds of CPU time (default 1000)", 0 },
+
+    { "live",           429,    0,          0, 
+        "Publish the instruction count, PC, I/O operations, faults and speed in shared "
+        "memory while running, for ckone-top", 0 },
+
+    { "cache",          430,    "FILE",     OPTION_ARG_OPTIONAL, 
+        "Simulate L1 instruction and data caches and an L2 cache, and print their hit "
+        "rates and the estimated cycles of each symbol to FILE or the standard output", 0 },
+
+    { "cache-config",   431,    "CONFIG",   0, 
+        "Configure the caches with comma-separated NAME=SIZE:WAYS:LINE[:POLICY[:LATENCY]] "
+        "entries, where NAME is l1i, l1d or l2 and POLICY lru, fifo or random, and "
+        "mem=LATENCY (default: l1i=1k:2:16:lru:1,l1d=1k:2:16:lru:1,l2=16k:4:32:lru:10,"
+        "mem=100)", 0 },
+
+    { "branch",         432,    "FILE",     OPTION_ARG_OPTIONAL, 
+        "Simulate a branch predictor and a return address stack, and print their "
+        "accuracy and the most mispredicted jumps to FILE or the standard output", 0 },
+
+    { "branch-predictor", 433,  "CONFIG",   0, 
+        "Use the branch predictor NAME[:BITS[:PENALTY]], where NAME is static, bimodal "
+        "or gshare, BITS the log2 of the number of counters and PENALTY the cycles lost "
+        "on a misprediction (default: gshare:12:10)", 0 },
     
     { 0, 0, 0, 0, 0, 0 }    // end of table
 };
@@ -319,6 +628,7 @@ parse_opt (
         ) 
 {
     s_arguments* arguments = state->input;
+    char* end;
 
     switch (key) {
         case 'i':
@@ -357,6 +667,143 @@ parse_opt (
         case 'y':
             arguments->include_symtable = true;
             break;
+        case 'p':
+            if (arguments->plugin_count >= MAX_PLUGINS)
+                argp_error (state, "at most %d plugins can be loaded", MAX_PLUGINS);
+            arguments->plugins[arguments->plugin_count++] = arg;
+            break;
+        case 401:
+            arguments->profile = true;
+            arguments->profile_file = arg;
+            break;
+        case 402:
+            arguments->callgraph_file = arg;
+            break;
+        case 403:
+            arguments->trace_file = arg;
+            break;
+        case 404:
+            arguments->trace_compress = true;
+            break;
+        case 405:
+            arguments->decode_trace = arg;
+            break;
+        case 406:
+            arguments->record_file = arg;
+            break;
+        case 407:
+            arguments->replay_file = arg;
+            break;
+        case 408:
+            if (!arg) {
+                arguments->undo_size = DEFAULT_UNDO_SIZE;
+                break;
+            }
+            errno = 0;
+            long entries = strtol (arg, &end, 10);
+            if (!isdigit ((unsigned char) *arg) || errno == ERANGE || *end
+                    || entries > INT32_MAX)
+                argp_error (state, "the undo log size must be a number of entries");
+            arguments->undo_size = entries;
+            break;
+        case 409:
+            if (arguments->break_count >= MAX_BREAKPOINTS)
+                argp_error (state, "at most %d breakpoints can be set", MAX_BREAKPOINTS);
+            arguments->breaks[arguments->break_count++] = arg;
+            break;
+        case 410:
+            if (arguments->watch_count >= MAX_WATCHPOINTS)
+                argp_error (state, "at most %d watchpoints can be set", MAX_WATCHPOINTS);
+            arguments->watches[arguments->watch_count++] = arg;
+            break;
+        case 411:
+            arguments->gdb_socket = arg;
+            break;
+        case 412:
+            arguments->restore_file = arg;
+            break;
+        case 413:
+            arguments->snapshot_file = arg;
+            break;
+        case 414:
+            errno = 0;
+            arguments->snapshot_interval = strtoull (arg, &end, 0);
+            if (!isdigit ((unsigned char) *arg) || errno == ERANGE || *end)
+                argp_error (state, "the snapshot interval must be a number of instructions");
+            break;
+        case 415:
+            arguments->fork_server = arg;
+            break;
+        case 416:
+            arguments->serve_socket = arg;
+            break;
+        case 417:
+            arguments->dump_changes = true;
+            break;
+        case 418:
+            arguments->dump_sparse = true;
+            break;
+        case 419:
+            arguments->dump_binary = arg;
+            break;
+        case 420:
+            if (arguments->report_count >= MAX_REPORTS)
+                argp_error (state, "at most %d --report options can be given", MAX_REPORTS);
+            arguments->reports[arguments->report_count++] = arg;
+            break;
+        case 421:
+            if (!strcmp (arg, "binary"))
+                arguments->binary_report = true;
+            else if (!strcmp (arg, "json"))
+                arguments->binary_report = false;
+            else
+                argp_error (state, "the report format must be json or binary");
+            break;
+        case 422:
+            arguments->report_file = arg;
+            break;
+        case 423:
+            arguments->no_dump = true;
+            break;
+        case 424:
+            arguments->async_log = true;
+            break;
+        case 425:
+            arguments->perf_counters = true;
+            break;
+        case 426:
+            arguments->mix = true;
+            arguments->mix_file = arg;
+            break;
+        case 427:
+            arguments->sample = true;
+            arguments->sample_file = arg;
+            break;
+        case 428:
+            errno = 0;
+            unsigned long interval = strtoul (arg, &end, 0);
+            if (!isdigit ((unsigned char) *arg) || errno == ERANGE || *end
+                    || !interval || interval > UINT32_MAX)
+                argp_error (state, "the sampling interval must be a positive number");
+            arguments->sample_interval = interval;
+            break;
+        case 429:
+            arguments->live = true;
+            break;
+        case 430:
+            arguments->cache = true;
+            arguments->cache_file = arg;
+            break;
+        case 431:
+            arguments->cache_config = arg;
+            break;
+        case 432:
+            arguments->branch = true;
+            arguments->branch_file = arg;
+            break;
+        case 433:
+            arguments->branch_config = arg;
+            break;
 
         case ARGP_KEY_ARG:
             if (state->arg_num >= 1)
@@ -366,8 +813,29 @@ parse_opt (
             break;
 
         case ARGP_KEY_END:
-            if (state->arg_num < 1)
+            if (state->arg_num < 1 && !arguments->decode_trace && !arguments->restore_file
+                    && !arguments->serve_socket)
                 argp_usage (state);
+            if (arguments->record_file && arguments->replay_file)
+                argp_error (state, "--record and --replay cannot be used together");
+            if (arguments->snapshot_interval && !arguments->snapshot_file)
+                argp_error (state, "--snapshot-every needs --snapshot");
+            if (arguments->fork_server && (arguments->gdb_socket || arguments->trace_file
+                        || arguments->record_file || arguments->replay_file))
+                argp_error (state, "--fork-server cannot be used with --gdb, --trace, "
+                        "--record or --replay");
+            if (arguments->serve_socket && (arguments->step || arguments->profile
+                        || arguments->callgraph_file || arguments->trace_file
+                        || arguments->record_file || arguments->replay_file
+                        || arguments->undo_size || arguments->break_count
+                        || arguments->watch_count || arguments->gdb_socket
+                        || arguments->restore_file || arguments->snapshot_file
+                        || arguments->fork_server || arguments->perf_counters
+                        || arguments->mix || arguments->sample || arguments->live
+                        || arguments->cache || arguments->branch
+                        || arguments->stdin_file || arguments->stdout_file))
+                argp_error (state, "--serve can only be used with the memory "
+                        "and plugin options");
             break;
 
         default:
@@ -422,6 +890,45 @@ parse_args (
     args.emulate_bugs = false;
     args.program = NULL;
     args.include_symtable = false;
+    args.plugin_count = 0;
+    args.profile = false;
+    args.profile_file = NULL;
+    args.callgraph_file = NULL;
+    args.trace_file = NULL;
+    args.trace_compress = false;
+    args.decode_trace = NULL;
+    args.record_file = NULL;
+    args.replay_file = NULL;
+    args.undo_size = 0;
+    args.break_count = 0;
+    args.watch_count = 0;
+    args.gdb_socket = NULL;
+    args.restore_file = NULL;
+    args.snapshot_file = NULL;
+    args.snapshot_interval = 0;
+    args.fork_server = NULL;
+    args.serve_socket = NULL;
+    args.dump_changes = false;
+    args.dump_sparse = false;
+    args.dump_binary = NULL;
+    args.report_count = 0;
+    args.binary_report = false;
+    args.report_file = NULL;
+    args.no_dump = false;
+    args.async_log = false;
+    args.perf_counters = false;
+    args.mix = false;
+    args.mix_file = NULL;
+    args.sample = false;
+    args.sample_file = NULL;
+    args.sample_interval = 1000;
+    args.live = false;
+    args.cache = false;
+    args.cache_file = NULL;
+    args.cache_config = NULL;
+    args.branch = false;
+    args.branch_file = NULL;
+    args.branch_config = NULL;
 
     // Parse
     argp_parse (&argp, argc, argv, 0, 0, &args);
@@ -439,6 +946,49 @@ parse_args (
     DLOG ("emulate_bugs = %s\n", bool_to_yesno (args.emulate_bugs));
     DLOG ("program = %s\n", args.program);
     DLOG ("include_symtable = %s\n", bool_to_yesno (args.include_symtable));
+    for (int i = 0; i < args.plugin_count; i++)
+        DLOG ("plugins[%d] = %s\n", i, args.plugins[i]);
+    DLOG ("profile = %s\n", bool_to_yesno (args.profile));
+    DLOG ("profile_file = %s\n", args.profile_file);
+    DLOG ("callgraph_file = %s\n", args.callgraph_file);
+    DLOG ("trace_file = %s\n", args.trace_file);
+    DLOG ("trace_compress = %s\n", bool_to_yesno (args.trace_compress));
+    DLOG ("decode_trace = %s\n", args.decode_trace);
+    DLOG ("record_file = %s\n", args.record_file);
+    DLOG ("replay_file = %s\n", args.replay_file);
+    DLOG ("undo_size = %d\n", args.undo_size);
+    for (int i = 0; i < args.break_count; i++)
+        DLOG ("breaks[%d] = %s\n", i, args.breaks[i]);
+    for (int i = 0; i < args.watch_count; i++)
+        DLOG ("watches[%d] = %s\n", i, args.watches[i]);
+    DLOG ("gdb_socket = %s\n", args.gdb_socket);
+    DLOG ("restore_file = %s\n", args.restore_file);
+    DLOG ("snapshot_file = %s\n", args.snapshot_file);
+    DLOG ("snapshot_interval = %llu\n", (unsigned long long) args.snapshot_interval);
+    DLOG ("fork_server = %s\n", args.fork_server);
+    DLOG ("serve_socket = %s\n", args.serve_socket);
+    DLOG ("dump_changes = %s\n", bool_to_yesno (args.dump_changes));
+    DLOG ("dump_sparse = %s\n", bool_to_yesno (args.dump_sparse));
+    DLOG ("dump_binary = %s\n", args.dump_binary);
+    for (int i = 0; i < args.report_count; i++)
+        DLOG ("reports[%d] = %s\n", i, args.reports[i]);
+    DLOG ("binary_report = %s\n", bool_to_yesno (args.binary_report));
+    DLOG ("report_file = %s\n", args.report_file);
+    DLOG ("no_dump = %s\n", bool_to_yesno (args.no_dump));
+    DLOG ("async_log = %s\n", bool_to_yesno (args.async_log));
+    DLOG ("perf_counters = %s\n", bool_to_yesno (args.perf_counters));
+    DLOG ("mix = %s\n", bool_to_yesno (args.mix));
+    DLOG ("mix_file = %s\n", args.mix_file);
+    DLOG ("sample = %s\n", bool_to_yesno (args.sample));
+    DLOG ("sample_file = %s\n", args.sample_file);
+    DLOG ("sample_interval = %u\n", args.sample_interval);
+    DLOG ("live = %s\n", bool_to_yesno (args.live));
+    DLOG ("cache = %s\n", bool_to_yesno (args.cache));
+    DLOG ("cache_file = %s\n", args.cache_file);
+    DLOG ("cache_config = %s\n", args.cache_config);
+    DLOG ("branch = %s\n", bool_to_yesno (args.branch));
+    DLOG ("branch_file = %s\n", args.branch_file);
+    DLOG ("branch_config = %s\n", args.branch_config);
 
 
     // Validate the arguments.
@@ -468,6 +1018,11 @@ parse_args (
         return false;
     }
 
+    if (args.undo_size < 0 || (args.undo_size > 0 && args.undo_size < MIN_UNDO_SIZE)) {
+        ELOG ("The undo log must have at least %d entries\n", MIN_UNDO_SIZE);
+        return false;
+    }
+
     if (args.verbosity > 2) {
         args.verbosity = 2;
         ILOG ("Verbosity limited to 2\n", 0);
@@ -477,6 +1032,68 @@ parse_args (
 }
 
 
+/**
+ * @internal
+ * A function which writes a report at the end of the run, such as
+ * prof_report().
+ */
+typedef void (*output_writer) (s_ckone* kone, FILE* out);
+
+
+/**
+ * @internal
+ * Write a report to the file given with its option, or to the standard
+ * output.
+ */
+static void 
+write_output (
+        const char* path,       ///< The file, or NULL for the standard output.
+        const char* mode,       ///< The mode to open the file in.
+        output_writer write,    ///< The function which writes the report.
+        s_ckone* kone           ///< The state structure.
+        ) 
+{
+    FILE* out = stdout;
+    if (path) {
+        out = fopen (path, mode);
+        if (!out) {
+            ELOG ("Cannot open %s for writing\n", path);
+            return;
+        }
+    }
+
+    write (kone, out);
+
+    if (out != stdout)
+        fclose (out);
+    else
+        fflush (out);
+}
+
+
+/**
+ * @internal
+ * Write the call paths to the file given with the callgraph option
+ * (see callgraph_write_folded()) and print the call graph summary.
+ */
+static void 
+write_callgraph (
+        void
+        ) 
+{
+    FILE* out = fopen (args.callgraph_file, "w");
+    if (!out) {
+        ELOG ("Cannot open %s for writing\n", args.callgraph_file);
+        return;
+    }
+
+    callgraph_write_folded (out);
+    fclose (out);
+
+    callgraph_report (stdout);
+}
+
+
 /**
  * The program entry point.
  *
@@ -493,40 +1110,138 @@ main (
     if (!parse_args (argc, argv))
         return EXIT_FAILURE;
 
+    // Write the log from a background thread?
+    if (args.async_log && !log_init ())
+        return EXIT_FAILURE;
+
+    // Only print a trace?
+    if (args.decode_trace)
+        return trace_decode (args.decode_trace, stdout)? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Load the SVC plugins.
+    for (int i = 0; i < args.plugin_count; i++)
+        if (!plugin_load (args.plugins[i]))
+            return EXIT_FAILURE;
+
+    // Serve jobs? The daemon loads the programs itself.
+    if (args.serve_socket)
+        return serve_run ();
+
     // Initialize the emulator.
     s_ckone kone;
     if (!ckone_init (&kone))
         return EXIT_FAILURE;
 
-    // Load the program.
-    FILE* program_file = NULL;
-    if (!strcmp (args.program, "-")) {
-        program_file = stdin;
-        ILOG ("Reading the program from standard input.\n", 0);
+    // Load the program, or restore a snapshot.
+    if (args.restore_file) {
+        if (!snapshot_load (&kone, args.restore_file))
+            return EXIT_FAILURE;
     } else {
-        program_file = fopen (args.program, "r");
-        ILOG ("Reading the program from %s\n", args.program);
-    }
+        FILE* program_file = NULL;
+        if (!strcmp (args.program, "-")) {
+            program_file = stdin;
+            ILOG ("Reading the program from standard input.\n", 0);
+        } else {
+            program_file = fopen (args.program, "r");
+            ILOG ("Reading the program from %s\n", args.program);
+        }
 
-    if (!program_file) {
-        ELOG ("Cannot open %s for reading\n", args.program);
-        return EXIT_FAILURE;
+        if (!program_file) {
+            ELOG ("Cannot open %s for reading\n", args.program);
+            return EXIT_FAILURE;
+        }
+
+        if (!ckone_load (&kone, program_file))
+            return EXIT_FAILURE;
+
+        if (program_file != stdin)
+            fclose (program_file);
     }
 
-    if (!ckone_load (&kone, program_file))
+    if (args.profile && !prof_init (&kone))
+        return EXIT_FAILURE;
+    if (args.sample && !sample_init (&kone))
+        return EXIT_FAILURE;
+    if (args.cache && !cache_init (&kone, args.cache_config))
+        return EXIT_FAILURE;
+    if (args.branch && !branch_init (&kone, args.branch_config))
+        return EXIT_FAILURE;
+    if (args.callgraph_file && !callgraph_init (&kone))
+        return EXIT_FAILURE;
+    if (args.trace_file && !trace_open (&kone, args.trace_file, args.trace_compress))
+        return EXIT_FAILURE;
+    if (args.record_file && !replay_open (args.record_file, false))
+        return EXIT_FAILURE;
+    if (args.replay_file && !replay_open (args.replay_file, true))
+        return EXIT_FAILURE;
+    if (args.undo_size && !undo_init (args.undo_size))
+        return EXIT_FAILURE;
+    if ((args.break_count || args.watch_count || args.gdb_socket) && !debug_init (&kone))
+        return EXIT_FAILURE;
+    if ((args.dump_changes || args.snapshot_interval) && !dirty_init (&kone))
+        return EXIT_FAILURE;
+    if (args.report_count && !report_init (&kone))
         return EXIT_FAILURE;
 
-    if (program_file != stdin)
-        fclose (program_file);
+    // In the fork-server mode, only the children continue from here.
+    int retval = EXIT_SUCCESS;
+    if (!args.fork_server || forksrv_run (&retval)) {
+        // Init the external devices.
+        ext_init_devices ();
 
-    // Init the external devices.
-    ext_init_devices ();
+        // Run the emulator.
+        if (args.mix && !mix_init (&kone))
+            args.mix = false;
+        if (args.live)
+            live_init (&kone);
+        bool counting = args.perf_counters && perf_start ();
+        bool sampling = args.sample && sample_start (&kone, args.sample_interval);
+        retval = args.gdb_socket? gdb_run (&kone) : ckone_run (&kone);
+        if (sampling)
+            sample_stop ();
+        if (counting)
+            perf_stop ();
+        if (args.live)
+            live_close (&kone);
 
-    // Run the emulator.
-    int retval = ckone_run (&kone);
+        if (args.trace_file)
+            trace_close ();
+        replay_close ();
+
+        // Print the reports.
+        if (args.profile)
+            write_output (args.profile_file, "w", prof_report, &kone);
+        if (sampling)
+            write_output (args.sample_file, "w", sample_report, &kone);
+        if (args.cache)
+            write_output (args.cache_file, "w", cache_report, &kone);
+        if (args.branch)
+            write_output (args.branch_file, "w", branch_report, &kone);
+        if (args.callgraph_file)
+            write_callgraph ();
+        if (args.report_count)
+            write_output (args.report_file, args.binary_report? "wb" : "w",
+                    args.binary_report? report_binary : report_json, &kone);
+        if (counting)
+            perf_report (&kone, stdout);
+        if (args.mix)
+            write_output (args.mix_file, "w", mix_json, &kone);
+    }
 
     // Clean up.
     ext_close_devices ();
+    prof_free ();
+    sample_free ();
+    cache_free ();
+    branch_free ();
+    callgraph_free ();
+    undo_free ();
+    debug_free ();
+    dirty_free ();
+    report_free ();
+    perf_free ();
+    mix_free (&kone);
+    plugin_unload_all ();
     ckone_free (&kone);
 
     return retval;
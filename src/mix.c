@@ -0,0 +1,269 @@
+/**
+ * @file mix.c
+ *
+ * Instruction mix and fault statistics. Counts how many times each opcode
+ * was executed in each addressing mode, how many times each jump jumped,
+ * the memory reads and writes, the SVCs by number, and the faults by the
+ * bit of SR they set. The mix shows which instructions and paths are worth
+ * making faster.
+ *
+ * Each instruction costs one increment, in a table indexed by its opcode
+ * and addressing mode; the other counters only change when their event
+ * happens. The totals per opcode, per mode and the jumps not taken are
+ * derived from the table once, when the mix is read with mix_get().
+ *
+ * The counters belong to the machine (see s_ckone::mix). The hooks are
+ * called from cpu.c and mmu.c when they have been allocated with
+ * mix_init().
+ */
+
+#include "common.h"
+#include "instr.h"
+#include "mix.h"
+
+
+/**
+ * The counters of one machine, reached through s_ckone::mix.
+ */
+struct mix_counts {
+    /// The executions, indexed by the opcode and the addressing mode bits.
+    uint64_t op_modes[256][4];
+
+    /// The times each jump opcode jumped.
+    uint64_t taken[256];
+
+    /// The memory reads, including the instruction fetches.
+    uint64_t reads;
+
+    /// The memory writes.
+    uint64_t writes;
+
+    /// The SVCs by number. The last entry counts the larger numbers.
+    uint64_t svcs[MIX_SVC_COUNT + 1];
+
+    /// The faults by the bit of SR they set.
+    uint64_t faults[32];
+};
+
+
+/**
+ * Allocate the cleared counters of the machine. See also mix_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+mix_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    kone->mix = calloc (1, sizeof(struct mix_counts));
+    if (!kone->mix) {
+        ELOG ("Could not allocate memory for the instruction mix\n", 0);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Free the counters allocated by mix_init().
+ */
+void
+mix_free (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    free (kone->mix);
+    kone->mix = NULL;
+}
+
+
+/**
+ * Count an execution of the instruction in IR. Called after the
+ * instruction has been fetched.
+ */
+void
+mix_instr (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    kone->mix->op_modes[(uint32_t) kone->ir >> 24][(kone->ir >> 19) & 0x3]++;
+}
+
+
+/**
+ * Count a jump taken by the instruction in IR.
+ */
+void
+mix_taken (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    kone->mix->taken[(uint32_t) kone->ir >> 24]++;
+}
+
+
+/**
+ * Count a memory read.
+ */
+void
+mix_read (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    kone->mix->reads++;
+}
+
+
+/**
+ * Count a memory write.
+ */
+void
+mix_write (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    kone->mix->writes++;
+}
+
+
+/**
+ * Count a SVC.
+ */
+void
+mix_svc (
+        s_ckone* kone,      ///< The state structure.
+        int32_t num         ///< The number of the SVC.
+        )
+{
+    if (num >= 0 && num < MIX_SVC_COUNT)
+        kone->mix->svcs[num]++;
+    else
+        kone->mix->svcs[MIX_SVC_COUNT]++;
+}
+
+
+/**
+ * Count the faults set in SR. Called when an execution cycle fails.
+ */
+void
+mix_fault (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    for (int bit = 0; bit < 32; bit++)
+        if ((uint32_t) (kone->sr & SR_FAULTS) & (1u << bit))
+            kone->mix->faults[bit]++;
+}
+
+
+/**
+ * Get the instruction mix counted so far.
+ */
+void
+mix_get (
+        s_ckone* kone,      ///< The state structure.
+        s_mix* mix          ///< Where to store the mix.
+        )
+{
+    memset (mix, 0, sizeof(s_mix));
+    mix->instructions = kone->instr_count;
+    const struct mix_counts* c = kone->mix;
+    if (!c)
+        return;
+
+    for (int op = 0; op < 256; op++) {
+        for (int mode = 0; mode < 4; mode++) {
+            mix->opcodes[op] += c->op_modes[op][mode];
+            if (mode < 3)
+                mix->modes[mode] += c->op_modes[op][mode];
+        }
+    }
+
+    for (int op = JUMP; op <= JNGRE; op++) {
+        mix->taken[op] = c->taken[op];
+        mix->not_taken[op] = mix->opcodes[op] - c->taken[op];
+    }
+
+    mix->reads = c->reads;
+    mix->writes = c->writes;
+    memcpy (mix->svcs, c->svcs, sizeof(c->svcs));
+    memcpy (mix->faults, c->faults, sizeof(c->faults));
+}
+
+
+/**
+ * Write the instruction mix as JSON: an object with the members
+ * @c instructions, @c opcodes (the executions by opcode name), @c modes,
+ * @c jumps (the @c taken and @c not_taken counts by opcode name),
+ * @c memory (the @c reads, including the fetches, and @c writes),
+ * @c svcs (by number, with @c other for numbers of MIX_SVC_COUNT and
+ * above) and @c faults (by the name of the SR bit).
+ */
+void
+mix_json (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The output file.
+        )
+{
+    static const char* mode_names[] = { "immediate", "direct", "indirect" };
+    static const struct {
+        const char* name;   ///< The name of the bit.
+        uint32_t bit;       ///< The bit.
+    } fault_names[] = {
+        { "O", SR_O }, { "Z", SR_Z }, { "U", SR_U }, { "M", SR_M },
+    };
+
+    s_mix mix;
+    mix_get (kone, &mix);
+
+    fprintf (out, "{\"instructions\": %llu,\n \"opcodes\": {",
+            (unsigned long long) mix.instructions);
+    const char* sep = "";
+    for (int op = 0; op < 256; op++) {
+        if (mix.opcodes[op]) {
+            fprintf (out, "%s\"%s\": %llu", sep, instr_op_name (op),
+                    (unsigned long long) mix.opcodes[op]);
+            sep = ", ";
+        }
+    }
+
+    fprintf (out, "},\n \"modes\": {");
+    for (int mode = 0; mode < 3; mode++)
+        fprintf (out, "%s\"%s\": %llu", mode? ", " : "", mode_names[mode],
+                (unsigned long long) mix.modes[mode]);
+
+    fprintf (out, "},\n \"jumps\": {");
+    sep = "";
+    for (int op = JUMP; op <= JNGRE; op++) {
+        if (mix.opcodes[op]) {
+            fprintf (out, "%s\"%s\": {\"taken\": %llu, \"not_taken\": %llu}", sep,
+                    instr_op_name (op), (unsigned long long) mix.taken[op],
+                    (unsigned long long) mix.not_taken[op]);
+            sep = ", ";
+        }
+    }
+
+    fprintf (out, "},\n \"memory\": {\"reads\": %llu, \"writes\": %llu},\n \"svcs\": {",
+            (unsigned long long) mix.reads, (unsigned long long) mix.writes);
+    sep = "";
+    for (int num = 0; num <= MIX_SVC_COUNT; num++) {
+        if (!mix.svcs[num])
+            continue;
+        if (num < MIX_SVC_COUNT)
+            fprintf (out, "%s\"%d\": %llu", sep, num, (unsigned long long) mix.svcs[num]);
+        else
+            fprintf (out, "%s\"other\": %llu", sep, (unsigned long long) mix.svcs[num]);
+        sep = ", ";
+    }
+
+    fprintf (out, "},\n \"faults\": {");
+    for (size_t i = 0; i < sizeof(fault_names) / sizeof(fault_names[0]); i++) {
+        int bit = 0;
+        while (!(fault_names[i].bit & (1u << bit)))
+            bit++;
+        fprintf (out, "%s\"%s\": %llu", i? ", " : "", fault_names[i].name,
+                (unsigned long long) mix.faults[bit]);
+    }
+    fprintf (out, "}}\n");
+}
@@ -0,0 +1,63 @@
+/**
+ * @file mix.h
+ *
+ * The instruction mix and fault statistics, and their public functions.
+ */
+
+#ifndef MIX_H
+#define MIX_H
+
+
+/// The number of SVC numbers counted separately. The larger numbers
+/// are counted in the last entry of s_mix::svcs.
+#define MIX_SVC_COUNT 64
+
+
+/**
+ * The instruction mix of a run, filled in by mix_get().
+ */
+typedef struct {
+    /// The number of instructions executed.
+    uint64_t instructions;
+
+    /// The executions of each opcode (see ::e_opcode).
+    uint64_t opcodes[256];
+
+    /// The executions in each addressing mode (see ::e_addr_mode).
+    uint64_t modes[3];
+
+    /// The times each jump opcode jumped.
+    uint64_t taken[256];
+
+    /// The times each jump opcode did not jump.
+    uint64_t not_taken[256];
+
+    /// The memory reads, including the instruction fetches.
+    uint64_t reads;
+
+    /// The memory writes.
+    uint64_t writes;
+
+    /// The SVCs by number. The last entry counts the larger numbers.
+    uint64_t svcs[MIX_SVC_COUNT + 1];
+
+    /// The faults by the bit of SR they set (see ::e_status_bits).
+    uint64_t faults[32];
+} s_mix;
+
+
+extern bool mix_init (s_ckone* kone);
+extern void mix_free (s_ckone* kone);
+
+extern void mix_instr (s_ckone* kone);
+extern void mix_taken (s_ckone* kone);
+extern void mix_read (s_ckone* kone);
+extern void mix_write (s_ckone* kone);
+extern void mix_svc (s_ckone* kone, int32_t num);
+extern void mix_fault (s_ckone* kone);
+
+extern void mix_get (s_ckone* kone, s_mix* mix);
+extern void mix_json (s_ckone* kone, FILE* out);
+
+
+#endif
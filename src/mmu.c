@@ -5,6 +5,14 @@
  */
 
 #include "common.h"
+#include "prof.h"
+#include "mix.h"
+#include "cache.h"
+#include "trace.h"
+#include "undo.h"
+#include "debug.h"
+#include "dirty.h"
+#include "args.h"
 
 
 /**
@@ -42,18 +50,17 @@ valid_paddr (
 
 
 /**
- * Read a word from memory.
- *
- * Calculates the physical address for MAR and reads data from
- * that memory address into MBR.
+ * @internal
+ * Read a word from memory. See mmu_read() and mmu_fetch().
  *
  * Affects: MBR
  *
  * Affected status bits: ::SR_M
  */
-void 
-mmu_read (
-        s_ckone* kone       ///< The state structure.
+static inline void 
+read_word (
+        s_ckone* kone,      ///< The state structure.
+        e_cache_access kind ///< The kind of the read for the cache simulator.
         ) 
 {
     int32_t paddr = calculate_paddr (kone, kone->mar);
@@ -69,10 +76,52 @@ mmu_read (
     }
 
     kone->mbr = kone->mem[paddr];
+    if (args.profile)
+        prof_read ();
+    if (kone->mix)
+        mix_read (kone);
+    if (args.cache)
+        cache_access (kone->mar, paddr, kind);
     DLOG ("Read 0x%x from 0x%x\n", kone->mbr, paddr);
 }
 
 
+/**
+ * Read a word from memory.
+ *
+ * Calculates the physical address for MAR and reads data from
+ * that memory address into MBR.
+ *
+ * Affects: MBR
+ *
+ * Affected status bits: ::SR_M
+ */
+void 
+mmu_read (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    read_word (kone, CACHE_READ);
+}
+
+
+/**
+ * Fetch an instruction from memory. Works like mmu_read(), except
+ * that the cache simulator sees an instruction fetch.
+ *
+ * Affects: MBR
+ *
+ * Affected status bits: ::SR_M
+ */
+void 
+mmu_fetch (
+        s_ckone* kone       ///< The state structure.
+        ) 
+{
+    read_word (kone, CACHE_FETCH);
+}
+
+
 /**
  * Write a word to memory.
  *
@@ -98,7 +147,72 @@ mmu_write (
         return;
     }
 
+    if (args.undo_size)
+        undo_write (paddr, kone->mem[paddr]);
+    if (args.watch_count || args.gdb_socket)
+        debug_write (kone, paddr, kone->mem[paddr], kone->mbr);
     kone->mem[paddr] = kone->mbr;
+    if (args.dump_changes || args.snapshot_interval)
+        dirty_write (paddr);
+    if (args.profile)
+        prof_write ();
+    if (kone->mix)
+        mix_write (kone);
+    if (args.cache)
+        cache_access (kone->mar, paddr, CACHE_WRITE);
+    if (args.trace_file)
+        trace_write (kone->mar, kone->mbr);
     DLOG ("Wrote 0x%x to 0x%x\n", kone->mem[paddr], paddr);
 }
 
+
+
+/**
+ * Read a word from the given logical address. The read is done
+ * through MAR and MBR, so the MMU limits are checked.
+ *
+ * Affects: MAR, MBR
+ *
+ * Affected status bits: ::SR_M
+ *
+ * @return True if the read succeeded.
+ */
+bool 
+mmu_read_word (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr,       ///< The logical address.
+        int32_t* value      ///< A pointer to a variable where the word should be stored.
+        ) 
+{
+    kone->mar = addr;
+    mmu_read (kone);
+    if (kone->sr & SR_M)
+        return false;
+
+    *value = kone->mbr;
+    return true;
+}
+
+
+/**
+ * Write a word to the given logical address. The write is done
+ * through MAR and MBR, so the MMU limits are checked.
+ *
+ * Affects: MAR, MBR
+ *
+ * Affected status bits: ::SR_M
+ *
+ * @return True if the write succeeded.
+ */
+bool 
+mmu_write_word (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr,       ///< The logical address.
+        int32_t value       ///< The word to write.
+        ) 
+{
+    kone->mar = addr;
+    kone->mbr = value;
+    mmu_write (kone);
+    return !(kone->sr & SR_M);
+}
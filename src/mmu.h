@@ -9,7 +9,10 @@
 
 
 extern void mmu_read (s_ckone* kone);
+extern void mmu_fetch (s_ckone* kone);
 extern void mmu_write (s_ckone* kone);
+extern bool mmu_read_word (s_ckone* kone, int32_t addr, int32_t* value);
+extern bool mmu_write_word (s_ckone* kone, int32_t addr, int32_t value);
 
 
 #endif
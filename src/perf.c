@@ -0,0 +1,278 @@
+/**
+ * @file perf.c
+ *
+ * Host hardware performance counters around the emulation. With the
+ * perf-counters option (see ::args), the counters of the Linux
+ * @c perf_event_open interface are enabled while the program runs: the
+ * host CPU cycles, instructions, branch misses, L1 data cache misses and
+ * instruction TLB misses. At the end they are reported together with the
+ * number of emulated instructions, so that for example the host cycles
+ * and branch misses per guest instruction show how well the dispatch of
+ * the interpreter works.
+ *
+ * Only the emulator process in user mode is counted. Each counter is
+ * opened on its own, so a counter the host does not have is just left
+ * out. If no counter can be opened, for example because the kernel does
+ * not permit it (see @c /proc/sys/kernel/perf_event_paranoid), a warning
+ * is printed and the program runs without them. When the kernel has
+ * to share the hardware between more counters than it has, the values
+ * are scaled by the time each counter was really counting.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include "common.h"
+#include "config.h"
+#include "perf.h"
+
+#ifdef HAVE_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef HAVE_PERF_EVENT
+
+/**
+ * @internal
+ * A counter.
+ */
+typedef struct {
+    const char* name;       ///< The name of the counter in the report.
+    uint32_t type;          ///< The perf_event_attr type.
+    uint64_t config;        ///< The perf_event_attr config.
+    int fd;                 ///< The counter, or -1 if it is not open.
+    uint64_t value;         ///< The value after perf_stop().
+} s_counter;
+
+
+/// @cond skip
+// the config of a cache counter
+#define CACHE_MISSES(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+/// @endcond
+
+
+/**
+ * @internal
+ * The counters.
+ */
+static s_counter counters[] = {
+    { "cycles",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       -1, 0 },
+    { "instructions",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     -1, 0 },
+    { "branch-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    -1, 0 },
+    { "L1d-misses",     PERF_TYPE_HW_CACHE, CACHE_MISSES (PERF_COUNT_HW_CACHE_L1D),  -1, 0 },
+    { "iTLB-misses",    PERF_TYPE_HW_CACHE, CACHE_MISSES (PERF_COUNT_HW_CACHE_ITLB), -1, 0 },
+};
+
+/**
+ * @internal
+ * The number of counters.
+ */
+#define COUNTER_COUNT ((int) (sizeof(counters) / sizeof(counters[0])))
+
+
+/**
+ * @internal
+ * Open a counter for this process, disabled.
+ *
+ * @return The counter, or -1 with errno set.
+ */
+static int
+open_counter (
+        const s_counter* c      ///< The counter.
+        )
+{
+    struct perf_event_attr attr;
+    memset (&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = c->type;
+    attr.config = c->config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/**
+ * Open the counters and start counting. Must be called in the process
+ * which runs the emulation, after any fork.
+ *
+ * @return False if no counter could be opened. A warning has then
+ *         been printed, and perf_stop() and perf_report() do nothing.
+ */
+bool
+perf_start (
+        void
+        )
+{
+    int opened = 0;
+    int error = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters[i].value = 0;
+        counters[i].fd = open_counter (&counters[i]);
+        if (counters[i].fd >= 0)
+            opened++;
+        else if (!error)
+            error = errno;
+    }
+
+    if (!opened && (error == EACCES || error == EPERM)) {
+        WLOG ("Hardware performance counters are not permitted (%s); "
+              "check /proc/sys/kernel/perf_event_paranoid\n", strerror (error));
+        return false;
+    }
+    if (!opened) {
+        WLOG ("Hardware performance counters are not available on this host (%s)\n",
+                strerror (error));
+        return false;
+    }
+    if (opened < COUNTER_COUNT)
+        ILOG ("Only %d of %d performance counters are available\n", opened, COUNTER_COUNT);
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters[i].fd >= 0) {
+            ioctl (counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl (counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Stop counting and read the counters.
+ */
+void
+perf_stop (
+        void
+        )
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        if (counters[i].fd >= 0)
+            ioctl (counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        s_counter* c = &counters[i];
+        uint64_t data[3];   // the value, the time enabled and the time running
+        if (c->fd < 0)
+            continue;
+        if (read (c->fd, data, sizeof(data)) != sizeof(data)) {
+            close (c->fd);
+            c->fd = -1;
+            continue;
+        }
+
+        c->value = data[0];
+        if (data[2] && data[2] < data[1])
+            c->value = (uint64_t) ((double) data[0] * data[1] / data[2]);
+    }
+}
+
+
+/**
+ * Write the counters read by perf_stop(), per guest instruction.
+ */
+void
+perf_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< Where to write the report.
+        )
+{
+    int opened = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        opened += counters[i].fd >= 0;
+    if (!opened)
+        return;
+
+    uint64_t guest = kone->instr_count;
+    fprintf (out, "Host performance counters for %llu guest instructions:\n",
+            (unsigned long long) guest);
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        s_counter* c = &counters[i];
+        if (c->fd < 0)
+            fprintf (out, "  %-14s %16s\n", c->name, "not counted");
+        else if (guest)
+            fprintf (out, "  %-14s %16llu  %10.3f per guest instruction\n", c->name,
+                    (unsigned long long) c->value, (double) c->value / guest);
+        else
+            fprintf (out, "  %-14s %16llu\n", c->name, (unsigned long long) c->value);
+    }
+}
+
+
+/**
+ * Close the counters.
+ */
+void
+perf_free (
+        void
+        )
+{
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters[i].fd >= 0)
+            close (counters[i].fd);
+        counters[i].fd = -1;
+    }
+}
+
+#else
+
+/**
+ * Without @c perf_event_open, only print a warning.
+ *
+ * @return False.
+ */
+bool
+perf_start (
+        void
+        )
+{
+    WLOG ("Hardware performance counters are not available; "
+          "ckone was built without perf_event_open\n", 0);
+    return false;
+}
+
+
+/**
+ * Does nothing without @c perf_event_open.
+ */
+void
+perf_stop (
+        void
+        )
+{
+}
+
+
+/**
+ * Does nothing without @c perf_event_open.
+ */
+void
+perf_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< Where to write the report.
+        )
+{
+    (void) kone;
+    (void) out;
+}
+
+
+/**
+ * Does nothing without @c perf_event_open.
+ */
+void
+perf_free (
+        void
+        )
+{
+}
+
+#endif
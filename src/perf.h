@@ -0,0 +1,17 @@
+/**
+ * @file perf.h
+ *
+ * The public functions of the host performance counters.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+
+extern bool perf_start (void);
+extern void perf_stop (void);
+extern void perf_report (s_ckone* kone, FILE* out);
+extern void perf_free (void);
+
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file plugin.c
+ *
+ * Loads SVC plugins and keeps track of the SVCs they provide.
+ * See plugin.h for the plugin interface.
+ *
+ * Calls functions in mmu.c to give the plugins checked access
+ * to the emulator memory.
+ */
+
+#include <dlfcn.h>
+#include "common.h"
+#include "mmu.h"
+#include "plugin.h"
+
+
+/**
+ * @internal
+ * The functions given to every plugin SVC handler.
+ */
+static const s_plugin_api plugin_api = {
+    mmu_read_word,
+    mmu_write_word,
+    wlog
+};
+
+
+/**
+ * @internal
+ * The registered SVCs.
+ */
+static s_plugin_svc svcs[MAX_PLUGIN_SVCS];
+
+/**
+ * @internal
+ * The number of entries used in ::svcs.
+ */
+static int svc_count = 0;
+
+
+/**
+ * @internal
+ * The handles of the loaded shared objects.
+ */
+static void* handles[MAX_PLUGIN_SVCS];
+
+/**
+ * @internal
+ * The number of entries used in ::handles.
+ */
+static int handle_count = 0;
+
+
+/**
+ * Register a native SVC handler. The SVC numbers of the built-in
+ * routines (::PLUGIN_FIRST_BUILTIN_SVC to ::PLUGIN_LAST_BUILTIN_SVC) are
+ * handled before the plugins are consulted, so they cannot be registered.
+ *
+ * @return False if the table is full or the number is already taken.
+ */
+bool
+plugin_register_svc (
+        const s_plugin_svc* svc     ///< The SVC to register.
+        )
+{
+    if (svc->num >= PLUGIN_FIRST_BUILTIN_SVC
+            && svc->num <= PLUGIN_LAST_BUILTIN_SVC) {
+        ELOG ("SVC %d (%s) is a built-in routine\n", svc->num, svc->name);
+        return false;
+    }
+
+    if (plugin_find_svc (svc->num)) {
+        ELOG ("SVC %d is already registered\n", svc->num);
+        return false;
+    }
+
+    if (svc_count >= MAX_PLUGIN_SVCS) {
+        ELOG ("Too many plugin SVCs (at most %d are allowed)\n", MAX_PLUGIN_SVCS);
+        return false;
+    }
+
+    ILOG ("Registering SVC %d (%s)\n", svc->num, svc->name);
+    svcs[svc_count++] = *svc;
+    return true;
+}
+
+
+/**
+ * Find a registered plugin SVC.
+ *
+ * @return NULL if no plugin provides the SVC.
+ */
+const s_plugin_svc*
+plugin_find_svc (
+        int32_t num         ///< The SVC number.
+        )
+{
+    for (int i = 0; i < svc_count; i++)
+        if (svcs[i].num == num)
+            return &svcs[i];
+    return NULL;
+}
+
+
+/**
+ * Call a plugin SVC handler.
+ *
+ * @return The number of parameters of the SVC.
+ */
+int32_t
+plugin_call_svc (
+        s_ckone* kone,              ///< The state structure.
+        const s_plugin_svc* svc     ///< The SVC to call.
+        )
+{
+    DLOG ("SVC %s (plugin)\n", svc->name);
+    return svc->handler (kone, &plugin_api);
+}
+
+
+/**
+ * Load a plugin and register all SVCs in its table.
+ *
+ * @return True if successful.
+ */
+bool
+plugin_load (
+        const char* path    ///< The path of the shared object.
+        )
+{
+    ILOG ("Loading plugin %s\n", path);
+
+    if (handle_count >= MAX_PLUGIN_SVCS) {
+        ELOG ("Too many plugins\n", 0);
+        return false;
+    }
+
+    void* handle = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        ELOG ("Cannot load plugin %s: %s\n", path, dlerror ());
+        return false;
+    }
+    handles[handle_count++] = handle;
+
+    int* version = dlsym (handle, "ckone_plugin_api_version");
+    if (!version || *version != PLUGIN_API_VERSION) {
+        ELOG ("Plugin %s was not built for plugin API version %d\n",
+                path, PLUGIN_API_VERSION);
+        return false;
+    }
+
+    s_plugin_svc* table = dlsym (handle, "ckone_plugin_svcs");
+    if (!table) {
+        ELOG ("Plugin %s has no SVC table\n", path);
+        return false;
+    }
+
+    for (s_plugin_svc* svc = table; svc->handler; svc++)
+        if (!plugin_register_svc (svc))
+            return false;
+
+    return true;
+}
+
+
+/**
+ * Forget all registered SVCs and unload the plugins.
+ */
+void
+plugin_unload_all (
+        void
+        )
+{
+    svc_count = 0;
+    for (int i = 0; i < handle_count; i++)
+        dlclose (handles[i]);
+    handle_count = 0;
+}
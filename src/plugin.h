@@ -0,0 +1,83 @@
+/**
+ * @file plugin.h
+ *
+ * The interface for SVC plugins. A plugin is a shared object which
+ * exports a table of native SVC handlers. It is loaded with the
+ * @c --plugin command line option, and its handlers are called by
+ * ext_svc() for SVC numbers not implemented by ckone itself.
+ *
+ * A plugin must export the following two symbols:
+@verbatim
+    int ckone_plugin_api_version = PLUGIN_API_VERSION;
+
+    s_plugin_svc ckone_plugin_svcs[] = {
+        { 20, "SORT", svc_sort },
+        { 0, NULL, NULL }           // end of table
+    };
+@endverbatim
+ * A handler works like the built-in SVC routines: when it is called,
+ * PC and FP have been pushed onto the stack, so the parameters are at
+ * FP-2, FP-3, and so on. It must return the number of parameters, which
+ * are then removed from the stack. Memory should only be accessed through
+ * the functions in ::s_plugin_api so that the MMU limits are respected.
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+
+/// The version of the plugin interface. Plugins built against
+/// a different version are rejected.
+#define PLUGIN_API_VERSION 1
+
+/// The first SVC number used by the built-in routines.
+#define PLUGIN_FIRST_BUILTIN_SVC 11
+
+/// The last SVC number used by the built-in routines.
+#define PLUGIN_LAST_BUILTIN_SVC 16
+
+/// The maximum number of SVCs all plugins can register together.
+#define MAX_PLUGIN_SVCS 64
+
+
+/**
+ * The functions ckone offers to plugin SVC handlers.
+ */
+typedef struct {
+    /// See mmu_read_word().
+    bool (*read_word) (s_ckone* kone, int32_t addr, int32_t* value);
+
+    /// See mmu_write_word().
+    bool (*write_word) (s_ckone* kone, int32_t addr, int32_t value);
+
+    /// See wlog().
+    void (*wlog) (e_loglevel lvl, const char* fmt, ...);
+} s_plugin_api;
+
+
+/**
+ * A native SVC handler.
+ *
+ * @return The number of parameters the SVC takes.
+ */
+typedef int32_t (*plugin_svc_handler) (s_ckone* kone, const s_plugin_api* api);
+
+
+/**
+ * One entry in the SVC table of a plugin.
+ */
+typedef struct {
+    int32_t num;                    ///< The SVC number.
+    const char* name;               ///< The SVC name. Used in messages.
+    plugin_svc_handler handler;     ///< The handler. NULL ends the table.
+} s_plugin_svc;
+
+
+extern bool plugin_load (const char* path);
+extern void plugin_unload_all ();
+extern bool plugin_register_svc (const s_plugin_svc* svc);
+extern const s_plugin_svc* plugin_find_svc (int32_t num);
+extern int32_t plugin_call_svc (s_ckone* kone, const s_plugin_svc* svc);
+
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * @file prof.c
+ *
+ * An execution profiler. Counts how many times the instruction at each
+ * address was executed, how many times each opcode was executed, and how
+ * many memory reads and writes each instruction made, in per-address
+ * counters (see counters.c). At the end a report of the hot spots and
+ * routines is printed.
+ *
+ * The hooks are called from cpu.c and mmu.c when the profile flag
+ * (see ::args) is set.
+ */
+
+#include "common.h"
+#include "instr.h"
+#include "counters.h"
+
+
+/// @cond skip
+// How many of the hottest instructions are listed in the report.
+#define PROF_TOP 20
+/// @endcond
+
+
+/**
+ * @internal
+ * The counters of one address.
+ */
+typedef struct {
+    uint64_t execs;         ///< The number of times the instruction was executed.
+    uint64_t reads;         ///< The number of memory reads, including the fetches.
+    uint64_t writes;        ///< The number of memory writes.
+} s_prof_counts;
+
+
+/**
+ * @internal
+ * The counters, indexed by logical address (see counters_alloc()).
+ */
+static s_prof_counts* counts = NULL;
+
+/**
+ * @internal
+ * The number of addresses in ::counts.
+ */
+static int32_t size = 0;
+
+/**
+ * @internal
+ * The counters of the current instruction.
+ */
+static s_prof_counts* current = NULL;
+
+/**
+ * @internal
+ * The number of executions of each opcode.
+ */
+static uint64_t op_counts[256];
+
+
+/**
+ * Allocate the counters. The program must have been loaded. See also
+ * prof_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+prof_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    counts = counters_alloc (kone, sizeof(s_prof_counts), &size);
+    if (!counts) {
+        ELOG ("Could not allocate memory for the profiler\n", 0);
+        return false;
+    }
+
+    current = &counts[size];
+    memset (op_counts, 0, sizeof(op_counts));
+    return true;
+}
+
+
+/**
+ * Free the counters allocated by prof_init().
+ */
+void
+prof_free (
+        void
+        )
+{
+    free (counts);
+    counts = NULL;
+    current = NULL;
+    size = 0;
+}
+
+
+/**
+ * Select the counters of the instruction PC points to. Called
+ * before the instruction is fetched.
+ */
+void
+prof_fetch (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    current = &counts[COUNTERS_INDEX (kone->pc, size)];
+}
+
+
+/**
+ * Count an execution of the current instruction. Called after
+ * the instruction has been fetched into IR.
+ */
+void
+prof_instr (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    current->execs++;
+    op_counts[(uint32_t) kone->ir >> 24]++;
+}
+
+
+/**
+ * Count a memory read by the current instruction.
+ */
+void
+prof_read (
+        void
+        )
+{
+    current->reads++;
+}
+
+
+/**
+ * Count a memory write by the current instruction.
+ */
+void
+prof_write (
+        void
+        )
+{
+    current->writes++;
+}
+
+
+/**
+ * @internal
+ * Sum up the counters of the executed addresses by routine. Data reads
+ * do not include the instruction fetches.
+ *
+ * @return The sums, indexed by routine, which must be freed, or NULL if
+ *         the allocation failed.
+ */
+static s_prof_counts*
+sum_routines (
+        const int32_t* addrs,   ///< The executed addresses.
+        int32_t n,              ///< The number of addresses.
+        s_routines* routines    ///< Where to store the routines.
+        )
+{
+    if (!counters_routines (size, routines))
+        return NULL;
+    s_prof_counts* sums = calloc (routines->count, sizeof(s_prof_counts));
+    if (!sums)
+        return NULL;
+
+    for (int32_t i = 0; i < n; i++) {
+        s_prof_counts* c = &counts[addrs[i]];
+        s_prof_counts* r = &sums[routines->of[addrs[i]]];
+        r->execs += c->execs;
+        r->reads += c->reads - c->execs;
+        r->writes += c->writes;
+    }
+    return sums;
+}
+
+
+/**
+ * Print the profile: the hottest instructions, the totals of each
+ * routine, and the opcode counts. Data reads do not include the
+ * instruction fetches. Must be called before symtable_clear().
+ */
+void
+prof_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The file to print the report to.
+        )
+{
+    if (!counts)
+        return;
+
+    s_routines routines = { NULL, NULL, 0 };
+    int32_t n = 0, nr = 0;
+    int32_t* addrs = counters_top (counts, sizeof(s_prof_counts),
+            offsetof (s_prof_counts, execs), size, &n);
+    s_prof_counts* sums = addrs? sum_routines (addrs, n, &routines) : NULL;
+    int32_t* order = sums? counters_top (sums, sizeof(s_prof_counts),
+            offsetof (s_prof_counts, execs), routines.count, &nr) : NULL;
+    if (!order) {
+        ELOG ("Could not allocate memory for the profile report\n", 0);
+        free (sums);
+        counters_free_routines (&routines);
+        free (addrs);
+        return;
+    }
+
+    uint64_t total = 0;
+    for (int32_t i = 0; i < n; i++)
+        total += counts[addrs[i]].execs;
+    fprintf (out, "Profile: %llu instructions executed at %d addresses\n\n",
+            (unsigned long long) total, n);
+
+    // the hottest instructions
+    fprintf (out, "Hot spots:\n");
+    fprintf (out, "%14s %7s %12s %12s  %-20s %s\n",
+            "Executions", "%", "Data reads", "Writes", "Address", "Instruction");
+    for (int32_t i = 0; i < n && i < PROF_TOP; i++) {
+        int32_t a = addrs[i];
+        char sym[64], instr[256];
+        counters_describe (kone, a, sym, sizeof(sym), instr, sizeof(instr));
+        fprintf (out, "%14llu %6.2f%% %12llu %12llu  %-20s %s\n",
+                (unsigned long long) counts[a].execs, counters_percent (counts[a].execs, total),
+                (unsigned long long) (counts[a].reads - counts[a].execs),
+                (unsigned long long) counts[a].writes, sym, instr);
+    }
+    fprintf (out, "\n");
+
+    // the routine totals
+    fprintf (out, "Routines:\n");
+    fprintf (out, "%14s %7s %12s %12s  %s\n",
+            "Executions", "%", "Data reads", "Writes", "Routine");
+    for (int32_t i = 0; i < nr; i++) {
+        s_prof_counts* r = &sums[order[i]];
+        const char* name = routines.names[order[i]];
+        fprintf (out, "%14llu %6.2f%% %12llu %12llu  %s\n",
+                (unsigned long long) r->execs, counters_percent (r->execs, total),
+                (unsigned long long) r->reads, (unsigned long long) r->writes,
+                name? name : "(unknown)");
+    }
+    fprintf (out, "\n");
+
+    // the opcodes
+    fprintf (out, "Opcodes:\n");
+    for (int op = 0; op < 256; op++)
+        if (op_counts[op])
+            fprintf (out, "%14llu %6.2f%%  %s\n",
+                    (unsigned long long) op_counts[op], counters_percent (op_counts[op], total),
+                    instr_op_name (op));
+    fprintf (out, "\n");
+
+    free (order);
+    free (sums);
+    counters_free_routines (&routines);
+    free (addrs);
+}
@@ -0,0 +1,22 @@
+/**
+ * @file prof.h
+ *
+ * The public functions of the execution profiler.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+
+extern bool prof_init (s_ckone* kone);
+extern void prof_free ();
+
+extern void prof_fetch (s_ckone* kone);
+extern void prof_instr (s_ckone* kone);
+extern void prof_read ();
+extern void prof_write ();
+
+extern void prof_report (s_ckone* kone, FILE* out);
+
+
+#endif
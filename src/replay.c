@@ -0,0 +1,273 @@
+/**
+ * @file replay.c
+ *
+ * Record and replay of the nondeterministic inputs of a program. When
+ * recording, every value read from the KBD and STDIN devices (with IN
+ * or SVC READ) and every time returned to SVC TIME and SVC DATE is
+ * written to a log. When replaying, the values are taken from the log
+ * instead, so a run can be repeated exactly without a terminal and
+ * without depending on the clock.
+ *
+ * The log starts with the 8 bytes "CKREPLAY". It is followed by one
+ * record per value: the byte 'I', the device number as a byte and the
+ * value, or the byte 'T' and the tm_sec, tm_min, tm_hour, tm_mday,
+ * tm_mon and tm_year fields of the local time. All numbers are 32-bit
+ * little-endian integers.
+ *
+ * The functions are called from ext.c when a record or replay file
+ * (see ::args) has been given.
+ */
+
+#include <time.h>
+#include "common.h"
+#include "replay.h"
+
+
+/**
+ * @internal
+ * The magic bytes at the start of a log.
+ */
+static const char magic[8] = { 'C', 'K', 'R', 'E', 'P', 'L', 'A', 'Y' };
+
+/**
+ * @internal
+ * The record tags.
+ */
+enum {
+    TAG_INPUT = 'I',        ///< A value read from an input device.
+    TAG_TIME = 'T'          ///< A local time.
+};
+
+/**
+ * @internal
+ * The log file. NULL if not recording or replaying.
+ */
+static FILE* log_file = NULL;
+
+/**
+ * @internal
+ * True if replaying, false if recording.
+ */
+static bool replaying = false;
+
+/**
+ * @internal
+ * The number of records read or written so far.
+ */
+static uint32_t records = 0;
+
+
+/**
+ * @internal
+ * Write a 32-bit little-endian integer to the log.
+ */
+static void
+put_le32 (
+        int32_t value       ///< The number to write.
+        )
+{
+    for (int i = 0; i < 4; i++)
+        putc ((uint32_t) value >> (8 * i) & 0xff, log_file);
+}
+
+
+/**
+ * @internal
+ * Read a 32-bit little-endian integer from the log.
+ *
+ * @return False at the end of the log.
+ */
+static bool
+get_le32 (
+        int32_t* value      ///< Where to store the number.
+        )
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = getc (log_file);
+        if (c == EOF)
+            return false;
+        v |= (uint32_t) c << (8 * i);
+    }
+    *value = (int32_t) v;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read the tag of the next record and check that it is the expected one.
+ *
+ * @return False if the log has ended or the record is of another kind.
+ */
+static bool
+get_tag (
+        int tag             ///< The expected tag.
+        )
+{
+    int c = getc (log_file);
+    if (c == EOF) {
+        ELOG ("The replay log ended after %u records\n", records);
+        return false;
+    }
+    if (c != tag) {
+        ELOG ("Record %u of the replay log is '%c', expected '%c'; the program "
+                "does not follow the recorded run\n", records, c, tag);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Open a log for recording or replaying. See also replay_close().
+ *
+ * @return False if the file could not be opened or is not a replay log.
+ */
+bool
+replay_open (
+        const char* path,   ///< The log file.
+        bool replay         ///< True to replay, false to record.
+        )
+{
+    log_file = fopen (path, replay? "rb" : "wb");
+    if (!log_file) {
+        ELOG ("Cannot open the replay log %s\n", path);
+        return false;
+    }
+
+    replaying = replay;
+    records = 0;
+    if (!replay) {
+        fwrite (magic, 1, sizeof(magic), log_file);
+        return true;
+    }
+
+    char buf[sizeof(magic)];
+    if (fread (buf, 1, sizeof(buf), log_file) != sizeof(buf)
+            || memcmp (buf, magic, sizeof(magic))) {
+        ELOG ("%s is not a replay log\n", path);
+        fclose (log_file);
+        log_file = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Close the log opened with replay_open().
+ */
+void
+replay_close (
+        void
+        )
+{
+    if (!log_file)
+        return;
+
+    ILOG ("%s %u records\n", replaying? "Replayed" : "Recorded", records);
+    if (replaying && getc (log_file) != EOF)
+        WLOG ("The program did not use all of the replay log\n", 0);
+    fclose (log_file);
+    log_file = NULL;
+}
+
+
+/**
+ * Write a value read from an input device to the log.
+ */
+void
+replay_record_input (
+        int32_t dev_num,    ///< The device number.
+        int32_t value       ///< The value read.
+        )
+{
+    putc (TAG_INPUT, log_file);
+    putc (dev_num & 0xff, log_file);
+    put_le32 (value);
+    records++;
+}
+
+
+/**
+ * Read the next value of an input device from the log.
+ *
+ * @return False if the next record is not a value of this device.
+ */
+bool
+replay_input (
+        int32_t dev_num,    ///< The device number.
+        int32_t* value      ///< Where to store the value.
+        )
+{
+    if (!get_tag (TAG_INPUT))
+        return false;
+
+    int dev = getc (log_file);
+    if (dev != (dev_num & 0xff)) {
+        ELOG ("Record %u of the replay log is from device %d, expected %d\n",
+                records, dev, dev_num);
+        return false;
+    }
+    if (!get_le32 (value)) {
+        ELOG ("The replay log is truncated\n", 0);
+        return false;
+    }
+
+    records++;
+    return true;
+}
+
+
+/**
+ * Write a local time to the log.
+ */
+void
+replay_record_time (
+        const struct tm* t  ///< The time.
+        )
+{
+    putc (TAG_TIME, log_file);
+    put_le32 (t->tm_sec);
+    put_le32 (t->tm_min);
+    put_le32 (t->tm_hour);
+    put_le32 (t->tm_mday);
+    put_le32 (t->tm_mon);
+    put_le32 (t->tm_year);
+    records++;
+}
+
+
+/**
+ * Read the next local time from the log. Only the fields written by
+ * replay_record_time() are set.
+ *
+ * @return False if the next record is not a time.
+ */
+bool
+replay_time (
+        struct tm* t        ///< Where to store the time.
+        )
+{
+    if (!get_tag (TAG_TIME))
+        return false;
+
+    int32_t f[6];
+    for (int i = 0; i < 6; i++) {
+        if (!get_le32 (&f[i])) {
+            ELOG ("The replay log is truncated\n", 0);
+            return false;
+        }
+    }
+
+    memset (t, 0, sizeof(*t));
+    t->tm_sec = f[0];
+    t->tm_min = f[1];
+    t->tm_hour = f[2];
+    t->tm_mday = f[3];
+    t->tm_mon = f[4];
+    t->tm_year = f[5];
+    records++;
+    return true;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file replay.h
+ *
+ * The public functions of the input record and replay.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <time.h>
+
+
+extern bool replay_open (const char* path, bool replay);
+extern void replay_close ();
+
+extern void replay_record_input (int32_t dev_num, int32_t value);
+extern bool replay_input (int32_t dev_num, int32_t* value);
+
+extern void replay_record_time (const struct tm* t);
+extern bool replay_time (struct tm* t);
+
+
+#endif
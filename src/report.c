@@ -0,0 +1,311 @@
+/**
+ * @file report.c
+ *
+ * Machine-readable end-of-run reports. Instead of parsing the text dump,
+ * a test harness asks for the registers, variables and memory ranges it
+ * needs (see ::args) and gets only those, as JSON or in a fixed binary
+ * layout.
+ *
+ * An item is a register name (@c r0 to @c r7, @c sp, @c fp, @c pc, @c ir,
+ * @c tr, @c sr, @c mar or @c mbr), a symbol or an address, which reports
+ * the memory word there, or a range <tt>START..END</tt> of logical
+ * addresses, both ends included, given as numbers or symbols. The items
+ * are resolved by report_init() once the program has been loaded. Each
+ * item may be given only once, since the names are the keys of the JSON
+ * objects.
+ *
+ * The JSON report is an object with the members @c status (@c "halted" or
+ * @c "fault"), @c instructions, @c registers, @c symbols (the words at
+ * symbols and single addresses, by the name given) and @c memory (a list
+ * of ranges with their @c start and @c values). The binary report is the
+ * number of instructions as a 64-bit and the status (0 for halted, 1 for
+ * a fault) as a 32-bit integer, followed by the values of the items in
+ * the order given, as 32-bit integers; all little-endian.
+ */
+
+#include "common.h"
+#include "debug.h"
+#include "args.h"
+#include "report.h"
+
+
+/**
+ * @internal
+ * The maximum number of items.
+ */
+#define MAX_REPORT_ITEMS 256
+
+
+/**
+ * @internal
+ * The kinds of report items.
+ */
+typedef enum {
+    ITEM_REGISTER,          ///< A register.
+    ITEM_WORD,              ///< A memory word at a symbol or an address.
+    ITEM_RANGE              ///< A range of memory words.
+} e_item_kind;
+
+
+/**
+ * @internal
+ * A resolved report item.
+ */
+typedef struct {
+    e_item_kind kind;       ///< The kind of the item.
+    char name[64];          ///< The name given by the user.
+    size_t offset;          ///< The offset of a register in ::s_ckone.
+    int32_t addr;           ///< The logical address of a word or a range.
+    int32_t count;          ///< The number of words in a range.
+} s_item;
+
+
+/**
+ * @internal
+ * The registers which can be reported.
+ */
+static const struct {
+    const char* name;       ///< The name of the register.
+    size_t offset;          ///< The offset in ::s_ckone.
+} registers[] = {
+    { "r0", offsetof (s_ckone, r[0]) }, { "r1", offsetof (s_ckone, r[1]) },
+    { "r2", offsetof (s_ckone, r[2]) }, { "r3", offsetof (s_ckone, r[3]) },
+    { "r4", offsetof (s_ckone, r[4]) }, { "r5", offsetof (s_ckone, r[5]) },
+    { "r6", offsetof (s_ckone, r[6]) }, { "r7", offsetof (s_ckone, r[7]) },
+    { "sp", offsetof (s_ckone, r[SP]) }, { "fp", offsetof (s_ckone, r[FP]) },
+    { "pc", offsetof (s_ckone, pc) }, { "ir", offsetof (s_ckone, ir) },
+    { "tr", offsetof (s_ckone, tr) }, { "sr", offsetof (s_ckone, sr) },
+    { "mar", offsetof (s_ckone, mar) }, { "mbr", offsetof (s_ckone, mbr) },
+};
+
+/**
+ * @internal
+ * The resolved items.
+ */
+static s_item* items = NULL;
+
+/**
+ * @internal
+ * The number of items in ::items.
+ */
+static int item_count = 0;
+
+
+/**
+ * @internal
+ * Resolve one item.
+ *
+ * @return False if the item is not a register, a known symbol, an
+ *         address or a range inside the program memory.
+ */
+static bool
+resolve_item (
+        s_ckone* kone,      ///< The state structure.
+        char* str,          ///< The item.
+        s_item* item        ///< Where to store the resolved item.
+        )
+{
+    snprintf (item->name, sizeof(item->name), "%s", str);
+
+    for (size_t i = 0; i < sizeof(registers) / sizeof(registers[0]); i++) {
+        if (!strcmp (str, registers[i].name)) {
+            item->kind = ITEM_REGISTER;
+            item->offset = registers[i].offset;
+            return true;
+        }
+    }
+
+    char* dots = strstr (str, "..");
+    int32_t end;
+    if (dots) {
+        *dots = '\0';
+        bool ok = debug_parse_addr (str, &item->addr) && debug_parse_addr (dots + 2, &end);
+        *dots = '.';
+        if (!ok || end < item->addr)
+            return false;
+        item->kind = ITEM_RANGE;
+        item->count = end - item->addr + 1;
+    } else {
+        if (!debug_parse_addr (str, &item->addr))
+            return false;
+        item->kind = ITEM_WORD;
+        item->count = 1;
+        end = item->addr;
+    }
+
+    return item->addr >= 0 && end < kone->mmu_limit;
+}
+
+
+/**
+ * Resolve the report items given in ::args. Must be called after the
+ * program has been loaded. See also report_free().
+ *
+ * @return False if an item is invalid.
+ */
+bool
+report_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    items = malloc (MAX_REPORT_ITEMS * sizeof(s_item));
+    if (!items) {
+        ELOG ("Could not allocate memory for the report\n", 0);
+        return false;
+    }
+
+    item_count = 0;
+    for (int i = 0; i < args.report_count; i++) {
+        char list[1024];
+        snprintf (list, sizeof(list), "%s", args.reports[i]);
+
+        for (char* s = strtok (list, ","); s; s = strtok (NULL, ",")) {
+            if (item_count == MAX_REPORT_ITEMS) {
+                ELOG ("At most %d items can be reported\n", MAX_REPORT_ITEMS);
+                return false;
+            }
+            if (!resolve_item (kone, s, &items[item_count])) {
+                ELOG ("Unknown or invalid report item: %s\n", s);
+                return false;
+            }
+            for (int j = 0; j < item_count; j++) {
+                if (!strcmp (items[j].name, items[item_count].name)) {
+                    ELOG ("The report item %s is given more than once\n", s);
+                    return false;
+                }
+            }
+            item_count++;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Free the memory allocated by report_init().
+ */
+void
+report_free (
+        void
+        )
+{
+    free (items);
+    items = NULL;
+    item_count = 0;
+}
+
+
+/**
+ * @internal
+ * Get the value of a register item.
+ *
+ * @return The value.
+ */
+static int32_t
+register_value (
+        s_ckone* kone,      ///< The state structure.
+        s_item* item        ///< The item.
+        )
+{
+    int32_t value;
+    memcpy (&value, (char*) kone + item->offset, sizeof(value));
+    return value;
+}
+
+
+/**
+ * @internal
+ * Write the items of one kind as JSON members or list entries.
+ */
+static void
+json_items (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out,          ///< The output file.
+        e_item_kind kind    ///< The kind of the items.
+        )
+{
+    const char* sep = "";
+    for (int i = 0; i < item_count; i++) {
+        s_item* item = &items[i];
+        if (item->kind != kind)
+            continue;
+
+        // the names are symbols, numbers or register names and
+        // need no escaping
+        if (kind == ITEM_REGISTER)
+            fprintf (out, "%s\"%s\": %d", sep, item->name, register_value (kone, item));
+        else if (kind == ITEM_WORD)
+            fprintf (out, "%s\"%s\": %d", sep, item->name,
+                    kone->mem[kone->mmu_base + item->addr]);
+        else {
+            fprintf (out, "%s{\"start\": %d, \"values\": [", sep, item->addr);
+            for (int32_t a = item->addr; a < item->addr + item->count; a++)
+                fprintf (out, "%s%d", a == item->addr? "" : ", ",
+                        kone->mem[kone->mmu_base + a]);
+            fprintf (out, "]}");
+        }
+        sep = ", ";
+    }
+}
+
+
+/**
+ * Write the report as JSON.
+ */
+void
+report_json (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The output file.
+        )
+{
+    bool fault = !kone->halted || (kone->sr & SR_FAULTS);
+    fprintf (out, "{\"status\": \"%s\", \"instructions\": %llu,\n",
+            fault? "fault" : "halted", (unsigned long long) kone->instr_count);
+    fprintf (out, " \"registers\": {");
+    json_items (kone, out, ITEM_REGISTER);
+    fprintf (out, "},\n \"symbols\": {");
+    json_items (kone, out, ITEM_WORD);
+    fprintf (out, "},\n \"memory\": [");
+    json_items (kone, out, ITEM_RANGE);
+    fprintf (out, "]}\n");
+}
+
+
+/**
+ * @internal
+ * Write a 32-bit little-endian integer.
+ */
+static void
+put_le32 (
+        FILE* out,          ///< The output file.
+        uint32_t value      ///< The number to write.
+        )
+{
+    for (int i = 0; i < 4; i++)
+        putc (value >> (8 * i) & 0xff, out);
+}
+
+
+/**
+ * Write the report in the binary layout.
+ */
+void
+report_binary (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The output file.
+        )
+{
+    bool fault = !kone->halted || (kone->sr & SR_FAULTS);
+    put_le32 (out, (uint32_t) kone->instr_count);
+    put_le32 (out, (uint32_t) (kone->instr_count >> 32));
+    put_le32 (out, fault);
+
+    for (int i = 0; i < item_count; i++) {
+        s_item* item = &items[i];
+        if (item->kind == ITEM_REGISTER)
+            put_le32 (out, register_value (kone, item));
+        else
+            for (int32_t a = item->addr; a < item->addr + item->count; a++)
+                put_le32 (out, kone->mem[kone->mmu_base + a]);
+    }
+}
@@ -0,0 +1,18 @@
+/**
+ * @file report.h
+ *
+ * The public functions of the end-of-run reports.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+
+extern bool report_init (s_ckone* kone);
+extern void report_free ();
+
+extern void report_json (s_ckone* kone, FILE* out);
+extern void report_binary (s_ckone* kone, FILE* out);
+
+
+#endif
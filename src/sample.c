@@ -0,0 +1,324 @@
+/**
+ * @file sample.c
+ *
+ * A sampling profiler. Instead of counting every instruction like prof.c,
+ * a @c SIGPROF timer interrupts the emulator every few milliseconds of
+ * the CPU time of its thread, and the signal handler records the guest
+ * PC and the return addresses found by following the FP-linked frames.
+ * The log writer thread (see log.c) blocks the signal, so the handler
+ * always runs in the emulator thread, and the time of the writer is not
+ * counted in the interval. Between the samples nothing is done, so the
+ * profiler costs practically nothing and can be left on in long runs.
+ *
+ * The samples are counted per address (see counters.c). The routine of
+ * each address is found once before the run, so the handler also counts
+ * for each routine the samples in which it is on the stack, once per
+ * sample also when it recurses. At the end a report of the addresses and
+ * routines with the most samples is printed.
+ *
+ * The frame chain follows the layout made by CALL (see push_pc_fp() in
+ * cpu.c): the word at FP is the FP of the caller and the word before it
+ * the return address. The stack grows upwards, so the chain ends at the
+ * first FP which does not decrease.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "common.h"
+#include "counters.h"
+#include "sample.h"
+
+
+/// @cond skip
+// How many of the hottest addresses are listed in the report.
+#define SAMPLE_TOP 20
+
+// How many frames are followed in each sample.
+#define SAMPLE_DEPTH 32
+/// @endcond
+
+
+/**
+ * @internal
+ * The samples with PC at each logical address (see counters_alloc()).
+ */
+static uint64_t* self = NULL;
+
+/**
+ * @internal
+ * The number of addresses in ::self.
+ */
+static int32_t size = 0;
+
+/**
+ * @internal
+ * The routines of the addresses.
+ */
+static s_routines routines = { NULL, NULL, 0 };
+
+/**
+ * @internal
+ * The samples in which each routine was executing or a caller.
+ */
+static uint64_t* routine_total = NULL;
+
+/**
+ * @internal
+ * The machine being sampled, or NULL when the timer is not running.
+ */
+static s_ckone* volatile sampled = NULL;
+
+/**
+ * @internal
+ * The number of samples taken.
+ */
+static volatile uint64_t sample_count = 0;
+
+/**
+ * @internal
+ * The sampling interval in microseconds.
+ */
+static uint32_t sample_interval = 0;
+
+/**
+ * @internal
+ * The @c SIGPROF action before sample_start().
+ */
+static struct sigaction old_action;
+
+/**
+ * @internal
+ * The timer on the CPU time of the emulator thread.
+ */
+static timer_t timer;
+
+
+/**
+ * Allocate the counters and find the routines. The program must have
+ * been loaded. See also sample_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+sample_init (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    self = counters_alloc (kone, sizeof(uint64_t), &size);
+    if (!self || !counters_routines (size, &routines)
+            || !(routine_total = calloc (routines.count, sizeof(uint64_t)))) {
+        ELOG ("Could not allocate memory for the sampling profiler\n", 0);
+        return false;
+    }
+
+    DLOG ("Found %d routines\n", routines.count - 1);
+    sample_count = 0;
+    return true;
+}
+
+
+/**
+ * Free the counters allocated by sample_init().
+ */
+void
+sample_free (
+        void
+        )
+{
+    free (self);
+    free (routine_total);
+    counters_free_routines (&routines);
+    self = NULL;
+    routine_total = NULL;
+    size = 0;
+}
+
+
+/**
+ * @internal
+ * Take a sample. The @c SIGPROF handler. Only reads the registers and the
+ * memory of the machine and updates the counters, so it is safe to run
+ * between any two instructions of the emulator.
+ */
+static void
+take_sample (
+        int sig             ///< The signal number.
+        )
+{
+    (void) sig;
+    s_ckone* kone = sampled;
+    if (!kone)
+        return;
+
+    sample_count++;
+    if ((uint32_t) kone->pc >= (uint32_t) size) {
+        self[size]++;
+        return;
+    }
+    self[kone->pc]++;
+
+    // count each routine on the stack once
+    int32_t seen[SAMPLE_DEPTH + 1];
+    int n = 0;
+    seen[n++] = routines.of[kone->pc];
+    routine_total[seen[0]]++;
+
+    int32_t fp = kone->r[FP];
+    for (int depth = 0; depth < SAMPLE_DEPTH && fp >= 1 && fp < size
+            && kone->mmu_base + fp < kone->mem_size; depth++) {
+        int32_t ret = kone->mem[kone->mmu_base + fp - 1];
+        int32_t caller_fp = kone->mem[kone->mmu_base + fp];
+
+        if ((uint32_t) ret < (uint32_t) size) {
+            int32_t id = routines.of[ret];
+            int i = 0;
+            while (i < n && seen[i] != id)
+                i++;
+            if (i == n) {
+                seen[n++] = id;
+                routine_total[id]++;
+            }
+        }
+
+        if (caller_fp >= fp)
+            break;
+        fp = caller_fp;
+    }
+}
+
+
+/**
+ * Start sampling the machine every @p interval microseconds of CPU
+ * time of the calling thread. The counters must have been allocated
+ * with sample_init(). See also sample_stop().
+ *
+ * @return False if the timer could not be started.
+ */
+bool
+sample_start (
+        s_ckone* kone,      ///< The state structure.
+        uint32_t interval   ///< The sampling interval in microseconds.
+        )
+{
+    struct sigaction action;
+    memset (&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset (&action.sa_mask);
+    if (sigaction (SIGPROF, &action, &old_action)) {
+        ELOG ("Could not install the sampling signal handler: %s\n", strerror (errno));
+        return false;
+    }
+
+    sample_interval = interval;
+    sampled = kone;
+
+    struct sigevent event;
+    memset (&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+
+    struct itimerspec period;
+    period.it_interval.tv_sec = interval / 1000000;
+    period.it_interval.tv_nsec = interval % 1000000 * 1000;
+    period.it_value = period.it_interval;
+    if (timer_create (CLOCK_THREAD_CPUTIME_ID, &event, &timer)) {
+        ELOG ("Could not create the sampling timer: %s\n", strerror (errno));
+        sampled = NULL;
+        sigaction (SIGPROF, &old_action, NULL);
+        return false;
+    }
+    if (timer_settime (timer, 0, &period, NULL)) {
+        ELOG ("Could not start the sampling timer: %s\n", strerror (errno));
+        timer_delete (timer);
+        sampled = NULL;
+        sigaction (SIGPROF, &old_action, NULL);
+        return false;
+    }
+
+    DLOG ("Sampling every %u microseconds\n", interval);
+    return true;
+}
+
+
+/**
+ * Stop the timer started by sample_start().
+ */
+void
+sample_stop (
+        void
+        )
+{
+    timer_delete (timer);
+    sampled = NULL;
+    sigaction (SIGPROF, &old_action, NULL);
+}
+
+
+/**
+ * Print the samples: the addresses with the most samples, and for each
+ * routine the samples in it and the samples in which it was executing
+ * or a caller. Must be called before symtable_clear().
+ */
+void
+sample_report (
+        s_ckone* kone,      ///< The state structure.
+        FILE* out           ///< The file to print the report to.
+        )
+{
+    if (!self)
+        return;
+
+    int32_t n = 0, nr = 0;
+    int32_t* addrs = counters_top (self, sizeof(uint64_t), 0, size, &n);
+    uint64_t* routine_self = calloc (routines.count, sizeof(uint64_t));
+    int32_t* order = counters_top (routine_total, sizeof(uint64_t), 0, routines.count, &nr);
+    if (!addrs || !routine_self || !order) {
+        ELOG ("Could not allocate memory for the sampling report\n", 0);
+        free (order);
+        free (routine_self);
+        free (addrs);
+        return;
+    }
+
+    uint64_t total = sample_count;
+    fprintf (out, "Sampling profile: %llu samples, one every %u microseconds of CPU time\n\n",
+            (unsigned long long) total, sample_interval);
+
+    // the hottest addresses
+    fprintf (out, "Hot spots:\n");
+    fprintf (out, "%10s %7s  %-20s %s\n", "Samples", "%", "Address", "Instruction");
+    for (int32_t i = 0; i < n && i < SAMPLE_TOP; i++) {
+        int32_t a = addrs[i];
+        char sym[64], instr[256];
+        counters_describe (kone, a, sym, sizeof(sym), instr, sizeof(instr));
+        fprintf (out, "%10llu %6.2f%%  %-20s %s\n",
+                (unsigned long long) self[a], counters_percent (self[a], total), sym, instr);
+    }
+    if (self[size])
+        fprintf (out, "%10llu %6.2f%%  %-20s\n", (unsigned long long) self[size],
+                counters_percent (self[size], total), "(out of bounds)");
+    fprintf (out, "\n");
+
+    // the routine totals
+    for (int32_t i = 0; i < n; i++)
+        routine_self[routines.of[addrs[i]]] += self[addrs[i]];
+
+    fprintf (out, "Routines:\n");
+    fprintf (out, "%10s %7s %10s %7s  %s\n", "Self", "%", "Total", "%", "Routine");
+    for (int32_t i = 0; i < nr; i++) {
+        int32_t r = order[i];
+        fprintf (out, "%10llu %6.2f%% %10llu %6.2f%%  %s\n",
+                (unsigned long long) routine_self[r], counters_percent (routine_self[r], total),
+                (unsigned long long) routine_total[r], counters_percent (routine_total[r], total),
+                routines.names[r]? routines.names[r] : "(unknown)");
+    }
+    fprintf (out, "\n");
+
+    free (order);
+    free (routine_self);
+    free (addrs);
+}
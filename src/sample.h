@@ -0,0 +1,20 @@
+/**
+ * @file sample.h
+ *
+ * The public functions of the sampling profiler.
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+
+extern bool sample_init (s_ckone* kone);
+extern void sample_free ();
+
+extern bool sample_start (s_ckone* kone, uint32_t interval);
+extern void sample_stop ();
+
+extern void sample_report (s_ckone* kone, FILE* out);
+
+
+#endif
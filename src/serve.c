@@ -0,0 +1,958 @@
+/**
+ * @file serve.c
+ *
+ * A daemon which runs jobs sent over a Unix domain socket (see ::args).
+ * The daemon parses the command line once and keeps a cache of loaded
+ * program images, so a job only pays for forking a copy of the daemon
+ * and the execution itself.
+ *
+ * A job is one connection. The client sends header lines, some of them
+ * followed by a payload of the given number of bytes, and ends them with
+ * @c RUN:
+ *
+ *     PROGRAM LENGTH   the program (a .b91 file) follows
+ *     IMAGE ID         run a program sent earlier instead
+ *     INPUT LENGTH     the data read from KBD follows
+ *     STDIN LENGTH     the data read from the STDIN device follows
+ *     LIMIT N          stop after N instructions
+ *     TIME SECONDS     kill the job after SECONDS seconds
+ *     RUN
+ *
+ * The daemon replies with <tt>IMAGE ID</tt>, then with zero or more
+ * <tt>OUTPUT LENGTH</tt> and <tt>STDOUT LENGTH</tt> lines each followed
+ * by that many bytes written to CRT or to the STDOUT device, as the
+ * program writes them, and finally with one of
+ *
+ *     END REASON INSTRUCTIONS R0 R1 R2 R3 R4 R5 R6 R7 PC SR
+ *     END timeout
+ *     END signal NUMBER
+ *
+ * where REASON is @c halted, @c fault or @c limit. A request which
+ * cannot be run gets <tt>ERROR MESSAGE</tt> instead.
+ *
+ * The STDIN and STDOUT devices of a job never use the files named in
+ * the program or on the command line, so that a job cannot read or
+ * write the files of the host.
+ *
+ * The daemon reads the requests itself, since loading a program updates
+ * its image cache. It receives the requests of up to SERVE_MAX_CLIENTS
+ * connections at once and handles each one when it is complete, so a
+ * client which sends its request slowly does not hold up the others. A
+ * request must arrive within SERVE_REQUEST_TIMEOUT seconds.
+ *
+ * The emulator keeps its state in global variables, so each job runs in
+ * a process forked from the daemon instead of a thread. The job process
+ * forwards the output of the machine, which runs in a process of its
+ * own, and reports how it ended. The memory of a cached program is kept
+ * as a shared image (see image.c), which each machine maps privately.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "cpu.h"
+#include "ext.h"
+#include "image.h"
+#include "symtable.h"
+#include "args.h"
+#include "serve.h"
+
+
+extern bool ckone_init (s_ckone* kone);
+extern bool ckone_load (s_ckone* kone, FILE* input);
+
+
+/**
+ * @internal
+ * The number of program images kept in the cache.
+ */
+#define SERVE_CACHE_SIZE 64
+
+/**
+ * @internal
+ * The maximum size of a program or an input in bytes.
+ */
+#define SERVE_MAX_PAYLOAD (16 << 20)
+
+/**
+ * @internal
+ * The maximum size of a whole request in bytes.
+ */
+#define SERVE_MAX_REQUEST (4 * SERVE_MAX_PAYLOAD)
+
+/**
+ * @internal
+ * The maximum number of connections whose requests are received at once.
+ */
+#define SERVE_MAX_CLIENTS 64
+
+/**
+ * @internal
+ * The maximum size of an @c OUTPUT message.
+ */
+#define SERVE_CHUNK_SIZE 4096
+
+/**
+ * @internal
+ * The time in seconds within which a whole request must be received.
+ */
+#define SERVE_REQUEST_TIMEOUT 10
+
+
+/**
+ * @internal
+ * A loaded program.
+ */
+typedef struct {
+    uint64_t id;            ///< The hash of the program, or 0 if unused.
+    s_ckone kone;           ///< The machine after loading the program.
+    int mem_image;          ///< The memory of the machine as an image, or 
+                            ///< -1 if s_ckone::mem is used instead.
+    char* symbols;          ///< The symbols as names and values, each ending
+                            ///< with a NUL, starting from the last one inserted.
+    size_t symbols_len;     ///< The length of ::symbols.
+} s_image;
+
+
+/**
+ * @internal
+ * A connection whose request is being received.
+ */
+typedef struct {
+    int fd;                 ///< The connection.
+    double deadline;        ///< The time by which the request must be received.
+    char* data;             ///< The data received so far.
+    size_t len;             ///< The number of bytes in ::data.
+    size_t size;            ///< The size of ::data.
+    const char* error;      ///< The reply if the request cannot be received, or NULL.
+} s_client;
+
+
+/**
+ * @internal
+ * A received request being parsed.
+ */
+typedef struct {
+    char* data;             ///< The request.
+    size_t pos;             ///< The position of the next byte in ::data.
+    size_t len;             ///< The length of ::data.
+} s_reader;
+
+
+/**
+ * @internal
+ * The reasons for a machine to stop.
+ */
+typedef enum {
+    SERVE_HALTED = 0,       ///< The program halted.
+    SERVE_FAULT,            ///< The program caused an error.
+    SERVE_LIMIT             ///< The instruction limit was reached.
+} e_serve_reason;
+
+/**
+ * @internal
+ * The names of ::e_serve_reason.
+ */
+static const char* reason_names[] = { "halted", "fault", "limit" };
+
+
+/**
+ * @internal
+ * The final state of a machine, sent from the machine to the job process.
+ */
+typedef struct {
+    int32_t reason;         ///< See ::e_serve_reason.
+    uint64_t instr_count;   ///< The number of instructions executed.
+    int32_t r[8];           ///< The working registers.
+    int32_t pc;             ///< The program counter.
+    int32_t sr;             ///< The status register.
+} s_result;
+
+
+/**
+ * @internal
+ * The image cache. New images replace the oldest ones.
+ */
+static s_image cache[SERVE_CACHE_SIZE];
+
+/**
+ * @internal
+ * The cache entry to use for the next new image.
+ */
+static int next_image = 0;
+
+/**
+ * @internal
+ * The connections whose requests are being received.
+ */
+static s_client clients[SERVE_MAX_CLIENTS];
+
+/**
+ * @internal
+ * The number of connections in ::clients.
+ */
+static int client_count = 0;
+
+/**
+ * @internal
+ * Compute the FNV-1a hash of a program.
+ *
+ * @return The hash, never 0.
+ */
+static uint64_t
+hash_program (
+        const char* data,   ///< The program.
+        size_t len          ///< The length of the program.
+        )
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 1099511628211ULL;
+    }
+    return h? h : 1;
+}
+
+
+/**
+ * @internal
+ * Append a symbol to the image being loaded. Called through
+ * symtable_foreach().
+ */
+static void
+add_symbol (
+        const char* name,   ///< The name of the symbol.
+        const char* value,  ///< The value of the symbol.
+        void* data          ///< The image.
+        )
+{
+    s_image* image = data;
+    size_t name_len = strlen (name) + 1, value_len = strlen (value) + 1;
+    char* symbols = realloc (image->symbols, image->symbols_len + name_len + value_len);
+    if (!symbols)
+        return;
+
+    memcpy (symbols + image->symbols_len, name, name_len);
+    memcpy (symbols + image->symbols_len + name_len, value, value_len);
+    image->symbols = symbols;
+    image->symbols_len += name_len + value_len;
+}
+
+
+/**
+ * @internal
+ * Free a cache entry.
+ */
+static void
+free_image (
+        s_image* image      ///< The cache entry.
+        )
+{
+    if (image->mem_image >= 0)
+        close (image->mem_image);
+    image_unmap (&image->kone);
+    free (image->symbols);
+    memset (image, 0, sizeof(s_image));
+    image->mem_image = -1;
+}
+
+
+/**
+ * @internal
+ * Find an image in the cache.
+ *
+ * @return The image, or NULL if it is not in the cache.
+ */
+static s_image*
+find_image (
+        uint64_t id         ///< The id of the image.
+        )
+{
+    for (int i = 0; i < SERVE_CACHE_SIZE; i++)
+        if (id && cache[i].id == id)
+            return &cache[i];
+    return NULL;
+}
+
+
+/**
+ * @internal
+ * Load a program into the cache, unless it is there already.
+ *
+ * @return The image, or NULL if the program could not be loaded.
+ */
+static s_image*
+load_image (
+        char* data,         ///< The program.
+        size_t len          ///< The length of the program.
+        )
+{
+    uint64_t id = hash_program (data, len);
+    s_image* image = find_image (id);
+    if (image)
+        return image;
+
+    image = &cache[next_image];
+    next_image = (next_image + 1) % SERVE_CACHE_SIZE;
+    free_image (image);
+
+    symtable_clear ();
+
+    FILE* f = len? fmemopen (data, len, "r") : NULL;
+    bool ok = f && ckone_init (&image->kone) && ckone_load (&image->kone, f);
+    if (f)
+        fclose (f);
+    if (ok)
+        symtable_foreach (add_symbol, image);
+
+    // ckone_load() points the file names to the symbol table
+    symtable_clear ();
+    args.stdin_file = NULL;
+    args.stdout_file = NULL;
+
+    if (!ok) {
+        free_image (image);
+        return NULL;
+    }
+    // only keep the pages of the program which are not zero
+    image->mem_image = image_create (&image->kone);
+    if (image->mem_image >= 0)
+        image_unmap (&image->kone);
+
+    image->id = id;
+    ILOG ("Loaded the image %016llx\n", (unsigned long long) id);
+    return image;
+}
+
+
+/**
+ * @internal
+ * Put the symbols of an image into the symbol table, in the order in
+ * which they were originally inserted.
+ *
+ * @return False if the symbols could not be inserted.
+ */
+static bool
+restore_symbols (
+        s_image* image      ///< The image.
+        )
+{
+    size_t count = 0;
+    for (size_t pos = 0; pos < image->symbols_len; count++)
+        pos += strlen (image->symbols + pos) + 1;
+    if (!count)
+        return true;
+
+    char** pairs = malloc (count * sizeof(char*));
+    if (!pairs) {
+        ELOG ("Could not allocate memory for %zu symbols\n", count / 2);
+        return false;
+    }
+    for (size_t i = 0, pos = 0; i < count; i++) {
+        pairs[i] = image->symbols + pos;
+        pos += strlen (pairs[i]) + 1;
+    }
+
+    bool ok = true;
+    for (size_t i = count; ok && i >= 2; i -= 2)
+        ok = symtable_insert (pairs[i - 2], pairs[i - 1]);
+    free (pairs);
+    return ok;
+}
+
+
+/**
+ * @internal
+ * Write the whole buffer to a socket or a pipe.
+ *
+ * @return False if the other end has gone away.
+ */
+static bool
+write_all (
+        int fd,             ///< The file descriptor.
+        const void* data,   ///< The data.
+        size_t len          ///< The length of the data.
+        )
+{
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write (fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/**
+ * @internal
+ * Send a formatted line to the client.
+ *
+ * @return False if the client has gone away.
+ */
+static bool
+send_line (
+        int conn,           ///< The connection.
+        const char* line    ///< The line, including the newline.
+        )
+{
+    return write_all (conn, line, strlen (line));
+}
+
+
+/**
+ * @internal
+ * Run the machine of a job until it stops, and send the final state to
+ * the job process. The standard input and output have already been
+ * redirected to the KBD input and the CRT output of the job. Never
+ * returns.
+ */
+static void
+run_machine (
+        s_image* image,     ///< The program.
+        FILE* stdin_data,   ///< The data for the STDIN device.
+        int stdout_fd,      ///< Where to write the output of the STDOUT device.
+        uint64_t limit,     ///< The instruction limit, or 0.
+        int result_fd       ///< Where to write the final state.
+        )
+{
+    s_ckone kone = image->kone;
+    if (image->mem_image >= 0 && !image_map (&kone, image->mem_image))
+        _exit (EXIT_FAILURE);
+    if (!restore_symbols (image))
+        _exit (EXIT_FAILURE);
+
+    // stream the output line by line
+    FILE* stdout_file = fdopen (stdout_fd, "w");
+    setvbuf (stdout, NULL, _IOLBF, 0);
+    if (stdout_file)
+        setvbuf (stdout_file, NULL, _IOLBF, 0);
+    rewind (stdin_data);
+    ext_init_files (stdin_data, stdout_file);
+
+    s_result result;
+    result.reason = SERVE_HALTED;
+    while (!kone.halted) {
+        if (limit && kone.instr_count >= limit) {
+            result.reason = SERVE_LIMIT;
+            break;
+        }
+        if (!cpu_step (&kone)) {
+            result.reason = SERVE_FAULT;
+            break;
+        }
+    }
+
+    ext_close_devices ();
+    fflush (stdout);
+
+    result.instr_count = kone.instr_count;
+    memcpy (result.r, kone.r, sizeof(result.r));
+    result.pc = kone.pc;
+    result.sr = kone.sr;
+    write_all (result_fd, &result, sizeof(result));
+    log_flush ();
+    _exit (EXIT_SUCCESS);
+}
+
+
+/**
+ * @internal
+ * Run a job in a process forked from the daemon: start the machine,
+ * forward its output to the client, and report how it ended. Never
+ * returns.
+ */
+static void
+run_job (
+        int conn,           ///< The connection.
+        s_image* image,     ///< The program.
+        FILE* input,        ///< The data for KBD.
+        FILE* stdin_data,   ///< The data for the STDIN device.
+        uint64_t limit,     ///< The instruction limit, or 0.
+        unsigned seconds    ///< The time limit, or 0.
+        )
+{
+    char line[256];
+    snprintf (line, sizeof(line), "IMAGE %016llx\n", (unsigned long long) image->id);
+    send_line (conn, line);
+
+    // the daemon ignores its children, but the job waits for the machine
+    signal (SIGCHLD, SIG_DFL);
+
+    int out[2], dev[2], res[2];
+    if (pipe (out) || pipe (dev) || pipe (res)) {
+        send_line (conn, "ERROR cannot create pipes\n");
+        _exit (EXIT_FAILURE);
+    }
+
+    pid_t pid = fork ();
+    if (pid < 0) {
+        send_line (conn, "ERROR cannot fork\n");
+        _exit (EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close (conn);
+        close (out[0]);
+        close (dev[0]);
+        close (res[0]);
+        rewind (input);
+        dup2 (fileno (input), STDIN_FILENO);
+        dup2 (out[1], STDOUT_FILENO);
+        close (out[1]);
+        if (seconds)
+            alarm (seconds);
+        run_machine (image, stdin_data, dev[1], limit, res[1]);
+    }
+    close (out[1]);
+    close (dev[1]);
+    close (res[1]);
+
+    // forward the output of CRT and STDOUT until the machine closes both
+    static const char* frames[] = { "OUTPUT", "STDOUT" };
+    struct pollfd fds[2] = { { out[0], POLLIN, 0 }, { dev[0], POLLIN, 0 } };
+    int streams = 2;
+    char buf[SERVE_CHUNK_SIZE];
+    while (streams > 0) {
+        if (poll (fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            kill (pid, SIGKILL);
+            break;
+        }
+        for (int i = 0; i < 2 && streams > 0; i++) {
+            if (!fds[i].revents)
+                continue;
+            ssize_t n = read (fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0) {
+                // poll() skips a negative descriptor
+                fds[i].fd = -1;
+                streams--;
+                continue;
+            }
+            snprintf (line, sizeof(line), "%s %ld\n", frames[i], (long) n);
+            if (n < 0 || !send_line (conn, line) || !write_all (conn, buf, n)) {
+                kill (pid, SIGKILL);
+                streams = 0;
+            }
+        }
+    }
+
+    int status;
+    s_result result;
+    waitpid (pid, &status, 0);
+    if (WIFSIGNALED (status) && WTERMSIG (status) == SIGALRM)
+        snprintf (line, sizeof(line), "END timeout\n");
+    else if (WIFSIGNALED (status))
+        snprintf (line, sizeof(line), "END signal %d\n", WTERMSIG (status));
+    else if (read (res[0], &result, sizeof(result)) != sizeof(result))
+        snprintf (line, sizeof(line), "ERROR the machine failed\n");
+    else
+        snprintf (line, sizeof(line),
+                "END %s %llu %d %d %d %d %d %d %d %d %d %d\n",
+                reason_names[result.reason], (unsigned long long) result.instr_count,
+                result.r[0], result.r[1], result.r[2], result.r[3],
+                result.r[4], result.r[5], result.r[6], result.r[7],
+                result.pc, result.sr);
+    send_line (conn, line);
+    _exit (EXIT_SUCCESS);
+}
+
+
+/**
+ * @internal
+ * The time of CLOCK_MONOTONIC.
+ *
+ * @return The time in seconds.
+ */
+static double
+now (
+        void
+        )
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * @internal
+ * Read a header line of a request. A line longer than the buffer is
+ * returned in parts, like with fgets().
+ *
+ * @return False if the request ended before a line.
+ */
+static bool
+read_line (
+        s_reader* r,        ///< The request.
+        char* line,         ///< Where to store the line.
+        size_t size         ///< The size of @p line.
+        )
+{
+    size_t n = 0;
+    while (n + 1 < size && r->pos < r->len) {
+        line[n++] = r->data[r->pos++];
+        if (line[n - 1] == '\n')
+            break;
+    }
+    line[n] = '\0';
+    return n > 0;
+}
+
+
+/**
+ * @internal
+ * Read a payload of a request.
+ *
+ * @return The payload, which points into the request, or NULL if the
+ *         request ended before it.
+ */
+static char*
+read_payload (
+        s_reader* r,        ///< The request.
+        size_t len          ///< The length of the payload.
+        )
+{
+    if (r->len - r->pos < len)
+        return NULL;
+    char* data = r->data + r->pos;
+    r->pos += len;
+    return data;
+}
+
+
+/**
+ * @internal
+ * Check if a header line of a request is followed by a payload.
+ *
+ * @return True if it is, false otherwise.
+ */
+static bool
+has_payload (
+        const char* cmd     ///< The request type.
+        )
+{
+    return !strcmp (cmd, "PROGRAM") || !strcmp (cmd, "INPUT") || !strcmp (cmd, "STDIN");
+}
+
+
+/**
+ * @internal
+ * Check if the whole request of a connection has been received, up to
+ * @c RUN, or far enough to find an error in it.
+ *
+ * @return True if the request can be handled.
+ */
+static bool
+request_complete (
+        s_client* c         ///< The connection.
+        )
+{
+    s_reader r;
+    r.data = c->data;
+    r.pos = 0;
+    r.len = c->len;
+
+    char line[256];
+    while (read_line (&r, line, sizeof(line))) {
+        // the rest of the line has not arrived yet
+        size_t n = strlen (line);
+        if (line[n - 1] != '\n' && n + 1 < sizeof(line))
+            return false;
+
+        char cmd[16];
+        unsigned long long value = 0;
+        if (sscanf (line, "%15s %llu", cmd, &value) < 1)
+            continue;
+        if (!strcmp (cmd, "RUN"))
+            return true;
+        if (has_payload (cmd) && (value > SERVE_MAX_PAYLOAD || !read_payload (&r, value)))
+            return value > SERVE_MAX_PAYLOAD;
+    }
+    return false;
+}
+
+
+/**
+ * @internal
+ * Receive more data of the request of a connection.
+ *
+ * @return False if the connection was closed, or if the request cannot
+ *         be received (see s_client::error).
+ */
+static bool
+receive (
+        s_client* c         ///< The connection.
+        )
+{
+    if (c->len == c->size) {
+        if (c->size == SERVE_MAX_REQUEST) {
+            c->error = "ERROR the request is too large\n";
+            return false;
+        }
+        size_t size = c->size? 2 * c->size : SERVE_CHUNK_SIZE;
+        if (size > SERVE_MAX_REQUEST)
+            size = SERVE_MAX_REQUEST;
+        char* data = realloc (c->data, size);
+        if (!data) {
+            c->error = "ERROR out of resources\n";
+            return false;
+        }
+        c->data = data;
+        c->size = size;
+    }
+
+    ssize_t n = read (c->fd, c->data + c->len, c->size - c->len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return true;
+    if (n <= 0)
+        return false;
+    c->len += n;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Parse a received request and start a job for it.
+ */
+static void
+handle_request (
+        s_client* c         ///< The connection.
+        )
+{
+    int conn = c->fd;
+    FILE* input = tmpfile ();
+    FILE* stdin_data = tmpfile ();
+    if (!input || !stdin_data) {
+        send_line (conn, "ERROR out of resources\n");
+        if (input)
+            fclose (input);
+        if (stdin_data)
+            fclose (stdin_data);
+        return;
+    }
+
+    s_reader in;
+    in.data = c->data;
+    in.pos = 0;
+    in.len = c->len;
+
+    s_image* image = NULL;
+    uint64_t limit = 0;
+    unsigned long seconds = 0;
+    const char* error = NULL;
+    char line[256];
+
+    while (!error) {
+        char cmd[16];
+        unsigned long long value = 0;
+        if (!read_line (&in, line, sizeof(line))) {
+            error = "ERROR the request ended before RUN\n";
+            break;
+        }
+        if (sscanf (line, "%15s %llx", cmd, &value) < 1)
+            continue;
+        if (!strcmp (cmd, "RUN"))
+            break;
+
+        if (!strcmp (cmd, "IMAGE")) {
+            image = find_image (value);
+            if (!image)
+                error = "ERROR unknown image\n";
+            continue;
+        }
+
+        // the rest take a decimal number
+        value = 0;
+        sscanf (line, "%15s %llu", cmd, &value);
+        if (!strcmp (cmd, "LIMIT"))
+            limit = value;
+        else if (!strcmp (cmd, "TIME"))
+            seconds = value;
+        else if (!has_payload (cmd))
+            error = "ERROR unknown request\n";
+        else if (value > SERVE_MAX_PAYLOAD)
+            error = "ERROR the payload is too large\n";
+        else {
+            char* data = read_payload (&in, value);
+            if (!data)
+                error = "ERROR the payload ended early\n";
+            else if (!strcmp (cmd, "INPUT"))
+                fwrite (data, 1, value, input);
+            else if (!strcmp (cmd, "STDIN"))
+                fwrite (data, 1, value, stdin_data);
+            else if (!(image = load_image (data, value)))
+                error = "ERROR the program cannot be loaded\n";
+        }
+    }
+
+    if (!error && !image)
+        error = "ERROR no program\n";
+    fflush (input);
+    fflush (stdin_data);
+
+    if (error)
+        send_line (conn, error);
+    else {
+        pid_t pid = fork ();
+        if (pid == 0) {
+            // the job only keeps its own connection
+            for (int i = 0; i < client_count; i++)
+                if (clients[i].fd != conn)
+                    close (clients[i].fd);
+            run_job (conn, image, input, stdin_data, limit, seconds);
+        }
+        if (pid < 0)
+            send_line (conn, "ERROR cannot fork\n");
+    }
+
+    fclose (input);
+    fclose (stdin_data);
+}
+
+
+/**
+ * @internal
+ * Open a listening Unix domain socket.
+ *
+ * @return The socket, or -1 on error.
+ */
+static int
+listen_on (
+        const char* path    ///< The path of the socket.
+        )
+{
+    struct sockaddr_un sun;
+    memset (&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof(sun.sun_path)) {
+        ELOG ("The socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy (sun.sun_path, path);
+
+    // only replace a socket left behind, never another file
+    struct stat st;
+    if (!lstat (path, &st)) {
+        if (!S_ISSOCK (st.st_mode)) {
+            ELOG ("The path %s is in use and not a socket\n", path);
+            return -1;
+        }
+        unlink (path);
+    }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind (fd, (struct sockaddr*) &sun, sizeof(sun)) || listen (fd, 64)) {
+        ELOG ("Cannot listen on %s\n", path);
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * Run the daemon on the socket given in ::args. Only returns if the
+ * socket cannot be used.
+ *
+ * @return EXIT_FAILURE.
+ */
+int
+serve_run (
+        void
+        )
+{
+    int fd = listen_on (args.serve_socket);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    // a client going away must not kill the daemon, and the jobs
+    // are reaped automatically
+    signal (SIGPIPE, SIG_IGN);
+    signal (SIGCHLD, SIG_IGN);
+    for (int i = 0; i < SERVE_CACHE_SIZE; i++)
+        cache[i].mem_image = -1;
+
+    ILOG ("Serving jobs on %s\n", args.serve_socket);
+    struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+    while (true) {
+        // stop accepting connections while the table is full
+        double t = now (), deadline = t + SERVE_REQUEST_TIMEOUT;
+        fds[0].fd = client_count < SERVE_MAX_CLIENTS? fd : -1;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < client_count; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+            if (clients[i].deadline < deadline)
+                deadline = clients[i].deadline;
+        }
+        if (poll (fds, client_count + 1, (int) ((deadline - t) * 1000) + 1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ELOG ("Could not wait for connections on %s\n", args.serve_socket);
+            break;
+        }
+
+        // a finished connection is replaced by the last one, which has
+        // already been seen
+        t = now ();
+        for (int i = client_count - 1; i >= 0; i--) {
+            s_client* c = &clients[i];
+            if (fds[i + 1].revents && (!receive (c) || request_complete (c))) {
+                if (c->error)
+                    send_line (c->fd, c->error);
+                else
+                    handle_request (c);
+            } else if (t >= c->deadline)
+                send_line (c->fd, "ERROR the request timed out\n");
+            else
+                continue;
+            close (c->fd);
+            free (c->data);
+            *c = clients[--client_count];
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int conn = accept (fd, NULL, NULL);
+            if (conn < 0 && errno != EINTR) {
+                ELOG ("Could not accept a connection on %s\n", args.serve_socket);
+                break;
+            }
+            if (conn >= 0) {
+                s_client* c = &clients[client_count++];
+                memset (c, 0, sizeof(s_client));
+                c->fd = conn;
+                c->deadline = now () + SERVE_REQUEST_TIMEOUT;
+            }
+        }
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        close (clients[i].fd);
+        free (clients[i].data);
+    }
+    client_count = 0;
+    close (fd);
+    for (int i = 0; i < SERVE_CACHE_SIZE; i++)
+        free_image (&cache[i]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,14 @@
+/**
+ * @file serve.h
+ *
+ * The public functions of the job daemon.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+
+extern int serve_run (void);
+
+
+#endif
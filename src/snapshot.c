@@ -0,0 +1,683 @@
+/**
+ * @file snapshot.c
+ *
+ * Snapshots of the complete machine state. A snapshot holds the
+ * registers, the MMU registers, the timer, the memory, the names of and
+ * the positions in the STDIN and STDOUT files, and the symbol table, so
+ * that a run can be continued from it later, possibly after the host
+ * has been restarted.
+ *
+ * The file starts with the 8 bytes "CKSNAPSH" and the format version,
+ * ::SNAPSHOT_VERSION. The rest is a sequence of 32-bit little-endian
+ * integers and strings; a string is its length followed by its bytes.
+ * In order, it contains: the kind of the snapshot (full or delta), its
+ * serial number, the registers in the order of ::s_ckone, the memory,
+ * the STDIN and STDOUT file names and positions, and the number of
+ * symbols followed by the name and value of each symbol. 64-bit numbers
+ * are written as two integers, the low half first.
+ *
+ * The periodic snapshots are incremental. snapshot_checkpoint() writes
+ * a full snapshot first, and after that a delta to the file with 
+ * ".delta" appended, holding only the pages written since the full 
+ * snapshot (see dirty.c): the memory is then the number of pages 
+ * followed by the number and the words of each page, and there are no
+ * symbols. The delta has the serial number of its full snapshot, and 
+ * each delta replaces the previous one. Once a delta would hold half of
+ * the memory, a new full snapshot is written instead.
+ *
+ * Snapshots are written with snapshot_save() and snapshot_checkpoint() 
+ * from ckone.c, and read with snapshot_load() from main.c instead of
+ * loading a program. snapshot_load() applies the delta if there is one.
+ */
+
+#include <time.h>
+#include "common.h"
+#include "symtable.h"
+#include "ext.h"
+#include "dirty.h"
+#include "args.h"
+#include "snapshot.h"
+
+
+/**
+ * @internal
+ * The magic bytes at the start of a snapshot.
+ */
+static const char magic[8] = { 'C', 'K', 'S', 'N', 'A', 'P', 'S', 'H' };
+
+/**
+ * @internal
+ * The STDIN and STDOUT file names read from a snapshot. ::args points
+ * to these after snapshot_load().
+ */
+static char file_names[2][1024];
+
+/**
+ * @internal
+ * The kinds of snapshots.
+ */
+enum {
+    SNAPSHOT_FULL = 0,      ///< The complete state.
+    SNAPSHOT_DELTA          ///< The changes since a full snapshot.
+};
+
+/**
+ * @internal
+ * The serial number of the last full snapshot written by 
+ * snapshot_checkpoint(), or 0 if there is none.
+ */
+static int64_t base_serial = 0;
+
+/**
+ * @internal
+ * The dirty page epoch which started with the last full snapshot.
+ */
+static uint32_t base_epoch = 0;
+
+
+/**
+ * @internal
+ * Write a 32-bit little-endian integer.
+ */
+static void
+put_le32 (
+        FILE* f,            ///< The file.
+        int32_t value       ///< The number to write.
+        )
+{
+    for (int i = 0; i < 4; i++)
+        putc ((uint32_t) value >> (8 * i) & 0xff, f);
+}
+
+
+/**
+ * @internal
+ * Write a 64-bit number as two 32-bit integers.
+ */
+static void
+put_le64 (
+        FILE* f,            ///< The file.
+        int64_t value       ///< The number to write.
+        )
+{
+    put_le32 (f, (int32_t) (uint32_t) value);
+    put_le32 (f, (int32_t) (uint32_t) ((uint64_t) value >> 32));
+}
+
+
+/**
+ * @internal
+ * Write a string. NULL is written as an empty string.
+ */
+static void
+put_string (
+        FILE* f,            ///< The file.
+        const char* str     ///< The string.
+        )
+{
+    size_t len = str? strlen (str) : 0;
+    put_le32 (f, len);
+    if (len)
+        fwrite (str, 1, len, f);
+}
+
+
+/**
+ * @internal
+ * Write one symbol. Called through symtable_foreach().
+ */
+static void
+put_symbol (
+        const char* name,   ///< The name of the symbol.
+        const char* value,  ///< The value of the symbol.
+        void* data          ///< The file.
+        )
+{
+    put_string (data, name);
+    put_string (data, value);
+}
+
+
+/**
+ * @internal
+ * Count the symbols. Called through symtable_foreach().
+ */
+static void
+count_symbol (
+        const char* name,   ///< The name of the symbol.
+        const char* value,  ///< The value of the symbol.
+        void* data          ///< A pointer to the count.
+        )
+{
+    (void) name;
+    (void) value;
+    (*(int32_t*) data)++;
+}
+
+
+/**
+ * @internal
+ * Write the registers.
+ */
+static void
+put_registers (
+        s_ckone* kone,      ///< The state structure.
+        FILE* f             ///< The file.
+        )
+{
+    for (int r = 0; r < 8; r++)
+        put_le32 (f, kone->r[r]);
+    put_le32 (f, kone->alu_in1);
+    put_le32 (f, kone->alu_in2);
+    put_le32 (f, kone->alu_out);
+    put_le32 (f, kone->tr);
+    put_le32 (f, kone->pc);
+    put_le32 (f, kone->ir);
+    put_le32 (f, kone->sr);
+    put_le32 (f, kone->mmu_base);
+    put_le32 (f, kone->mmu_limit);
+    put_le32 (f, kone->mar);
+    put_le32 (f, kone->mbr);
+    put_le32 (f, kone->mem_size);
+    put_le32 (f, kone->halted);
+    put_le64 (f, kone->instr_count);
+    put_le32 (f, kone->ivec);
+    put_le32 (f, kone->timer_period);
+    put_le32 (f, kone->timer_left);
+}
+
+
+/**
+ * @internal
+ * Write the pages written since an epoch.
+ */
+static void
+put_pages (
+        s_ckone* kone,      ///< The state structure.
+        FILE* f,            ///< The file.
+        uint32_t since      ///< The epoch.
+        )
+{
+    put_le32 (f, dirty_count (since));
+    for (int32_t page = 0; page << DIRTY_PAGE_BITS < kone->mem_size; page++) {
+        if (!dirty_page (page, since))
+            continue;
+
+        put_le32 (f, page);
+        int32_t start = page << DIRTY_PAGE_BITS;
+        for (int32_t i = start; i < start + DIRTY_PAGE_WORDS; i++)
+            put_le32 (f, i < kone->mem_size? kone->mem[i] : 0);
+    }
+}
+
+
+/**
+ * @internal
+ * Write a full snapshot or a delta. The snapshot is first written to a
+ * temporary file which then replaces the file, so an earlier snapshot
+ * is never left half overwritten.
+ *
+ * @return False if the file could not be written.
+ */
+static bool
+write_snapshot (
+        s_ckone* kone,      ///< The state structure.
+        const char* path,   ///< The file.
+        int64_t serial,     ///< The serial number of the full snapshot.
+        bool delta,         ///< True to write a delta.
+        uint32_t since      ///< The epoch of the full snapshot of a delta.
+        )
+{
+    char tmp[1024];
+    snprintf (tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen (tmp, "wb");
+    if (!f) {
+        ELOG ("Cannot open %s for writing\n", tmp);
+        return false;
+    }
+
+    fwrite (magic, 1, sizeof(magic), f);
+    put_le32 (f, SNAPSHOT_VERSION);
+    put_le32 (f, delta? SNAPSHOT_DELTA : SNAPSHOT_FULL);
+    put_le64 (f, serial);
+    put_registers (kone, f);
+
+    if (delta)
+        put_pages (kone, f, since);
+    else
+        for (int32_t i = 0; i < kone->mem_size; i++)
+            put_le32 (f, kone->mem[i]);
+
+    long stdin_pos, stdout_pos;
+    ext_device_positions (&stdin_pos, &stdout_pos);
+    put_string (f, args.stdin_file);
+    put_le64 (f, stdin_pos);
+    put_string (f, args.stdout_file);
+    put_le64 (f, stdout_pos);
+
+    if (!delta) {
+        int32_t count = 0;
+        symtable_foreach (count_symbol, &count);
+        put_le32 (f, count);
+        symtable_foreach (put_symbol, f);
+    }
+
+    bool ok = !ferror (f);
+    if (fclose (f) || !ok || rename (tmp, path)) {
+        ELOG ("Could not write the snapshot %s\n", path);
+        remove (tmp);
+        return false;
+    }
+
+    ILOG ("Saved a %s to %s after %llu instructions\n", delta? "delta" : "snapshot",
+            path, (unsigned long long) kone->instr_count);
+    return true;
+}
+
+
+/**
+ * @internal
+ * Make a serial number for a full snapshot, so that a delta is never
+ * applied to a full snapshot of another run.
+ *
+ * @return The serial number, never 0.
+ */
+static int64_t
+new_serial (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    int64_t serial = ((int64_t) time (NULL) << 32) ^ (int64_t) kone->instr_count;
+    return serial? serial : 1;
+}
+
+
+/**
+ * Write a full snapshot of the machine.
+ *
+ * @return False if the file could not be written.
+ */
+bool
+snapshot_save (
+        s_ckone* kone,      ///< The state structure.
+        const char* path    ///< The file.
+        )
+{
+    return write_snapshot (kone, path, new_serial (kone), false, 0);
+}
+
+
+/**
+ * Write a periodic snapshot: a delta holding the pages written since
+ * the last full snapshot, or a new full snapshot if there is none or
+ * the delta would hold half of the memory. dirty_init() must have been
+ * called.
+ *
+ * @return False if the file could not be written.
+ */
+bool
+snapshot_checkpoint (
+        s_ckone* kone,      ///< The state structure.
+        const char* path    ///< The file of the full snapshot.
+        )
+{
+    char delta_path[1024];
+    snprintf (delta_path, sizeof(delta_path), "%s.delta", path);
+
+    if (base_serial && 2 * dirty_count (base_epoch) <= dirty_count (0))
+        return write_snapshot (kone, delta_path, base_serial, true, base_epoch);
+
+    int64_t serial = new_serial (kone);
+    uint32_t epoch = dirty_clear ();
+    if (!write_snapshot (kone, path, serial, false, 0))
+        return false;
+
+    // the old delta would not apply to the new snapshot anyway
+    remove (delta_path);
+    base_serial = serial;
+    base_epoch = epoch;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read a 32-bit little-endian integer.
+ *
+ * @return False at the end of the file.
+ */
+static bool
+get_le32 (
+        FILE* f,            ///< The file.
+        int32_t* value      ///< Where to store the number.
+        )
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = getc (f);
+        if (c == EOF)
+            return false;
+        v |= (uint32_t) c << (8 * i);
+    }
+    *value = (int32_t) v;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read a 64-bit number written by put_le64().
+ *
+ * @return False at the end of the file.
+ */
+static bool
+get_le64 (
+        FILE* f,            ///< The file.
+        int64_t* value      ///< Where to store the number.
+        )
+{
+    int32_t lo, hi;
+    if (!get_le32 (f, &lo) || !get_le32 (f, &hi))
+        return false;
+    *value = (int64_t) ((uint64_t) (uint32_t) hi << 32 | (uint32_t) lo);
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read a string written by put_string().
+ *
+ * @return False at the end of the file or if the string is too long.
+ */
+static bool
+get_string (
+        FILE* f,            ///< The file.
+        char* buf,          ///< Where to store the string.
+        size_t size         ///< The size of the buffer.
+        )
+{
+    int32_t len;
+    if (!get_le32 (f, &len) || len < 0 || (size_t) len >= size)
+        return false;
+    if (fread (buf, 1, len, f) != (size_t) len)
+        return false;
+    buf[len] = '\0';
+    return true;
+}
+
+
+/**
+ * @internal
+ * Open a snapshot and read its header.
+ *
+ * @return The file, or NULL if it is not a snapshot of this version.
+ */
+static FILE*
+open_snapshot (
+        const char* path,   ///< The file.
+        int32_t* kind,      ///< Where to store the kind of the snapshot.
+        int64_t* serial     ///< Where to store the serial number.
+        )
+{
+    FILE* f = fopen (path, "rb");
+    if (!f) {
+        ELOG ("Cannot open %s for reading\n", path);
+        return NULL;
+    }
+
+    char buf[sizeof(magic)];
+    int32_t version;
+    if (fread (buf, 1, sizeof(buf), f) != sizeof(buf) || memcmp (buf, magic, sizeof(magic))) {
+        ELOG ("%s is not a snapshot\n", path);
+        fclose (f);
+        return NULL;
+    }
+    if (!get_le32 (f, &version) || version != SNAPSHOT_VERSION
+            || !get_le32 (f, kind) || !get_le64 (f, serial)) {
+        ELOG ("%s is a snapshot of an unsupported version\n", path);
+        fclose (f);
+        return NULL;
+    }
+    return f;
+}
+
+
+/**
+ * @internal
+ * Read the registers from a snapshot. The memory is reallocated if the
+ * snapshot has a different memory size, unless it is a delta.
+ *
+ * @return False if the snapshot is truncated or invalid.
+ */
+static bool
+load_registers (
+        s_ckone* kone,      ///< The state structure.
+        FILE* f,            ///< The file.
+        bool delta          ///< True if the snapshot is a delta.
+        )
+{
+    s_ckone s;
+    int32_t halted;
+    int64_t instr_count;
+    bool ok = true;
+    for (int r = 0; r < 8; r++)
+        ok = ok && get_le32 (f, &s.r[r]);
+    ok = ok && get_le32 (f, &s.alu_in1) && get_le32 (f, &s.alu_in2)
+        && get_le32 (f, &s.alu_out) && get_le32 (f, &s.tr)
+        && get_le32 (f, &s.pc) && get_le32 (f, &s.ir) && get_le32 (f, &s.sr)
+        && get_le32 (f, &s.mmu_base) && get_le32 (f, &s.mmu_limit)
+        && get_le32 (f, &s.mar) && get_le32 (f, &s.mbr)
+        && get_le32 (f, &s.mem_size) && get_le32 (f, &halted)
+        && get_le64 (f, &instr_count) && get_le32 (f, &s.ivec)
+        && get_le32 (f, &s.timer_period) && get_le32 (f, &s.timer_left);
+    if (!ok || s.mem_size <= 0 || s.mmu_base < 0 || s.mmu_limit < 0
+            || (int64_t) s.mmu_base + s.mmu_limit > s.mem_size)
+        return false;
+
+    if (s.mem_size != kone->mem_size) {
+        if (delta)
+            return false;
+        if (kone->mem_mapped) {
+            ELOG ("Cannot resize the memory mapped from an image\n", 0);
+            return false;
+        }
+        int32_t* mem = realloc (kone->mem, s.mem_size * sizeof(int32_t));
+        if (!mem) {
+            ELOG ("Could not allocate %zu bytes of memory\n", s.mem_size * sizeof(int32_t));
+            return false;
+        }
+        kone->mem = mem;
+    }
+
+    s.mem = kone->mem;
+    s.mem_mapped = kone->mem_mapped;
+    s.mix = kone->mix;
+    s.halted = halted != 0;
+    s.instr_count = instr_count;
+    *kone = s;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read the memory from a full snapshot.
+ *
+ * @return False if the snapshot is truncated.
+ */
+static bool
+load_memory (
+        s_ckone* kone,      ///< The state structure.
+        FILE* f             ///< The file.
+        )
+{
+    for (int32_t i = 0; i < kone->mem_size; i++)
+        if (!get_le32 (f, &kone->mem[i]))
+            return false;
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read the pages of a delta.
+ *
+ * @return False if the snapshot is truncated or invalid.
+ */
+static bool
+load_pages (
+        s_ckone* kone,      ///< The state structure.
+        FILE* f             ///< The file.
+        )
+{
+    int32_t count;
+    if (!get_le32 (f, &count))
+        return false;
+
+    for (int32_t n = 0; n < count; n++) {
+        int32_t page, value;
+        if (!get_le32 (f, &page) || page < 0 || page << DIRTY_PAGE_BITS >= kone->mem_size)
+            return false;
+
+        int32_t start = page << DIRTY_PAGE_BITS;
+        for (int32_t i = start; i < start + DIRTY_PAGE_WORDS; i++) {
+            if (!get_le32 (f, &value))
+                return false;
+            if (i < kone->mem_size)
+                kone->mem[i] = value;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @internal
+ * Read the STDIN and STDOUT file names and positions.
+ *
+ * @return False if the snapshot is truncated or invalid.
+ */
+static bool
+load_files (
+        FILE* f,            ///< The file.
+        int64_t* stdin_pos, ///< Where to store the STDIN position.
+        int64_t* stdout_pos ///< Where to store the STDOUT position.
+        )
+{
+    return get_string (f, file_names[0], sizeof(file_names[0]))
+        && get_le64 (f, stdin_pos)
+        && get_string (f, file_names[1], sizeof(file_names[1]))
+        && get_le64 (f, stdout_pos);
+}
+
+
+/**
+ * @internal
+ * Read the symbol table from a snapshot. The symbols are inserted in 
+ * the same order as they were originally.
+ *
+ * @return False if the snapshot is truncated or invalid.
+ */
+static bool
+load_symbols (
+        FILE* f             ///< The file.
+        )
+{
+    int32_t count;
+    if (!get_le32 (f, &count) || count < 0)
+        return false;
+
+    // the symbols were written starting from the last one inserted
+    char (*names)[1024] = malloc (count * sizeof(*names));
+    char (*values)[1024] = malloc (count * sizeof(*values));
+    bool ok = !count || (names && values);
+    for (int32_t i = 0; ok && i < count; i++)
+        ok = get_string (f, names[i], sizeof(names[i]))
+            && get_string (f, values[i], sizeof(values[i]));
+    for (int32_t i = count - 1; ok && i >= 0; i--)
+        ok = symtable_insert (names[i], values[i]);
+
+    free (names);
+    free (values);
+    return ok;
+}
+
+
+/**
+ * Restore the machine from a snapshot written by snapshot_save() or
+ * snapshot_checkpoint(), applying its delta if there is one. This
+ * replaces ckone_load(): ckone_init() must have been called, and the
+ * symbol table must be empty. The STDIN and STDOUT files of the snapshot
+ * are used unless others were given in ::args, and ext_init_devices()
+ * will continue from the saved positions in them.
+ *
+ * @return False if the snapshot could not be read.
+ */
+bool
+snapshot_load (
+        s_ckone* kone,      ///< The state structure.
+        const char* path    ///< The file.
+        )
+{
+    int32_t kind;
+    int64_t serial;
+    FILE* f = open_snapshot (path, &kind, &serial);
+    if (!f)
+        return false;
+    if (kind != SNAPSHOT_FULL) {
+        ELOG ("%s is a delta; restore its full snapshot instead\n", path);
+        fclose (f);
+        return false;
+    }
+
+    int64_t stdin_pos, stdout_pos;
+    bool ok = load_registers (kone, f, false) && load_memory (kone, f)
+        && load_files (f, &stdin_pos, &stdout_pos) && load_symbols (f);
+    fclose (f);
+
+    if (!ok) {
+        ELOG ("The snapshot %s is corrupted\n", path);
+        return false;
+    }
+
+    // the newer state in the delta, if it belongs to this snapshot
+    char delta_path[1024];
+    snprintf (delta_path, sizeof(delta_path), "%s.delta", path);
+    int32_t delta_kind;
+    int64_t delta_serial;
+    FILE* delta = fopen (delta_path, "rb");
+    if (delta) {
+        fclose (delta);
+        delta = open_snapshot (delta_path, &delta_kind, &delta_serial);
+    }
+    if (delta && (delta_kind != SNAPSHOT_DELTA || delta_serial != serial))
+        WLOG ("%s does not belong to %s; ignoring it\n", delta_path, path);
+    else if (delta) {
+        ok = load_registers (kone, delta, true) && load_pages (kone, delta)
+            && load_files (delta, &stdin_pos, &stdout_pos);
+        if (!ok) {
+            ELOG ("The delta %s is corrupted\n", delta_path);
+            fclose (delta);
+            return false;
+        }
+        ILOG ("Applied the delta %s\n", delta_path);
+    }
+    if (delta)
+        fclose (delta);
+
+    // the positions only make sense in the same files
+    if (!args.stdin_file && file_names[0][0])
+        args.stdin_file = file_names[0];
+    else
+        stdin_pos = -1;
+    if (!args.stdout_file && file_names[1][0])
+        args.stdout_file = file_names[1];
+    else
+        stdout_pos = -1;
+    ext_resume_devices (stdin_pos, stdout_pos);
+
+    ILOG ("Restored a snapshot from %s after %llu instructions\n", path,
+            (unsigned long long) kone->instr_count);
+    return true;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file snapshot.h
+ *
+ * The public functions of the machine state snapshots.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+
+/// The version of the snapshot file format. Incremented whenever the
+/// format changes; older snapshots are then refused.
+#define SNAPSHOT_VERSION 2
+
+
+extern bool snapshot_save (s_ckone* kone, const char* path);
+extern bool snapshot_checkpoint (s_ckone* kone, const char* path);
+extern bool snapshot_load (s_ckone* kone, const char* path);
+
+
+#endif
@@ -5,6 +5,7 @@
  */
 
 #include "common.h"
+#include "symtable.h"
 
 
 /**
@@ -15,6 +16,7 @@ typedef struct s_symtable {
     char* name;                 ///< The name (key) of the symbol.
     int value;                  ///< The integer value of the symbol. This
                                 ///< is undefined for symbols stdin and stdout.
+    bool is_number;             ///< True if the value is an integer.
     char* value_str;            ///< The value of the symbol as a string.
     struct s_symtable* next;    ///< A pointer to the next node in the list.
 } s_symtable;
@@ -83,7 +85,7 @@ create_node (
     //*dst = 0;
 
     DLOG ("Converting value to integer...\n", 0);
-    sscanf (value, "%d", &new->value);
+    new->is_number = sscanf (value, "%d", &new->value) == 1;
     DLOG ("The integer value is: %d\n", new->value);
 
     return new;
@@ -198,6 +200,109 @@ symtable_lookup_str (
 }
 
 
+/**
+ * @internal
+ * The symbols which Titokone always puts in the symbol table. They
+ * are device and SVC numbers, so they never name a code location.
+ */
+static const char* builtin_symbols[] = {
+    "crt", "kbd", "stdin", "stdout", "halt", "read", "write", "time", "date",
+    NULL
+};
+
+
+/**
+ * @internal
+ * Check if a symbol is one of ::builtin_symbols.
+ *
+ * @return True if the symbol is built-in.
+ */
+static bool 
+is_builtin (
+        const char* name    ///< The symbol name.
+        ) 
+{
+    for (const char** b = builtin_symbols; *b; b++)
+        if (!strcmp (*b, name))
+            return true;
+    return false;
+}
+
+
+/**
+ * Find the label for an address: the symbol with the largest value
+ * which is not greater than the address. Built-in symbols and negative
+ * values (which are usually frame offsets) are skipped. Constants defined
+ * with @c EQU cannot be told apart from labels, so a small constant may
+ * sometimes be reported.
+ *
+ * @note The name written by this function will become invalid after
+ * symtable_clear() has been called.
+ *
+ * @return False if no symbol precedes the address.
+ */
+bool 
+symtable_lookup_addr (
+        int32_t addr,       ///< The address.
+        char** name,        ///< A pointer to a variable where the name should be stored.
+        int32_t* offset     ///< A pointer to a variable where addr minus the symbol value 
+                            ///< should be stored.
+        ) 
+{
+    s_symtable* best = NULL;
+    for (s_symtable* s = symtable; s; s = s->next) {
+        if (!s->is_number || s->value < 0 || s->value > addr || is_builtin (s->name))
+            continue;
+        if (!best || s->value > best->value)
+            best = s;
+    }
+
+    if (!best)
+        return false;
+
+    *name = best->name;
+    *offset = addr - best->value;
+    return true;
+}
+
+
+/**
+ * Write a symbolic name for an address to a buffer, for example
+ * @c fact or @c fact+3. If no symbol precedes the address, the
+ * address itself is written.
+ */
+void 
+symtable_addr_string (
+        int32_t addr,       ///< The address.
+        char* buffer,       ///< The buffer to write the result to.
+        size_t buf_size     ///< The size of the buffer.
+        ) 
+{
+    char* name;
+    int32_t offset;
+    if (!symtable_lookup_addr (addr, &name, &offset))
+        snprintf (buffer, buf_size, "%d", addr);
+    else if (offset == 0)
+        snprintf (buffer, buf_size, "%s", name);
+    else
+        snprintf (buffer, buf_size, "%s+%d", name, offset);
+}
+
+
+/**
+ * Call a function for each symbol, starting from the one inserted last.
+ */
+void 
+symtable_foreach (
+        symtable_visitor visit, ///< The function to call.
+        void* data              ///< Passed to the function.
+        ) 
+{
+    for (s_symtable* s = symtable; s; s = s->next)
+        visit (s->name, s->value_str, data);
+}
+
+
 /**
  * Print the symbol table.
  */
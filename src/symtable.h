@@ -8,9 +8,17 @@
 #define SYMTABLE_H
 
 
+/// A function called by symtable_foreach() with the name and the
+/// string value of a symbol.
+typedef void (*symtable_visitor) (const char* name, const char* value, void* data);
+
+
 extern bool symtable_insert (char* name, char* value);
 extern bool symtable_lookup (char* name, int* value);
 extern bool symtable_lookup_str (char* name, char** value);
+extern bool symtable_lookup_addr (int32_t addr, char** name, int32_t* offset);
+extern void symtable_addr_string (int32_t addr, char* buffer, size_t buf_size);
+extern void symtable_foreach (symtable_visitor visit, void* data);
 extern void symtable_dump ();
 extern void symtable_clear ();
 
@@ -0,0 +1,268 @@
+/**
+ * @file top.c
+ *
+ * The live metrics viewer, built as the @c ckone-top executable. Lists
+ * the emulators started with the live option (see live.c) by looking for
+ * their shared memory objects in @c /dev/shm, maps each one read-only and
+ * shows the instructions executed, the speed over the last second, the
+ * instructions since the last I/O operation, the I/O operations, the
+ * faults, the state, and the program counter and its symbol. A program
+ * which runs fast and has not done any I/O for a long time is most
+ * likely in an infinite loop.
+ *
+ * A machine which has not published anything for over a second is
+ * waiting, typically for input, and its speed is shown as 0. The objects
+ * of processes which no longer exist, for example because they were
+ * killed, are removed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <argp.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "config.h"
+#include "live.h"
+
+
+/**
+ * @internal
+ * The directory where the shared memory objects are.
+ */
+#define SHM_DIR "/dev/shm"
+
+/**
+ * @internal
+ * The maximum number of machines shown.
+ */
+#define MAX_MACHINES 1024
+
+
+/**
+ * @internal
+ * The command line options of ckone-top.
+ */
+static struct {
+    double delay;           ///< The time between the updates in seconds.
+    int iterations;         ///< The number of updates, or 0 for no limit.
+    bool batch;             ///< If true, the screen is not cleared.
+} options;
+
+
+/// @cond skip
+const char* argp_program_version = "ckone-top " VERSION;
+
+static char doc[] =
+"ckone-top -- show the running ckone emulators\v"
+"Shows the emulators started with the --live option, fastest first. SINCE IO is\n"
+"the number of instructions executed since the last I/O operation.\n";
+
+static struct argp_option argp_options[] = {
+    { "delay",          'd',    "SECONDS",  0,
+        "Update every SECONDS seconds (default: 1)", 0 },
+
+    { "iterations",     'n',    "N",        0,
+        "Stop after N updates", 0 },
+
+    { "batch",          'b',    0,          0,
+        "Do not clear the screen between the updates", 0 },
+
+    { 0, 0, 0, 0, 0, 0 }    // end of table
+};
+/// @endcond
+
+
+/**
+ * @internal
+ * Parse one command line option. See the argp documentation.
+ *
+ * @return 0 on success, ARGP_ERR_UNKNOWN if the option is unknown.
+ */
+static error_t
+parse_opt (
+        int key,                    ///< The option key.
+        char* arg,                  ///< The option argument.
+        struct argp_state* state    ///< The parser state.
+        )
+{
+    switch (key) {
+        case 'd':
+            options.delay = atof (arg);
+            if (options.delay <= 0)
+                argp_error (state, "the delay must be positive");
+            break;
+        case 'n':
+            options.iterations = atoi (arg);
+            if (options.iterations < 1)
+                argp_error (state, "the number of updates must be positive");
+            break;
+        case 'b':
+            options.batch = true;
+            break;
+        case ARGP_KEY_ARG:
+            argp_usage (state);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/// @cond skip
+static struct argp argp = { argp_options, parse_opt, 0, doc, 0, 0, 0 };
+/// @endcond
+
+
+/**
+ * @internal
+ * The time of CLOCK_MONOTONIC, which is the same for all processes.
+ *
+ * @return The time in seconds.
+ */
+static double
+now (
+        void
+        )
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * @internal
+ * Read the metrics of one machine. The object of a process which no
+ * longer exists is removed.
+ *
+ * @return False if the object is not a valid segment of a live process.
+ */
+static bool
+read_machine (
+        const char* name,           ///< The name of the object, without the slash.
+        s_live_metrics* metrics     ///< Where to store the metrics.
+        )
+{
+    if (!live_read (name, metrics))
+        return false;
+
+    if (kill (metrics->pid, 0) && errno == ESRCH) {
+        char path[300];
+        snprintf (path, sizeof(path), "/%s", name);
+        DLOG ("Removing the live metrics of process %d\n", metrics->pid);
+        shm_unlink (path);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @internal
+ * Compare two machines by their speed, fastest first. Used with qsort().
+ *
+ * @return See qsort().
+ */
+static int
+compare_machines (
+        const void* a,      ///< The first machine.
+        const void* b       ///< The second machine.
+        )
+{
+    const s_live_metrics* ma = a;
+    const s_live_metrics* mb = b;
+    if (ma->mips != mb->mips)
+        return ma->mips < mb->mips? 1 : -1;
+    return ma->pid - mb->pid;
+}
+
+
+/**
+ * @internal
+ * Show the machines once.
+ */
+static void
+show (
+        s_live_metrics* machines    ///< The space for the metrics.
+        )
+{
+    int count = 0;
+    DIR* dir = opendir (SHM_DIR);
+    if (dir) {
+        struct dirent* entry;
+        while (count < MAX_MACHINES && (entry = readdir (dir)))
+            if (!strncmp (entry->d_name, LIVE_PREFIX, strlen (LIVE_PREFIX))
+                    && read_machine (entry->d_name, &machines[count]))
+                count++;
+        closedir (dir);
+    }
+
+    // a machine which has not published anything is waiting
+    double t = now ();
+    for (int i = 0; i < count; i++)
+        if (machines[i].state != LIVE_RUNNING || t - machines[i].updated > 1.0)
+            machines[i].mips = 0;
+    qsort (machines, count, sizeof(s_live_metrics), compare_machines);
+
+    static const char* states[] = { "run", "halt", "fault" };
+    if (!options.batch)
+        printf ("\033[H\033[2J");
+    printf ("%d emulator%s\n\n", count, count == 1? "" : "s");
+    printf ("%8s %8s %14s %14s %8s %6s %-5s %8s %6s  %-20s %s\n", "PID", "MIPS",
+            "INSTRUCTIONS", "SINCE IO", "IO", "FAULTS", "STATE", "TIME", "PC", "SYMBOL", "PROGRAM");
+    for (int i = 0; i < count; i++) {
+        s_live_metrics* m = &machines[i];
+        bool waiting = m->state == LIVE_RUNNING && t - m->updated > 1.0;
+        printf ("%8d %8.2f %14llu %14llu %8llu %6llu %-5s %8.1f %6d  %-20.20s %s\n",
+                m->pid, m->mips, (unsigned long long) m->instructions,
+                (unsigned long long) (m->instructions - m->io_instructions),
+                (unsigned long long) m->io, (unsigned long long) m->faults,
+                waiting? "wait" : states[m->state < 0 || m->state > 2? 0 : m->state],
+                t - m->started, m->pc, m->symbol, m->program);
+    }
+    fflush (stdout);
+}
+
+
+/**
+ * The entry point of ckone-top.
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if memory could not be allocated.
+ */
+int
+main (
+        int argc,       ///< The number of command line arguments.
+        char** argv     ///< The command line arguments.
+        )
+{
+    options.delay = 1;
+    options.iterations = 0;
+    options.batch = false;
+    argp_parse (&argp, argc, argv, 0, 0, 0);
+
+    s_live_metrics* machines = malloc (MAX_MACHINES * sizeof(s_live_metrics));
+    if (!machines) {
+        ELOG ("Could not allocate memory for the machines\n", 0);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; !options.iterations || i < options.iterations; i++) {
+        if (i) {
+            struct timespec ts;
+            ts.tv_sec = (time_t) options.delay;
+            ts.tv_nsec = (long) ((options.delay - ts.tv_sec) * 1e9);
+            nanosleep (&ts, NULL);
+            if (options.batch)
+                printf ("\n");
+        }
+        show (machines);
+    }
+
+    free (machines);
+    return EXIT_SUCCESS;
+}
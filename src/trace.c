@@ -0,0 +1,685 @@
+/**
+ * @file trace.c
+ *
+ * A compact binary execution trace, and a decoder which prints it.
+ *
+ * The trace starts with a header: the 8 bytes "CKTRACE1", then MMU_BASE,
+ * MMU_LIMIT, PC, SR and R0 to R7 at the start of the run as 32-bit
+ * little-endian integers. After that there is one record per executed
+ * instruction. A record starts with a byte of ::e_trace_flags telling which of the following fields are present:
+ *  -# ::T_PC: the address of the instruction, as a difference from the
+ *     address following the previous instruction.
+ *  -# ::T_IR: the instruction. Both the writer and the decoder remember
+ *     the last instruction seen at each address, and the instruction is
+ *     only stored when it differs from that.
+ *  -# ::T_REGS: a byte with one bit for each of R0 to R7 which changed,
+ *     followed by the differences of the new values from the old ones.
+ *  -# ::T_SR: the new value of SR, rotated so that the used high bits
+ *     become low bits.
+ *  -# ::T_MEM: the number of memory writes, followed by the address of
+ *     each write (as a difference from the previous address, starting
+ *     from the instruction address) and the value written.
+ *
+ * All numbers are written as variable-length integers (7 bits per byte,
+ * least significant first), and the differences are first zigzag-encoded
+ * so that small negative numbers stay small. The records go through a
+ * large buffer, and if ckone was built with zlib, the buffer can be
+ * written through a gzip stream. The decoder reads both formats.
+ *
+ * The recording hooks are called from cpu.c and mmu.c when a trace file
+ * (see ::args) has been given.
+ */
+
+#include "common.h"
+#include "instr.h"
+#include "trace.h"
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+
+/// @cond skip
+// The trace file header, without the registers.
+#define TRACE_MAGIC "CKTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+// The number of registers in the header.
+#define TRACE_HEADER_REGS 12
+
+// The size of the output buffer.
+#define TRACE_BUF_SIZE (1 << 20)
+
+// The maximum size of one encoded record, not including the memory writes.
+#define TRACE_MAX_RECORD 64
+
+// The maximum size of one encoded memory write.
+#define TRACE_MAX_WRITE 10
+/// @endcond
+
+
+/**
+ * The flags in the first byte of each record.
+ */
+typedef enum {
+    T_PC = 0x01,        ///< The instruction is not the one after the previous.
+    T_IR = 0x02,        ///< The instruction differs from the last one seen at the address.
+    T_REGS = 0x04,      ///< Some of the registers R0 to R7 changed.
+    T_SR = 0x08,        ///< SR changed.
+    T_MEM = 0x10        ///< The instruction wrote to memory.
+} e_trace_flags;
+
+
+/**
+ * @internal
+ * One memory write made by the current instruction.
+ */
+typedef struct {
+    int32_t addr;           ///< The logical address.
+    int32_t value;          ///< The value written.
+} s_trace_write;
+
+
+/**
+ * @internal
+ * The state of the trace writer.
+ */
+static struct {
+    FILE* file;             ///< The trace file, if not compressed.
+#ifdef HAVE_ZLIB
+    gzFile gz;              ///< The trace file, if compressed.
+#endif
+    uint8_t* buf;           ///< The output buffer.
+    size_t len;             ///< The number of bytes used in buf.
+
+    int32_t* last_ir;       ///< The last instruction seen at each address.
+    int32_t size;           ///< The number of entries in last_ir.
+    int32_t next_pc;        ///< The address after the previous instruction.
+
+    int32_t pc;             ///< The address of the current instruction.
+    int32_t r[8];           ///< R0 to R7 before the current instruction.
+    int32_t sr;             ///< SR before the current instruction.
+    uint64_t count;         ///< The instruction count before the current instruction.
+
+    s_trace_write* writes;  ///< The memory writes of the current instruction.
+    int writes_len;         ///< The number of entries used in writes.
+    int writes_cap;         ///< The number of entries allocated for writes.
+} tr;
+
+
+/**
+ * @internal
+ * Zigzag-encode a difference, so that numbers close to zero
+ * become small unsigned numbers.
+ *
+ * @return The encoded number.
+ */
+static uint32_t
+zigzag (
+        int32_t value       ///< The number to encode.
+        )
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+
+/**
+ * @internal
+ * Decode a zigzag-encoded number. See zigzag().
+ *
+ * @return The decoded number.
+ */
+static int32_t
+unzigzag (
+        uint32_t value      ///< The number to decode.
+        )
+{
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+
+/**
+ * @internal
+ * Zigzag-encode the difference of two numbers. The difference is taken
+ * modulo 2^32, so that it cannot overflow.
+ *
+ * @return The encoded difference.
+ */
+static uint32_t
+zigzag_delta (
+        int32_t value,      ///< The new number.
+        int32_t base        ///< The number it is relative to.
+        )
+{
+    return zigzag ((int32_t) ((uint32_t) value - (uint32_t) base));
+}
+
+
+/**
+ * @internal
+ * Add a difference encoded with zigzag_delta() to a number, modulo 2^32.
+ *
+ * @return The new number.
+ */
+static int32_t
+unzigzag_delta (
+        int32_t base,       ///< The number the difference is relative to.
+        uint32_t value      ///< The encoded difference.
+        )
+{
+    return (int32_t) ((uint32_t) base + (uint32_t) unzigzag (value));
+}
+
+
+/**
+ * @internal
+ * Rotate SR so that the status bits (the high 11 bits) become the
+ * low bits, which makes the encoded value short.
+ *
+ * @return The rotated value.
+ */
+static uint32_t
+rotate_sr (
+        int32_t sr          ///< The value of SR.
+        )
+{
+    return ((uint32_t) sr << 11) | ((uint32_t) sr >> 21);
+}
+
+
+/**
+ * @internal
+ * Undo rotate_sr().
+ *
+ * @return The value of SR.
+ */
+static int32_t
+unrotate_sr (
+        uint32_t value      ///< The rotated value.
+        )
+{
+    return (int32_t) ((value >> 11) | (value << 21));
+}
+
+
+/**
+ * @internal
+ * Append a variable-length integer to a buffer.
+ *
+ * @return A pointer past the written bytes.
+ */
+static uint8_t*
+put_varint (
+        uint8_t* p,         ///< Where to write.
+        uint32_t value      ///< The number to write.
+        )
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+
+/**
+ * @internal
+ * Append a 32-bit little-endian integer to a buffer.
+ *
+ * @return A pointer past the written bytes.
+ */
+static uint8_t*
+put_le32 (
+        uint8_t* p,         ///< Where to write.
+        int32_t value       ///< The number to write.
+        )
+{
+    for (int i = 0; i < 4; i++)
+        *p++ = (uint8_t) ((uint32_t) value >> (8 * i));
+    return p;
+}
+
+
+/**
+ * @internal
+ * Write out the contents of the output buffer.
+ */
+static void
+flush (
+        void
+        )
+{
+    size_t written;
+#ifdef HAVE_ZLIB
+    if (tr.gz)
+        written = gzwrite (tr.gz, tr.buf, tr.len) > 0? tr.len : 0;
+    else
+#endif
+        written = fwrite (tr.buf, 1, tr.len, tr.file);
+
+    if (written != tr.len && tr.len)
+        ELOG ("Failed to write the trace\n", 0);
+    tr.len = 0;
+}
+
+
+/**
+ * Open a trace file and write its header. The program should have been
+ * loaded, since the MMU registers are stored in the header. See also
+ * trace_close().
+ *
+ * @return False if the file could not be opened.
+ */
+bool
+trace_open (
+        s_ckone* kone,      ///< The state structure.
+        const char* path,   ///< The trace file name.
+        bool compress       ///< True if the trace should be gzip-compressed.
+        )
+{
+    ILOG ("Opening trace file %s\n", path);
+    memset (&tr, 0, sizeof(tr));
+
+    if (compress) {
+#ifdef HAVE_ZLIB
+        tr.gz = gzopen (path, "wb1");
+        if (!tr.gz) {
+            ELOG ("Cannot open %s for writing\n", path);
+            return false;
+        }
+#else
+        ELOG ("Trace compression is not available; ckone was built without zlib\n", 0);
+        return false;
+#endif
+    } else {
+        tr.file = fopen (path, "wb");
+        if (!tr.file) {
+            ELOG ("Cannot open %s for writing\n", path);
+            return false;
+        }
+    }
+
+    tr.size = kone->mmu_limit;
+    tr.buf = malloc (TRACE_BUF_SIZE);
+    tr.last_ir = calloc (tr.size, sizeof(int32_t));
+    if (!tr.buf || !tr.last_ir) {
+        ELOG ("Could not allocate memory for the trace\n", 0);
+        trace_close ();
+        return false;
+    }
+
+    memcpy (tr.buf, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    uint8_t* p = tr.buf + TRACE_MAGIC_LEN;
+    p = put_le32 (p, kone->mmu_base);
+    p = put_le32 (p, kone->mmu_limit);
+    p = put_le32 (p, kone->pc);
+    p = put_le32 (p, kone->sr);
+    for (int r = 0; r < 8; r++)
+        p = put_le32 (p, kone->r[r]);
+    tr.len = p - tr.buf;
+
+    tr.next_pc = kone->pc;
+    return true;
+}
+
+
+/**
+ * Flush and close the trace file opened with trace_open().
+ */
+void
+trace_close (
+        void
+        )
+{
+    if (tr.buf)
+        flush ();
+
+#ifdef HAVE_ZLIB
+    if (tr.gz)
+        gzclose (tr.gz);
+#endif
+    if (tr.file)
+        fclose (tr.file);
+
+    free (tr.buf);
+    free (tr.last_ir);
+    free (tr.writes);
+    memset (&tr, 0, sizeof(tr));
+}
+
+
+/**
+ * Remember the registers before an instruction is executed.
+ */
+void
+trace_begin (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    tr.pc = kone->pc;
+    memcpy (tr.r, kone->r, sizeof(tr.r));
+    tr.sr = kone->sr;
+    tr.count = kone->instr_count;
+    tr.writes_len = 0;
+}
+
+
+/**
+ * Remember a memory write made by the current instruction.
+ */
+void
+trace_write (
+        int32_t addr,       ///< The logical address.
+        int32_t value       ///< The value written.
+        )
+{
+    if (tr.writes_len == tr.writes_cap) {
+        int cap = tr.writes_cap? 2 * tr.writes_cap : 16;
+        s_trace_write* writes = realloc (tr.writes, cap * sizeof(s_trace_write));
+        if (!writes) {
+            ELOG ("Could not allocate memory for the trace\n", 0);
+            return;
+        }
+        tr.writes = writes;
+        tr.writes_cap = cap;
+    }
+
+    tr.writes[tr.writes_len].addr = addr;
+    tr.writes[tr.writes_len].value = value;
+    tr.writes_len++;
+}
+
+
+/**
+ * Write the record of the instruction executed after trace_begin().
+ * Nothing is written if the instruction could not be fetched.
+ */
+void
+trace_end (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (kone->instr_count == tr.count)
+        return;
+
+    size_t needed = TRACE_MAX_RECORD + (size_t) tr.writes_len * TRACE_MAX_WRITE;
+    if (tr.len + needed > TRACE_BUF_SIZE)
+        flush ();
+
+    uint8_t* start = tr.buf + tr.len;
+    uint8_t* p = start + 1;
+    uint8_t flags = 0;
+
+    if (tr.pc != tr.next_pc) {
+        flags |= T_PC;
+        p = put_varint (p, zigzag_delta (tr.pc, tr.next_pc));
+    }
+    tr.next_pc = (int32_t) ((uint32_t) tr.pc + 1);
+
+    bool in_range = (uint32_t) tr.pc < (uint32_t) tr.size;
+    if (!in_range || tr.last_ir[tr.pc] != kone->ir) {
+        flags |= T_IR;
+        p = put_varint (p, (uint32_t) kone->ir);
+        if (in_range)
+            tr.last_ir[tr.pc] = kone->ir;
+    }
+
+    uint8_t mask = 0;
+    for (int r = 0; r < 8; r++)
+        if (kone->r[r] != tr.r[r])
+            mask |= 1 << r;
+    if (mask) {
+        flags |= T_REGS;
+        *p++ = mask;
+        for (int r = 0; r < 8; r++)
+            if (mask & (1 << r))
+                p = put_varint (p, zigzag_delta (kone->r[r], tr.r[r]));
+    }
+
+    if (kone->sr != tr.sr) {
+        flags |= T_SR;
+        p = put_varint (p, rotate_sr (kone->sr));
+    }
+
+    if (tr.writes_len) {
+        flags |= T_MEM;
+        p = put_varint (p, tr.writes_len);
+        int32_t prev = tr.pc;
+        for (int i = 0; i < tr.writes_len; i++) {
+            p = put_varint (p, zigzag_delta (tr.writes[i].addr, prev));
+            p = put_varint (p, zigzag (tr.writes[i].value));
+            prev = tr.writes[i].addr;
+        }
+    }
+
+    *start = flags;
+    tr.len = p - tr.buf;
+}
+
+
+/**
+ * @internal
+ * A trace file being decoded. Reads through zlib if available,
+ * since gzread() also reads uncompressed files.
+ */
+typedef struct {
+#ifdef HAVE_ZLIB
+    gzFile gz;              ///< The trace file.
+#else
+    FILE* file;             ///< The trace file.
+#endif
+    bool eof;               ///< True if the end of the file was reached.
+} s_trace_reader;
+
+
+/**
+ * @internal
+ * Read one byte from a trace.
+ *
+ * @return The byte, or -1 at the end of the file.
+ */
+static int
+get_byte (
+        s_trace_reader* in  ///< The trace.
+        )
+{
+#ifdef HAVE_ZLIB
+    int c = gzgetc (in->gz);
+#else
+    int c = fgetc (in->file);
+#endif
+    if (c < 0)
+        in->eof = true;
+    return c;
+}
+
+
+/**
+ * @internal
+ * Read a variable-length integer from a trace. See put_varint().
+ *
+ * @return The number. The eof flag of the reader is set if the
+ *         file ended before the number did.
+ */
+static uint32_t
+get_varint (
+        s_trace_reader* in  ///< The trace.
+        )
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = get_byte (in);
+        if (c < 0)
+            return 0;
+        value |= (uint32_t) (c & 0x7f) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+    return value;
+}
+
+
+/**
+ * @internal
+ * Get the name of the given register.
+ *
+ * @return The name of the register (R0-R5, SP, FP).
+ */
+static const char*
+reg_name (
+        int r               ///< The register.
+        )
+{
+    static const char* names[] = { "R0", "R1", "R2", "R3", "R4", "R5", "SP", "FP" };
+    return names[r & 7];
+}
+
+
+/**
+ * @internal
+ * Read a 32-bit little-endian integer from a trace.
+ *
+ * @return The number.
+ */
+static int32_t
+get_le32 (
+        s_trace_reader* in  ///< The trace.
+        )
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t) (get_byte (in) & 0xff) << (8 * i);
+    return (int32_t) value;
+}
+
+
+/**
+ * @internal
+ * Print the records of a trace whose header has been read.
+ *
+ * @return False if the trace ends in the middle of a record.
+ */
+static bool
+decode_records (
+        s_trace_reader* in, ///< The trace.
+        FILE* out,          ///< The file to print to.
+        int32_t* last_ir,   ///< The last instruction seen at each address.
+        int32_t limit,      ///< The number of entries in last_ir.
+        int32_t pc,         ///< The initial value of PC.
+        int32_t* r          ///< The initial values of R0 to R7.
+        )
+{
+    int32_t next_pc = pc;
+    for (uint64_t seq = 1; ; seq++) {
+        int flags = get_byte (in);
+        if (flags < 0)
+            return true;
+
+        pc = next_pc;
+        if (flags & T_PC)
+            pc = unzigzag_delta (pc, get_varint (in));
+        next_pc = (int32_t) ((uint32_t) pc + 1);
+
+        bool in_range = pc >= 0 && pc < limit;
+        int32_t ir = in_range? last_ir[pc] : 0;
+        if (flags & T_IR) {
+            ir = (int32_t) get_varint (in);
+            if (in_range)
+                last_ir[pc] = ir;
+        }
+
+        char buf[256];
+        instr_string (ir, buf, sizeof(buf));
+        fprintf (out, "%10llu %8d  %s", (unsigned long long) seq, pc, buf);
+
+        if (flags & T_REGS) {
+            int mask = get_byte (in);
+            for (int i = 0; i < 8; i++) {
+                if (mask & (1 << i)) {
+                    r[i] = unzigzag_delta (r[i], get_varint (in));
+                    fprintf (out, "  %s=%d", reg_name (i), r[i]);
+                }
+            }
+        }
+
+        if (flags & T_SR)
+            fprintf (out, "  SR=0x%08x", unrotate_sr (get_varint (in)));
+
+        if (flags & T_MEM) {
+            uint32_t n = get_varint (in);
+            int32_t addr = pc;
+            for (uint32_t i = 0; i < n && !in->eof; i++) {
+                addr = unzigzag_delta (addr, get_varint (in));
+                fprintf (out, "  [%d]=%d", addr, unzigzag (get_varint (in)));
+            }
+        }
+        fprintf (out, "\n");
+
+        if (in->eof) {
+            ELOG ("The trace ends in the middle of a record\n", 0);
+            return false;
+        }
+    }
+}
+
+
+/**
+ * Print a trace file written with trace_open(). Each instruction is
+ * printed on one line with its sequence number, address, disassembly,
+ * and the registers and memory locations it changed.
+ *
+ * @return False if the file could not be read or is not a trace.
+ */
+bool
+trace_decode (
+        const char* path,   ///< The trace file name.
+        FILE* out           ///< The file to print to.
+        )
+{
+    s_trace_reader in;
+    in.eof = false;
+#ifdef HAVE_ZLIB
+    in.gz = gzopen (path, "rb");
+    if (!in.gz) {
+#else
+    in.file = fopen (path, "rb");
+    if (!in.file) {
+#endif
+        ELOG ("Cannot open %s for reading\n", path);
+        return false;
+    }
+
+    char magic[TRACE_MAGIC_LEN];
+    for (int i = 0; i < TRACE_MAGIC_LEN; i++)
+        magic[i] = (char) get_byte (&in);
+
+    int32_t regs[TRACE_HEADER_REGS];
+    for (int i = 0; i < TRACE_HEADER_REGS; i++)
+        regs[i] = get_le32 (&in);
+
+    bool ok = false;
+    int32_t* last_ir = NULL;
+    if (in.eof || memcmp (magic, TRACE_MAGIC, TRACE_MAGIC_LEN)) {
+        ELOG ("%s is not a ckone trace file\n", path);
+    } else {
+        int32_t limit = regs[1];
+        fprintf (out, "Trace of a program with MMU base %d and MMU limit %d\n", 
+                regs[0], limit);
+
+        last_ir = calloc (limit > 0? limit : 1, sizeof(int32_t));
+        if (!last_ir)
+            ELOG ("Could not allocate memory for the trace\n", 0);
+        else
+            ok = decode_records (&in, out, last_ir, limit, regs[2], &regs[4]);
+    }
+
+    free (last_ir);
+#ifdef HAVE_ZLIB
+    gzclose (in.gz);
+#else
+    fclose (in.file);
+#endif
+    return ok;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file trace.h
+ *
+ * The public functions of the binary execution trace.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+extern bool trace_open (s_ckone* kone, const char* path, bool compress);
+extern void trace_close ();
+
+extern void trace_begin (s_ckone* kone);
+extern void trace_write (int32_t addr, int32_t value);
+extern void trace_end (s_ckone* kone);
+
+extern bool trace_decode (const char* path, FILE* out);
+
+
+#endif
@@ -0,0 +1,362 @@
+/**
+ * @file undo.c
+ *
+ * An undo log for reverse execution. For each executed instruction the
+ * old values of everything it changed are appended to a ring buffer:
+ * the memory words it wrote, the working registers, SR and the timer
+ * state that differ from before the instruction, and finally a mark
+ * holding the old PC. Undoing an instruction pops its entries and puts
+ * the old values back.
+ *
+ * The ring buffer is allocated once by undo_init(), so recording does no
+ * allocation and is cheap enough for full-speed runs. When it is full,
+ * the oldest instructions are dropped as a whole. An instruction which
+ * changes more than the whole log holds, such as a plugin SVC writing
+ * a large buffer, cannot be undone; the log is cleared after it. Input
+ * and output done through the devices are not undone.
+ *
+ * The hooks are called from cpu.c and mmu.c when an undo log size
+ * (see ::args) has been given. The memory words put back are marked
+ * dirty (see dirty.c).
+ */
+
+#include "common.h"
+#include "undo.h"
+#include "dirty.h"
+
+
+/**
+ * @internal
+ * The special addresses of the undo log entries. Non-negative addresses
+ * are physical memory addresses, and -1 - r is working register r.
+ */
+enum {
+    UNDO_SR = -9,           ///< The status register.
+    UNDO_TIMER_LEFT = -10,  ///< The number of instructions left on the timer.
+    UNDO_TIMER_PERIOD = -11,///< The timer period.
+    UNDO_IVEC = -12,        ///< The interrupt vector.
+    UNDO_MARK = -13         ///< The end of an instruction. The value is the old PC.
+};
+
+
+/**
+ * @internal
+ * One entry of the undo log.
+ */
+typedef struct {
+    int32_t addr;           ///< What was changed; see above.
+    int32_t value;          ///< The old value.
+} s_undo_entry;
+
+
+/**
+ * @internal
+ * The ring buffer.
+ */
+static s_undo_entry* ring = NULL;
+
+/**
+ * @internal
+ * The number of entries in ::ring.
+ */
+static uint32_t size = 0;
+
+/**
+ * @internal
+ * The index of the next entry to write.
+ */
+static uint32_t head = 0;
+
+/**
+ * @internal
+ * The number of entries in use.
+ */
+static uint32_t used = 0;
+
+/**
+ * @internal
+ * The number of instructions in the log.
+ */
+static uint64_t instrs = 0;
+
+/**
+ * @internal
+ * True if the current instruction has changed more than the log holds.
+ */
+static bool overflow = false;
+
+/**
+ * @internal
+ * The state before the current instruction.
+ */
+static struct {
+    int32_t r[8];           ///< The working registers.
+    int32_t pc;             ///< The program counter.
+    int32_t sr;             ///< The status register.
+    int32_t timer_left;     ///< See s_ckone::timer_left.
+    int32_t timer_period;   ///< See s_ckone::timer_period.
+    int32_t ivec;           ///< See s_ckone::ivec.
+    uint64_t instr_count;   ///< The number of instructions executed.
+} before;
+
+
+/**
+ * @internal
+ * Append an entry to the log. If the log is full, the oldest
+ * instruction is dropped first. If only the entries of the current
+ * instruction are left, it cannot be undone, and its entries are
+ * discarded until undo_end().
+ */
+static inline void
+push (
+        int32_t addr,       ///< What was changed.
+        int32_t value       ///< The old value.
+        )
+{
+    if (overflow)
+        return;
+
+    if (used == size) {
+        if (!instrs) {
+            overflow = true;
+            head = used = 0;
+            return;
+        }
+
+        // the oldest entry is at head; drop entries up to and
+        // including the mark which ends the oldest instruction
+        uint32_t tail = head;
+        do {
+            used--;
+        } while (ring[tail++ % size].addr != UNDO_MARK && used > 0);
+        instrs--;
+    }
+
+    ring[head].addr = addr;
+    ring[head].value = value;
+    head = (head + 1) % size;
+    used++;
+}
+
+
+/**
+ * @internal
+ * Remove the newest entry from the log.
+ *
+ * @return The entry.
+ */
+static inline s_undo_entry
+pop (
+        void
+        )
+{
+    head = (head + size - 1) % size;
+    used--;
+    return ring[head];
+}
+
+
+/**
+ * Allocate the undo log. See also undo_free().
+ *
+ * @return False if the allocation failed.
+ */
+bool
+undo_init (
+        uint32_t entries    ///< The size of the log in entries.
+        )
+{
+    ring = malloc (entries * sizeof(s_undo_entry));
+    if (!ring) {
+        ELOG ("Could not allocate %u entries for the undo log\n", entries);
+        return false;
+    }
+
+    size = entries;
+    head = used = 0;
+    instrs = 0;
+    overflow = false;
+    return true;
+}
+
+
+/**
+ * Free the memory allocated by undo_init().
+ */
+void
+undo_free (
+        void
+        )
+{
+    free (ring);
+    ring = NULL;
+    size = head = used = 0;
+    instrs = 0;
+    overflow = false;
+}
+
+
+/**
+ * Save the state before an instruction. Called before each cycle.
+ */
+void
+undo_begin (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    memcpy (before.r, kone->r, sizeof(before.r));
+    before.pc = kone->pc;
+    before.sr = kone->sr;
+    before.timer_left = kone->timer_left;
+    before.timer_period = kone->timer_period;
+    before.ivec = kone->ivec;
+    before.instr_count = kone->instr_count;
+}
+
+
+/**
+ * Record the old value of a memory word. Called before the word
+ * is written.
+ */
+void
+undo_write (
+        int32_t paddr,      ///< The physical address.
+        int32_t old_value   ///< The value before the write.
+        )
+{
+    push (paddr, old_value);
+}
+
+
+/**
+ * Record the registers changed by an instruction and end it. Called
+ * after each cycle. A cycle in which no instruction was fetched is
+ * not recorded.
+ */
+void
+undo_end (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (kone->instr_count == before.instr_count && !overflow)
+        return;
+
+    for (int r = 0; r < 8; r++)
+        if (kone->r[r] != before.r[r])
+            push (-1 - r, before.r[r]);
+    if (kone->sr != before.sr)
+        push (UNDO_SR, before.sr);
+    if (kone->timer_left != before.timer_left)
+        push (UNDO_TIMER_LEFT, before.timer_left);
+    if (kone->timer_period != before.timer_period)
+        push (UNDO_TIMER_PERIOD, before.timer_period);
+    if (kone->ivec != before.ivec)
+        push (UNDO_IVEC, before.ivec);
+
+    push (UNDO_MARK, before.pc);
+    instrs++;
+
+    if (overflow) {
+        // the instructions before this one cannot be reached either
+        WLOG ("The instruction at %d changed more than the undo log holds; "
+                "the undo log was cleared\n", before.pc);
+        overflow = false;
+        head = used = 0;
+        instrs = 0;
+    }
+}
+
+
+/**
+ * @internal
+ * Undo the newest instruction in the log.
+ *
+ * @return True if the instruction wrote to the given physical address.
+ */
+static bool
+undo_instr (
+        s_ckone* kone,      ///< The state structure.
+        int32_t paddr       ///< The physical address to look for, or -1.
+        )
+{
+    bool wrote = false;
+
+    kone->pc = pop ().value;
+    while (used > 0 && ring[(head + size - 1) % size].addr != UNDO_MARK) {
+        s_undo_entry e = pop ();
+        switch (e.addr) {
+            case UNDO_SR: kone->sr = e.value; break;
+            case UNDO_TIMER_LEFT: kone->timer_left = e.value; break;
+            case UNDO_TIMER_PERIOD: kone->timer_period = e.value; break;
+            case UNDO_IVEC: kone->ivec = e.value; break;
+            default:
+                if (e.addr < 0)
+                    kone->r[-1 - e.addr] = e.value;
+                else {
+                    kone->mem[e.addr] = e.value;
+                    dirty_write (e.addr);
+                    if (e.addr == paddr)
+                        wrote = true;
+                }
+                break;
+        }
+    }
+
+    instrs--;
+    kone->instr_count--;
+    kone->halted = false;
+    return wrote;
+}
+
+
+/**
+ * Undo the last instruction.
+ *
+ * @return False if the log is empty.
+ */
+bool
+undo_step (
+        s_ckone* kone       ///< The state structure.
+        )
+{
+    if (!instrs)
+        return false;
+
+    undo_instr (kone, -1);
+    return true;
+}
+
+
+/**
+ * Undo instructions until one which wrote to the given address has
+ * been undone, so that it is the next instruction to execute. If there
+ * is no such instruction in the log, the whole log is undone.
+ *
+ * @return False if no write to the address was found.
+ */
+bool
+undo_to_write (
+        s_ckone* kone,      ///< The state structure.
+        int32_t addr        ///< The logical address.
+        )
+{
+    int32_t paddr = kone->mmu_base + addr;
+    while (instrs)
+        if (undo_instr (kone, paddr))
+            return true;
+    return false;
+}
+
+
+/**
+ * Get the number of instructions which can be undone.
+ *
+ * @return The number of instructions in the log.
+ */
+uint64_t
+undo_count (
+        void
+        )
+{
+    return instrs;
+}
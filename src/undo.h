@@ -0,0 +1,25 @@
+/**
+ * @file undo.h
+ *
+ * The public functions of the undo log.
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+/// The smallest allowed undo log size. One instruction must always fit.
+#define MIN_UNDO_SIZE 64
+
+extern bool undo_init (uint32_t entries);
+extern void undo_free ();
+
+extern void undo_begin (s_ckone* kone);
+extern void undo_write (int32_t paddr, int32_t old_value);
+extern void undo_end (s_ckone* kone);
+
+extern bool undo_step (s_ckone* kone);
+extern bool undo_to_write (s_ckone* kone, int32_t addr);
+extern uint64_t undo_count ();
+
+
+#endif
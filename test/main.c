@@ -8,6 +8,22 @@ extern void test_instr ();
 extern void test_mmu ();
 extern void test_cpu ();
 extern void test_alu ();
+extern void test_debug ();
+extern void test_dump ();
+extern void test_log ();
+extern void test_cache ();
+extern void test_branch ();
+extern void test_trace ();
+extern void test_replay ();
+extern void test_report ();
+extern void test_mix ();
+extern void test_sample ();
+extern void test_forksrv ();
+extern void test_gdb ();
+extern void test_callgraph ();
+extern void test_live ();
+extern void test_prof ();
+extern void test_serve ();
 
 
 int main() {
@@ -19,6 +35,22 @@ int main() {
     SUITE(test_mmu);
     SUITE(test_cpu);
     SUITE(test_alu);
+    SUITE(test_debug);
+    SUITE(test_dump);
+    SUITE(test_log);
+    SUITE(test_cache);
+    SUITE(test_branch);
+    SUITE(test_trace);
+    SUITE(test_replay);
+    SUITE(test_report);
+    SUITE(test_mix);
+    SUITE(test_sample);
+    SUITE(test_forksrv);
+    SUITE(test_gdb);
+    SUITE(test_callgraph);
+    SUITE(test_live);
+    SUITE(test_prof);
+    SUITE(test_serve);
 
     END_TESTS();
 
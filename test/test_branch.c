@@ -0,0 +1,164 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "instr.h"
+#include "branch.h"
+
+
+/**
+ * Read the number of mispredictions of a kind of jumps from the report.
+ *
+ * @param kone The state structure.
+ * @param label The label of the kind in the report.
+ * @return The mispredictions, or -1 if they are not reported.
+ */
+static int32_t missed (s_ckone* kone, const char* label) {
+    FILE* f = tmpfile ();
+    char line[256];
+    int32_t n = -1;
+
+    if (!f)
+        return -1;
+    branch_report (kone, f);
+    rewind (f);
+    while (fgets (line, sizeof(line), f)) {
+        const char* s = strstr (line, label);
+        unsigned long long count;
+        double predicted;
+        if (s && sscanf (s + strlen (label), "%llu %lf", &count, &predicted) == 2)
+            n = (int32_t) (count * (100.0 - predicted) / 100.0 + 0.5);
+    }
+    fclose (f);
+    return n;
+}
+
+
+/**
+ * Execute a conditional jump.
+ *
+ * @param kone The state structure.
+ * @param pc The address of the jump.
+ * @param target The target of the jump.
+ * @param taken True if the jump is taken.
+ */
+static void jump (s_ckone* kone, int32_t pc, int32_t target, bool taken) {
+    kone->pc = pc + 1;
+    kone->ir = JNZER << 24;
+    kone->tr = target;
+    branch_jump (kone, taken);
+}
+
+
+/**
+ * Execute the jump at the end of a loop of @p length rounds @p times
+ * times: taken back to the start except in the last round.
+ */
+static void loop (s_ckone* kone, int length, int times) {
+    for (int t = 0; t < times; t++)
+        for (int i = 1; i <= length; i++)
+            jump (kone, 10, 5, i < length);
+}
+
+
+void test_branch () {
+    s_ckone k;
+    int32_t mem[64];
+    int32_t before;
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+
+
+    BEGIN ("static prediction") {
+        TEST_BOOL (true, branch_init (&k, "static"));
+        jump (&k, 10, 5, true);
+        jump (&k, 10, 10, true);
+        jump (&k, 10, 20, false);
+        TEST_I32 (0, missed (&k, "Conditional jumps"));
+        jump (&k, 10, 5, false);
+        jump (&k, 10, 20, true);
+        TEST_I32 (2, missed (&k, "Conditional jumps"));
+        branch_free ();
+    }
+
+    BEGIN ("bimodal counters") {
+        // from weakly not taken, the counter saturates at not taken
+        TEST_BOOL (true, branch_init (&k, "bimodal:4"));
+        for (int i = 0; i < 5; i++)
+            jump (&k, 10, 5, false);
+        TEST_I32 (0, missed (&k, "Conditional jumps"));
+        for (int i = 0; i < 3; i++)
+            jump (&k, 10, 5, true);
+        TEST_I32 (2, missed (&k, "Conditional jumps"));
+        branch_free ();
+
+        // a loop of 10 rounds: once saturated at taken, the exit only
+        // weakens the counter, so the next round is predicted taken
+        TEST_BOOL (true, branch_init (&k, "bimodal:4"));
+        loop (&k, 10, 3);
+        TEST_I32 (4, missed (&k, "Conditional jumps"));
+
+        // a loop of 4 rounds: the exit is always mispredicted
+        before = missed (&k, "Conditional jumps");
+        loop (&k, 4, 20);
+        TEST_I32 (20, missed (&k, "Conditional jumps") - before);
+        branch_free ();
+    }
+
+    BEGIN ("gshare counters") {
+        // the history tells the rounds apart, so the loop is learned
+        TEST_BOOL (true, branch_init (&k, "gshare:4"));
+        loop (&k, 4, 20);
+        TEST_BOOL (true, missed (&k, "Conditional jumps") > 0);
+        before = missed (&k, "Conditional jumps");
+        loop (&k, 4, 20);
+        TEST_I32 (0, missed (&k, "Conditional jumps") - before);
+        branch_free ();
+
+        // without history, gshare is bimodal
+        TEST_BOOL (true, branch_init (&k, "gshare:1"));
+        loop (&k, 4, 20);
+        before = missed (&k, "Conditional jumps");
+        loop (&k, 4, 20);
+        TEST_BOOL (true, missed (&k, "Conditional jumps") - before >= 20);
+        branch_free ();
+    }
+
+    BEGIN ("return address stack") {
+        TEST_BOOL (true, branch_init (&k, "static"));
+        for (int i = 0; i < 3; i++)
+            branch_call (100 + i);
+        for (int i = 2; i >= 0; i--)
+            branch_exit (50, 100 + i);
+        TEST_I32 (0, missed (&k, "Returns"));
+
+        // 20 nested calls: the 16 innermost returns are predicted
+        for (int i = 0; i < 20; i++)
+            branch_call (100 + i);
+        for (int i = 19; i >= 0; i--)
+            branch_exit (50, 100 + i);
+        TEST_I32 (4, missed (&k, "Returns"));
+
+        // a return without a call
+        branch_exit (50, 100);
+        TEST_I32 (5, missed (&k, "Returns"));
+        branch_free ();
+    }
+
+    BEGIN ("configurations") {
+        const char* valid[] = { "static", "bimodal", "gshare:12", "gshare:24:0", "bimodal:1:100" };
+        for (size_t i = 0; i < sizeof(valid)/sizeof(valid[0]); i++) {
+            TEST_BOOL (true, branch_init (&k, valid[i]));
+            branch_free ();
+        }
+
+        const char* invalid[] = { "", "perceptron", "gshare:", "gshare:0", "gshare:25",
+                "gshare:12x", "gshare:12:", "gshare:12:5x", "gshare:12:5:1", "gshare:-1",
+                "gshare: 12", "gshare::5", "gshare:12:-5" };
+        for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++) {
+            TEST_BOOL (false, branch_init (&k, invalid[i]));
+            branch_free ();
+        }
+    }
+}
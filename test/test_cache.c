@@ -0,0 +1,127 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cache.h"
+
+
+/**
+ * Read the hits and misses of a cache from the report.
+ *
+ * @param kone The state structure.
+ * @param name The name of the cache in the report.
+ * @param hits Where to store the hits, -1 if the cache is not listed.
+ * @param misses Where to store the misses.
+ */
+static void stats (s_ckone* kone, const char* name, int32_t* hits, int32_t* misses) {
+    FILE* f = tmpfile ();
+    char line[256];
+    size_t len = strlen (name);
+
+    *hits = *misses = -1;
+    if (!f)
+        return;
+    cache_report (kone, f);
+    rewind (f);
+    while (fgets (line, sizeof(line), f)) {
+        unsigned long long h, m;
+        if (!strncmp (line, name, len) && line[len] == ' '
+                && sscanf (line + len, "%*u %*u %*u %*s %*u %llu %llu", &h, &m) == 2) {
+            *hits = h;
+            *misses = m;
+        }
+    }
+    fclose (f);
+}
+
+
+/**
+ * Read the words 0, 4, 0, 8, 4: the lines A, B, A, C, B of 16 bytes.
+ */
+static void access_lines () {
+    int32_t addrs[] = { 0, 4, 0, 8, 4 };
+    for (int i = 0; i < 5; i++)
+        cache_access (addrs[i], addrs[i], CACHE_READ);
+}
+
+
+void test_cache () {
+    s_ckone k;
+    int32_t mem[64];
+    int32_t hits, misses;
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+
+
+    BEGIN ("LRU replacement") {
+        // a single set of 2 ways: C replaces B, which was used before A
+        TEST_BOOL (true, cache_init (&k, "l1d=32:2:16:lru:1,l2=0"));
+        access_lines ();
+        stats (&k, "L1D", &hits, &misses);
+        TEST_I32 (1, hits);
+        TEST_I32 (4, misses);
+        stats (&k, "L2", &hits, &misses);
+        TEST_I32 (-1, hits);
+        cache_free ();
+    }
+
+    BEGIN ("FIFO replacement") {
+        // C replaces A, which was filled first, although A was used after B
+        TEST_BOOL (true, cache_init (&k, "l1d=32:2:16:fifo:1,l2=0"));
+        access_lines ();
+        stats (&k, "L1D", &hits, &misses);
+        TEST_I32 (2, hits);
+        TEST_I32 (3, misses);
+        cache_free ();
+    }
+
+    BEGIN ("L2 behind L1") {
+        // the L1 misses go to an L2 of 2 sets, which holds all the lines
+        TEST_BOOL (true, cache_init (&k, "l1d=32:2:16:lru:1,l2=64:2:16:lru:10"));
+        access_lines ();
+        stats (&k, "L1D", &hits, &misses);
+        TEST_I32 (1, hits);
+        TEST_I32 (4, misses);
+        stats (&k, "L2", &hits, &misses);
+        TEST_I32 (1, hits);
+        TEST_I32 (3, misses);
+        stats (&k, "L1I", &hits, &misses);
+        TEST_I32 (0, hits);
+        TEST_I32 (0, misses);
+        cache_free ();
+    }
+
+    BEGIN ("invalid configurations") {
+        TEST_BOOL (true, cache_init (&k, NULL));
+        cache_free ();
+
+        const char* configs[] = {
+            "l3=1k:2:16",               // an unknown cache
+            "l1d=1k:2:16:mru",          // an unknown policy
+            "l1d=1k:2",                 // no line size
+            "l1d=1k:2:16:lru:1:1",      // an extra field
+            "l1d=1k:2:16x",             // trailing garbage
+            "l1d=0",                    // no L1 cache
+            "l1d=1k:2:24",              // a line size which is not a power of 2
+            "l1d=48:2:16",              // not a whole number of sets
+            "l1d=1k:65536:65536",       // ways times line size wraps to 0
+            "l1d=1k:2:2048",            // a line larger than the cache
+            "l1d=4194305k:2:16",        // a size which does not fit in 32 bits
+            "l2=4194304k",
+            "mem=-1",                   // a negative latency
+            "mem",
+        };
+        for (size_t i = 0; i < sizeof(configs)/sizeof(configs[0]); i++) {
+            TEST_BOOL (false, cache_init (&k, configs[i]));
+            cache_free ();
+        }
+
+        // more entries than are parsed
+        char config[256] = "";
+        for (int i = 0; i < 17; i++)
+            strcat (config, "mem=1,");
+        TEST_BOOL (false, cache_init (&k, config));
+        cache_free ();
+    }
+}
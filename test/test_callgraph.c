@@ -0,0 +1,121 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "instr.h"
+#include "callgraph.h"
+#include "symtable.h"
+#include "args.h"
+
+
+/**
+ * Read the whole output of a call graph function.
+ */
+static void output (void (*write) (FILE*), char* buf, size_t size) {
+    FILE* f = tmpfile ();
+    buf[0] = '\0';
+    if (!f)
+        return;
+    write (f);
+    rewind (f);
+    buf[fread (buf, 1, size - 1, f)] = '\0';
+    fclose (f);
+}
+
+
+/**
+ * Read the counts of a routine from the call graph report.
+ *
+ * @param report The report.
+ * @param name The name of the routine.
+ * @param counts Where to store the inclusive and exclusive counts, the
+ *               calls and the maximum recursion.
+ * @return False if the routine is not in the report.
+ */
+static bool routine (const char* report, const char* name, int32_t counts[4]) {
+    for (const char* line = report; line; line = strchr (line, '\n')) {
+        unsigned long long inclusive, exclusive, calls;
+        int recursion;
+        char routine[64];
+        if (*line == '\n')
+            line++;
+        if (sscanf (line, "%llu %*f%% %llu %*f%% %llu %d %63s",
+                    &inclusive, &exclusive, &calls, &recursion, routine) == 5
+                && !strcmp (routine, name)) {
+            counts[0] = (int32_t) inclusive;
+            counts[1] = (int32_t) exclusive;
+            counts[2] = (int32_t) calls;
+            counts[3] = recursion;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void test_callgraph () {
+    s_ckone k;
+    int32_t mem[64];
+    char buf[2048];
+    int32_t counts[4];
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    symtable_insert ("main", "0");
+    symtable_insert ("f", "5");
+
+    // main calls f with R1 = 2, and f calls itself until R1 is 0
+    mem[0] = make_instr (LOAD, R1, IMMEDIATE, R0, 2);
+    mem[1] = make_instr (CALL, SP, IMMEDIATE, R0, 5);
+    mem[2] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    mem[5] = make_instr (SUB, R1, IMMEDIATE, R0, 1);
+    mem[6] = make_instr (JZER, R1, IMMEDIATE, R0, 8);
+    mem[7] = make_instr (CALL, SP, IMMEDIATE, R0, 5);
+    mem[8] = make_instr (EXIT, SP, IMMEDIATE, R0, 0);
+    k.r[SP] = k.r[FP] = 40;
+
+    args.callgraph_file = (char*) "callgraph";
+    TEST_BOOL (true, callgraph_init (&k));
+    while (!k.halted && cpu_step (&k))
+        ;
+    TEST_BOOL (true, k.halted);
+
+
+    BEGIN ("folded stacks") {
+        output (callgraph_write_folded, buf, sizeof(buf));
+        TEST_STR ("main 2\n"
+                "main;f 4\n"
+                "main;f;f 3\n"
+                "main;SVC:HALT 1\n", buf);
+    }
+
+    BEGIN ("routine counts") {
+        const char* summary = "Call graph: 10 instructions, 4 call paths, "
+            "maximum call depth 2,";
+        output (callgraph_report, buf, sizeof(buf));
+        TEST_BOOL (true, !strncmp (buf, summary, strlen (summary)));
+
+        TEST_BOOL (true, routine (buf, "main", counts));
+        TEST_I32 (10, counts[0]);
+        TEST_I32 (2, counts[1]);
+        TEST_I32 (1, counts[2]);
+
+        // the recursive call is counted once towards the inclusive count
+        TEST_BOOL (true, routine (buf, "f", counts));
+        TEST_I32 (7, counts[0]);
+        TEST_I32 (7, counts[1]);
+        TEST_I32 (2, counts[2]);
+        TEST_I32 (2, counts[3]);
+
+        // the SVC is a leaf which executes one instruction
+        TEST_BOOL (true, routine (buf, "SVC:HALT", counts));
+        TEST_I32 (1, counts[0]);
+        TEST_I32 (1, counts[1]);
+        TEST_I32 (1, counts[2]);
+    }
+
+    callgraph_free ();
+    args.callgraph_file = NULL;
+    symtable_clear ();
+}
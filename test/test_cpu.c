@@ -1,8 +1,38 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
 #include "common.h"
 #include "test.h"
 #include "util.h"
 #include "cpu.h"
 #include "instr.h"
+#include "plugin.h"
+#include "undo.h"
+#include "snapshot.h"
+#include "dirty.h"
+#include "args.h"
+
+
+/**
+ * A native SVC which doubles the variable whose address is the parameter.
+ */
+static int32_t svc_double (s_ckone* kone, const s_plugin_api* api) {
+    int32_t addr, value;
+    if (api->read_word (kone, kone->r[FP] - 2, &addr) &&
+        api->read_word (kone, addr, &value))
+        api->write_word (kone, addr, 2 * value);
+    return 1;
+}
+
+
+/**
+ * A native SVC which writes the numbers 1 to 200 from address 100 on.
+ */
+static int32_t svc_fill (s_ckone* kone, const s_plugin_api* api) {
+    for (int32_t i = 0; i < 200; i++)
+        api->write_word (kone, 100 + i, i + 1);
+    return 1;
+}
 
 
 void test_cpu () {
@@ -301,5 +331,216 @@ void test_cpu () {
         TEST_I32 (6, k.r[R6]);
         TEST_I32 (7, k.r[R7]);
     }
-}
 
+    BEGIN ("plugin svc") {
+        clear (&k);
+
+        s_plugin_svc svc = { 20, "DOUBLE", svc_double };
+        TEST_BOOL (true, plugin_register_svc (&svc));
+        TEST_BOOL (false, plugin_register_svc (&svc));
+        s_plugin_svc builtin = { 11, "HALT", svc_double };
+        TEST_BOOL (false, plugin_register_svc (&builtin));
+        builtin.num = 16;
+        TEST_BOOL (false, plugin_register_svc (&builtin));
+
+        mem[0] = 46137352;      // load sp, =stack
+        mem[1] = 868220935;     // push sp, =x
+        mem[2] = 1891631124;    // svc sp, =20
+        mem[3] = 1891631115;    // svc sp, =halt
+        mem[7] = 21;            // x dc 21
+        mem[8] = 0;             // stack ds 100 ...
+
+        cpu_step (&k);          // load sp, =stack
+        cpu_step (&k);          // push sp, =x
+        cpu_step (&k);          // svc sp, =20
+        TEST_I32 (42, mem[7]);
+        TEST_I32 (8, k.r[SP]);
+        TEST_I32 (0, k.sr);
+
+        plugin_unload_all ();
+    }
+
+    BEGIN ("timer interrupt") {
+        clear (&k);
+
+        mem[0] = 46137364;      // load sp, =stack
+        mem[1] = 35651590;      // load r1, =handler
+        mem[2] = 69206026;      // out r1, =ivec
+        mem[3] = 35651586;      // load r1, =2
+        mem[4] = 69206024;      // out r1, =timer
+        mem[5] = 536870917;     // loop jump loop
+        mem[6] = 37748835;      // handler load r2, =99
+        mem[20] = 0;            // stack ds 100 ...
+
+        for (int i = 0; i < 5; i++)
+            cpu_step (&k);
+        TEST_I32 (2, k.timer_period);
+        TEST_I32 (1, k.timer_left);
+        TEST_BITSCLR (k.sr, SR_I | SR_D);
+
+        cpu_step (&k);          // jump loop, interrupt
+        TEST_I32 (6, k.pc);
+        TEST_I32 (5, mem[21]);
+        TEST_I32 (22, k.r[FP]);
+        TEST_BITSSET (k.sr, SR_D);
+        TEST_BITSCLR (k.sr, SR_I);
+
+        cpu_step (&k);          // handler load r2, =99
+        TEST_I32 (99, k.r[R2]);
+        cpu_step (&k);          // nop, timer expires again
+        TEST_BITSSET (k.sr, SR_I | SR_D);
+        TEST_I32 (8, k.pc);
+    }
+
+    BEGIN ("undo") {
+        clear (&k);
+        args.undo_size = MIN_UNDO_SIZE;
+        undo_init (args.undo_size);
+
+        mem[0] = 35651589;      // load r1, =5
+        mem[1] = 18874398;      // store r1, 30
+        mem[2] = 287309825;     // add r1, =1
+        mem[3] = 18874398;      // store r1, 30
+        mem[30] = 0;
+
+        for (int i = 0; i < 4; i++)
+            cpu_step (&k);
+        TEST_I32 (6, mem[30]);
+        TEST_I32 (4, k.pc);
+
+        TEST_BOOL (true, undo_step (&k));
+        TEST_I32 (3, k.pc);
+        TEST_I32 (5, mem[30]);
+        TEST_I32 (6, k.r[R1]);
+
+        TEST_BOOL (true, undo_to_write (&k, 30));
+        TEST_I32 (1, k.pc);
+        TEST_I32 (0, mem[30]);
+        TEST_I32 (5, k.r[R1]);
+        TEST_I32 (1, (int32_t) undo_count ());
+
+        TEST_BOOL (true, undo_step (&k));
+        TEST_I32 (0, k.pc);
+        TEST_BOOL (false, undo_step (&k));
+
+        undo_free ();
+        args.undo_size = 0;
+    }
+
+    BEGIN ("undo overflow") {
+        // an instruction which writes more than the log holds
+        clear (&k);
+        args.undo_size = MIN_UNDO_SIZE;
+        undo_init (args.undo_size);
+        s_plugin_svc svc = { 21, "FILL", svc_fill };
+        TEST_BOOL (true, plugin_register_svc (&svc));
+
+        mem[0] = 46137384;      // load sp, =stack
+        mem[1] = 35651589;      // load r1, =5
+        mem[2] = 18874398;      // store r1, 30
+        mem[3] = 1891631125;    // svc sp, =21
+        mem[4] = 287309825;     // add r1, =1
+        mem[30] = 0;
+        mem[40] = 0;            // stack ds 50
+
+        for (int i = 0; i < 4; i++)
+            cpu_step (&k);
+        TEST_I32 (200, mem[299]);
+        TEST_I32 (0, (int32_t) undo_count ());
+        TEST_BOOL (false, undo_step (&k));
+        TEST_I32 (4, k.pc);
+
+        cpu_step (&k);          // add r1, =1
+        TEST_I32 (1, (int32_t) undo_count ());
+        TEST_BOOL (true, undo_step (&k));
+        TEST_I32 (4, k.pc);
+        TEST_I32 (5, k.r[R1]);
+        TEST_I32 (200, mem[299]);
+        TEST_BOOL (false, undo_step (&k));
+
+        plugin_unload_all ();
+        undo_free ();
+        args.undo_size = 0;
+    }
+
+    BEGIN ("snapshot") {
+        clear (&k);
+        char path[] = "/tmp/ckone_test_snapshot_XXXXXX";
+        int fd = mkstemp (path);
+        TEST_BOOL (true, fd >= 0);
+        close (fd);
+
+        mem[0] = 35651589;      // load r1, =5
+        mem[1] = 18874398;      // store r1, 30
+        mem[2] = 287309825;     // add r1, =1
+        mem[3] = 18874398;      // store r1, 30
+        mem[30] = 0;
+
+        cpu_step (&k);
+        cpu_step (&k);
+        TEST_BOOL (true, snapshot_save (&k, path));
+        cpu_step (&k);
+        cpu_step (&k);
+        TEST_I32 (6, mem[30]);
+
+        TEST_BOOL (true, snapshot_load (&k, path));
+        TEST_I32 (2, k.pc);
+        TEST_I32 (5, k.r[R1]);
+        TEST_I32 (5, mem[30]);
+        TEST_I32 (2, (int32_t) k.instr_count);
+        remove (path);
+    }
+
+    BEGIN ("delta snapshot") {
+        clear (&k);
+        char path[] = "/tmp/ckone_test_snapshot_XXXXXX";
+        char delta_path[64];
+        int fd = mkstemp (path);
+        TEST_BOOL (true, fd >= 0);
+        close (fd);
+        snprintf (delta_path, sizeof(delta_path), "%s.delta", path);
+        args.snapshot_interval = 1;
+        TEST_BOOL (true, dirty_init (&k));
+
+        mem[0] = 35651589;      // load r1, =5
+        mem[1] = 18874398;      // store r1, 30
+        mem[2] = 287309825;     // add r1, =1
+        mem[3] = 18874398;      // store r1, 30
+
+        cpu_step (&k);
+        cpu_step (&k);
+        TEST_BOOL (true, snapshot_checkpoint (&k, path));
+        TEST_BOOL (false, access (delta_path, F_OK) == 0);
+        cpu_step (&k);
+        cpu_step (&k);
+        TEST_BOOL (true, snapshot_checkpoint (&k, path));
+        TEST_BOOL (true, access (delta_path, F_OK) == 0);
+
+        k.pc = 0;
+        k.r[R1] = 0;
+        mem[30] = 0;
+        TEST_BOOL (true, snapshot_load (&k, path));
+        TEST_I32 (4, k.pc);
+        TEST_I32 (6, k.r[R1]);
+        TEST_I32 (6, mem[30]);
+        TEST_I32 (4, (int32_t) k.instr_count);
+
+        // a new full snapshot does not use the old delta
+        k.r[R1] = 7;
+        TEST_BOOL (true, snapshot_save (&k, path));
+        k.r[R1] = 0;
+        TEST_BOOL (true, snapshot_load (&k, path));
+        TEST_I32 (7, k.r[R1]);
+
+        // the MMU limits must fit in the memory without overflowing
+        k.mmu_base = INT32_MAX;
+        k.mmu_limit = 1;
+        TEST_BOOL (true, snapshot_save (&k, path));
+        TEST_BOOL (false, snapshot_load (&k, path));
+
+        remove (path);
+        remove (delta_path);
+        dirty_free ();
+        args.snapshot_interval = 0;
+    }
+}
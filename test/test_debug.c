@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "debug.h"
+#include "args.h"
+
+
+extern int ckone_run (s_ckone* kone);
+
+
+/**
+ * Run a program with ckone_run(), answering the pauses with the given input.
+ *
+ * @return The return value of ckone_run().
+ */
+static int run_with_input (s_ckone* kone, const char* input) {
+    char path[] = "/tmp/ckone_test_debug_XXXXXX";
+    int fd = mkstemp (path);
+    FILE* f = fd >= 0? fdopen (fd, "w") : NULL;
+    if (!f)
+        return -1;
+    fputs (input, f);
+    fclose (f);
+
+    bool ok = freopen (path, "r", stdin) != NULL;
+    remove (path);
+    int retval = ok? ckone_run (kone) : -1;
+    return freopen ("/dev/null", "r", stdin)? retval : -1;
+}
+
+
+/**
+ * Load the test program: 5 and 6 are stored to address 30.
+ */
+static void load_program (s_ckone* kone) {
+    clear (kone);
+    kone->mem[0] = 35651589;    // load r1, =5
+    kone->mem[1] = 18874398;    // store r1, 30
+    kone->mem[2] = 287309825;   // add r1, =1
+    kone->mem[3] = 18874398;    // store r1, 30
+    kone->mem[4] = 1891631115;  // svc sp, =halt
+}
+
+
+void test_debug () {
+    s_ckone k;
+    int32_t mem[64];
+    int32_t addr;
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+
+    // the dumps at the pauses
+    args.no_dump = true;
+    args.mem_cols = 8;
+
+
+    BEGIN ("breakpoints") {
+        load_program (&k);
+        char* breaks[] = { "0", "2" };
+        args.breaks[0] = breaks[0];
+        args.breaks[1] = breaks[1];
+        args.break_count = 2;
+        TEST_BOOL (true, debug_init (&k));
+
+        // the entry point is checked before any instruction is executed
+        TEST_I32 (DEBUG_BREAK, debug_check (&k, &addr));
+        TEST_I32 (0, addr);
+        cpu_step (&k);
+        TEST_I32 (DEBUG_NONE, debug_check (&k, &addr));
+        cpu_step (&k);
+        TEST_I32 (DEBUG_BREAK, debug_check (&k, &addr));
+        TEST_I32 (2, addr);
+
+        TEST_BOOL (true, debug_set_break (2, false));
+        TEST_I32 (DEBUG_NONE, debug_check (&k, &addr));
+        TEST_BOOL (false, debug_set_break (k.mmu_limit, true));
+        debug_free ();
+    }
+
+    BEGIN ("breakpoint at the entry point") {
+        // continue at the entry point, quit at the second breakpoint
+        load_program (&k);
+        TEST_BOOL (true, debug_init (&k));
+        TEST_I32 (EXIT_FAILURE, run_with_input (&k, "c\nq\n"));
+        TEST_I32 (2, (int32_t) k.instr_count);
+        TEST_I32 (5, mem[30]);
+
+        // continue at both breakpoints
+        load_program (&k);
+        TEST_I32 (EXIT_SUCCESS, run_with_input (&k, "c\nc\n"));
+        TEST_BOOL (true, k.halted);
+        TEST_I32 (6, mem[30]);
+        debug_free ();
+        args.break_count = 0;
+    }
+
+    BEGIN ("watchpoints") {
+        load_program (&k);
+        char* watches[] = { "30" };
+        args.watches[0] = watches[0];
+        args.watch_count = 1;
+        TEST_BOOL (true, debug_init (&k));
+
+        TEST_I32 (DEBUG_NONE, debug_check (&k, &addr));
+        cpu_step (&k);          // load r1, =5
+        TEST_I32 (DEBUG_NONE, debug_check (&k, &addr));
+        cpu_step (&k);          // store r1, 30
+        TEST_I32 (DEBUG_WATCH, debug_check (&k, &addr));
+        TEST_I32 (30, addr);
+        TEST_I32 (DEBUG_NONE, debug_check (&k, &addr));
+
+        // stop after each store, then quit
+        load_program (&k);
+        TEST_I32 (EXIT_FAILURE, run_with_input (&k, "c\nq\n"));
+        TEST_I32 (4, (int32_t) k.instr_count);
+        TEST_I32 (6, mem[30]);
+
+        TEST_BOOL (true, debug_set_watch (&k, 30, false));
+        load_program (&k);
+        TEST_I32 (EXIT_SUCCESS, run_with_input (&k, ""));
+        TEST_BOOL (true, k.halted);
+        debug_free ();
+        args.watch_count = 0;
+    }
+
+    args.no_dump = false;
+    args.mem_cols = 0;
+}
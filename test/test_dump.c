@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "instr.h"
+#include "args.h"
+#include "config.h"
+
+
+extern int ckone_run (s_ckone* kone);
+
+
+/**
+ * Run a program with ckone_run() and store the rows of the memory dump,
+ * which follow the line of dashes, in @p buf.
+ */
+static void run_dump (s_ckone* kone, char* buf, size_t size) {
+    FILE* out = tmpfile ();
+    buf[0] = '\0';
+    if (!out)
+        return;
+
+    fflush (stdout);
+    int saved = dup (STDOUT_FILENO);
+    dup2 (fileno (out), STDOUT_FILENO);
+    ckone_run (kone);
+    fflush (stdout);
+    dup2 (saved, STDOUT_FILENO);
+    close (saved);
+
+    char all[8192];
+    rewind (out);
+    all[fread (all, 1, sizeof(all) - 1, out)] = '\0';
+    fclose (out);
+
+    const char* rows = strstr (all, "-\n");
+    if (rows)
+        snprintf (buf, size, "%s", rows + 2);
+}
+
+
+/**
+ * Append a row of the memory dump, formatted with printf(), to @p buf.
+ */
+static void expect_row (s_ckone* kone, int32_t row, int base, char* buf, size_t size) {
+    size_t len = strlen (buf);
+    if (base == 10)
+        len += snprintf (buf + len, size - len, "%10d |", row);
+    else
+        len += snprintf (buf + len, size - len, "0x%08x |", (uint32_t) row);
+    for (int32_t i = row; i < row + args.mem_cols; i++) {
+        if (base == 10)
+            len += snprintf (buf + len, size - len, " %11d", kone->mem[i]);
+        else
+            len += snprintf (buf + len, size - len, "  0x%08x", (uint32_t) kone->mem[i]);
+    }
+    snprintf (buf + len, size - len, "\n");
+}
+
+
+/**
+ * Load the test program, which halts at once and leaves rows 8, 12 and
+ * 16 equal, and rows 24 and 28 equal.
+ */
+static void load_program (s_ckone* kone) {
+    clear (kone);
+    kone->mem[0] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    kone->mem[5] = -123456;
+    kone->mem[6] = INT32_MIN;
+    kone->mem[7] = INT32_MAX;
+    kone->r[SP] = kone->r[FP] = 20;
+}
+
+
+void test_dump () {
+    s_ckone k;
+    int32_t mem[32];
+    char buf[4096], expected[4096];
+    int base = DEFAULT_MEMDUMP_BASE;
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    args.mem_cols = 4;
+
+
+    BEGIN ("full dump") {
+        load_program (&k);
+        run_dump (&k, buf, sizeof(buf));
+        expected[0] = '\0';
+        for (int32_t row = 0; row < k.mem_size; row += 4)
+            expect_row (&k, row, base, expected, sizeof(expected));
+        strcat (expected, "\n");
+        TEST_STR (expected, buf);
+    }
+
+    BEGIN ("sparse dump") {
+        args.dump_sparse = true;
+        for (int i = 0; i < 2; i++) {
+            // both number bases
+            args.mem_swap_base = i;
+            int b = args.mem_swap_base? (base == 10? 16 : 10) : base;
+
+            load_program (&k);
+            run_dump (&k, buf, sizeof(buf));
+            expected[0] = '\0';
+            expect_row (&k, 0, b, expected, sizeof(expected));
+            expect_row (&k, 4, b, expected, sizeof(expected));
+            expect_row (&k, 8, b, expected, sizeof(expected));
+            strcat (expected, "*\n");
+            expect_row (&k, 20, b, expected, sizeof(expected));
+            expect_row (&k, 24, b, expected, sizeof(expected));
+
+            // the last row is shown even if it is equal to the one before
+            expect_row (&k, 28, b, expected, sizeof(expected));
+            strcat (expected, "\n");
+            TEST_STR (expected, buf);
+        }
+        args.mem_swap_base = false;
+        args.dump_sparse = false;
+    }
+
+    BEGIN ("binary dump") {
+        char path[] = "/tmp/ckone_test_dump_XXXXXX";
+        int fd = mkstemp (path);
+        TEST_BOOL (true, fd >= 0);
+        if (fd >= 0)
+            close (fd);
+
+        load_program (&k);
+        args.dump_binary = path;
+        run_dump (&k, buf, sizeof(buf));
+        args.dump_binary = NULL;
+        TEST_STR ("", buf);
+
+        unsigned char bytes[sizeof(mem) + 1];
+        FILE* f = fopen (path, "rb");
+        size_t len = 0;
+        if (f) {
+            len = fread (bytes, 1, sizeof(bytes), f);
+            fclose (f);
+        }
+        remove (path);
+
+        TEST_I32 (sizeof(mem), (int32_t) len);
+        TEST_I32 (0x0b, bytes[0]);
+        TEST_I32 (0xc0, bytes[20]);
+        TEST_I32 (0x1d, bytes[21]);
+        TEST_I32 (0xfe, bytes[22]);
+        TEST_I32 (0xff, bytes[23]);
+        TEST_I32 (0x00, bytes[24]);
+        TEST_I32 (0x80, bytes[27]);
+        TEST_I32 (0xff, bytes[28]);
+        TEST_I32 (0x7f, bytes[31]);
+        TEST_I32 (0x01, bytes[21 * 4]);
+    }
+
+    args.mem_cols = 0;
+}
@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "forksrv.h"
+#include "args.h"
+
+
+/**
+ * Write a number to a new temporary file.
+ */
+static void write_number (char* path, int n) {
+    int fd = mkstemp (path);
+    if (fd < 0)
+        return;
+    close (fd);
+    FILE* f = fopen (path, "w");
+    if (f) {
+        fprintf (f, "%d\n", n);
+        fclose (f);
+    }
+}
+
+
+/**
+ * Read a number from a file.
+ *
+ * @return The number, or -1 if there is none.
+ */
+static int read_number (const char* path) {
+    int n = -1;
+    FILE* f = fopen (path, "r");
+    if (f) {
+        if (fscanf (f, "%d", &n) != 1)
+            n = -1;
+        fclose (f);
+    }
+    return n;
+}
+
+
+/**
+ * Serve the requests written to a pipe given as the standard input, and
+ * store the lines the server wrote for them, without the process ids, in
+ * @p replies. Each child reads a number from KBD, writes its double to
+ * CRT and exits with the number.
+ */
+static void serve (const char* requests, char* replies, size_t size) {
+    int control[2];
+    FILE* out = tmpfile ();
+    replies[0] = '\0';
+    if (pipe (control) || !out)
+        return;
+    if (write (control[1], requests, strlen (requests)) < 0)
+        return;
+    close (control[1]);
+
+    fflush (stdout);
+    int saved_in = dup (STDIN_FILENO);
+    int saved_out = dup (STDOUT_FILENO);
+    dup2 (control[0], STDIN_FILENO);
+    dup2 (fileno (out), STDOUT_FILENO);
+    close (control[0]);
+    clearerr (stdin);
+
+    int retval;
+    args.fork_server = (char*) "-";
+    if (forksrv_run (&retval)) {
+        int n;
+        if (scanf ("%d", &n) != 1)
+            _exit (100);
+        printf ("%d\n", 2 * n);
+        fflush (stdout);
+        _exit (n);
+    }
+    args.fork_server = NULL;
+
+    fflush (stdout);
+    dup2 (saved_in, STDIN_FILENO);
+    dup2 (saved_out, STDOUT_FILENO);
+    close (saved_in);
+    close (saved_out);
+    clearerr (stdin);
+
+    // leave out the process ids
+    rewind (out);
+    char line[256];
+    while (fgets (line, sizeof(line), out)) {
+        char* s = strchr (line, ' ');
+        if (s && strlen (replies) + strlen (s) < size)
+            strcat (replies, s + 1);
+    }
+    fclose (out);
+}
+
+
+void test_forksrv () {
+    char kbd1[] = "/tmp/ckone_test_forksrv_XXXXXX";
+    char kbd2[] = "/tmp/ckone_test_forksrv_XXXXXX";
+    char crt1[] = "/tmp/ckone_test_forksrv_XXXXXX";
+    char crt2[] = "/tmp/ckone_test_forksrv_XXXXXX";
+    char requests[256], replies[256];
+
+    write_number (kbd1, 3);
+    write_number (kbd2, 4);
+    write_number (crt1, 0);
+    write_number (crt2, 0);
+
+
+    BEGIN ("two requests through a pipe") {
+        snprintf (requests, sizeof(requests), "%s %s\n%s %s\n", kbd1, crt1, kbd2, crt2);
+        serve (requests, replies, sizeof(replies));
+        TEST_STR ("exit 3\nexit 4\n", replies);
+        TEST_I32 (6, read_number (crt1));
+        TEST_I32 (8, read_number (crt2));
+    }
+
+    BEGIN ("KBD from the control pipe") {
+        snprintf (requests, sizeof(requests), "- %s\n%s %s\n", crt1, kbd2, crt2);
+        serve (requests, replies, sizeof(replies));
+        TEST_STR ("exit 1\nexit 4\n", replies);
+    }
+
+    remove (kbd1);
+    remove (kbd2);
+    remove (crt1);
+    remove (crt2);
+}
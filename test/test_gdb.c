@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <time.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "instr.h"
+#include "debug.h"
+#include "gdb.h"
+#include "args.h"
+
+
+/**
+ * Start the stub in a child process on the Unix socket @p path and
+ * connect to it.
+ *
+ * @return The connection, or -1 on error.
+ */
+static int start (s_ckone* kone, const char* path, pid_t* pid) {
+    args.gdb_socket = (char*) path;
+    fflush (stdout);
+    fflush (stderr);
+    *pid = fork ();
+    if (*pid < 0)
+        return -1;
+    if (*pid == 0)
+        _exit (gdb_run (kone));
+
+    struct sockaddr_un sun;
+    memset (&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, path);
+
+    // wait for the stub to listen
+    struct timespec pause = { 0, 10000000 };
+    for (int i = 0; i < 500; i++) {
+        int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && !connect (fd, (struct sockaddr*) &sun, sizeof(sun))) {
+            // don't hang if the stub stops answering
+            struct timeval timeout = { 5, 0 };
+            setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        if (fd >= 0)
+            close (fd);
+        nanosleep (&pause, NULL);
+    }
+    return -1;
+}
+
+
+/**
+ * Wait for the stub to end.
+ *
+ * @return Its exit status, or -1 if it did not exit normally.
+ */
+static int finish (int fd, pid_t pid) {
+    int status;
+    close (fd);
+    if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status))
+        return -1;
+    return WEXITSTATUS (status);
+}
+
+
+/**
+ * Read one byte from the stub.
+ *
+ * @return The byte, or -1 if the connection was closed.
+ */
+static int get_byte (int fd) {
+    unsigned char c;
+    return recv (fd, &c, 1, 0) == 1? c : -1;
+}
+
+
+/**
+ * Send a packet with the given checksum, or the right one if @p sum is
+ * negative.
+ *
+ * @return The acknowledgement of the stub.
+ */
+static int send_packet (int fd, const char* data, int sum) {
+    char buf[4096];
+    uint8_t s = 0;
+    for (const char* p = data; *p; p++)
+        s += (uint8_t) *p;
+    snprintf (buf, sizeof(buf), "$%s#%02x", data, sum < 0? s : sum);
+    if (send (fd, buf, strlen (buf), 0) < 0)
+        return -1;
+    return get_byte (fd);
+}
+
+
+/**
+ * Receive a packet and acknowledge it. The contents are stored in
+ * @p reply, or "bad checksum" if the checksum is wrong.
+ */
+static void get_packet (int fd, char* reply, size_t size) {
+    int c;
+    while ((c = get_byte (fd)) != '$')
+        if (c < 0) {
+            snprintf (reply, size, "closed");
+            return;
+        }
+
+    size_t len = 0;
+    uint8_t sum = 0;
+    while ((c = get_byte (fd)) >= 0 && c != '#') {
+        if (len < size - 1)
+            reply[len++] = c;
+        sum += c;
+    }
+    reply[len] = '\0';
+
+    char digits[3] = { 0, 0, 0 };
+    digits[0] = get_byte (fd);
+    digits[1] = get_byte (fd);
+    if (strtoul (digits, NULL, 16) != sum)
+        snprintf (reply, size, "bad checksum");
+    send (fd, "+", 1, 0);
+}
+
+
+/**
+ * Send a packet and receive the reply.
+ *
+ * @return The reply, in a static buffer.
+ */
+static const char* command (int fd, const char* data) {
+    static char reply[4096];
+    if (send_packet (fd, data, -1) != '+')
+        return "not acknowledged";
+    get_packet (fd, reply, sizeof(reply));
+    return reply;
+}
+
+
+void test_gdb () {
+    s_ckone k;
+    int32_t mem[64];
+    char path[] = "/tmp/ckone_test_gdb_XXXXXX";
+    char regs[128];
+    pid_t pid;
+
+    int tmp = mkstemp (path);
+    if (tmp < 0)
+        return;
+    close (tmp);
+    remove (path);
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    mem[0] = make_instr (LOAD, R1, IMMEDIATE, R0, 5);
+    mem[1] = make_instr (DIV, R1, IMMEDIATE, R0, 0);
+    mem[2] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    mem[33] = 0x12345678;
+    k.r[SP] = k.r[FP] = 40;
+    debug_init (&k);
+
+
+    BEGIN ("packets and registers") {
+        int fd = start (&k, path, &pid);
+        TEST_BOOL (true, fd >= 0);
+
+        // a packet with a wrong checksum is rejected, and the reply has
+        // a right one
+        TEST_I32 ('-', send_packet (fd, "g", 0));
+        TEST_STR ("000000000000000000000000000000000000000000000000"
+                "2800000028000000" "00000000" "00000000", command (fd, "g"));
+
+        TEST_STR ("28000000", command (fd, "p6"));
+        TEST_STR ("OK", command (fd, "P1=07000000"));
+        TEST_STR ("07000000", command (fd, "p1"));
+        TEST_STR ("E01", command (fd, "pa"));
+        TEST_STR ("E01", command (fd, "P1=07"));
+
+        strcpy (regs, command (fd, "g"));
+        memcpy (regs + 16, "ffffffff", 8);      // R2 = -1
+        char packet[128] = "G";
+        strcat (packet, regs);
+        TEST_STR ("OK", command (fd, packet));
+        TEST_STR ("ffffffff", command (fd, "p2"));
+        TEST_STR (regs, command (fd, "g"));
+        TEST_STR ("E01", command (fd, "G0000"));
+
+        TEST_STR ("closed", command (fd, "k"));
+        TEST_I32 (EXIT_FAILURE, finish (fd, pid));
+    }
+
+    BEGIN ("memory") {
+        int fd = start (&k, path, &pid);
+        TEST_BOOL (true, fd >= 0);
+
+        TEST_STR ("78563412", command (fd, "m84,4"));
+        TEST_STR ("3412", command (fd, "m86,2"));
+        TEST_STR ("OK", command (fd, "M85,2:aabb"));
+        TEST_STR ("78aabb12", command (fd, "m84,4"));
+        TEST_STR ("E02", command (fd, "m100,4"));
+        TEST_STR ("E01", command (fd, "m84"));
+        TEST_STR ("E01", command (fd, "M84,1:x"));
+
+        TEST_STR ("closed", command (fd, "k"));
+        TEST_I32 (EXIT_FAILURE, finish (fd, pid));
+    }
+
+    BEGIN ("breakpoints and faults") {
+        int fd = start (&k, path, &pid);
+        TEST_BOOL (true, fd >= 0);
+
+        TEST_STR ("OK", command (fd, "Z0,4,4"));
+        TEST_STR ("S05", command (fd, "c"));
+        TEST_STR ("01000000", command (fd, "p8"));
+        TEST_STR ("OK", command (fd, "z0,4,4"));
+        TEST_STR ("OK", command (fd, "Z2,84,4"));
+        TEST_STR ("OK", command (fd, "z2,84,4"));
+        TEST_STR ("", command (fd, "Z3,84,4"));
+
+        // the fault is reported until SR is cleared
+        TEST_STR ("S08", command (fd, "c"));
+        TEST_STR ("02000000", command (fd, "p8"));
+        TEST_STR ("S08", command (fd, "s"));
+        TEST_STR ("02000000", command (fd, "p8"));
+        TEST_STR ("S08", command (fd, "?"));
+        TEST_STR ("OK", command (fd, "P9=00000000"));
+        TEST_STR ("W00", command (fd, "c"));
+        TEST_I32 (EXIT_SUCCESS, finish (fd, pid));
+    }
+
+    BEGIN ("invalid port") {
+        args.gdb_socket = (char*) "70000";
+        TEST_I32 (EXIT_FAILURE, gdb_run (&k));
+        args.gdb_socket = (char*) "0";
+        TEST_I32 (EXIT_FAILURE, gdb_run (&k));
+    }
+
+    debug_free ();
+    args.gdb_socket = NULL;
+    remove (path);
+}
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "symtable.h"
+#include "args.h"
+#include "live.h"
+
+
+void test_live () {
+    s_ckone k;
+    int32_t mem[64];
+    s_live_metrics m;
+    char name[64];
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    symtable_insert ("loop", "3");
+    args.program = (char*) "test.b91";
+    snprintf (name, sizeof(name), "%s%d", LIVE_PREFIX, (int) getpid ());
+
+    TEST_BOOL (true, live_init (&k));
+
+    // map the segment like another process would, to hold the lock
+    s_live_metrics* segment = MAP_FAILED;
+    char path[80];
+    snprintf (path, sizeof(path), "/%s", name);
+    int fd = shm_open (path, O_RDWR, 0);
+    if (fd >= 0) {
+        segment = mmap (NULL, sizeof(s_live_metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close (fd);
+    }
+    TEST_BOOL (true, segment != MAP_FAILED);
+
+
+    BEGIN ("publish") {
+        TEST_BOOL (true, live_read (name, &m));
+        TEST_I32 ((int32_t) getpid (), m.pid);
+        TEST_I32 (LIVE_RUNNING, m.state);
+        TEST_I32 (0, (int32_t) m.instructions);
+        TEST_STR ("test.b91", m.program);
+
+        k.instr_count = 1000;
+        k.pc = 3;
+        live_update (&k);
+        live_io (&k);
+        live_io (&k);
+        k.instr_count = 1500;
+        k.pc = 4;
+        live_fault (&k);
+
+        TEST_BOOL (true, live_read (name, &m));
+        TEST_I32 (1500, (int32_t) m.instructions);
+        TEST_I32 (4, m.pc);
+        TEST_STR ("loop+1", m.symbol);
+        TEST_I32 (2, (int32_t) m.io);
+        TEST_I32 (1000, (int32_t) m.io_instructions);
+        TEST_I32 (1, (int32_t) m.faults);
+        TEST_I32 (0, (int32_t) (m.seq & 1));
+    }
+
+    BEGIN ("sequence lock") {
+        if (segment != MAP_FAILED) {
+            // an update in progress is never read
+            segment->seq++;
+            TEST_BOOL (false, live_read (name, &m));
+            segment->seq++;
+            TEST_BOOL (true, live_read (name, &m));
+        }
+        TEST_BOOL (false, live_read ("ckone-live.none", &m));
+    }
+
+    BEGIN ("close") {
+        k.halted = true;
+        live_close (&k);
+        TEST_BOOL (false, live_read (name, &m));
+        if (segment != MAP_FAILED)
+            TEST_I32 (LIVE_HALTED, segment->state);
+    }
+
+    if (segment != MAP_FAILED)
+        munmap (segment, sizeof(s_live_metrics));
+    args.program = NULL;
+    symtable_clear ();
+}
@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "args.h"
+
+
+/**
+ * The file which replaces stderr while the messages are captured.
+ */
+static FILE* captured;
+
+/**
+ * The file descriptor of the real stderr while the messages are captured.
+ */
+static int saved_stderr;
+
+/**
+ * The messages written while captured.
+ */
+static char output[1024];
+
+
+/**
+ * Start capturing what is written to stderr.
+ */
+static void begin_capture () {
+    fflush (stderr);
+    captured = tmpfile ();
+    saved_stderr = dup (STDERR_FILENO);
+    dup2 (fileno (captured), STDERR_FILENO);
+}
+
+
+/**
+ * Stop capturing, once the writer thread has written the messages.
+ *
+ * @return The messages written.
+ */
+static const char* end_capture () {
+    log_flush ();
+    dup2 (saved_stderr, STDERR_FILENO);
+    close (saved_stderr);
+
+    rewind (captured);
+    size_t n = fread (output, 1, sizeof(output) - 1, captured);
+    output[n] = '\0';
+    fclose (captured);
+    return output;
+}
+
+
+void test_log () {
+    char longer[201];
+    memset (longer, 'x', sizeof(longer) - 1);
+    longer[sizeof(longer) - 1] = '\0';
+
+    char expected[256];
+
+    TEST_BOOL (true, log_init ());
+
+    BEGIN ("records") {
+        begin_capture ();
+        wlog (LOG_ERROR, "%d %u %05x %c %.2f %s%%\n", -1, 7u, 0xab, 'z', 0.5, "str");
+        wlog (LOG_ERROR, "%lld %hhd %s\n", -5000000000LL, 300, (char*) NULL);
+        TEST_STR ("-1 7 000ab z 0.50 str%\n-5000000000 44 (null)\n", end_capture ());
+    }
+
+    BEGIN ("several strings") {
+        begin_capture ();
+        wlog (LOG_ERROR, "%s-%s-%s-%5s\n", "a", "bc", "", "d");
+        TEST_STR ("a-bc--    d\n", end_capture ());
+    }
+
+    BEGIN ("truncated strings") {
+        // the first string fills the text, the second gets no space
+        begin_capture ();
+        wlog (LOG_ERROR, "%s|%s|%d\n", longer, "after", 42);
+        snprintf (expected, sizeof(expected), "%.127s||42\n", longer);
+        TEST_STR (expected, end_capture ());
+
+        // the second string gets the space left after the first
+        begin_capture ();
+        wlog (LOG_ERROR, "%s|%s|%s\n", longer + 100, longer, "end");
+        snprintf (expected, sizeof(expected), "%.100s|%.26s|\n", longer, longer);
+        TEST_STR (expected, end_capture ());
+    }
+
+    BEGIN ("unsupported formats") {
+        // formatted into the text of the record
+        begin_capture ();
+        wlog (LOG_ERROR, "%*d|%s\n", 4, 7, "s");
+        TEST_STR ("   7|s\n", end_capture ());
+    }
+
+    log_close ();
+}
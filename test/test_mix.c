@@ -0,0 +1,104 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "instr.h"
+#include "mix.h"
+
+
+/**
+ * Load the test program: a loop which stores 5, 6 and 7 to address
+ * 30, then stores -3 to address 31 and halts.
+ */
+static void load_program (s_ckone* kone) {
+    clear (kone);
+    kone->mem[0] = make_instr (LOAD, R1, IMMEDIATE, R0, 5);
+    kone->mem[1] = make_instr (STORE, R1, IMMEDIATE, R0, 30);
+    kone->mem[2] = make_instr (ADD, R1, IMMEDIATE, R0, 1);
+    kone->mem[3] = make_instr (COMP, R1, IMMEDIATE, R0, 8);
+    kone->mem[4] = make_instr (JLES, R0, IMMEDIATE, R0, 1);
+    kone->mem[5] = make_instr (LOAD, R2, DIRECT, R0, 30);
+    kone->mem[6] = make_instr (STORE, R2, IMMEDIATE, R0, 31);
+    kone->mem[7] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    kone->r[SP] = kone->r[FP] = 40;
+}
+
+
+void test_mix () {
+    s_ckone k;
+    int32_t mem[64];
+    s_mix mix;
+    char buf[1024];
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+
+
+    BEGIN ("mix_get") {
+        load_program (&k);
+        TEST_BOOL (true, mix_init (&k));
+        while (!k.halted && cpu_step (&k))
+            ;
+        mix_get (&k, &mix);
+        mix_free (&k);
+
+        TEST_I32 (16, (int32_t) mix.instructions);
+        TEST_I32 (2, (int32_t) mix.opcodes[LOAD]);
+        TEST_I32 (4, (int32_t) mix.opcodes[STORE]);
+        TEST_I32 (3, (int32_t) mix.opcodes[ADD]);
+        TEST_I32 (3, (int32_t) mix.opcodes[JLES]);
+        TEST_I32 (1, (int32_t) mix.opcodes[SVC]);
+        TEST_I32 (15, (int32_t) mix.modes[IMMEDIATE]);
+        TEST_I32 (1, (int32_t) mix.modes[DIRECT]);
+        TEST_I32 (2, (int32_t) mix.taken[JLES]);
+        TEST_I32 (1, (int32_t) mix.not_taken[JLES]);
+        TEST_I32 (1, (int32_t) mix.svcs[11]);
+        TEST_I32 (0, (int32_t) mix.faults[0]);
+    }
+
+    BEGIN ("separate machines") {
+        load_program (&k);
+        TEST_BOOL (true, mix_init (&k));
+        cpu_step (&k);
+
+        s_ckone other = k;
+        TEST_BOOL (true, mix_init (&other));
+        cpu_step (&other);
+        cpu_step (&other);
+
+        mix_get (&k, &mix);
+        TEST_I32 (1, (int32_t) mix.opcodes[LOAD]);
+        TEST_I32 (0, (int32_t) mix.opcodes[STORE]);
+        mix_get (&other, &mix);
+        TEST_I32 (0, (int32_t) mix.opcodes[LOAD]);
+        TEST_I32 (1, (int32_t) mix.opcodes[STORE]);
+        TEST_I32 (1, (int32_t) mix.opcodes[ADD]);
+        mix_free (&other);
+        mix_free (&k);
+    }
+
+    BEGIN ("mix_json") {
+        load_program (&k);
+        k.mem[3] = make_instr (DIV, R1, IMMEDIATE, R0, 0);
+        TEST_BOOL (true, mix_init (&k));
+        while (!k.halted && cpu_step (&k))
+            ;
+
+        FILE* f = tmpfile ();
+        if (f) {
+            mix_json (&k, f);
+            rewind (f);
+            buf[fread (buf, 1, sizeof(buf) - 1, f)] = '\0';
+            fclose (f);
+        }
+        mix_free (&k);
+
+        TEST_STR ("{\"instructions\": 4,\n"
+                " \"opcodes\": {\"STORE\": 1, \"LOAD\": 1, \"ADD\": 1, \"DIV\": 1},\n"
+                " \"modes\": {\"immediate\": 4, \"direct\": 0, \"indirect\": 0},\n"
+                " \"jumps\": {},\n"
+                " \"memory\": {\"reads\": 4, \"writes\": 1},\n"
+                " \"svcs\": {},\n"
+                " \"faults\": {\"O\": 0, \"Z\": 1, \"U\": 0, \"M\": 0}}\n", buf);
+    }
+}
@@ -1,7 +1,11 @@
+#include <unistd.h>
 #include "common.h"
 #include "test.h"
 #include "util.h"
 #include "mmu.h"
+#include "image.h"
+#include "dirty.h"
+#include "args.h"
 
 
 void test_mmu () {
@@ -43,5 +47,60 @@ void test_mmu () {
         mmu_write (&k);
         TEST (int32_t, "%u", 42, k.mem[1]);
     }
-}
+    {
+        // two machines mapped from the same image
+        int32_t* mem1 = malloc (4096 * sizeof(int32_t));
+        s_ckone k1, k2;
+        memset (&k1, 0, sizeof(k1));
+        memset (mem1, 0, 4096 * sizeof(int32_t));
+        k1.mem = mem1;
+        k1.mem_size = k1.mmu_limit = 4096;
+        k1.mem[4000] = 1337;
+
+        int image = image_create (&k1);
+        TEST_BOOL (true, image >= 0);
+        k2 = k1;
+        k2.mem = NULL;
+        TEST_BOOL (true, image_map (&k1, image));
+        TEST_BOOL (true, image_map (&k2, image));
+        close (image);
 
+        TEST_I32 (1337, k1.mem[4000]);
+        k1.mar = 4000;
+        k1.mbr = 42;
+        mmu_write (&k1);
+        TEST_I32 (42, k1.mem[4000]);
+        TEST_I32 (1337, k2.mem[4000]);
+        TEST_I32 (0, k2.mem[0]);
+
+        image_unmap (&k1);
+        image_unmap (&k2);
+    }
+    {
+        // dirty pages
+        int32_t big[4 * DIRTY_PAGE_WORDS];
+        s_ckone k1;
+        k1.mem = big;
+        k1.mem_size = 4 * DIRTY_PAGE_WORDS;
+        clear (&k1);
+        args.dump_changes = true;
+        TEST_BOOL (true, dirty_init (&k1));
+
+        uint32_t epoch = dirty_clear ();
+        k1.mar = 2 * DIRTY_PAGE_WORDS + 1;
+        k1.mbr = 7;
+        mmu_write (&k1);
+        TEST_BOOL (true, dirty_page (2, epoch));
+        TEST_BOOL (false, dirty_page (1, epoch));
+        TEST_BOOL (true, dirty_range (0, 3 * DIRTY_PAGE_WORDS, epoch));
+        TEST_BOOL (false, dirty_range (0, 2 * DIRTY_PAGE_WORDS, epoch));
+        TEST_I32 (1, dirty_count (epoch));
+
+        uint32_t later = dirty_clear ();
+        TEST_BOOL (false, dirty_page (2, later));
+        TEST_BOOL (true, dirty_page (2, epoch));
+
+        dirty_free ();
+        args.dump_changes = false;
+    }
+}
@@ -0,0 +1,141 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "instr.h"
+#include "prof.h"
+#include "symtable.h"
+#include "args.h"
+
+
+/**
+ * Find the line of an address, a routine or an opcode in a section
+ * of the profile, and read its counts.
+ *
+ * @param report The profile.
+ * @param section The title of the section, e.g. "Hot spots:".
+ * @param name The address, routine or opcode which starts the last
+ *             column of the line.
+ * @param counts Where to store the executions, and for addresses and
+ *               routines the data reads and writes.
+ * @return False if there is no such line.
+ */
+static bool find (const char* report, const char* section, const char* name,
+        int32_t counts[3]) {
+    const char* line = strstr (report, section);
+    if (!line)
+        return false;
+
+    while ((line = strchr (line, '\n')) && line[1] != '\n') {
+        line++;
+        unsigned long long execs, reads, writes;
+        int column;
+        if (sscanf (line, "%llu %*f%% %llu %llu %n", &execs, &reads, &writes, &column) == 3
+                && !strncmp (line + column, name, strlen (name))
+                && strchr (" \n", line[column + strlen (name)])) {
+            counts[0] = (int32_t) execs;
+            counts[1] = (int32_t) reads;
+            counts[2] = (int32_t) writes;
+            return true;
+        }
+        if (sscanf (line, "%llu %*f%% %n", &execs, &column) == 1
+                && !strncmp (line + column, name, strlen (name))
+                && line[column + strlen (name)] == '\n') {
+            counts[0] = (int32_t) execs;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void test_prof () {
+    s_ckone k;
+    int32_t mem[64];
+    static char buf[8192];
+    int32_t counts[3];
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    symtable_insert ("main", "0");
+    symtable_insert ("done", "5");
+
+    // a loop which stores 5, 6 and 7 to address 30, then copies the
+    // last value to address 31
+    mem[0] = make_instr (LOAD, R1, IMMEDIATE, R0, 5);
+    mem[1] = make_instr (STORE, R1, IMMEDIATE, R0, 30);
+    mem[2] = make_instr (ADD, R1, IMMEDIATE, R0, 1);
+    mem[3] = make_instr (COMP, R1, IMMEDIATE, R0, 8);
+    mem[4] = make_instr (JLES, R0, IMMEDIATE, R0, 1);
+    mem[5] = make_instr (LOAD, R2, DIRECT, R0, 30);
+    mem[6] = make_instr (STORE, R2, IMMEDIATE, R0, 31);
+    mem[7] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    k.r[SP] = k.r[FP] = 40;
+
+    args.profile = true;
+    TEST_BOOL (true, prof_init (&k));
+    while (!k.halted && cpu_step (&k))
+        ;
+    args.profile = false;
+
+    FILE* f = tmpfile ();
+    buf[0] = '\0';
+    if (f) {
+        prof_report (&k, f);
+        rewind (f);
+        buf[fread (buf, 1, sizeof(buf) - 1, f)] = '\0';
+        fclose (f);
+    }
+
+
+    BEGIN ("counts per address") {
+        const char* summary = "Profile: 16 instructions executed at 8 addresses\n";
+        TEST_BOOL (true, !strncmp (buf, summary, strlen (summary)));
+        TEST_BOOL (true, find (buf, "Hot spots:", "main+1", counts));
+        TEST_I32 (3, counts[0]);
+        TEST_I32 (0, counts[1]);
+        TEST_I32 (3, counts[2]);
+        TEST_BOOL (true, find (buf, "Hot spots:", "main", counts));
+        TEST_I32 (1, counts[0]);
+        TEST_I32 (0, counts[2]);
+        TEST_BOOL (true, find (buf, "Hot spots:", "done", counts));
+        TEST_I32 (1, counts[0]);
+        TEST_I32 (1, counts[1]);
+        TEST_I32 (0, counts[2]);
+        TEST_BOOL (true, find (buf, "Hot spots:", "done+1", counts));
+        TEST_I32 (1, counts[0]);
+        TEST_I32 (0, counts[1]);
+        TEST_I32 (1, counts[2]);
+
+        // the SVC pushes PC and FP
+        TEST_BOOL (true, find (buf, "Hot spots:", "done+2", counts));
+        TEST_I32 (2, counts[2]);
+    }
+
+    BEGIN ("counts per routine") {
+        TEST_BOOL (true, find (buf, "Routines:", "main", counts));
+        TEST_I32 (13, counts[0]);
+        TEST_I32 (0, counts[1]);
+        TEST_I32 (3, counts[2]);
+        TEST_BOOL (true, find (buf, "Routines:", "done", counts));
+        TEST_I32 (3, counts[0]);
+        TEST_I32 (1, counts[1]);
+        TEST_I32 (3, counts[2]);
+    }
+
+    BEGIN ("counts per opcode") {
+        TEST_BOOL (true, find (buf, "Opcodes:", "LOAD", counts));
+        TEST_I32 (2, counts[0]);
+        TEST_BOOL (true, find (buf, "Opcodes:", "STORE", counts));
+        TEST_I32 (4, counts[0]);
+        TEST_BOOL (true, find (buf, "Opcodes:", "JLES", counts));
+        TEST_I32 (3, counts[0]);
+        TEST_BOOL (true, find (buf, "Opcodes:", "SVC", counts));
+        TEST_I32 (1, counts[0]);
+        TEST_BOOL (false, find (buf, "Opcodes:", "SUB", counts));
+    }
+
+    prof_free ();
+    symtable_clear ();
+}
@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "ext.h"
+#include "instr.h"
+#include "replay.h"
+#include "args.h"
+
+
+/**
+ * Load the test program: read @p reads values from KBD, store their sum
+ * to address 30, write it to CRT and halt.
+ */
+static void load_program (s_ckone* kone, int reads) {
+    int32_t a = 0;
+    clear (kone);
+    kone->mem[a++] = make_instr (LOAD, R1, IMMEDIATE, R0, 0);
+    for (int i = 0; i < reads; i++) {
+        kone->mem[a++] = make_instr (IN, R2, IMMEDIATE, R0, 1);
+        kone->mem[a++] = make_instr (ADD, R1, IMMEDIATE, R2, 0);
+    }
+    kone->mem[a++] = make_instr (STORE, R1, IMMEDIATE, R0, 30);
+    kone->mem[a++] = make_instr (OUT, R1, IMMEDIATE, R0, 0);
+    kone->mem[a++] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    kone->r[SP] = kone->r[FP] = 40;
+}
+
+
+/**
+ * Run a program with the given input for KBD.
+ *
+ * @return True if the program halted.
+ */
+static bool run (s_ckone* kone, const char* input, char* output, size_t output_size) {
+    char buf[64];
+    snprintf (buf, sizeof(buf), "%s", input);
+    FILE* kbd = fmemopen (buf, strlen (buf), "r");
+    FILE* crt = tmpfile ();
+    if (!kbd || !crt)
+        return false;
+
+    ext_init_devices ();
+    ext_attach_console (kbd, crt);
+    while (!kone->halted && cpu_step (kone))
+        ;
+    ext_close_devices ();
+
+    rewind (crt);
+    size_t n = fread (output, 1, output_size - 1, crt);
+    output[n] = '\0';
+    fclose (crt);
+    fclose (kbd);
+    return kone->halted;
+}
+
+
+void test_replay () {
+    s_ckone k;
+    int32_t mem[64];
+    int32_t value;
+    char output[64];
+    char path[] = "/tmp/ckone_test_replay_XXXXXX";
+    int fd = mkstemp (path);
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    if (fd < 0)
+        return;
+    close (fd);
+
+    char* stdin_file = args.stdin_file;
+    char* stdout_file = args.stdout_file;
+    args.stdin_file = args.stdout_file = "/dev/null";
+
+
+    BEGIN ("record and replay a run") {
+        args.record_file = path;
+        TEST_BOOL (true, replay_open (path, false));
+        load_program (&k, 2);
+        TEST_BOOL (true, run (&k, "4\n9\n", output, sizeof(output)));
+        replay_close ();
+        args.record_file = NULL;
+        TEST_I32 (13, mem[30]);
+        TEST_STR ("13\n", output);
+
+        // the values come from the log, not from KBD
+        args.replay_file = path;
+        TEST_BOOL (true, replay_open (path, true));
+        load_program (&k, 2);
+        TEST_BOOL (true, run (&k, "100\n200\n", output, sizeof(output)));
+        replay_close ();
+        TEST_I32 (13, mem[30]);
+        TEST_STR ("13\n", output);
+
+        // a program which reads more than was recorded stops
+        TEST_BOOL (true, replay_open (path, true));
+        load_program (&k, 3);
+        TEST_BOOL (false, run (&k, "1\n2\n3\n", output, sizeof(output)));
+        replay_close ();
+        TEST_I32 (0, mem[30]);
+        args.replay_file = NULL;
+    }
+
+    BEGIN ("replay log records") {
+        struct tm t, r;
+        memset (&t, 0, sizeof(t));
+        t.tm_sec = 56;
+        t.tm_min = 34;
+        t.tm_hour = 12;
+        t.tm_mday = 18;
+        t.tm_mon = 9;
+        t.tm_year = 126;
+
+        TEST_BOOL (true, replay_open (path, false));
+        replay_record_input (1, -42);
+        replay_record_time (&t);
+        replay_record_input (2, 7);
+        replay_close ();
+
+        TEST_BOOL (true, replay_open (path, true));
+        TEST_BOOL (true, replay_input (1, &value));
+        TEST_I32 (-42, value);
+        TEST_BOOL (true, replay_time (&r));
+        TEST_I32 (56, r.tm_sec);
+        TEST_I32 (34, r.tm_min);
+        TEST_I32 (12, r.tm_hour);
+        TEST_I32 (18, r.tm_mday);
+        TEST_I32 (9, r.tm_mon);
+        TEST_I32 (126, r.tm_year);
+
+        // another device, another kind of record, the end of the log
+        TEST_BOOL (false, replay_input (1, &value));
+        replay_close ();
+        TEST_BOOL (true, replay_open (path, true));
+        TEST_BOOL (false, replay_time (&r));
+        replay_close ();
+        TEST_BOOL (true, replay_open (path, true));
+        TEST_BOOL (true, replay_input (1, &value));
+        TEST_BOOL (true, replay_time (&r));
+        TEST_BOOL (true, replay_input (2, &value));
+        TEST_I32 (7, value);
+        TEST_BOOL (false, replay_input (2, &value));
+        replay_close ();
+
+        // not a replay log
+        FILE* f = fopen (path, "wb");
+        fputs ("CKTRACE1", f);
+        fclose (f);
+        TEST_BOOL (false, replay_open (path, true));
+    }
+
+    remove (path);
+    args.stdin_file = stdin_file;
+    args.stdout_file = stdout_file;
+}
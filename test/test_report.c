@@ -0,0 +1,134 @@
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "report.h"
+#include "symtable.h"
+#include "args.h"
+
+
+/**
+ * Resolve the report items of one --report option.
+ *
+ * @return The return value of report_init().
+ */
+static bool init (s_ckone* kone, const char* items) {
+    args.reports[0] = (char*) items;
+    args.report_count = 1;
+    return report_init (kone);
+}
+
+
+/**
+ * Write a report to a temporary file and read it back.
+ *
+ * @return The number of bytes read.
+ */
+static size_t write_report (s_ckone* kone, void (*write) (s_ckone*, FILE*),
+        char* buf, size_t size) {
+    FILE* f = tmpfile ();
+    if (!f)
+        return 0;
+    write (kone, f);
+    rewind (f);
+    size_t n = fread (buf, 1, size - 1, f);
+    buf[n] = '\0';
+    fclose (f);
+    return n;
+}
+
+
+/**
+ * Read a 32-bit little-endian integer.
+ *
+ * @return The number.
+ */
+static int32_t le32 (const char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t) (uint8_t) p[i] << (8 * i);
+    return (int32_t) value;
+}
+
+
+void test_report () {
+    s_ckone k;
+    int32_t mem[64];
+    char buf[512];
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    k.r[1] = 7;
+    k.r[SP] = 20;
+    k.pc = 3;
+    k.mem[5] = -1;
+    k.mem[30] = 11;
+    k.mem[40] = 1;
+    k.mem[41] = 2;
+    k.mem[42] = 3;
+    k.instr_count = 12;
+    k.halted = true;
+    symtable_insert ("x", "30");
+    symtable_insert ("arr", "40");
+
+
+    BEGIN ("JSON report") {
+        TEST_BOOL (true, init (&k, "r1,sp,pc,x,5,arr..42"));
+        write_report (&k, report_json, buf, sizeof(buf));
+        TEST_STR ("{\"status\": \"halted\", \"instructions\": 12,\n"
+                " \"registers\": {\"r1\": 7, \"sp\": 20, \"pc\": 3},\n"
+                " \"symbols\": {\"x\": 11, \"5\": -1},\n"
+                " \"memory\": [{\"start\": 40, \"values\": [1, 2, 3]}]}\n", buf);
+        report_free ();
+
+        k.halted = false;
+        TEST_BOOL (true, init (&k, "X,30,41..41"));
+        write_report (&k, report_json, buf, sizeof(buf));
+        TEST_STR ("{\"status\": \"fault\", \"instructions\": 12,\n"
+                " \"registers\": {},\n"
+                " \"symbols\": {\"X\": 11, \"30\": 11},\n"
+                " \"memory\": [{\"start\": 41, \"values\": [2]}]}\n", buf);
+        report_free ();
+        k.halted = true;
+    }
+
+    BEGIN ("binary report") {
+        // the count, the status and the items in the order given
+        TEST_BOOL (true, init (&k, "x,r1,40..42,pc"));
+        TEST_I32 (4 * 9, (int32_t) write_report (&k, report_binary, buf, sizeof(buf)));
+        TEST_I32 (12, le32 (buf));
+        TEST_I32 (0, le32 (buf + 4));
+        TEST_I32 (0, le32 (buf + 8));
+        TEST_I32 (11, le32 (buf + 12));
+        TEST_I32 (7, le32 (buf + 16));
+        TEST_I32 (1, le32 (buf + 20));
+        TEST_I32 (2, le32 (buf + 24));
+        TEST_I32 (3, le32 (buf + 28));
+        TEST_I32 (3, le32 (buf + 32));
+
+        k.halted = false;
+        k.instr_count = 0x100000005ull;
+        write_report (&k, report_binary, buf, sizeof(buf));
+        TEST_I32 (5, le32 (buf));
+        TEST_I32 (1, le32 (buf + 4));
+        TEST_I32 (1, le32 (buf + 8));
+        report_free ();
+        k.halted = true;
+        k.instr_count = 12;
+    }
+
+    BEGIN ("invalid report items") {
+        const char* invalid[] = {
+            "r8", "y", "x..y",                      // unknown
+            "-1", "64", "0..64", "5..4",            // outside the memory or empty
+            "r1,r1", "x,x", "40..42,40..42",        // given twice
+        };
+        for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++) {
+            TEST_BOOL (false, init (&k, invalid[i]));
+            report_free ();
+        }
+    }
+
+    args.report_count = 0;
+    symtable_clear ();
+}
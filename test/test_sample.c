@@ -0,0 +1,102 @@
+#include <signal.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "sample.h"
+#include "symtable.h"
+
+
+/**
+ * Read the samples of a routine from the report.
+ *
+ * @param kone The state structure.
+ * @param name The name of the routine.
+ * @param self Where to store the samples in the routine.
+ * @return The samples in which the routine was executing or a caller,
+ *         or -1 if the routine is not reported.
+ */
+static int32_t samples (s_ckone* kone, const char* name, int32_t* self) {
+    FILE* f = tmpfile ();
+    char line[256];
+    int32_t total = -1;
+
+    if (!f)
+        return -1;
+    sample_report (kone, f);
+    rewind (f);
+    while (fgets (line, sizeof(line), f)) {
+        unsigned long long s, t;
+        char routine[64];
+        if (sscanf (line, "%llu %*f%% %llu %*f%% %63s", &s, &t, routine) == 3
+                && !strcmp (routine, name)) {
+            *self = (int32_t) s;
+            total = (int32_t) t;
+        }
+    }
+    fclose (f);
+    return total;
+}
+
+
+void test_sample () {
+    s_ckone k;
+    int32_t mem[64];
+    int32_t self;
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    clear (&k);
+    symtable_insert ("main", "0");
+    symtable_insert ("f", "10");
+    symtable_insert ("g", "20");
+
+    // main calls f, which calls g, which calls itself
+    mem[40] = 40;           // the frame of main
+    mem[41] = 5;            // the return address in main
+    mem[42] = 40;           // the frame of f
+    mem[43] = 15;           // the return address in f
+    mem[44] = 42;           // the frame of g
+    mem[45] = 25;           // the return address in g
+    mem[46] = 44;           // the frame of the recursive call of g
+
+
+    BEGIN ("frame walk") {
+        TEST_BOOL (true, sample_init (&k));
+        TEST_BOOL (true, sample_start (&k, 1000000));
+
+        k.pc = 22;
+        k.r[FP] = 46;
+        raise (SIGPROF);
+        k.pc = 12;
+        k.r[FP] = 42;
+        raise (SIGPROF);
+        sample_stop ();
+
+        TEST_I32 (1, samples (&k, "g", &self));
+        TEST_I32 (1, self);
+        TEST_I32 (2, samples (&k, "f", &self));
+        TEST_I32 (1, self);
+        TEST_I32 (2, samples (&k, "main", &self));
+        TEST_I32 (0, self);
+        sample_free ();
+    }
+
+    BEGIN ("broken frame chain") {
+        TEST_BOOL (true, sample_init (&k));
+        TEST_BOOL (true, sample_start (&k, 1000000));
+
+        // a caller frame which is not below the frame ends the walk
+        mem[46] = 1000;
+        k.pc = 22;
+        k.r[FP] = 46;
+        raise (SIGPROF);
+        sample_stop ();
+
+        TEST_I32 (1, samples (&k, "g", &self));
+        TEST_I32 (-1, samples (&k, "f", &self));
+        TEST_I32 (-1, samples (&k, "main", &self));
+        sample_free ();
+    }
+
+    symtable_clear ();
+}
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <time.h>
+#include "common.h"
+#include "test.h"
+#include "instr.h"
+#include "serve.h"
+#include "args.h"
+
+
+/**
+ * Connect to the daemon on the Unix socket @p path, waiting for it to
+ * listen.
+ *
+ * @return The connection, or -1 on error.
+ */
+static int connect_to (const char* path) {
+    struct sockaddr_un sun;
+    memset (&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, path);
+
+    struct timespec pause = { 0, 10000000 };
+    for (int i = 0; i < 500; i++) {
+        int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && !connect (fd, (struct sockaddr*) &sun, sizeof(sun))) {
+            // don't hang if the daemon stops answering
+            struct timeval timeout = { 5, 0 };
+            setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        if (fd >= 0)
+            close (fd);
+        nanosleep (&pause, NULL);
+    }
+    return -1;
+}
+
+
+/**
+ * Send a request, or the rest of it, on a connection to the daemon and
+ * collect the reply: the IMAGE line in @p image, the data of the OUTPUT
+ * frames in @p crt, the data of the STDOUT frames in @p dev, and the
+ * last line in @p end. The connection is closed.
+ */
+static void job (int fd, const char* request, size_t len,
+        char* image, char* crt, char* dev, char* end, size_t size) {
+    static char reply[8192];
+    size_t n = 0;
+    ssize_t got;
+    image[0] = crt[0] = dev[0] = end[0] = '\0';
+
+    if (fd < 0)
+        return;
+    if (send (fd, request, len, 0) == (ssize_t) len)
+        while (n < sizeof(reply) - 1 && (got = recv (fd, reply + n, sizeof(reply) - 1 - n, 0)) > 0)
+            n += got;
+    close (fd);
+    reply[n] = '\0';
+
+    for (char* p = reply; *p; ) {
+        char* nl = strchr (p, '\n');
+        long length;
+        char* data = NULL;
+        if (!nl)
+            break;
+        if (sscanf (p, "OUTPUT %ld", &length) == 1)
+            data = crt;
+        else if (sscanf (p, "STDOUT %ld", &length) == 1)
+            data = dev;
+        else
+            snprintf (strncmp (p, "IMAGE ", 6)? end : image, size, "%.*s", (int) (nl - p), p);
+        p = nl + 1;
+        if (data && length <= reply + n - p && strlen (data) + length < size) {
+            strncat (data, p, length);
+            p += length;
+        }
+    }
+}
+
+
+/**
+ * Write a string to a new temporary file.
+ */
+static void write_file (char* path, const char* text) {
+    int fd = mkstemp (path);
+    if (fd < 0)
+        return;
+    if (write (fd, text, strlen (text)) < 0)
+        path[0] = '\0';
+    close (fd);
+}
+
+
+void test_serve () {
+    char path[] = "/tmp/ckone_test_serve_XXXXXX";
+    char victim[] = "/tmp/ckone_test_serve_XXXXXX";
+    char secret[] = "/tmp/ckone_test_serve_XXXXXX";
+    char program[1024], request[2048];
+    char image[256], crt[256], dev[256], end[256];
+    pid_t pid;
+
+    write_file (path, "");
+    remove (path);
+    write_file (victim, "important\n");
+    write_file (secret, "99\n");
+
+    // read KBD and STDIN, and write them to CRT and STDOUT
+    int len = snprintf (program, sizeof(program),
+            "___b91___\n___code___\n0 4\n%d\n%d\n%d\n%d\n%d\n"
+            "___data___\n5 4\n___symboltable___\n"
+            "stdin %s\nstdout %s\nhalt 11\n___end___\n",
+            make_instr (IN, R1, IMMEDIATE, R0, 1),
+            make_instr (OUT, R1, IMMEDIATE, R0, 0),
+            make_instr (IN, R2, IMMEDIATE, R0, 6),
+            make_instr (OUT, R2, IMMEDIATE, R0, 7),
+            make_instr (SVC, SP, IMMEDIATE, R0, 11),
+            secret, victim);
+
+    args.serve_socket = path;
+    args.mem_size = args.mmu_limit = 64;
+    args.zero = true;
+    fflush (stdout);
+    fflush (stderr);
+    pid = fork ();
+    if (pid == 0)
+        _exit (serve_run ());
+
+
+    BEGIN ("CRT and STDOUT") {
+        int n = snprintf (request, sizeof(request), "PROGRAM %d\n%sINPUT 2\n5\n"
+                "STDIN 2\n7\nRUN\n", len, program);
+        job (connect_to (path), request, n, image, crt, dev, end, sizeof(crt));
+        TEST_STR ("Enter an integer: Program outputted: 5\n", crt);
+        TEST_STR ("7\n", dev);
+        TEST_BOOL (true, !strncmp (end, "END halted 5 0 5 7 ", 19));
+
+        // the files named in the symbol table are not used
+        FILE* f = fopen (victim, "r");
+        char line[64] = "";
+        if (f) {
+            if (!fgets (line, sizeof(line), f))
+                line[0] = '\0';
+            fclose (f);
+        }
+        TEST_STR ("important\n", line);
+    }
+
+    BEGIN ("cached image") {
+        char id[256];
+        snprintf (id, sizeof(id), "%s", image);
+        int n = snprintf (request, sizeof(request), "%s\nSTDIN 3\n-8\nINPUT 2\n3\nRUN\n", id);
+        job (connect_to (path), request, n, image, crt, dev, end, sizeof(crt));
+        TEST_STR (id, image);
+        TEST_STR ("Enter an integer: Program outputted: 3\n", crt);
+        TEST_STR ("-8\n", dev);
+        TEST_BOOL (true, !strncmp (end, "END halted 5 0 3 -8 ", 20));
+
+        n = snprintf (request, sizeof(request), "IMAGE 1\nRUN\n");
+        job (connect_to (path), request, n, image, crt, dev, end, sizeof(crt));
+        TEST_STR ("ERROR unknown image", end);
+    }
+
+    BEGIN ("slow client") {
+        // a client which has sent part of its request does not hold up
+        // the others
+        int slow = connect_to (path);
+        int n = snprintf (request, sizeof(request), "PROGRAM %d\n%sINPUT 2\n1\nSTDIN 2\n4\nRUN\n",
+                len, program);
+        TEST_BOOL (true, slow >= 0 && send (slow, request, 20, 0) == 20);
+        job (connect_to (path), request, n, image, crt, dev, end, sizeof(crt));
+        TEST_STR ("4\n", dev);
+
+        job (slow, request + 20, n - 20, image, crt, dev, end, sizeof(crt));
+        TEST_STR ("4\n", dev);
+        TEST_BOOL (true, !strncmp (end, "END halted 5 ", 13));
+    }
+
+    if (pid > 0) {
+        kill (pid, SIGTERM);
+        waitpid (pid, NULL, 0);
+    }
+    args.serve_socket = NULL;
+    args.mem_size = args.mmu_limit = 0;
+    args.zero = false;
+    remove (path);
+    remove (victim);
+    remove (secret);
+}
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "common.h"
+#include "test.h"
+#include "util.h"
+#include "cpu.h"
+#include "instr.h"
+#include "trace.h"
+#include "args.h"
+#include "config.h"
+
+
+/**
+ * Load the test program: a loop which stores 5, 6 and 7 to address
+ * 30, then stores -3 to address 31 and halts. R2 starts from the
+ * largest number, so its change does not fit in 32 bits.
+ */
+static void load_program (s_ckone* kone) {
+    clear (kone);
+    kone->mem[0] = make_instr (LOAD, R1, IMMEDIATE, R0, 5);
+    kone->mem[1] = make_instr (STORE, R1, IMMEDIATE, R0, 30);
+    kone->mem[2] = make_instr (ADD, R1, IMMEDIATE, R0, 1);
+    kone->mem[3] = make_instr (COMP, R1, IMMEDIATE, R0, 8);
+    kone->mem[4] = make_instr (JLES, R0, IMMEDIATE, R0, 1);
+    kone->mem[5] = make_instr (LOAD, R2, IMMEDIATE, R0, 0) | (-3 & 0xffff);
+    kone->mem[6] = make_instr (STORE, R2, IMMEDIATE, R0, 31);
+    kone->mem[7] = make_instr (SVC, SP, IMMEDIATE, R0, 11);
+    kone->r[R2] = INT32_MAX;
+    kone->r[SP] = kone->r[FP] = 40;
+}
+
+
+/**
+ * Run the test program, writing a trace to @p path, and print what the
+ * decoder should print for the run to @p expected.
+ */
+static void run (s_ckone* kone, const char* path, bool compress, FILE* expected) {
+    static const char* names[] = { "R0", "R1", "R2", "R3", "R4", "R5", "SP", "FP" };
+    int32_t mem[64];
+
+    load_program (kone);
+    if (!trace_open (kone, path, compress))
+        return;
+    args.trace_file = (char*) path;
+    fprintf (expected, "Trace of a program with MMU base %d and MMU limit %d\n",
+            kone->mmu_base, kone->mmu_limit);
+
+    while (!kone->halted) {
+        s_ckone before = *kone;
+        memcpy (mem, kone->mem, sizeof(mem));
+        if (!cpu_step (kone))
+            break;
+
+        char buf[256];
+        instr_string (kone->ir, buf, sizeof(buf));
+        fprintf (expected, "%10llu %8d  %s", (unsigned long long) kone->instr_count,
+                before.pc, buf);
+        for (int r = 0; r < 8; r++)
+            if (kone->r[r] != before.r[r])
+                fprintf (expected, "  %s=%d", names[r], kone->r[r]);
+        if (kone->sr != before.sr)
+            fprintf (expected, "  SR=0x%08x", kone->sr);
+        for (int a = 0; a < 64; a++)
+            if (kone->mem[a] != mem[a])
+                fprintf (expected, "  [%d]=%d", a, kone->mem[a]);
+        fprintf (expected, "\n");
+    }
+
+    trace_close ();
+    args.trace_file = NULL;
+}
+
+
+/**
+ * Read the whole contents of a file.
+ */
+static void read_all (FILE* f, char* buf, size_t size) {
+    rewind (f);
+    size_t n = fread (buf, 1, size - 1, f);
+    buf[n] = '\0';
+}
+
+
+/**
+ * Trace the test program, decode the trace, and compare the result with
+ * the changes seen in the machine.
+ */
+static void round_trip (s_ckone* kone, const char* path, bool compress) {
+    static char expected[4096], decoded[4096];
+    FILE* e = tmpfile ();
+    FILE* d = tmpfile ();
+
+    run (kone, path, compress, e);
+    TEST_BOOL (true, kone->halted);
+    TEST_I32 (7, kone->mem[30]);
+    TEST_I32 (-3, kone->mem[31]);
+
+    TEST_BOOL (true, trace_decode (path, d));
+    read_all (e, expected, sizeof(expected));
+    read_all (d, decoded, sizeof(decoded));
+    TEST_STR (expected, decoded);
+    fclose (e);
+    fclose (d);
+}
+
+
+void test_trace () {
+    s_ckone k;
+    int32_t mem[64];
+    char path[] = "/tmp/ckone_test_trace_XXXXXX";
+    int fd = mkstemp (path);
+
+    k.mem = mem;
+    k.mem_size = sizeof(mem)/sizeof(int32_t);
+    if (fd < 0)
+        return;
+    close (fd);
+
+
+    BEGIN ("trace round trip") {
+        round_trip (&k, path, false);
+    }
+
+#ifdef HAVE_ZLIB
+    BEGIN ("compressed trace round trip") {
+        round_trip (&k, path, true);
+    }
+#endif
+
+    BEGIN ("invalid traces") {
+        FILE* out = tmpfile ();
+
+        // a record cut after its flags, which say that registers follow
+        run (&k, path, false, out);
+        FILE* f = fopen (path, "ab");
+        fputc (0x04, f);
+        fclose (f);
+        TEST_BOOL (false, trace_decode (path, out));
+
+        f = fopen (path, "wb");
+        fputs ("CKTRACE0", f);
+        fclose (f);
+        TEST_BOOL (false, trace_decode (path, out));
+
+        remove (path);
+        TEST_BOOL (false, trace_decode (path, out));
+        fclose (out);
+    }
+}